@@ -0,0 +1,109 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#include <math.h>
+#include <string.h>
+#include "alert.h"
+
+void alert_reset(alert_t *alert) {
+    memset(alert, 0, sizeof(alert_t));
+}
+
+/*
+ * hands the state to the sink unless the rate limit is used up, except for the clear of an alert the sink has seen
+ * raised, so the sink never keeps an alert open that is over
+ */
+static int alert_emit(alert_t *alert, alert_state_t state, sensor_value_t value, sensor_ts_t ts, alert_event_t *event) {
+    if(ts - alert->rate_window_start >= ALERT_RATE_WINDOW) {
+        alert->rate_window_start = ts;
+        alert->emitted = 0;
+    }
+    int closes = state == ALERT_CLEARED && alert->open;
+    //a clear of a raise the sink never got has nothing to close
+    if((state == ALERT_CLEARED && !closes) || (!closes && alert->emitted >= ALERT_RATE_MAX)) {
+        alert->suppressed++;
+        return 0;
+    }
+    if(alert->emitted < UINT8_MAX) alert->emitted++;
+    alert->open = state != ALERT_CLEARED;
+    event->state = state;
+    event->kind = alert->kind;
+    event->value = value;
+    event->ts = ts;
+    event->suppressed = alert->suppressed;
+    alert->suppressed = 0;
+    return 1;
+}
+
+/*
+ * moves to a new state and applies the rate limit
+ */
+static int alert_transition(alert_t *alert, alert_state_t state, sensor_value_t value, sensor_ts_t ts, alert_event_t *event) {
+    alert->state = state;
+    alert->since = ts;
+    return alert_emit(alert, state, value, ts, event);
+}
+
+static int alert_step(alert_t *alert, sensor_value_t value, sensor_value_t min_temp, sensor_value_t max_temp,
+                      sensor_ts_t ts, alert_event_t *event) {
+
+    if(alert->state == ALERT_RAISED || alert->state == ALERT_SUSTAINED) {
+        //hysteresis, the clear limit lies ALERT_HYSTERESIS inside the raise limit
+        int cleared = (alert->kind == ALERT_HOT && value <= max_temp - ALERT_HYSTERESIS)
+                      || (alert->kind == ALERT_COLD && value >= min_temp + ALERT_HYSTERESIS);
+        if(cleared) return alert_transition(alert, ALERT_CLEARED, value, ts, event);
+        if(alert->state == ALERT_RAISED && ts - alert->since >= ALERT_SUSTAIN_AFTER) {
+            return alert_transition(alert, ALERT_SUSTAINED, value, ts, event);
+        }
+        return 0;
+    }
+
+    //normal or cleared, debounce before raising
+    alert_kind_t kind = value > max_temp ? ALERT_HOT : (value < min_temp ? ALERT_COLD : ALERT_NONE);
+    if(kind == ALERT_NONE) {
+        alert->pending_kind = ALERT_NONE;
+        if(alert->state == ALERT_CLEARED && ts - alert->since >= ALERT_MIN_DURATION) {
+            alert->state = ALERT_NORMAL;
+            alert->since = ts;
+        }
+        return 0;
+    }
+    if(alert->pending_kind != kind) {
+        alert->pending_kind = kind;
+        alert->pending_since = ts;
+    }
+    if(ts - alert->pending_since < ALERT_MIN_DURATION) return 0;
+    alert->pending_kind = ALERT_NONE;
+    alert->kind = kind;
+    return alert_transition(alert, ALERT_RAISED, value, ts, event);
+}
+
+int alert_update(alert_t *alert, sensor_value_t value, sensor_value_t min_temp, sensor_value_t max_temp, sensor_ts_t ts,
+                 alert_event_t *event) {
+
+    if(isnan(value)) return 0;
+    if(alert_step(alert, value, min_temp, max_temp, ts, event)) return 1;
+    //a raise the rate limit held back goes out once the window reopens, if the alert is still raised by then
+    if((alert->state != ALERT_RAISED && alert->state != ALERT_SUSTAINED) || alert->open) return 0;
+    if(ts - alert->rate_window_start < ALERT_RATE_WINDOW && alert->emitted >= ALERT_RATE_MAX) return 0;
+    return alert_emit(alert, (alert_state_t) alert->state, value, ts, event);
+}
+
+const char *alert_state_name(alert_state_t state) {
+    switch(state) {
+        case ALERT_RAISED: return "raised";
+        case ALERT_SUSTAINED: return "sustained";
+        case ALERT_CLEARED: return "cleared";
+        default: return "normal";
+    }
+}
+
+const char *alert_kind_name(alert_kind_t kind) {
+    switch(kind) {
+        case ALERT_HOT: return "too hot";
+        case ALERT_COLD: return "too cold";
+        case ALERT_STALE: return "stale";
+        default: return "ok";
+    }
+}
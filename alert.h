@@ -0,0 +1,73 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#ifndef _ALERT_H_
+#define _ALERT_H_
+
+#include <stdint.h>
+#include "config.h"
+
+/*
+ * alert state machine for one sensor or room
+ *
+ * normal/cleared -> raised     limit exceeded for at least ALERT_MIN_DURATION seconds
+ * raised -> sustained          still exceeded ALERT_SUSTAIN_AFTER seconds after raising
+ * raised/sustained -> cleared  back inside the limit by at least ALERT_HYSTERESIS
+ * cleared -> normal            inside the limit for ALERT_MIN_DURATION seconds, not emitted
+ *
+ * only emitted transitions are handed to the sink, at most ALERT_RATE_MAX per ALERT_RATE_WINDOW seconds per alert,
+ * the clear of an alert the sink has seen raised always goes out, a raise held back by the rate limit goes out once
+ * the window reopens if the alert is still raised then, so the sink always ends up with the state of the alert
+ *
+ * liveness events of datamgr go through the same sink with kind ALERT_STALE, raised when a sensor went silent and
+ * cleared when it reports again, they do not pass the state machine or the rate limit
+ */
+
+enum alert_state {ALERT_NORMAL = 0, ALERT_RAISED, ALERT_SUSTAINED, ALERT_CLEARED};
+typedef enum alert_state alert_state_t;
+
+enum alert_kind {ALERT_NONE = 0, ALERT_HOT, ALERT_COLD, ALERT_STALE};
+typedef enum alert_kind alert_kind_t;
+
+enum alert_subject {ALERT_SENSOR = 0, ALERT_ROOM};
+typedef enum alert_subject alert_subject_t;
+
+typedef struct {
+    uint8_t state;
+    uint8_t kind;                   /** < limit that raised the alert */
+    uint8_t pending_kind;           /** < limit currently exceeded while not raised yet */
+    uint8_t emitted;                /** < emissions in the current rate window */
+    uint8_t open;                   /** < the sink last got raised or sustained */
+    uint32_t suppressed;            /** < transitions dropped by the rate limit since the last emission */
+    sensor_ts_t since;              /** < time of the last transition */
+    sensor_ts_t pending_since;      /** < first time pending_kind was seen */
+    sensor_ts_t rate_window_start;
+} alert_t;
+
+typedef struct {
+    alert_subject_t subject;
+    uint16_t id;                    /** < sensor id or room id */
+    alert_state_t state;            /** < state entered */
+    alert_kind_t kind;
+    sensor_value_t value;           /** < average that caused the transition */
+    sensor_ts_t ts;
+    uint32_t suppressed;            /** < earlier transitions of this alert dropped by the rate limit */
+} alert_event_t;
+
+typedef void (*alert_sink_t)(const alert_event_t *event, void *arg);
+
+void alert_reset(alert_t *alert);
+
+/*
+ * feeds the current average of the subject, a NAN average (no full window yet) is ignored
+ * \return 1 if event was filled in and has to be handed to the sink, 0 otherwise
+ */
+int alert_update(alert_t *alert, sensor_value_t value, sensor_value_t min_temp, sensor_value_t max_temp, sensor_ts_t ts,
+                 alert_event_t *event);
+
+const char *alert_state_name(alert_state_t state);
+
+const char *alert_kind_name(alert_kind_t kind);
+
+#endif /* _ALERT_H_ */
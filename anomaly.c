@@ -0,0 +1,85 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "anomaly.h"
+
+void anomaly_reset(anomaly_t *anomaly) {
+    memset(anomaly, 0, sizeof(anomaly_t));
+}
+
+void anomaly_classify(anomaly_t *anomaly, sensor_value_t value, sensor_ts_t ts, sensor_ts_t watermark, anomaly_result_t *result) {
+
+    uint8_t flags = 0;
+    result->zscore = 0;
+    if(value > ANOMALY_VALUE_LIMIT || value < -ANOMALY_VALUE_LIMIT || isnan(value)) flags |= ANOMALY_BIT(ANOMALY_RANGE);
+    if(ts < ANOMALY_TS_MIN || ts > ANOMALY_TS_MAX) flags |= ANOMALY_BIT(ANOMALY_TIMESTAMP);
+    else if(ts < watermark) flags |= ANOMALY_BIT(ANOMALY_LATE);
+
+    if(!(flags & ANOMALY_REJECT)) {
+        if(anomaly->seen >= ANOMALY_WARMUP && anomaly->var > 1e-12) {
+            result->zscore = (value - anomaly->mean)/sqrt(anomaly->var);
+            if(fabs(result->zscore) > ANOMALY_ZSCORE_LIMIT) flags |= ANOMALY_BIT(ANOMALY_ZSCORE);
+        }
+        int in_order = anomaly->seen == 0 || ts >= anomaly->last_ts;
+        if(anomaly->seen > 0 && in_order) {
+            sensor_ts_t elapsed = ts - anomaly->last_ts;
+            if(elapsed < 1) elapsed = 1;    //timestamps have 1 second resolution
+            if(fabs(value - anomaly->last_value)/elapsed > ANOMALY_MAX_RATE) flags |= ANOMALY_BIT(ANOMALY_SPIKE);
+            if(value == anomaly->last_value) {
+                if(anomaly->flat_run < UINT16_MAX) anomaly->flat_run++;
+            } else {
+                anomaly->flat_run = 0;
+            }
+            if(anomaly->flat_run + 1 >= ANOMALY_FLATLINE_COUNT) flags |= ANOMALY_BIT(ANOMALY_FLATLINE);
+        }
+        //incremental exponentially weighted mean and variance
+        double diff = value - anomaly->mean;
+        double incr = ANOMALY_EWMA_ALPHA*diff;
+        if(anomaly->seen == 0) {
+            anomaly->mean = value;
+            anomaly->var = 0;
+        } else {
+            anomaly->mean += incr;
+            anomaly->var = (1 - ANOMALY_EWMA_ALPHA)*(anomaly->var + diff*incr);
+        }
+        if(anomaly->seen < UINT32_MAX) anomaly->seen++;
+        if(in_order) {
+            anomaly->last_value = value;
+            anomaly->last_ts = ts;
+        }
+    }
+
+    for(int c = 0; c < ANOMALY_CLASSES; c++) {
+        if(flags & ANOMALY_BIT(c)) anomaly->counts[c]++;
+    }
+    result->flags = flags;
+    result->new_episode = flags != anomaly->last_flags;
+    anomaly->last_flags = flags;
+}
+
+const char *anomaly_class_name(anomaly_class_t class) {
+    switch(class) {
+        case ANOMALY_RANGE: return "out of range";
+        case ANOMALY_TIMESTAMP: return "bad timestamp";
+        case ANOMALY_ZSCORE: return "deviation";
+        case ANOMALY_SPIKE: return "spike";
+        case ANOMALY_FLATLINE: return "flatline";
+        case ANOMALY_LATE: return "late";
+        default: return "unknown";
+    }
+}
+
+void anomaly_describe(uint8_t flags, char *buf, size_t size) {
+    size_t used = 0;
+    buf[0] = '\0';
+    for(int c = 0; c < ANOMALY_CLASSES && used < size; c++) {
+        if(!(flags & ANOMALY_BIT(c))) continue;
+        int n = snprintf(buf + used, size - used, "%s%s", used ? ", " : "", anomaly_class_name(c));
+        if(n < 0) break;
+        used += n;
+    }
+}
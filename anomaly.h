@@ -0,0 +1,64 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#ifndef _ANOMALY_H_
+#define _ANOMALY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "config.h"
+
+/*
+ * streaming anomaly detection for one sensor, O(1) time and memory per reading
+ *
+ * range      value outside +-ANOMALY_VALUE_LIMIT, kept out of the running average
+ * timestamp  ts outside ANOMALY_TS_MIN..ANOMALY_TS_MAX, kept out of the running average
+ * zscore     more than ANOMALY_ZSCORE_LIMIT deviations from the sensor's exponentially weighted mean
+ * spike      changed faster than ANOMALY_MAX_RATE degrees per second since the previous reading
+ * flatline   the same value ANOMALY_FLATLINE_COUNT times in a row
+ * late       event time behind the watermark of the sensor, kept out of the running average and only stored
+ *
+ * spike and flatline compare against the newest reading by event time, an out of order reading is only used for the mean
+ */
+
+enum anomaly_class {ANOMALY_RANGE = 0, ANOMALY_TIMESTAMP, ANOMALY_ZSCORE, ANOMALY_SPIKE, ANOMALY_FLATLINE, ANOMALY_LATE, ANOMALY_CLASSES};
+typedef enum anomaly_class anomaly_class_t;
+
+#define ANOMALY_BIT(c) (1u << (c))
+//classes that are not used for aggregates
+#define ANOMALY_REJECT (ANOMALY_BIT(ANOMALY_RANGE) | ANOMALY_BIT(ANOMALY_TIMESTAMP) | ANOMALY_BIT(ANOMALY_LATE))
+
+typedef struct {
+    double mean;                        /** < exponentially weighted mean */
+    double var;                         /** < exponentially weighted variance */
+    sensor_value_t last_value;
+    sensor_ts_t last_ts;                /** < newest event time seen */
+    uint32_t seen;                      /** < readings that went into mean and var */
+    uint16_t flat_run;                  /** < readings equal to last_value in a row */
+    uint8_t last_flags;
+    uint32_t counts[ANOMALY_CLASSES];   /** < readings per class */
+} anomaly_t;
+
+typedef struct {
+    uint8_t flags;          /** < ANOMALY_BIT() of every class the reading belongs to */
+    uint8_t new_episode;    /** < flags differ from the previous reading of the sensor */
+    double zscore;          /** < 0 during warmup */
+} anomaly_result_t;
+
+void anomaly_reset(anomaly_t *anomaly);
+
+/*
+ * classifies a reading and updates the statistics of the sensor
+ * \param watermark readings with an event time before it are late, 0 if the sensor has none yet
+ */
+void anomaly_classify(anomaly_t *anomaly, sensor_value_t value, sensor_ts_t ts, sensor_ts_t watermark, anomaly_result_t *result);
+
+const char *anomaly_class_name(anomaly_class_t class);
+
+/*
+ * writes the names of all classes in flags, comma separated, into buf
+ */
+void anomaly_describe(uint8_t flags, char *buf, size_t size);
+
+#endif /* _ANOMALY_H_ */
@@ -0,0 +1,144 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+/*
+ * benchmark of the storage backends: ingest rate, bytes per reading and range scans of one sensor and of all sensors
+ * not part of the gateway, run it in a scratch directory, build with:
+ * gcc -O2 -DSET_MAX_TEMP=20 -DSET_MIN_TEMP=10 -DDB_NAME='"backend_bench.db"' -DSTORAGE_COLUMN_DIR='"backend_bench_columns"' backend_bench.c sensor_db.c storage_profile.c storage_partition.c column_store.c storage_shard.c storage_backend.c histogram.c -lsqlite3 -lpthread -lm -o backend_bench
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include "config.h"
+#include "storage_backend.h"
+#include "histogram.h"
+
+#ifndef BENCH_SENSORS
+#define BENCH_SENSORS 100
+#endif
+
+#ifndef BENCH_READINGS
+#define BENCH_READINGS 20000 //per sensor
+#endif
+
+#ifndef BENCH_SCANS
+#define BENCH_SCANS 200
+#endif
+
+#define BENCH_INTERVAL 5 //seconds between the readings of a sensor
+#define BENCH_BATCH STORAGEMGR_BATCH_MAX
+
+static const char *backend_names[] = {"sqlite", "sharded", "column"};
+
+static int64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+static int count_reading(const sensor_data_t *data, void *arg) {
+    (*(double *) arg) += data->value;
+    return 0;
+}
+
+/*
+ * BENCH_SCANS scans of length seconds at random offsets, of sensor id or of all sensors if id is NULL
+ */
+static void bench_scans(storage_backend_t *backend, const char *label, const sensor_id_t *id, sensor_ts_t start,
+                        sensor_ts_t length) {
+    histogram_t latency;
+    histogram_reset(&latency);
+    sensor_ts_t span = (sensor_ts_t) BENCH_READINGS*BENCH_INTERVAL - length;
+    int64_t rows = 0;
+    double sum = 0;
+    srand(7);
+    int64_t begin = now_us();
+    for(int i = 0; i < BENCH_SCANS; i++) {
+        sensor_id_t sensor = id != NULL ? (sensor_id_t) (1 + rand() % BENCH_SENSORS) : 0;
+        sensor_ts_t from = start + (span > 0 ? rand() % span : 0);
+        int64_t scan_start = now_us();
+        int64_t found = storage_backend_scan(backend, id != NULL ? &sensor : NULL, from, from + length, count_reading,
+                                             &sum);
+        if(found < 0) {
+            printf("scan failed\n");
+            exit(EXIT_FAILURE);
+        }
+        histogram_add(&latency, now_us() - scan_start);
+        rows += found;
+    }
+    double seconds = (now_us() - begin)/1e6;
+    printf("  %-18s %8.0f rows/scan %10.0f rows/s  p50 %7lu us  p99 %7lu us\n", label, (double) rows/BENCH_SCANS,
+           rows/seconds, (unsigned long) histogram_percentile(&latency, 50),
+           (unsigned long) histogram_percentile(&latency, 99));
+}
+
+int main() {
+
+    int rows = BENCH_SENSORS*BENCH_READINGS;
+    sensor_data_t *data = malloc(rows*sizeof(sensor_data_t));
+    if(data == NULL) return EXIT_FAILURE;
+    //readings arrive interleaved like from the gateway, every sensor a random walk in steps of 0.01 degrees
+    sensor_ts_t start = time(NULL) - (sensor_ts_t) BENCH_READINGS*BENCH_INTERVAL;
+    double value[BENCH_SENSORS];
+    srand(1);
+    for(int s = 0; s < BENCH_SENSORS; s++) value[s] = SET_MIN_TEMP + rand() % (10*(SET_MAX_TEMP - SET_MIN_TEMP))/10.0;
+    for(int i = 0; i < rows; i++) {
+        int s = i % BENCH_SENSORS;
+        value[s] = round((value[s] + (rand() % 21 - 10)/100.0)*100)/100;
+        data[i].id = s + 1;
+        data[i].value = value[s];
+        data[i].ts = start + (sensor_ts_t) (i/BENCH_SENSORS)*BENCH_INTERVAL + rand() % 2;
+    }
+
+    printf("%i sensors, %i readings each, batches of %i, %i scans per row\n", BENCH_SENSORS, BENCH_READINGS,
+           BENCH_BATCH, BENCH_SCANS);
+    for(int b = 0; b < (int) (sizeof(backend_names)/sizeof(backend_names[0])); b++) {
+        status_code_storagemgr_t status;
+        storage_backend_t *backend = storage_backend_open(backend_names[b], 1, &status);
+        if(backend == NULL) {
+            printf("cannot open backend %s\n", backend_names[b]);
+            return EXIT_FAILURE;
+        }
+        printf("%s\n", backend_names[b]);
+        histogram_t latency;
+        histogram_reset(&latency);
+        int64_t begin = now_us();
+        for(int done = 0; done < rows; done += BENCH_BATCH) {
+            int count = rows - done < BENCH_BATCH ? rows - done : BENCH_BATCH;
+            int64_t append_start = now_us();
+            if(storage_backend_append(backend, data + done, count) != STATUS_OK) {
+                printf("append failed\n");
+                return EXIT_FAILURE;
+            }
+            histogram_add(&latency, now_us() - append_start);
+        }
+        double seconds = (now_us() - begin)/1e6;
+        printf("  %-18s %9.0f rows/s  batch p50 %7lu us  p99 %7lu us\n", "ingest", rows/seconds,
+               (unsigned long) histogram_percentile(&latency, 50), (unsigned long) histogram_percentile(&latency, 99));
+        uint64_t bytes = storage_backend_bytes(backend);
+        printf("  %-18s %9.1f bytes/reading (%llu bytes)\n", "size", (double) bytes/rows, (unsigned long long) bytes);
+
+        sensor_id_t any = 0;
+        bench_scans(backend, "one sensor, 1 h", &any, start, 3600);
+        bench_scans(backend, "one sensor, all", &any, start, (sensor_ts_t) BENCH_READINGS*BENCH_INTERVAL);
+        bench_scans(backend, "all sensors, 1 min", NULL, start, 60);
+        storage_backend_close(backend);
+    }
+    unlink(DB_NAME);
+    unlink(DB_NAME "-wal");
+    unlink(DB_NAME "-shm");
+    for(int i = 0; i < STORAGE_SHARDS; i++) {
+        char path[256], other[300];
+        storage_shard_path(i, path, sizeof(path));
+        unlink(path);
+        snprintf(other, sizeof(other), "%s-wal", path);
+        unlink(other);
+        snprintf(other, sizeof(other), "%s-shm", path);
+        unlink(other);
+    }
+    free(data);
+    return 0;
+}
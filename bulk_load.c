@@ -0,0 +1,61 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+/*
+ * backfills DB_NAME from binary sensor data files (packed id, value, timestamp records) with progress and throughput
+ * not part of the gateway, build with:
+ * gcc -O2 -DSET_MAX_TEMP=20 -DSET_MIN_TEMP=10 bulk_load.c sensor_db.c storage_profile.c storage_partition.c -lsqlite3 -lpthread -lm -o bulk_load
+ * usage: bulk_load [-r] file... (-r drops the indexes while loading and builds them again after)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "sensor_db.h"
+
+static void print_progress(const sensor_bulk_stats_t *stats, void *arg) {
+    printf("  %s: %llu rows, %.1f s, %.0f rows/s\n", (const char *) arg, (unsigned long long) stats->inserted,
+           stats->seconds, stats->seconds > 0 ? stats->inserted/stats->seconds : 0);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+
+    int rebuild = 0, first = 1;
+    if(argc > 1 && strcmp(argv[1], "-r") == 0) {
+        rebuild = 1;
+        first = 2;
+    }
+    if(first >= argc) {
+        fprintf(stderr, "usage: %s [-r] file...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    status_code_storagemgr_t status;
+    char table_name[64];
+    DBCONN *db = init_connection(0, &status, table_name);
+    if(db == NULL) {
+        fprintf(stderr, "cannot open %s\n", DB_NAME);
+        return EXIT_FAILURE;
+    }
+    int failed = 0;
+    for(int i = first; i < argc; i++) {
+        FILE *file = fopen(argv[i], "rb");
+        if(file == NULL) {
+            perror(argv[i]);
+            failed = 1;
+            continue;
+        }
+        sensor_bulk_stats_t stats;
+        int rc = sensor_bulk_load(db, file, rebuild, print_progress, argv[i], &stats);
+        fclose(file);
+        printf("%s: %s, %llu of %llu records inserted, %llu rejected, %llu trailing bytes, %.1f s, %.2f M rows/min\n",
+               argv[i], rc == 0 ? "done" : "FAILED", (unsigned long long) stats.inserted,
+               (unsigned long long) stats.records, (unsigned long long) stats.rejected,
+               (unsigned long long) stats.trailing_bytes, stats.seconds,
+               stats.seconds > 0 ? stats.inserted/stats.seconds*60/1e6 : 0);
+        if(rc != 0) failed = 1;
+    }
+    disconnect(db);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
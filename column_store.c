@@ -0,0 +1,694 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "column_store.h"
+
+#define MAGIC           "SENSCOL1"
+#define SERIES_MAX      65536               //every sensor_id_t
+#define GROW_BLOCKS     64                  //blocks added to a file at a time
+#define READING_MAX_BITS (4 + 64 + 2 + 5 + 6 + 64)
+#define NO_WINDOW       -1
+#define MANIFEST_MAGIC  "SENSMAN1"
+#define MANIFEST_FILE   "manifest"
+
+typedef struct {
+    char magic[8];
+    uint32_t block_size;
+    uint32_t sensor_id;
+    uint32_t blocks;                        //blocks in use, only the last one can be open
+    uint8_t reserved[44];
+} file_header_t;
+
+typedef struct {
+    int64_t first_ts;
+    int64_t min_ts;
+    int64_t max_ts;
+    double first_value;
+    uint32_t count;
+    uint32_t bits;                          //bits of the stream in use
+    uint32_t sealed;
+    uint32_t reserved;
+} block_header_t;
+
+#define STREAM_BYTES (COLUMN_BLOCK_SIZE - sizeof(block_header_t))
+
+/*
+ * the manifest is this header and an entry per series with readings, replaced as a whole with a rename
+ */
+typedef struct {
+    char magic[8];
+    uint64_t spool;                         //position of the caller, see column_store_commit()
+    uint64_t seq;
+    uint32_t series;                        //entries after the header
+    uint32_t reserved;
+} manifest_header_t;
+
+typedef struct {
+    uint32_t sensor_id;
+    uint32_t reserved;
+    uint64_t readings;
+} manifest_entry_t;
+
+typedef struct {
+    int64_t min_ts;
+    int64_t max_ts;
+    uint32_t count;
+    uint32_t bits;
+} block_index_t;
+
+/*
+ * state shared by encoder and decoder, after the same readings both hold the same state
+ */
+typedef struct {
+    int64_t ts;
+    int64_t delta;
+    uint64_t value;                         //bits of the last double
+    int leading;                            //window of the last XOR, NO_WINDOW before the first
+    int trailing;
+    uint32_t pos;                           //bit position in the stream
+} codec_t;
+
+typedef struct {
+    sensor_id_t id;
+    uint8_t *map;
+    size_t map_bytes;
+    uint32_t allocated;                     //blocks the file has room for
+    block_index_t *index;                   //per block in use, the time range index
+    codec_t writer;                         //state after the last reading of the last block
+    uint64_t readings;
+    uint64_t committed;                     //readings of the last commit, a rollback goes back to them
+    int64_t dirty;                          //first block changed since the last flush, -1 if none
+} series_t;
+
+struct column_store {
+    char *dir;
+    series_t **series;
+    uint64_t spool;                         //position of the last commit
+    uint64_t seq;
+    pthread_rwlock_t lock;                  //scans read, appends write (a growing file is mapped again)
+};
+
+static file_header_t *header_of(series_t *s) {
+    return (file_header_t *) s->map;
+}
+
+static block_header_t *block_of(series_t *s, uint32_t block) {
+    return (block_header_t *) (s->map + sizeof(file_header_t) + (size_t) block*COLUMN_BLOCK_SIZE);
+}
+
+static uint8_t *stream_of(series_t *s, uint32_t block) {
+    return (uint8_t *) (block_of(s, block) + 1);
+}
+
+static size_t file_bytes(uint32_t blocks) {
+    return sizeof(file_header_t) + (size_t) blocks*COLUMN_BLOCK_SIZE;
+}
+
+/*
+ * the stream past the used bits is always zero, so bits are OR'ed in, most significant first
+ */
+static void put_bits(uint8_t *stream, uint32_t *pos, uint64_t value, int n) {
+    while(n > 0) {
+        int room = 8 - (*pos & 7);
+        int take = n < room ? n : room;
+        uint8_t chunk = (uint8_t) ((value >> (n - take)) & ((1u << take) - 1));
+        stream[*pos >> 3] |= (uint8_t) (chunk << (room - take));
+        *pos += take;
+        n -= take;
+    }
+}
+
+static uint64_t get_bits(const uint8_t *stream, uint32_t *pos, int n) {
+    uint64_t value = 0;
+    while(n > 0) {
+        int room = 8 - (*pos & 7);
+        int take = n < room ? n : room;
+        value = (value << take) | ((stream[*pos >> 3] >> (room - take)) & ((1u << take) - 1));
+        *pos += take;
+        n -= take;
+    }
+    return value;
+}
+
+static uint64_t double_bits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static double bits_double(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static void codec_start(codec_t *codec, int64_t ts, double value) {
+    codec->ts = ts;
+    codec->delta = 0;
+    codec->value = double_bits(value);
+    codec->leading = NO_WINDOW;
+    codec->trailing = 0;
+    codec->pos = 0;
+}
+
+static void encode(codec_t *c, uint8_t *stream, int64_t ts, double value) {
+
+    //timestamps: delta of delta, 0 in 1 bit, small ones in 9 to 16 bits
+    int64_t delta = ts - c->ts;
+    int64_t dod = delta - c->delta;
+    if(dod == 0) {
+        put_bits(stream, &(c->pos), 0, 1);
+    } else if(dod >= -63 && dod <= 64) {
+        put_bits(stream, &(c->pos), 0x2, 2);
+        put_bits(stream, &(c->pos), dod + 63, 7);
+    } else if(dod >= -255 && dod <= 256) {
+        put_bits(stream, &(c->pos), 0x6, 3);
+        put_bits(stream, &(c->pos), dod + 255, 9);
+    } else if(dod >= -2047 && dod <= 2048) {
+        put_bits(stream, &(c->pos), 0xe, 4);
+        put_bits(stream, &(c->pos), dod + 2047, 12);
+    } else {
+        put_bits(stream, &(c->pos), 0xf, 4);
+        put_bits(stream, &(c->pos), (uint64_t) dod, 64);
+    }
+    c->ts = ts;
+    c->delta = delta;
+
+    //values: XOR with the previous one, only the bits between its leading and trailing zeros
+    uint64_t bits = double_bits(value);
+    uint64_t xor = bits ^ c->value;
+    c->value = bits;
+    if(xor == 0) {
+        put_bits(stream, &(c->pos), 0, 1);
+        return;
+    }
+    int leading = __builtin_clzll(xor), trailing = __builtin_ctzll(xor);
+    if(leading > 31) leading = 31;
+    if(c->leading != NO_WINDOW && leading >= c->leading && trailing >= c->trailing) {
+        put_bits(stream, &(c->pos), 0x2, 2);
+        put_bits(stream, &(c->pos), xor >> c->trailing, 64 - c->leading - c->trailing);
+        return;
+    }
+    int length = 64 - leading - trailing;
+    put_bits(stream, &(c->pos), 0x3, 2);
+    put_bits(stream, &(c->pos), leading, 5);
+    put_bits(stream, &(c->pos), length - 1, 6);
+    put_bits(stream, &(c->pos), xor >> trailing, length);
+    c->leading = leading;
+    c->trailing = trailing;
+}
+
+static void decode(codec_t *c, const uint8_t *stream, int64_t *ts, double *value) {
+
+    int64_t dod;
+    if(get_bits(stream, &(c->pos), 1) == 0) {
+        dod = 0;
+    } else if(get_bits(stream, &(c->pos), 1) == 0) {
+        dod = (int64_t) get_bits(stream, &(c->pos), 7) - 63;
+    } else if(get_bits(stream, &(c->pos), 1) == 0) {
+        dod = (int64_t) get_bits(stream, &(c->pos), 9) - 255;
+    } else if(get_bits(stream, &(c->pos), 1) == 0) {
+        dod = (int64_t) get_bits(stream, &(c->pos), 12) - 2047;
+    } else {
+        dod = (int64_t) get_bits(stream, &(c->pos), 64);
+    }
+    c->delta += dod;
+    c->ts += c->delta;
+    *ts = c->ts;
+
+    if(get_bits(stream, &(c->pos), 1) == 1) {
+        uint64_t xor;
+        if(get_bits(stream, &(c->pos), 1) == 0) {
+            xor = get_bits(stream, &(c->pos), 64 - c->leading - c->trailing) << c->trailing;
+        } else {
+            c->leading = (int) get_bits(stream, &(c->pos), 5);
+            int length = (int) get_bits(stream, &(c->pos), 6) + 1;
+            c->trailing = 64 - c->leading - length;
+            xor = get_bits(stream, &(c->pos), length) << c->trailing;
+        }
+        c->value ^= xor;
+    }
+    *value = bits_double(c->value);
+}
+
+/*
+ * maps the file with room for blocks blocks, growing it if it is smaller
+ */
+static int series_map(column_store_t *store, series_t *s, uint32_t blocks) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%u.col", store->dir, (unsigned) s->id);
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if(fd < 0) return -1;
+    size_t bytes = file_bytes(blocks);
+    struct stat st;
+    if(fstat(fd, &st) != 0 || ((size_t) st.st_size < bytes && ftruncate(fd, bytes) != 0)) {
+        close(fd);
+        return -1;
+    }
+    uint8_t *map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);          //the mapping keeps the file
+    if(map == MAP_FAILED) return -1;
+    block_index_t *index = realloc(s->index, blocks*sizeof(block_index_t));
+    if(index == NULL) {
+        munmap(map, bytes);
+        return -1;
+    }
+    if(s->map != NULL) munmap(s->map, s->map_bytes);
+    s->map = map;
+    s->map_bytes = bytes;
+    s->allocated = blocks;
+    s->index = index;
+    return 0;
+}
+
+static void series_free(series_t *s) {
+    if(s == NULL) return;
+    if(s->map != NULL) munmap(s->map, s->map_bytes);
+    free(s->index);
+    free(s);
+}
+
+static series_t *series_new(column_store_t *store, sensor_id_t id) {
+    series_t *s = calloc(1, sizeof(series_t));
+    if(s == NULL) return NULL;
+    s->id = id;
+    s->dirty = 0;
+    if(series_map(store, s, GROW_BLOCKS) != 0) {
+        series_free(s);
+        return NULL;
+    }
+    file_header_t *header = header_of(s);
+    memcpy(header->magic, MAGIC, sizeof(header->magic));
+    header->block_size = COLUMN_BLOCK_SIZE;
+    header->sensor_id = id;
+    header->blocks = 0;
+    return s;
+}
+
+/*
+ * decodes the first count readings of block b into the writer state and clears the stream after them,
+ * bits past the block header were written after it was last updated and did not happen
+ */
+static void writer_load(series_t *s, uint32_t b, uint32_t count, int64_t *min_ts, int64_t *max_ts) {
+    block_header_t *block = block_of(s, b);
+    uint8_t *stream = stream_of(s, b);
+    codec_start(&(s->writer), block->first_ts, block->first_value);
+    int64_t ts;
+    double value;
+    *min_ts = *max_ts = block->first_ts;
+    for(uint32_t i = 1; i < count; i++) {
+        decode(&(s->writer), stream, &ts, &value);
+        if(ts < *min_ts) *min_ts = ts;
+        if(ts > *max_ts) *max_ts = ts;
+    }
+    uint32_t used = (s->writer.pos + 7)/8;
+    if(s->writer.pos & 7) stream[used - 1] &= (uint8_t) (0xff << (8 - (s->writer.pos & 7)));
+    memset(stream + used, 0, STREAM_BYTES - used);
+}
+
+/*
+ * drops the readings after the first keep, the last block kept is opened for appends again
+ */
+static void series_truncate(series_t *s, uint64_t keep) {
+    if(keep >= s->readings) return;
+    file_header_t *header = header_of(s);
+    uint32_t b = 0;
+    uint64_t before = 0;
+    while(b < header->blocks && before + s->index[b].count <= keep) before += s->index[b++].count;
+    //b holds the first reading dropped, when it is also its first one the block before is the last kept
+    if(keep == before && b > 0) before -= s->index[--b].count;
+    uint32_t count = (uint32_t) (keep - before);
+    header->blocks = count > 0 ? b + 1 : b;
+    if(count > 0) {
+        block_header_t *block = block_of(s, b);
+        int64_t min_ts, max_ts;
+        writer_load(s, b, count, &min_ts, &max_ts);
+        block->min_ts = min_ts;
+        block->max_ts = max_ts;
+        block->bits = s->writer.pos;
+        block->count = count;
+        block->sealed = 0;
+        s->index[b] = (block_index_t) {min_ts, max_ts, count, block->bits};
+    }
+    s->readings = keep;
+    if(s->dirty < 0 || s->dirty > b) s->dirty = b;
+}
+
+/*
+ * maps an existing file, builds its index and picks up the writer state of the last block
+ */
+static series_t *series_load(column_store_t *store, sensor_id_t id, size_t size) {
+    if(size < sizeof(file_header_t)) return NULL;
+    series_t *s = calloc(1, sizeof(series_t));
+    if(s == NULL) return NULL;
+    s->id = id;
+    s->dirty = -1;
+    uint32_t allocated = (size - sizeof(file_header_t))/COLUMN_BLOCK_SIZE;
+    if(series_map(store, s, allocated > 0 ? allocated : GROW_BLOCKS) != 0) {
+        series_free(s);
+        return NULL;
+    }
+    file_header_t *header = header_of(s);
+    if(memcmp(header->magic, MAGIC, sizeof(header->magic)) != 0 || header->block_size != COLUMN_BLOCK_SIZE
+       || header->sensor_id != id || header->blocks > s->allocated) {
+        DEBUG_PRINTF("%u.col is not a column file of this build", (unsigned) id);
+        series_free(s);
+        return NULL;
+    }
+    //a block started right before a crash may not have its first reading
+    if(header->blocks > 0 && block_of(s, header->blocks - 1)->count == 0) header->blocks--;
+    for(uint32_t b = 0; b < header->blocks; b++) {
+        block_header_t *block = block_of(s, b);
+        s->index[b] = (block_index_t) {block->min_ts, block->max_ts, block->count, block->bits};
+        s->readings += block->count;
+    }
+    if(header->blocks > 0) {
+        int64_t min_ts, max_ts;
+        writer_load(s, header->blocks - 1, block_of(s, header->blocks - 1)->count, &min_ts, &max_ts);
+    }
+    s->committed = s->readings;
+    return s;
+}
+
+/*
+ * \return the sensor id of a column file name, -1 for other files
+ */
+static long column_file_id(const char *name) {
+    char *end;
+    long id = strtol(name, &end, 10);
+    return end != name && strcmp(end, ".col") == 0 && id >= 0 && id < SERIES_MAX ? id : -1;
+}
+
+static int remove_files(const char *dir) {
+    DIR *d = opendir(dir);
+    if(d == NULL) return -1;
+    struct dirent *entry;
+    char path[512];
+    snprintf(path, sizeof(path), "%s/" MANIFEST_FILE, dir);
+    unlink(path);
+    while((entry = readdir(d)) != NULL) {
+        if(column_file_id(entry->d_name) < 0) continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        unlink(path);
+    }
+    closedir(d);
+    return 0;
+}
+
+/*
+ * cuts every series back to the readings of the manifest, readings appended after the last commit before a crash,
+ * a store without a manifest keeps what its files hold
+ */
+static int load_manifest(column_store_t *store) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/" MANIFEST_FILE, store->dir);
+    FILE *file = fopen(path, "rb");
+    if(file == NULL) return errno == ENOENT ? 0 : -1;
+    manifest_header_t header;
+    manifest_entry_t entry;
+    int rc = 0;
+    if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, MANIFEST_MAGIC, sizeof(header.magic)) != 0) {
+        DEBUG_PRINTF("%s is not a manifest of this build", path);
+        fclose(file);
+        return -1;
+    }
+    for(int i = 0; i < SERIES_MAX; i++) {
+        if(store->series[i] != NULL) store->series[i]->committed = 0;
+    }
+    for(uint32_t i = 0; i < header.series && rc == 0; i++) {
+        if(fread(&entry, sizeof(entry), 1, file) != 1 || entry.sensor_id >= SERIES_MAX) rc = -1;
+        else if(store->series[entry.sensor_id] != NULL) store->series[entry.sensor_id]->committed = entry.readings;
+    }
+    fclose(file);
+    if(rc != 0) return -1;
+    for(int i = 0; i < SERIES_MAX; i++) {
+        series_t *s = store->series[i];
+        if(s == NULL) continue;
+        //a crash without sync can also leave fewer readings than the manifest counts, those are gone
+        if(s->committed < s->readings) DEBUG_PRINTF("dropping %lu uncommitted readings of sensor %i",
+                                                    (unsigned long) (s->readings - s->committed), i);
+        series_truncate(s, s->committed);
+        s->committed = s->readings;
+    }
+    store->spool = header.spool;
+    store->seq = header.seq;
+    return 0;
+}
+
+column_store_t *column_store_open(const char *dir, int clear) {
+
+    if(mkdir(dir, 0755) != 0 && errno != EEXIST) return NULL;
+    if(clear) remove_files(dir);
+    column_store_t *store = calloc(1, sizeof(column_store_t));
+    if(store == NULL) return NULL;
+    store->dir = strdup(dir);
+    store->series = calloc(SERIES_MAX, sizeof(series_t *));
+    if(store->dir == NULL || store->series == NULL) {
+        column_store_close(store);
+        return NULL;
+    }
+    pthread_rwlock_init(&(store->lock), NULL);
+    DIR *d = opendir(dir);
+    if(d == NULL) {
+        column_store_close(store);
+        return NULL;
+    }
+    struct dirent *entry;
+    char path[512];
+    while((entry = readdir(d)) != NULL) {
+        long id = column_file_id(entry->d_name);
+        if(id < 0) continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        struct stat st;
+        if(stat(path, &st) != 0) continue;
+        store->series[id] = series_load(store, (sensor_id_t) id, st.st_size);
+        if(store->series[id] == NULL) DEBUG_PRINTF("skipping %s", path);
+    }
+    closedir(d);
+    if(load_manifest(store) != 0) {
+        column_store_close(store);
+        return NULL;
+    }
+    return store;
+}
+
+void column_store_close(column_store_t *store) {
+    if(store == NULL) return;
+    if(store->series != NULL) {
+        column_store_flush(store, 0);
+        for(int i = 0; i < SERIES_MAX; i++) series_free(store->series[i]);
+        pthread_rwlock_destroy(&(store->lock));
+    }
+    free(store->series);
+    free(store->dir);
+    free(store);
+}
+
+/*
+ * starts a new block with its first reading, growing the file when it is full
+ */
+static int start_block(column_store_t *store, series_t *s, int64_t ts, double value) {
+    file_header_t *header = header_of(s);
+    if(header->blocks == s->allocated) {
+        if(series_map(store, s, s->allocated + GROW_BLOCKS) != 0) return -1;
+        header = header_of(s);
+    }
+    uint32_t b = header->blocks;
+    block_header_t *block = block_of(s, b);
+    //a block dropped by a rollback can have left bits here
+    memset(stream_of(s, b), 0, STREAM_BYTES);
+    *block = (block_header_t) {ts, ts, ts, value, 1, 0, 0, 0};
+    header->blocks = b + 1;
+    s->index[b] = (block_index_t) {ts, ts, 1, 0};
+    codec_start(&(s->writer), ts, value);
+    if(s->dirty < 0 || s->dirty > b) s->dirty = b;
+    return 0;
+}
+
+static int append_reading(column_store_t *store, series_t *s, int64_t ts, double value) {
+    uint32_t blocks = header_of(s)->blocks;
+    if(blocks == 0 || s->writer.pos + READING_MAX_BITS > STREAM_BYTES*8) {
+        if(blocks > 0) block_of(s, blocks - 1)->sealed = 1;
+        if(start_block(store, s, ts, value) != 0) return -1;
+        s->readings++;
+        return 0;
+    }
+    uint32_t b = blocks - 1;
+    block_header_t *block = block_of(s, b);
+    encode(&(s->writer), stream_of(s, b), ts, value);
+    //the header last, it is what makes the new bits count
+    if(ts < block->min_ts) block->min_ts = ts;
+    if(ts > block->max_ts) block->max_ts = ts;
+    block->bits = s->writer.pos;
+    block->count++;
+    s->index[b] = (block_index_t) {block->min_ts, block->max_ts, block->count, block->bits};
+    s->readings++;
+    if(s->dirty < 0 || s->dirty > b) s->dirty = b;
+    return 0;
+}
+
+int column_store_append(column_store_t *store, const sensor_data_t *data, int count) {
+
+    int rc = 0;
+    pthread_rwlock_wrlock(&(store->lock));
+    for(int i = 0; i < count && rc == 0; i++) {
+        series_t *s = store->series[data[i].id];
+        if(s == NULL) s = store->series[data[i].id] = series_new(store, data[i].id);
+        rc = s != NULL ? append_reading(store, s, (int64_t) data[i].ts, data[i].value) : -1;
+    }
+    pthread_rwlock_unlock(&(store->lock));
+    return rc;
+}
+
+int column_store_flush(column_store_t *store, int sync) {
+
+    int rc = 0;
+    long page = sysconf(_SC_PAGESIZE);
+    pthread_rwlock_rdlock(&(store->lock));
+    for(int i = 0; i < SERIES_MAX; i++) {
+        series_t *s = store->series[i];
+        if(s == NULL || s->dirty < 0) continue;
+        size_t from = (sizeof(file_header_t) + (size_t) s->dirty*COLUMN_BLOCK_SIZE)/page*page;
+        size_t to = file_bytes(header_of(s)->blocks);
+        rc |= msync(s->map, page, sync ? MS_SYNC : MS_ASYNC);        //the file header
+        if(to > from) rc |= msync(s->map + from, to - from, sync ? MS_SYNC : MS_ASYNC);
+        s->dirty = -1;
+    }
+    pthread_rwlock_unlock(&(store->lock));
+    return rc == 0 ? 0 : -1;
+}
+
+static int sync_dir(const char *dir) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if(fd < 0) return -1;
+    int rc = fsync(fd);
+    close(fd);
+    return rc;
+}
+
+int column_store_commit(column_store_t *store, uint64_t spool, uint64_t seq, int sync) {
+
+    if(column_store_flush(store, sync) != 0) return -1;
+    char path[512], tmp[512];
+    snprintf(path, sizeof(path), "%s/" MANIFEST_FILE, store->dir);
+    snprintf(tmp, sizeof(tmp), "%s/" MANIFEST_FILE ".tmp", store->dir);
+    FILE *file = fopen(tmp, "wb");
+    if(file == NULL) return -1;
+    manifest_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MANIFEST_MAGIC, sizeof(header.magic));
+    header.spool = spool;
+    header.seq = seq;
+    pthread_rwlock_rdlock(&(store->lock));
+    for(int i = 0; i < SERIES_MAX; i++) {
+        if(store->series[i] != NULL && store->series[i]->readings > 0) header.series++;
+    }
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for(int i = 0; i < SERIES_MAX && ok; i++) {
+        series_t *s = store->series[i];
+        if(s == NULL || s->readings == 0) continue;
+        manifest_entry_t entry = {(uint32_t) i, 0, s->readings};
+        ok = fwrite(&entry, sizeof(entry), 1, file) == 1;
+    }
+    pthread_rwlock_unlock(&(store->lock));
+    ok = fflush(file) == 0 && ok && (!sync || fsync(fileno(file)) == 0);
+    if(fclose(file) != 0 || !ok || rename(tmp, path) != 0) {
+        DEBUG_PRINTF("cannot write %s", path);
+        unlink(tmp);
+        return -1;
+    }
+    //from here on the manifest counts the readings, a failed directory sync only means the old one may come back
+    if(sync && sync_dir(store->dir) != 0) DEBUG_PRINTF("cannot sync %s", store->dir);
+    for(int i = 0; i < SERIES_MAX; i++) {
+        if(store->series[i] != NULL) store->series[i]->committed = store->series[i]->readings;
+    }
+    store->spool = spool;
+    store->seq = seq;
+    return 0;
+}
+
+void column_store_rollback(column_store_t *store) {
+    pthread_rwlock_wrlock(&(store->lock));
+    for(int i = 0; i < SERIES_MAX; i++) {
+        if(store->series[i] != NULL) series_truncate(store->series[i], store->series[i]->committed);
+    }
+    pthread_rwlock_unlock(&(store->lock));
+}
+
+void column_store_position(column_store_t *store, uint64_t *spool, uint64_t *seq) {
+    *spool = store->spool;
+    *seq = store->seq;
+}
+
+/*
+ * \return readings passed to f, or -(readings + 1) once f asked to stop
+ */
+static int64_t scan_series(series_t *s, sensor_ts_t from, sensor_ts_t to, column_scan_t f, void *arg) {
+    int64_t found = 0;
+    uint32_t blocks = header_of(s)->blocks;
+    for(uint32_t b = 0; b < blocks; b++) {
+        block_index_t *entry = &(s->index[b]);
+        if(entry->max_ts < (int64_t) from || entry->min_ts > (int64_t) to) continue;
+        block_header_t *block = block_of(s, b);
+        const uint8_t *stream = stream_of(s, b);
+        codec_t codec;
+        codec_start(&codec, block->first_ts, block->first_value);
+        sensor_data_t data = {s->id, block->first_value, (sensor_ts_t) block->first_ts};
+        for(uint32_t i = 0; i < entry->count; i++) {
+            if(i > 0) {
+                int64_t ts;
+                decode(&codec, stream, &ts, &(data.value));
+                data.ts = (sensor_ts_t) ts;
+            }
+            if(data.ts < from || data.ts > to) continue;
+            found++;
+            if(f(&data, arg) != 0) return -found - 1;
+        }
+    }
+    return found;
+}
+
+int64_t column_store_scan(column_store_t *store, const sensor_id_t *id, sensor_ts_t from, sensor_ts_t to,
+                          column_scan_t f, void *arg) {
+
+    int64_t found = 0;
+    pthread_rwlock_rdlock(&(store->lock));
+    for(int i = id != NULL ? *id : 0; i < (id != NULL ? *id + 1 : SERIES_MAX); i++) {
+        if(store->series[i] == NULL) continue;
+        int64_t n = scan_series(store->series[i], from, to, f, arg);
+        if(n < 0) {
+            found += -n - 1;
+            break;
+        }
+        found += n;
+    }
+    pthread_rwlock_unlock(&(store->lock));
+    return found;
+}
+
+void column_store_get_stats(column_store_t *store, column_store_stats_t *stats) {
+    memset(stats, 0, sizeof(column_store_stats_t));
+    pthread_rwlock_rdlock(&(store->lock));
+    for(int i = 0; i < SERIES_MAX; i++) {
+        series_t *s = store->series[i];
+        if(s == NULL) continue;
+        uint32_t blocks = header_of(s)->blocks;
+        stats->readings += s->readings;
+        stats->blocks += blocks;
+        stats->file_bytes += s->map_bytes;
+        stats->used_bytes += sizeof(file_header_t) + (uint64_t) blocks*sizeof(block_header_t);
+        for(uint32_t b = 0; b < blocks; b++) stats->used_bytes += (s->index[b].bits + 7)/8;
+    }
+    pthread_rwlock_unlock(&(store->lock));
+}
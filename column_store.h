@@ -0,0 +1,88 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#ifndef _COLUMN_STORE_H_
+#define _COLUMN_STORE_H_
+
+#include <stdint.h>
+#include "config.h"
+
+/*
+ * append only time series storage, one file per sensor in a directory
+ *
+ * a file is a header and fixed size blocks (COLUMN_BLOCK_SIZE), a block holds the readings of one sensor as two
+ * compressed columns in one bit stream: timestamps as delta of delta and values XOR'ed with the previous value
+ * (the encoding of Facebook's Gorilla), readings usually take a few bytes instead of a table row
+ * the files are mapped, readings are written straight into the last block and its header is updated after,
+ * a full block is sealed and a new one started
+ * every block header keeps the time range of its readings, read into a small index when the store is opened
+ * so range scans only decode the blocks that overlap
+ * a manifest file keeps the readings per sensor of the last commit, when the store is opened the files are cut back
+ * to it, so readings appended after the last commit before a crash are gone, like a rolled back transaction
+ *
+ * appends come from one thread, scans may come from any thread at the same time
+ */
+
+#define COLUMN_BLOCK_SIZE 4096
+
+typedef struct column_store column_store_t;
+
+typedef struct {
+    uint64_t readings;
+    uint64_t blocks;
+    uint64_t used_bytes;        /** < file headers, block headers and the bits written */
+    uint64_t file_bytes;        /** < including preallocated blocks and the unused end of blocks */
+} column_store_stats_t;
+
+/*
+ * called for every reading of a scan, non-zero stops the scan
+ */
+typedef int (*column_scan_t)(const sensor_data_t *data, void *arg);
+
+/*
+ * opens the store in directory dir, creating it if needed, clear removes stored readings
+ * \return the store, NULL if an error occurs
+ */
+column_store_t *column_store_open(const char *dir, int clear);
+
+void column_store_close(column_store_t *store);
+
+/*
+ * appends readings, the timestamps of a sensor should mostly increase but do not have to
+ * \return 0 for success, -1 if an error occurs
+ */
+int column_store_append(column_store_t *store, const sensor_data_t *data, int count);
+
+/*
+ * writes the mapped blocks changed since the last flush to disk, sync waits until they are there
+ */
+int column_store_flush(column_store_t *store, int sync);
+
+/*
+ * makes the readings appended so far the committed ones, together with a position of the caller (the spool batch
+ * they came from), both go to the manifest in one rename, sync waits until the readings and the manifest are on disk
+ * \return 0 for success, -1 if an error occurs, then the last commit still stands
+ */
+int column_store_commit(column_store_t *store, uint64_t spool, uint64_t seq, int sync);
+
+/*
+ * drops the readings appended after the last commit
+ */
+void column_store_rollback(column_store_t *store);
+
+/*
+ * the position of the last commit, 0 and 0 before the first one
+ */
+void column_store_position(column_store_t *store, uint64_t *spool, uint64_t *seq);
+
+/*
+ * calls f for all readings of sensor id (all sensors if id is NULL) with from <= ts <= to, per sensor in stored order
+ * \return the number of readings passed to f, -1 if an error occurs
+ */
+int64_t column_store_scan(column_store_t *store, const sensor_id_t *id, sensor_ts_t from, sensor_ts_t to,
+                          column_scan_t f, void *arg);
+
+void column_store_get_stats(column_store_t *store, column_store_stats_t *stats);
+
+#endif /* _COLUMN_STORE_H_ */
@@ -34,18 +34,268 @@
 #define TABLE_NAME "SensorData"
 #endif
 
+#ifndef DATAMGR_MAX_SENSORS
+#define DATAMGR_MAX_SENSORS 1024 //slots in the datamgr sensor state, at most UINT16_MAX + 1
+#endif
+
+#ifndef DATAMGR_SCAN_INTERVAL
+#define DATAMGR_SCAN_INTERVAL 5 //seconds between full scans over all sensors
+#endif
+
+#ifndef DATAMGR_STALE_AFTER
+#define DATAMGR_STALE_AFTER 60 //seconds without a reading before a sensor counts as stale, at most
+#endif
+
+#ifndef DATAMGR_STALE_INTERVALS
+#define DATAMGR_STALE_INTERVALS 3 //missed reporting intervals before a sensor counts as stale, once its interval is known
+#endif
+
+#ifndef DATAMGR_STALE_MIN
+#define DATAMGR_STALE_MIN 5
+#endif
+
+#ifndef DATAMGR_ALLOWED_LATENESS
+#define DATAMGR_ALLOWED_LATENESS 60 //seconds a reading may lag the newest one of its sensor and still go into the average
+#endif
+
+#ifndef ALERT_MIN_DURATION
+#define ALERT_MIN_DURATION 5 //seconds a limit has to be exceeded before an alert is raised
+#endif
+
+#ifndef ALERT_SUSTAIN_AFTER
+#define ALERT_SUSTAIN_AFTER 60 //seconds after raising before an alert is reported as sustained
+#endif
+
+#ifndef ALERT_HYSTERESIS
+#define ALERT_HYSTERESIS 0.5 //degrees an average has to come back inside the limit to clear an alert
+#endif
+
+#ifndef ALERT_RATE_WINDOW
+#define ALERT_RATE_WINDOW 60
+#endif
+
+#ifndef ALERT_RATE_MAX
+#define ALERT_RATE_MAX 4 //emitted transitions per alert in ALERT_RATE_WINDOW seconds, the rest is only counted
+#endif
+
+#ifndef ANOMALY_VALUE_LIMIT
+#define ANOMALY_VALUE_LIMIT 70 //readings beyond +-ANOMALY_VALUE_LIMIT are counted but not averaged
+#endif
+
+#ifndef ANOMALY_TS_MIN
+#define ANOMALY_TS_MIN 1640000000
+#endif
+
+#ifndef ANOMALY_TS_MAX
+#define ANOMALY_TS_MAX 10000000000
+#endif
+
+#ifndef ANOMALY_EWMA_ALPHA
+#define ANOMALY_EWMA_ALPHA 0.05 //weight of a new reading in the per sensor mean and variance
+#endif
+
+#ifndef ANOMALY_WARMUP
+#define ANOMALY_WARMUP 20 //readings before z-scores are used
+#endif
+
+#ifndef ANOMALY_ZSCORE_LIMIT
+#define ANOMALY_ZSCORE_LIMIT 4.0
+#endif
+
+#ifndef ANOMALY_MAX_RATE
+#define ANOMALY_MAX_RATE 0.5 //degrees per second
+#endif
+
+#ifndef ANOMALY_FLATLINE_COUNT
+#define ANOMALY_FLATLINE_COUNT 30 //identical readings in a row
+#endif
+
+#ifndef DATAMGR_CHECKPOINT_FILE
+#define DATAMGR_CHECKPOINT_FILE "./datamgr.ckpt"
+#endif
+
+#ifndef DATAMGR_CHECKPOINT_INTERVAL
+#define DATAMGR_CHECKPOINT_INTERVAL 30 //seconds between checkpoints of the datamgr state
+#endif
+
+#ifndef DATAMGR_CHECKPOINT_MAX_AGE
+#define DATAMGR_CHECKPOINT_MAX_AGE 900 //older checkpoints are not restored, the windows would be meaningless
+#endif
+
+#define DATAMGR_CHECKPOINT_VERSION 2
+
+#ifndef SENSOR_MAP_FILE
+#define SENSOR_MAP_FILE "./room_sensor.map"
+#endif
+
+#ifndef STORAGE_PROFILE
+#define STORAGE_PROFILE "balanced" //legacy, durable, balanced or fast, see storage_profile.h
+#endif
+
+#ifndef STORAGE_BACKEND
+#define STORAGE_BACKEND "sqlite" //sqlite, sharded or column, see storage_backend.h
+#endif
+
+#ifndef STORAGE_SHARDS
+#define STORAGE_SHARDS 4 //database files and writer threads of the sharded backend
+#endif
+
+#ifndef STORAGE_COLUMN_DIR
+#define STORAGE_COLUMN_DIR "sensor_columns" //directory of the column backend
+#endif
+
+#ifndef STORAGE_COLUMN_SYNC
+#define STORAGE_COLUMN_SYNC 0 //1 waits for every batch of the column backend to reach the disk
+#endif
+
+#ifndef STORAGE_SPOOL_FILE
+#define STORAGE_SPOOL_FILE "sensor_spool.bin" //readings wait here while the storage backend cannot take them
+#endif
+
+#ifndef STORAGE_SPOOL_RETRY_MS
+#define STORAGE_SPOOL_RETRY_MS 5000 //ms between attempts to reach the storage backend while readings are spooled
+#endif
+
+#ifndef STORAGE_SPOOL_REPLAY_ROWS
+#define STORAGE_SPOOL_REPLAY_ROWS 20000 //spooled readings replayed per backend transaction
+#endif
+
+#ifndef STORAGE_CHECKPOINT_INTERVAL
+#define STORAGE_CHECKPOINT_INTERVAL 5 //seconds between WAL checkpoints when the WAL stays below its threshold
+#endif
+
+#ifndef STORAGE_CHECKPOINT_RESTART_FACTOR
+#define STORAGE_CHECKPOINT_RESTART_FACTOR 4
+#endif
+
+#ifndef STORAGE_BUSY_TIMEOUT
+#define STORAGE_BUSY_TIMEOUT 2000 //ms a connection waits for a lock held by another connection
+#endif
+
+#ifndef STORAGE_BULK_TRANSACTION
+#define STORAGE_BULK_TRANSACTION 200000 //rows per transaction of insert_sensor_from_file
+#endif
+
+#ifndef STORAGE_BULK_REBUILD_INDEXES
+#define STORAGE_BULK_REBUILD_INDEXES 0 //1 drops the indexes during insert_sensor_from_file and builds them again after
+#endif
+
+#ifndef STORAGE_RETENTION_DAYS
+#define STORAGE_RETENTION_DAYS 30 //days of raw readings and minute rollups kept, 0 keeps everything (at most ~490)
+#endif
+
+#ifndef STORAGE_ROLLUP_INTERVAL
+#define STORAGE_ROLLUP_INTERVAL 60 //seconds between rollup updates and retention checks
+#endif
+
+#ifndef STORAGEMGR_BATCH_MAX
+#define STORAGEMGR_BATCH_MAX 256 //readings per database transaction, a full batch is committed right away
+#endif
+
+#ifndef STORAGEMGR_COMMIT_DEADLINE_MS
+#define STORAGEMGR_COMMIT_DEADLINE_MS 200 //longest a reading waits in an open batch before it is committed
+#endif
+
+#ifndef STORAGEMGR_STATS_INTERVAL
+#define STORAGEMGR_STATS_INTERVAL 60 //seconds between commit statistics in the log
+#endif
+
 #define TIMEDWAIT_LENGTH 10
 
 #ifndef CLEAR_DB
-#define CLEAR_DB 1
+#define CLEAR_DB 0 //1 drops all stored readings at start, old partitions expire anyway
+#endif
+
+#ifndef LOG_RING_WRITERS
+#define LOG_RING_WRITERS 8 //threads with a log queue of their own, more share one queue under a lock
+#endif
+
+#ifndef LOG_RING_SLOTS
+#define LOG_RING_SLOTS 1024 //records per log queue, a power of two
+#endif
+
+#ifndef LOG_RING_RESERVE
+#define LOG_RING_RESERVE 128 //slots of a log queue debug and info records are not written to, dropped instead
+#endif
+
+#ifndef LOG_DROP_REPORT_INTERVAL
+#define LOG_DROP_REPORT_INTERVAL 10 //seconds between reports of the log process on log records dropped since the last
 #endif
 
-#define MAX 120 //max length of log msg
+#define LOG_LINE_MAX 256 //max length of a line in the log
 
+#ifndef LOG_FLUSH_BYTES
+#define LOG_FLUSH_BYTES 65536 //buffered log bytes that are written right away
+#endif
+
+#ifndef LOG_FLUSH_MS
+#define LOG_FLUSH_MS 200 //longest a log line waits in the buffer of the log process
+#endif
+
+#define LOG_READ_BATCH 256 //records the log process takes from the ring at once
+
+#define LOG_FILE "./gateway.log"
+
+#ifndef LOG_ROTATE_BYTES
+#define LOG_ROTATE_BYTES (8*1024*1024) //the log file is rotated once it holds this many bytes
+#endif
+
+#ifndef LOG_ROTATE_SECONDS
+#define LOG_ROTATE_SECONDS 86400 //or once it is this old, 0 rotates by size only
+#endif
+
+#ifndef LOG_ROTATE_KEEP
+#define LOG_ROTATE_KEEP 8 //rotated log files kept, older ones are deleted
+#endif
+
+#ifndef LOG_COMPRESS_LEVEL
+#define LOG_COMPRESS_LEVEL 6 //zlib level of rotated log files, 1 fastest to 9 smallest
+#endif
+
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0 //log levels below this are compiled out: 0 debug, 1 info, 2 warn, 3 error
+#endif
 
+#ifndef LOG_LEVEL
+#define LOG_LEVEL 1 //runtime log level of every thread unless LOG_LEVEL_ENV sets another
+#endif
+
+#define LOG_LEVEL_ENV "GATEWAY_LOG_LEVEL" //"debug" or per thread "storagemgr=debug,connmgr=warn"
+
+#ifndef LOG_SAMPLE_RATE
+#define LOG_SAMPLE_RATE 16 //one in this many messages of a frequent event is logged
+#endif
+
+#ifndef METRICS_SOCKET
+#define METRICS_SOCKET "./gateway.metrics" //Unix socket metrics snapshots are read from, e.g. nc -U
+#endif
+
+#ifndef METRICS_PORT
+#define METRICS_PORT 0 //also serves metrics over HTTP on 127.0.0.1 at this port, 0 for none
+#endif
+
+#define METRICS_MAX 64 //metrics that can be registered
+
+#ifndef TRACE_SAMPLE_RATE
+#define TRACE_SAMPLE_RATE 16 //one in this many readings is traced from connmgr to datamgr and the DB, 0 for none
+#endif
+
+
+#include <stdio.h>
 #include <stdint.h>
 #include <time.h>
 
+#ifdef DEBUG
+#define DEBUG_PRINTF(...) 									                                        \
+        do {											                                            \
+            fprintf(stderr,"\nIn %s - function %s at line %d: ", __FILE__, __func__, __LINE__);	    \
+            fprintf(stderr,__VA_ARGS__);								                            \
+            fflush(stderr);                                                                         \
+                } while(0)
+#else
+#define DEBUG_PRINTF(...) (void)0
+#endif
+
 typedef uint16_t sensor_id_t;
 typedef double sensor_value_t;
 typedef time_t sensor_ts_t;         // UTC timestamp as returned by time() - notice that the size of time_t is different on 32/64 bit machine
@@ -15,22 +15,13 @@
 #include <unistd.h>
 #include "sbuffer.h"
 #include <pthread.h>
-#include "fifo_pipe.h"
-
-#ifdef DEBUG
-#define DEBUG_PRINTF(...) 									                                        \
-        do {											                                            \
-            fprintf(stderr,"\nIn %s - function %s at line %d: ", __FILE__, __func__, __LINE__);	    \
-            fprintf(stderr,__VA_ARGS__);								                            \
-            fflush(stderr);                                                                         \
-                } while(0)
-#else
-#define DEBUG_PRINTF(...) (void)0
-#endif
+#include "log.h"
+#include "metrics.h"
+#include "trace.h"
 
 pthread_mutex_t *lock;
 int *stop_thr_flag;
-fifo_pipe_t *log_pipe_p;
+log_ring_t *log_ring_p;
 dplist_t *socket_list;
 
 void socket_free(void **element) {
@@ -44,12 +35,7 @@ void close_all_connections(dplist_t *socket_list) {
     dpl_free(&socket_list, true);
 }
 
-void log_connmgr(char *msg) {
-    char *mod_msg;
-    asprintf(&mod_msg, "CONNMGR_THREAD: %s", msg);
-    fifo_pipe_write(log_pipe_p, mod_msg);
-    free(mod_msg);
-}
+#define log_connmgr(level, ...) LOG_EVENT(log_ring_p, level, LOG_CONNMGR, __VA_ARGS__)
 
 void connmgr_mem_fail() {
     printf("memory failure in connmgr, stopping gateway... \n");
@@ -82,7 +68,10 @@ void *connmgr_listen(void *args) {
     sbuffer_t *shared_buffer = arguments->sb;
     lock = arguments->lock;
     stop_thr_flag = arguments->stop_threads_flag;
-    log_pipe_p = arguments->log_pipe;
+    log_ring_p = arguments->log_ring;
+    metric_t *readings = metrics_counter_vec("gateway_readings_received_total", "readings received per sensor",
+                                             "sensor", UINT16_MAX + 1);
+    metric_t *connections = metrics_gauge("gateway_connections", "sensor nodes connected");
 
     //set up poll structure
     //this code is inspired by ibm.com/docs/en/i/7.4?topic=designs-using-poll-instead-select
@@ -124,7 +113,7 @@ void *connmgr_listen(void *args) {
                 pthread_exit(NULL);
             }
         } else {
-            log_connmgr("exiting connmgr due to no connections...");
+            log_connmgr(LOG_LEVEL_INFO, LOG_NO_CONNECTIONS, 0);
             printf("gateway stopping due to no active connections..\n");
             pthread_mutex_lock(lock);
             *stop_thr_flag = 1;
@@ -149,6 +138,7 @@ void *connmgr_listen(void *args) {
             compress_arrays = 0;
         }
 
+        metrics_set(connections, nfds - 1);
         DEBUG_PRINTF("polling..");
         int status = poll(fds, nfds, poll_time);
         if (status == 0){
@@ -190,6 +180,13 @@ void *connmgr_listen(void *args) {
                     continue;
                 };
                 DEBUG_PRINTF("tcp_wait_for_connection returned");
+                if(nfds == MAX_CONN + 1) {
+                    //fds is full, the node is closed right away and can connect again once a node left
+                    LOG_SAMPLED(log_ring_p, LOG_LEVEL_WARN, LOG_CONNMGR, LOG_SAMPLE_RATE, LOG_NODE_REFUSED, 1,
+                                LOG_I(MAX_CONN));
+                    socket_free((void **) &client);
+                    continue;
+                }
                 int *client_sd = malloc(sizeof(int));
                 if(client_sd == NULL) connmgr_mem_fail();
                 if(tcp_get_sd(client, client_sd) != TCP_NO_ERROR) {
@@ -211,11 +208,8 @@ void *connmgr_listen(void *args) {
                 bytes = sizeof(data.id);
                 result = tcp_receive(client, (void *) &data.id, &bytes);
                 if(result == TCP_CONNECTION_CLOSED) {
-                    char *msg;
-                    asprintf(&msg, "sensor node disconnected with id %i", tcp_get_sensor_id(client));
-                    log_connmgr(msg);
-                    printf("%s\n", msg);
-                    free(msg);
+                    log_connmgr(LOG_LEVEL_INFO, LOG_NODE_DISCONNECTED, 1, LOG_I(tcp_get_sensor_id(client)));
+                    printf("sensor node disconnected with id %i\n", tcp_get_sensor_id(client));
                     fds[i].fd = -1;
                     if(i == (nfds -1)) {
                         //last node in list
@@ -234,12 +228,10 @@ void *connmgr_listen(void *args) {
                     continue;
                 }
                 if(!(tcp_is_id_received(client))) {
-                    char *msg;
-                    asprintf(&msg, "sensor node connected with id %i", data.id);
-                    log_connmgr(msg);
-                    free(msg);
+                    log_connmgr(LOG_LEVEL_INFO, LOG_NODE_CONNECTED, 1, LOG_I(data.id));
                     tcp_set_sensor_id(client, data.id);
                 }
+                int64_t received = trace_receive();
                 // read temperature
                 bytes = sizeof(data.value);
                 result = tcp_receive(client, (void *) &data.value, &bytes);
@@ -251,7 +243,8 @@ void *connmgr_listen(void *args) {
                 if ((result == TCP_NO_ERROR) && bytes) {
 //                     printf("sensor id = %" PRIu16 " - temperature = %g - timestamp = %ld\n", data.id, data.value,
 //                         (long int) data.ts);
-                    sbuffer_insert(shared_buffer, &data);
+                    sbuffer_insert_traced(shared_buffer, &data, received);
+                    metrics_add_at(readings, data.id, 1);
                 }
             }
         }
@@ -3,212 +3,898 @@
 #include <stdio.h>
 #include <string.h>
 #include <stddef.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "config.h"
 #include "datamgr.h"
-#include "lib/dplist.h"
-
-#ifdef DEBUG
-#define DEBUG_PRINTF(...) 									                                        \
-        do {											                                            \
-            fprintf(stderr,"\nIn %s - function %s at line %d: ", __FILE__, __func__, __LINE__);	    \
-            fprintf(stderr,__VA_ARGS__);								                            \
-            fflush(stderr);                                                                         \
-                } while(0)
-#else
-#define DEBUG_PRINTF(...) (void)0
-#endif
-
+#include "simd_scan.h"
+#include "alert.h"
+#include "anomaly.h"
+#include "timer_wheel.h"
+
+/*
+ * struct-of-arrays sensor state, slot i of every array belongs to the same sensor
+ * slots are handed out by the loader and stay with their sensor id, only the datamgr thread writes the arrays
+ */
 typedef struct {
-    room_id_t room_id;
-    sensor_data_mgr_t sensor_data;
-} my_element_t;
+    int capacity;
+    sensor_value_t *window;     //RUN_AVG_LENGTH values per slot, window of slot i starts at i*RUN_AVG_LENGTH
+    sensor_ts_t *window_ts;     //event time of every window value, same layout as window
+    sensor_value_t *sum;        //running sum of the window
+    sensor_value_t *avg;        //NAN until the window is full
+    uint8_t *count;             //readings in the window
+    uint8_t *head;              //oldest reading, the window is a ring kept in event time order starting at head
+    sensor_ts_t *last_ts;       //newest event time, 0 means no reading yet
+    sensor_value_t *min_temp;
+    sensor_value_t *max_temp;
+    int8_t *flags;              //output of the threshold scan
+    sensor_id_t *sensor_id;     //sensor owning the slot, for events raised by timers
+    sensor_ts_t *seen_ts;       //arrival time of the newest plausible reading, liveness is measured from it
+    sensor_value_t *interval;   //learned reporting interval in seconds, 0 until known
+    sensor_ts_t *deadline;      //seen_ts plus the stale timeout, the wheel only moves a timer when it expires
+    uint8_t *stale;             //no reading before the deadline
+    int stale_count;
+    timer_wheel_t liveness;     //one timer per slot
+    sensor_value_t *room_avg;   //output of the room scan, indexed like the rooms of the map
+    alert_t *alerts;            //alert state per sensor slot
+    alert_t *room_alerts;       //alert state per room slot
+    anomaly_t *anomaly;         //anomaly detection state per sensor slot
+    uint64_t anomaly_totals[ANOMALY_CLASSES];
+} datamgr_store_t;
+
+/*
+ * checkpoint file: header followed by record_count fixed size records, native byte order
+ * the records can be used straight from an mmap of the file
+ */
+#define CHECKPOINT_MAGIC "DMGRCKPT"
 
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t run_avg_length;
+    uint32_t record_size;
+    uint32_t record_count;
+    int64_t created;
+    uint64_t checksum;          //FNV-1a over the header (with checksum 0) and all records
+} checkpoint_header_t;
 
-struct temp_buffer {
-    temp_buffer_node_t *head;
-    int count;  //how many readings are in the buffer
+typedef struct {
+    uint16_t sensor_id;
+    uint8_t count;
+    uint8_t head;
+    uint32_t anomaly_seen;
+    int64_t last_ts;
+    double window[RUN_AVG_LENGTH];
+    int64_t window_ts[RUN_AVG_LENGTH];
+    double anomaly_mean;
+    double anomaly_var;
+    double anomaly_last_value;
+    int64_t anomaly_last_ts;
+} checkpoint_record_t;
+
+/*
+ * one line of the room sensor map
+ */
+typedef struct {
+    sensor_id_t sensor_id;
+    room_id_t room_id;
+    int32_t slot;
+    sensor_value_t min_temp;
+    sensor_value_t max_temp;
+} datamgr_map_entry_t;
+
+/*
+ * immutable lookup table, sorted by sensor_id
+ * a reload builds a new one and swaps the pointer, entries are never edited in place
+ */
+struct datamgr_map {
+    int count;
+    datamgr_map_entry_t *entries;
+    int slot_count;             //slots handed out when this map was built, scans run over [0, slot_count)
+    int room_count;
+    room_id_t *room_ids;        //sorted
+    int32_t *room_start;        //room r owns room_slots[room_start[r]] up to room_slots[room_start[r+1]]
+    int32_t *room_slots;
+    int32_t *room_alert_slot;   //slot in store->room_alerts per room
+    unsigned long epoch;
+    datamgr_map_t *next_retired;
 };
 
-struct temp_buffer_node {
-    temp_buffer_node_t *next;
-    sensor_value_t value;
-};
+/*
+ * deferred reclamation with a single reader (the datamgr thread)
+ * when datamgr first sees a new map it applies the difference to the store and publishes the map epoch in adopted_epoch,
+ * a replaced map is kept on the retired list until datamgr adopted a newer one
+ */
+static _Atomic(datamgr_map_t *) current_map = NULL;
+static atomic_ulong adopted_epoch = 0;
+static datamgr_map_t *adopted_map = NULL;       //only used by the datamgr thread
+static datamgr_map_t *retired_maps = NULL;
+static unsigned long last_epoch = 0;
+static pthread_mutex_t load_lock = PTHREAD_MUTEX_INITIALIZER; //serializes loaders only, never taken by the reader
+
+static datamgr_store_t *store = NULL;
+
+/*
+ * slots per sensor id (room id), guarded by load_lock
+ */
+typedef struct {
+    int32_t slot_of[UINT16_MAX + 1];            //slot+1 per id, 0 if none
+    uint16_t owner[UINT16_MAX + 1];             //id per slot handed out
+    int used;                                   //slots handed out, [0, used)
+} slot_table_t;
+
+static slot_table_t sensor_slots;
+static slot_table_t room_slots;
+
+static alert_sink_t alert_sink = NULL;
+static void *alert_sink_arg = NULL;
+
+static void store_free(datamgr_store_t *st) {
+    if(st == NULL) return;
+    free(st->window);
+    free(st->window_ts);
+    free(st->sum);
+    free(st->avg);
+    free(st->count);
+    free(st->head);
+    free(st->last_ts);
+    free(st->min_temp);
+    free(st->max_temp);
+    free(st->flags);
+    free(st->sensor_id);
+    free(st->seen_ts);
+    free(st->interval);
+    free(st->deadline);
+    free(st->stale);
+    timer_wheel_free(&(st->liveness));
+    free(st->room_avg);
+    free(st->alerts);
+    free(st->room_alerts);
+    free(st->anomaly);
+    free(st);
+}
 
+static void store_clear_slot(datamgr_store_t *st, int slot) {
+    st->sum[slot] = 0;
+    st->avg[slot] = NAN;
+    st->count[slot] = 0;
+    st->head[slot] = 0;
+    st->last_ts[slot] = 0;
+    st->flags[slot] = SIMD_SCAN_OK;
+    st->seen_ts[slot] = 0;
+    st->interval[slot] = 0;
+    st->deadline[slot] = 0;
+    if(st->stale[slot]) st->stale_count--;
+    st->stale[slot] = 0;
+    timer_wheel_cancel(&(st->liveness), slot);
+    alert_reset(&(st->alerts[slot]));
+    anomaly_reset(&(st->anomaly[slot]));
+}
 
+static datamgr_store_t *store_create(int capacity) {
+    datamgr_store_t *st = calloc(1, sizeof(datamgr_store_t));
+    if(st == NULL) return NULL;
+    st->capacity = capacity;
+    st->window = malloc(capacity*RUN_AVG_LENGTH*sizeof(sensor_value_t));
+    st->window_ts = malloc(capacity*RUN_AVG_LENGTH*sizeof(sensor_ts_t));
+    st->sum = malloc(capacity*sizeof(sensor_value_t));
+    st->avg = malloc(capacity*sizeof(sensor_value_t));
+    st->count = malloc(capacity*sizeof(uint8_t));
+    st->head = malloc(capacity*sizeof(uint8_t));
+    st->last_ts = malloc(capacity*sizeof(sensor_ts_t));
+    st->min_temp = malloc(capacity*sizeof(sensor_value_t));
+    st->max_temp = malloc(capacity*sizeof(sensor_value_t));
+    st->flags = malloc(capacity*sizeof(int8_t));
+    st->sensor_id = calloc(capacity, sizeof(sensor_id_t));
+    st->seen_ts = malloc(capacity*sizeof(sensor_ts_t));
+    st->interval = malloc(capacity*sizeof(sensor_value_t));
+    st->deadline = malloc(capacity*sizeof(sensor_ts_t));
+    st->stale = calloc(capacity, sizeof(uint8_t));
+    st->room_avg = malloc(capacity*sizeof(sensor_value_t));
+    st->alerts = malloc(capacity*sizeof(alert_t));
+    st->room_alerts = malloc(capacity*sizeof(alert_t));
+    st->anomaly = malloc(capacity*sizeof(anomaly_t));
+    if(st->window == NULL || st->window_ts == NULL || st->sum == NULL || st->avg == NULL || st->count == NULL || st->head == NULL
+       || st->last_ts == NULL || st->min_temp == NULL || st->max_temp == NULL || st->flags == NULL
+       || st->stale == NULL || st->room_avg == NULL || st->alerts == NULL || st->room_alerts == NULL
+       || st->anomaly == NULL || st->sensor_id == NULL || st->seen_ts == NULL || st->interval == NULL || st->deadline == NULL
+       || timer_wheel_init(&(st->liveness), capacity, DATAMGR_STALE_AFTER) != 0) {
+        store_free(st);
+        return NULL;
+    }
+    for(int i = 0; i < capacity; i++) {
+        store_clear_slot(st, i);
+        st->min_temp[i] = SET_MIN_TEMP;
+        st->max_temp[i] = SET_MAX_TEMP;
+        alert_reset(&(st->room_alerts[i]));
+    }
+    simd_scan_init();
+    return st;
+}
 
-void* element_copy(void * element);
-void element_free(void ** element);
-int element_compare(void * x, void * y);
-void free_cyc_buffer(temp_buffer_t **buffer);
+static int entry_compare(const void *x, const void *y) {
+    //compares by sensor_id
+    sensor_id_t x_id = ((const datamgr_map_entry_t *) x)->sensor_id;
+    sensor_id_t y_id = ((const datamgr_map_entry_t *) y)->sensor_id;
+    return (x_id > y_id) - (x_id < y_id);
+}
 
-//not used
-void * element_copy(void * element) {
-    return NULL;
+static int room_compare(const void *x, const void *y) {
+    //compares by room_id, then sensor_id
+    const datamgr_map_entry_t *a = x, *b = y;
+    if(a->room_id != b->room_id) return (a->room_id > b->room_id) - (a->room_id < b->room_id);
+    return entry_compare(x, y);
 }
 
-void element_free(void ** element) {
-    //DEBUG_PRINTF("using element_free");
-    my_element_t *el = (my_element_t *) *element;
-    free_cyc_buffer(&(el->sensor_data.buffer));
-    el->sensor_data.buffer = NULL;
-    free( (my_element_t *) *element);
-    return;
+static datamgr_map_entry_t *map_find(datamgr_map_t *map, sensor_id_t sensor_id) {
+    if(map == NULL || map->count == 0) return NULL;
+    datamgr_map_entry_t key;
+    key.sensor_id = sensor_id;
+    return bsearch(&key, map->entries, map->count, sizeof(datamgr_map_entry_t), entry_compare);
 }
 
-void free_cyc_buffer(temp_buffer_t **buffer) {
-    if(*buffer == NULL) return;
-    temp_buffer_t *buf = *buffer;
-    if(buf->head == NULL) {
-        free(buf);
-        return;
-    }
-    temp_buffer_node_t *dummy = buf->head;
-    while(dummy->next != NULL) {
-        temp_buffer_node_t *to_remove = dummy;
-        dummy = dummy->next;
-        free(to_remove);
-    }
-    free(dummy);
-    free(buf);
+static void map_free(datamgr_map_t *map) {
+    if(map == NULL) return;
+    free(map->entries);
+    free(map->room_ids);
+    free(map->room_start);
+    free(map->room_slots);
+    free(map->room_alert_slot);
+    free(map);
 }
 
-int element_compare(void * x, void * y) {
-    //compares by sensor_id
-    sensor_id_t x_id = ((my_element_t*)x)->sensor_data.id;
-    sensor_id_t y_id = ((my_element_t*)y)->sensor_data.id;
-    if(x_id == y_id) {
-        //DEBUG_PRINTF("element compare found that %i is equal to %i",x_id, y_id);
-        return 1;
+static void mark_live_slots(datamgr_map_t *map, int rooms, uint8_t *live) {
+    if(rooms) {
+        for(int r = 0; r < map->room_count; r++) live[map->room_alert_slot[r]] = 1;
+    } else {
+        for(int i = 0; i < map->count; i++) live[map->entries[i].slot] = 1;
     }
-    //DEBUG_PRINTF("element compare found that %i is not equal to %i", x_id, y_id);
-    return 0;
 }
 
+/*
+ * marks the sensor (room) slots of every map datamgr may still be using, caller holds load_lock
+ * \return the marks per slot, NULL if out of memory
+ */
+static uint8_t *live_slots(int rooms) {
+    uint8_t *live = calloc(store->capacity, 1);
+    if(live == NULL) return NULL;
+    datamgr_map_t *current = atomic_load(&current_map);
+    if(current != NULL) mark_live_slots(current, rooms, live);
+    for(datamgr_map_t *map = retired_maps; map != NULL; map = map->next_retired) mark_live_slots(map, rooms, live);
+    return live;
+}
 
+/*
+ * the slot id had before, or a free one: a slot no map in live has, datamgr cleared it when it adopted a map without
+ * its last id, and only then one never handed out, so maps reloaded with other ids do not run out of slots
+ * \param next_free where the search for a free slot goes on, start at 0
+ * \return the slot, -1 if all DATAMGR_MAX_SENSORS are taken
+ */
+static int32_t slot_take(slot_table_t *table, uint8_t *live, int *next_free, uint16_t id) {
+    if(table->slot_of[id] != 0) return table->slot_of[id] - 1;
+    while(*next_free < table->used && live[*next_free]) (*next_free)++;
+    int32_t slot;
+    if(*next_free < table->used) {
+        slot = (*next_free)++;
+        table->slot_of[table->owner[slot]] = 0;
+    } else if(table->used < store->capacity) {
+        slot = table->used++;
+    } else {
+        return -1;
+    }
+    live[slot] = 1;
+    table->owner[slot] = id;
+    table->slot_of[id] = slot + 1;
+    return slot;
+}
 
-datamgr_status_t datamgr_parse_sensor_files(FILE *fp_sensor_map, dplist_t **data_list) {
+/*
+ * groups the slots of the map per room for the room scan
+ */
+static datamgr_status_t map_build_rooms(datamgr_map_t *map) {
+    map->room_slots = malloc((map->count + 1)*sizeof(int32_t));
+    map->room_ids = malloc((map->count + 1)*sizeof(room_id_t));
+    map->room_start = malloc((map->count + 2)*sizeof(int32_t));
+    map->room_alert_slot = malloc((map->count + 1)*sizeof(int32_t));
+    datamgr_map_entry_t *by_room = malloc((map->count + 1)*sizeof(datamgr_map_entry_t));
+    if(map->room_slots == NULL || map->room_ids == NULL || map->room_start == NULL || map->room_alert_slot == NULL || by_room == NULL) {
+        free(by_room);
+        return DATAMGR_MEM_ERROR;
+    }
+    if(map->count > 0) {
+        memcpy(by_room, map->entries, map->count*sizeof(datamgr_map_entry_t));
+        qsort(by_room, map->count, sizeof(datamgr_map_entry_t), room_compare);
+    }
+    map->room_count = 0;
+    for(int i = 0; i < map->count; i++) {
+        if(i == 0 || by_room[i].room_id != by_room[i-1].room_id) {
+            map->room_ids[map->room_count] = by_room[i].room_id;
+            map->room_start[map->room_count] = i;
+            map->room_count++;
+        }
+        map->room_slots[i] = by_room[i].slot;
+    }
+    map->room_start[map->room_count] = map->count;
+    free(by_room);
+    uint8_t *live = live_slots(1);
+    if(live == NULL) return DATAMGR_MEM_ERROR;
+    //rooms keeping their slot first, so none of those is handed to a new room
+    for(int r = 0; r < map->room_count; r++) {
+        if(room_slots.slot_of[map->room_ids[r]] != 0) live[room_slots.slot_of[map->room_ids[r]] - 1] = 1;
+    }
+    int next_free = 0;
+    datamgr_status_t status = DATAMGR_OK;
+    for(int r = 0; r < map->room_count && status == DATAMGR_OK; r++) {
+        map->room_alert_slot[r] = slot_take(&room_slots, live, &next_free, map->room_ids[r]);
+        if(map->room_alert_slot[r] < 0) status = DATAMGR_FAILURE;
+    }
+    free(live);
+    return status;
+}
+
+/*
+ * parse the map file into a new table, sensors get the slot they had before or a new one
+ * map lines are "room sensor" or "room sensor min_temp max_temp"
+ */
+static datamgr_status_t map_build(FILE *fp_sensor_map, datamgr_map_t **new_map) {
 
-    *data_list = dpl_create(element_copy, element_free, element_compare);
-    if(data_list == NULL) return DATAMGR_FAILURE;
+    datamgr_map_t *map = calloc(1, sizeof(datamgr_map_t));
+    if(map == NULL) return DATAMGR_MEM_ERROR;
+    datamgr_status_t status;
+    int capacity = 0;
     char * line = NULL;
     size_t length = 0;
-    size_t read;
-    while ((read = getline(&line, &length, fp_sensor_map)) != -1) {
+    while (getline(&line, &length, fp_sensor_map) != -1) {
         int room_nr, sens_id;
-        my_element_t *new_el = malloc(sizeof(my_element_t));//TODO implement element_copy
-        if(new_el == NULL) return DATAMGR_MEM_ERROR;
-        sscanf(line, "%d %d", &room_nr, &sens_id);
-        new_el->room_id = (room_id_t) room_nr;
-        new_el->sensor_data.id = sens_id;
-        new_el->sensor_data.buffer=malloc(sizeof(temp_buffer_t));
-        if(new_el->sensor_data.buffer == NULL) return DATAMGR_MEM_ERROR;
-        new_el->sensor_data.buffer->head = NULL;
-        new_el->sensor_data.buffer->count = 0;
-        *data_list = dpl_insert_at_index(*data_list, new_el, 0, false);
-        if(*data_list==NULL) return DATAMGR_FAILURE;
+        double min_temp = SET_MIN_TEMP, max_temp = SET_MAX_TEMP;
+        int fields = sscanf(line, "%d %d %lf %lf", &room_nr, &sens_id, &min_temp, &max_temp);
+        if((fields != 2 && fields != 4) || sens_id < 0 || sens_id > UINT16_MAX || min_temp >= max_temp) {
+            DEBUG_PRINTF("skipping malformed sensor map line: %s", line);
+            continue;
+        }
+        if(map->count == capacity) {
+            capacity = capacity ? capacity*2 : 64;
+            datamgr_map_entry_t *grown = realloc(map->entries, capacity*sizeof(datamgr_map_entry_t));
+            if(grown == NULL) {
+                free(line);
+                map_free(map);
+                return DATAMGR_MEM_ERROR;
+            }
+            map->entries = grown;
+        }
+        datamgr_map_entry_t *entry = &(map->entries[map->count]);
+        entry->room_id = (room_id_t) room_nr;
+        entry->sensor_id = (sensor_id_t) sens_id;
+        entry->min_temp = min_temp;
+        entry->max_temp = max_temp;
+        map->count++;
     }
     free(line);
+    if(ferror(fp_sensor_map)) {
+        map_free(map);
+        return DATAMGR_FAILURE;
+    }
+
+    if(map->count > 0) qsort(map->entries, map->count, sizeof(datamgr_map_entry_t), entry_compare);
+    //drop duplicate sensor ids, first one in sorted order wins
+    int unique = 0;
+    for(int i = 0; i < map->count; i++) {
+        if(unique > 0 && map->entries[unique-1].sensor_id == map->entries[i].sensor_id) {
+            DEBUG_PRINTF("duplicate sensor id %i in sensor map", map->entries[i].sensor_id);
+            continue;
+        }
+        map->entries[unique++] = map->entries[i];
+    }
+    map->count = unique;
+    uint8_t *live = live_slots(0);
+    if(live == NULL) {
+        map_free(map);
+        return DATAMGR_MEM_ERROR;
+    }
+    //sensors keeping their slot first, so none of those is handed to a new sensor
+    for(int i = 0; i < map->count; i++) {
+        int32_t kept = sensor_slots.slot_of[map->entries[i].sensor_id];
+        if(kept != 0) live[kept - 1] = 1;
+    }
+    int next_free = 0;
+    for(int i = 0; i < map->count; i++) {
+        map->entries[i].slot = slot_take(&sensor_slots, live, &next_free, map->entries[i].sensor_id);
+        if(map->entries[i].slot < 0) {
+            DEBUG_PRINTF("sensor map needs more than DATAMGR_MAX_SENSORS slots");
+            free(live);
+            map_free(map);
+            return DATAMGR_FAILURE;
+        }
+    }
+    free(live);
+    map->slot_count = sensor_slots.used;
+    status = map_build_rooms(map);
+    if(status != DATAMGR_OK) {
+        map_free(map);
+        return status;
+    }
+    *new_map = map;
     return DATAMGR_OK;
 }
 
+/*
+ * runs on the datamgr thread, brings the store in line with a newly published map
+ * linear merge of two sorted tables, no locks and no allocation
+ */
+static void map_adopt(datamgr_map_t *old_map, datamgr_map_t *new_map) {
+    int i = 0, j = 0;
+    int old_count = old_map == NULL ? 0 : old_map->count;
+    while(i < old_count || j < new_map->count) {
+        datamgr_map_entry_t *o = i < old_count ? &(old_map->entries[i]) : NULL;
+        datamgr_map_entry_t *n = j < new_map->count ? &(new_map->entries[j]) : NULL;
+        if(n == NULL || (o != NULL && o->sensor_id < n->sensor_id)) {
+            //sensor removed from the map
+            store_clear_slot(store, o->slot);
+            i++;
+            continue;
+        }
+        if(o == NULL || n->sensor_id < o->sensor_id) {
+            //new sensor, the slot may have been used by it before
+            store_clear_slot(store, n->slot);
+        } else {
+            //kept sensor, the window is left alone
+            i++;
+        }
+        store->sensor_id[n->slot] = n->sensor_id;
+        store->min_temp[n->slot] = n->min_temp;
+        store->max_temp[n->slot] = n->max_temp;
+        j++;
+    }
+    //rooms that were not in the old map start without alert
+    i = 0;
+    int old_rooms = old_map == NULL ? 0 : old_map->room_count;
+    for(j = 0; j < new_map->room_count; j++) {
+        while(i < old_rooms && old_map->room_ids[i] < new_map->room_ids[j]) i++;
+        if(i < old_rooms && old_map->room_ids[i] == new_map->room_ids[j]) continue;
+        alert_reset(&(store->room_alerts[new_map->room_alert_slot[j]]));
+    }
+}
+
+/*
+ * frees retired maps that datamgr can no longer be using, caller holds load_lock
+ */
+static void map_reclaim_locked() {
+    unsigned long adopted = atomic_load(&adopted_epoch);
+    datamgr_map_t **link = &retired_maps;
+    while(*link != NULL) {
+        datamgr_map_t *map = *link;
+        if(map->epoch < adopted) {
+            *link = map->next_retired;
+            map_free(map);
+        } else {
+            link = &(map->next_retired);
+        }
+    }
+}
 
-datamgr_status_t datamgr_get_sensor_data_from_sensorid(dplist_t *data_list, sensor_id_t sensor_id, sensor_data_mgr_t **s_data) {
+datamgr_status_t datamgr_load_sensor_map(FILE *fp_sensor_map) {
 
-    my_element_t *synth_element = malloc(sizeof(my_element_t));
-    if(synth_element == NULL) return DATAMGR_MEM_ERROR;
-    synth_element->sensor_data.id = sensor_id;
-    int index = dpl_get_index_of_element(data_list,synth_element);
-    if(index == -1) return DATAMGR_WRONG_ID;
-    my_element_t *found_el = dpl_get_element_at_index(data_list, index);//
-    if(found_el != NULL) {
-        free(synth_element);
-        *s_data = &(found_el->sensor_data);
-        return DATAMGR_OK;
+    pthread_mutex_lock(&load_lock);
+    if(store == NULL) {
+        store = store_create(DATAMGR_MAX_SENSORS);
+        if(store == NULL) {
+            pthread_mutex_unlock(&load_lock);
+            return DATAMGR_MEM_ERROR;
+        }
+    }
+    //maps datamgr moved past no longer hold on to their slots
+    map_reclaim_locked();
+    datamgr_map_t *new_map;
+    datamgr_status_t status = map_build(fp_sensor_map, &new_map);
+    if(status != DATAMGR_OK) {
+        pthread_mutex_unlock(&load_lock);
+        return status;
     }
-    return DATAMGR_FAILURE;
+    new_map->epoch = ++last_epoch;
+    datamgr_map_t *old_map = atomic_exchange(&current_map, new_map);
+    if(old_map != NULL) {
+        old_map->next_retired = retired_maps;
+        retired_maps = old_map;
+    }
+    map_reclaim_locked();
+    pthread_mutex_unlock(&load_lock);
+    return DATAMGR_OK;
 }
 
+void datamgr_map_reclaim() {
+    pthread_mutex_lock(&load_lock);
+    map_reclaim_locked();
+    pthread_mutex_unlock(&load_lock);
+}
 
-datamgr_status_t datamgr_get_avg(dplist_t *data_list, sensor_id_t sensor_id, sensor_value_t *av) {
+datamgr_map_t *datamgr_map_acquire() {
+    datamgr_map_t *map = atomic_load(&current_map);
+    if(map != NULL && map != adopted_map) {
+        map_adopt(adopted_map, map);
+        adopted_map = map;
+        atomic_store(&adopted_epoch, map->epoch);
+    }
+    return map;
+}
 
-    sensor_data_mgr_t *sensor_data;
-    datamgr_status_t status = datamgr_get_sensor_data_from_sensorid(data_list, sensor_id, &sensor_data);
-    if(status == DATAMGR_FAILURE || status == DATAMGR_MEM_ERROR) return status;
-    sensor_value_t average = 0;
-    if(sensor_data->buffer->count == RUN_AVG_LENGTH) {
-        //buffer full
-        temp_buffer_node_t *dummy = sensor_data->buffer->head;
-        while(dummy != NULL) {
-            average = average + dummy->value;
-            dummy=dummy->next;
-        }
-        average = average/RUN_AVG_LENGTH;
-    } else {
-        //buffer not full yet, have to return 0
-        average = 0;
+void datamgr_free() {
+    pthread_mutex_lock(&load_lock);
+    map_free(atomic_exchange(&current_map, NULL));
+    while(retired_maps != NULL) {
+        datamgr_map_t *map = retired_maps;
+        retired_maps = map->next_retired;
+        map_free(map);
     }
-    *av = average;
+    adopted_map = NULL;
+    store_free(store);
+    store = NULL;
+    pthread_mutex_unlock(&load_lock);
+}
+
+int datamgr_get_total_sensors() {
+    pthread_mutex_lock(&load_lock);
+    datamgr_map_t *map = atomic_load(&current_map);
+    int count = map == NULL ? 0 : map->count;
+    pthread_mutex_unlock(&load_lock);
+    return count;
+}
+
+
+datamgr_status_t datamgr_get_avg(datamgr_map_t *map, sensor_id_t sensor_id, sensor_value_t *av) {
+
+    datamgr_map_entry_t *entry = map_find(map, sensor_id);
+    if(entry == NULL) return DATAMGR_WRONG_ID;
+    //window not full yet, have to return 0
+    *av = isnan(store->avg[entry->slot]) ? 0 : store->avg[entry->slot];
     return DATAMGR_OK;
 }
 
+datamgr_status_t datamgr_get_thresholds(datamgr_map_t *map, sensor_id_t sensor_id, sensor_value_t *min_temp, sensor_value_t *max_temp) {
 
-int datamgr_insert_new_sensor_reading(dplist_t *data_list, sensor_id_t sensor_id, sensor_value_t value, sensor_ts_t ts) {
+    datamgr_map_entry_t *entry = map_find(map, sensor_id);
+    if(entry == NULL) return DATAMGR_WRONG_ID;
+    *min_temp = store->min_temp[entry->slot];
+    *max_temp = store->max_temp[entry->slot];
+    return DATAMGR_OK;
+}
 
-    if(data_list == NULL) return DATAMGR_FAILURE;
-    //sanity check inserted values
-    if(sensor_id < 0 || value > 70 || value < -70 || ts < 1640000000 || ts > 10000000000) {
-        DEBUG_PRINTF("rejected sensor reading due to sanity check fail");
-        return DATAMGR_FAILURE;
+
+void datamgr_set_alert_sink(alert_sink_t sink, void *arg) {
+    alert_sink = sink;
+    alert_sink_arg = arg;
+}
+
+static void emit_alert(alert_event_t *event, alert_subject_t subject, uint16_t id) {
+    if(alert_sink == NULL) return;
+    event->subject = subject;
+    event->id = id;
+    alert_sink(event, alert_sink_arg);
+}
+
+datamgr_status_t datamgr_update_alert(datamgr_map_t *map, sensor_id_t sensor_id, sensor_ts_t ts) {
+
+    datamgr_map_entry_t *entry = map_find(map, sensor_id);
+    if(entry == NULL) return DATAMGR_WRONG_ID;
+    int slot = entry->slot;
+    if(ts < store->last_ts[slot]) ts = store->last_ts[slot];   //alerts run on event time, an out of order reading does not turn it back
+    alert_event_t event;
+    if(alert_update(&(store->alerts[slot]), store->avg[slot], store->min_temp[slot], store->max_temp[slot], ts, &event)) {
+        emit_alert(&event, ALERT_SENSOR, sensor_id);
     }
-    sensor_data_mgr_t *sensor_data;
-    datamgr_status_t status = datamgr_get_sensor_data_from_sensorid(data_list, sensor_id, &sensor_data);
-    if(status != DATAMGR_OK){
-        return status;
+    return DATAMGR_OK;
+}
+
+
+/*
+ * stale timeout of a slot, DATAMGR_STALE_INTERVALS missed reports once the interval is known
+ */
+static sensor_ts_t liveness_timeout(int slot) {
+    if(store->interval[slot] <= 0) return DATAMGR_STALE_AFTER;
+    sensor_ts_t timeout = (sensor_ts_t) ceil(store->interval[slot]*DATAMGR_STALE_INTERVALS);
+    if(timeout < DATAMGR_STALE_MIN) return DATAMGR_STALE_MIN;
+    if(timeout > DATAMGR_STALE_AFTER) return DATAMGR_STALE_AFTER;
+    return timeout;
+}
+
+/*
+ * records a sign of life at arrival time now and pushes the deadline of a slot out
+ * deadlines are kept in the clock of datamgr_check_liveness(), the clock of the sensor may lag or run ahead
+ */
+static void liveness_touch(int slot, sensor_ts_t now) {
+    sensor_ts_t prev = store->seen_ts[slot];
+    if(now <= prev) return;  //readings arriving in the same second say nothing about the interval
+    if(prev != 0 && !store->stale[slot]) {
+        sensor_value_t delta = now - prev;
+        sensor_value_t interval = store->interval[slot];
+        store->interval[slot] = interval == 0 ? delta : interval + (delta - interval)/8;
+    }
+    store->seen_ts[slot] = now;
+    store->deadline[slot] = now + liveness_timeout(slot);
+    //a later deadline is picked up when the timer fires, an earlier one (shorter learned interval) moves the timer now
+    timer_wheel_t *wheel = &(store->liveness);
+    if(!timer_wheel_scheduled(wheel, slot) || store->deadline[slot] < wheel->due[slot]) {
+        timer_wheel_schedule(wheel, slot, store->deadline[slot]);
     }
+    if(store->stale[slot]) {
+        store->stale[slot] = 0;
+        store->stale_count--;
+        alert_event_t event = {.state = ALERT_CLEARED, .kind = ALERT_STALE, .value = store->avg[slot], .ts = now, .suppressed = 0};
+        emit_alert(&event, ALERT_SENSOR, store->sensor_id[slot]);
+    }
+}
 
-    sensor_data->ts = ts;
+static sensor_ts_t liveness_expired(int32_t slot, sensor_ts_t now, void *arg) {
+    if(store->deadline[slot] > now) return store->deadline[slot];  //readings came in since the timer was set
+    store->stale[slot] = 1;
+    store->stale_count++;
+    alert_event_t event = {.state = ALERT_RAISED, .kind = ALERT_STALE, .value = store->avg[slot], .ts = store->seen_ts[slot], .suppressed = 0};
+    emit_alert(&event, ALERT_SENSOR, store->sensor_id[slot]);
+    return 0;
+}
 
-    int readings_done = sensor_data->buffer->count;
+datamgr_status_t datamgr_check_liveness(datamgr_map_t *map, sensor_ts_t now, int *expired) {
 
-    if(readings_done < RUN_AVG_LENGTH) {
-        //not yet full buffer
-        //add new node to the end of buffer
-        temp_buffer_node_t *new_node = malloc(sizeof(temp_buffer_node_t));
-        if(new_node == NULL) return DATAMGR_MEM_ERROR;
-        new_node->value = value;
-        new_node->next = NULL;
+    if(map == NULL) return DATAMGR_FAILURE;
+    *expired = timer_wheel_advance(&(store->liveness), now, liveness_expired, NULL);
+    return DATAMGR_OK;
+}
 
-        temp_buffer_node_t *dummy = sensor_data->buffer->head;
-        if(dummy==NULL) {
-            sensor_data->buffer->head = new_node;
-            sensor_data->buffer->count++;
-            return DATAMGR_OK;
-        } else {
-            while(dummy->next != NULL) {//crawl through buffer until the last node
-                dummy= dummy->next;
-            }
-            dummy->next = new_node;
-            sensor_data->buffer->count++;
-            return DATAMGR_OK; //fix return values
+/*
+ * oldest event time a reading may have to still be used for the average of a slot
+ * readings older than the newest one by more than DATAMGR_ALLOWED_LATENESS are late, and so is anything that would
+ * fall out of a full window right away
+ */
+static sensor_ts_t slot_watermark(int slot) {
+    if(store->last_ts[slot] == 0) return 0;
+    sensor_ts_t watermark = store->last_ts[slot] - DATAMGR_ALLOWED_LATENESS;
+    if(store->count[slot] == RUN_AVG_LENGTH) {
+        sensor_ts_t oldest = store->window_ts[slot*RUN_AVG_LENGTH + store->head[slot]];
+        if(oldest > watermark) watermark = oldest;
+    }
+    return watermark;
+}
+
+int datamgr_insert_new_sensor_reading(datamgr_map_t *map, sensor_id_t sensor_id, sensor_value_t value, sensor_ts_t ts,
+                                      sensor_ts_t now, anomaly_result_t *anomaly) {
+
+    if(map == NULL) return DATAMGR_FAILURE;
+    datamgr_map_entry_t *entry = map_find(map, sensor_id);
+    if(entry == NULL) return DATAMGR_WRONG_ID;
+    int slot = entry->slot;
+
+    //classify instead of silently dropping, implausible values and timestamps and late readings stay out of the window
+    anomaly_result_t result;
+    if(anomaly == NULL) anomaly = &result;
+    anomaly_classify(&(store->anomaly[slot]), value, ts, slot_watermark(slot), anomaly);
+    for(int c = 0; c < ANOMALY_CLASSES; c++) {
+        if(anomaly->flags & ANOMALY_BIT(c)) store->anomaly_totals[c]++;
+    }
+    //a sensor sending implausible values is broken, not silent
+    if(!(anomaly->flags & ANOMALY_BIT(ANOMALY_TIMESTAMP))) liveness_touch(slot, now);
+    if(anomaly->flags & ANOMALY_REJECT) {
+        DEBUG_PRINTF("rejected sensor reading due to sanity check fail or lateness");
+        return DATAMGR_REJECTED;
+    }
+
+    //the window doubles as the reorder buffer, a ring in event time order starting at head
+    sensor_value_t *window = &(store->window[slot*RUN_AVG_LENGTH]);
+    sensor_ts_t *window_ts = &(store->window_ts[slot*RUN_AVG_LENGTH]);
+    int head = store->head[slot];
+    int count = store->count[slot];
+    if(ts > store->last_ts[slot]) store->last_ts[slot] = ts;
+    if(count == RUN_AVG_LENGTH) {
+        //window already full, drop the oldest reading, the watermark guarantees ts is not older than it
+        store->sum[slot] -= window[head];
+        head = (head + 1) % RUN_AVG_LENGTH;
+        count--;
+    }
+    //shift newer readings up by one, nothing moves for a reading that arrives in order
+    int pos = count;
+    while(pos > 0) {
+        int prev = (head + pos - 1) % RUN_AVG_LENGTH;
+        if(window_ts[prev] <= ts) break;
+        int cur = (head + pos) % RUN_AVG_LENGTH;
+        window[cur] = window[prev];
+        window_ts[cur] = window_ts[prev];
+        pos--;
+    }
+    int cur = (head + pos) % RUN_AVG_LENGTH;
+    window[cur] = value;
+    window_ts[cur] = ts;
+    count++;
+    store->sum[slot] += value;
+    store->head[slot] = head;
+    store->count[slot] = count;
+    if(count == RUN_AVG_LENGTH) {
+        if(head == 0) {
+            //resum once per lap so rounding errors do not pile up
+            sensor_value_t sum = 0;
+            for(int i = 0; i < RUN_AVG_LENGTH; i++) sum += window[i];
+            store->sum[slot] = sum;
+        }
+        store->avg[slot] = store->sum[slot]/RUN_AVG_LENGTH;
+    }
+    return DATAMGR_OK;
+}
+
+datamgr_status_t datamgr_scan(datamgr_map_t *map, sensor_ts_t now, datamgr_scan_t *scan) {
+
+    if(map == NULL) return DATAMGR_FAILURE;
+    int n = map->slot_count;
+    simd_scan_thresholds(store->avg, store->min_temp, store->max_temp, store->flags, n, &(scan->too_hot), &(scan->too_cold));
+    scan->stale = store->stale_count;
+    simd_scan_room_avg(store->avg, map->room_slots, map->room_start, map->room_count, store->room_avg);
+    scan->rooms = map->room_count;
+    for(int r = 0; r < map->room_count; r++) {
+        alert_event_t event;
+        if(alert_update(&(store->room_alerts[map->room_alert_slot[r]]), store->room_avg[r], SET_MIN_TEMP, SET_MAX_TEMP, now, &event)) {
+            emit_alert(&event, ALERT_ROOM, map->room_ids[r]);
         }
+    }
+    return DATAMGR_OK;
+}
+
+void datamgr_get_anomaly_totals(uint64_t totals[ANOMALY_CLASSES]) {
+    for(int c = 0; c < ANOMALY_CLASSES; c++) totals[c] = store == NULL ? 0 : store->anomaly_totals[c];
+}
+
+datamgr_status_t datamgr_get_anomaly_counts(datamgr_map_t *map, sensor_id_t sensor_id, uint32_t counts[ANOMALY_CLASSES]) {
+
+    datamgr_map_entry_t *entry = map_find(map, sensor_id);
+    if(entry == NULL) return DATAMGR_WRONG_ID;
+    memcpy(counts, store->anomaly[entry->slot].counts, ANOMALY_CLASSES*sizeof(uint32_t));
+    return DATAMGR_OK;
+}
+
+static uint64_t checkpoint_hash(uint64_t hash, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static uint64_t checkpoint_checksum(const checkpoint_header_t *header, const void *records, size_t size) {
+    checkpoint_header_t copy = *header;
+    copy.checksum = 0;
+    uint64_t hash = checkpoint_hash(14695981039346656037ULL, &copy, sizeof(copy));
+    return checkpoint_hash(hash, records, size);
+}
+
+datamgr_status_t datamgr_checkpoint_create(datamgr_map_t *map, sensor_ts_t now, void **image, size_t *size) {
+
+    if(map == NULL) return DATAMGR_FAILURE;
+    size_t total = sizeof(checkpoint_header_t) + map->count*sizeof(checkpoint_record_t);
+    char *buf = calloc(1, total);
+    if(buf == NULL) return DATAMGR_MEM_ERROR;
+    checkpoint_header_t *header = (checkpoint_header_t *) buf;
+    checkpoint_record_t *records = (checkpoint_record_t *) (buf + sizeof(checkpoint_header_t));
+    int count = 0;
+    for(int i = 0; i < map->count; i++) {
+        int slot = map->entries[i].slot;
+        if(store->count[slot] == 0 && store->anomaly[slot].seen == 0) continue;   //nothing worth keeping
+        checkpoint_record_t *record = &(records[count++]);
+        record->sensor_id = map->entries[i].sensor_id;
+        record->count = store->count[slot];
+        record->head = store->head[slot];
+        record->last_ts = store->last_ts[slot];
+        memcpy(record->window, &(store->window[slot*RUN_AVG_LENGTH]), sizeof(record->window));
+        memcpy(record->window_ts, &(store->window_ts[slot*RUN_AVG_LENGTH]), sizeof(record->window_ts));
+        anomaly_t *anomaly = &(store->anomaly[slot]);
+        record->anomaly_seen = anomaly->seen;
+        record->anomaly_mean = anomaly->mean;
+        record->anomaly_var = anomaly->var;
+        record->anomaly_last_value = anomaly->last_value;
+        record->anomaly_last_ts = anomaly->last_ts;
+    }
+    memcpy(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic));
+    header->version = DATAMGR_CHECKPOINT_VERSION;
+    header->run_avg_length = RUN_AVG_LENGTH;
+    header->record_size = sizeof(checkpoint_record_t);
+    header->record_count = count;
+    header->created = now;
+    header->checksum = checkpoint_checksum(header, records, count*sizeof(checkpoint_record_t));
+    *image = buf;
+    *size = sizeof(checkpoint_header_t) + count*sizeof(checkpoint_record_t);
+    return DATAMGR_OK;
+}
+
+datamgr_status_t datamgr_checkpoint_write(const char *path, void *image, size_t size) {
+
+    char tmp_path[PATH_MAX];
+    if(snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int) sizeof(tmp_path)) return DATAMGR_FAILURE;
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd == -1) return DATAMGR_FAILURE;
+    ssize_t written = write(fd, image, size);
+    if(written != (ssize_t) size || fsync(fd) == -1) {
+        DEBUG_PRINTF("failed to write checkpoint %s", tmp_path);
+        close(fd);
+        unlink(tmp_path);
+        return DATAMGR_FAILURE;
+    }
+    close(fd);
+    //rename is atomic, a crash leaves either the old or the new checkpoint
+    if(rename(tmp_path, path) == -1) {
+        unlink(tmp_path);
+        return DATAMGR_FAILURE;
+    }
+    return DATAMGR_OK;
+}
+
+datamgr_status_t datamgr_checkpoint_restore(datamgr_map_t *map, const char *path, sensor_ts_t now, int *restored) {
+
+    *restored = 0;
+    if(map == NULL) return DATAMGR_FAILURE;
+    int fd = open(path, O_RDONLY);
+    if(fd == -1) return DATAMGR_FAILURE;
+    struct stat st;
+    if(fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(checkpoint_header_t)) {
+        close(fd);
+        return DATAMGR_FAILURE;
+    }
+    void *image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(image == MAP_FAILED) return DATAMGR_FAILURE;
+
+    datamgr_status_t status = DATAMGR_FAILURE;
+    const checkpoint_header_t *header = image;
+    const checkpoint_record_t *records = (const checkpoint_record_t *) ((const char *) image + sizeof(checkpoint_header_t));
+    size_t records_size = (size_t) st.st_size - sizeof(checkpoint_header_t);
+    if(memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) != 0 || header->version != DATAMGR_CHECKPOINT_VERSION
+       || header->run_avg_length != RUN_AVG_LENGTH || header->record_size != sizeof(checkpoint_record_t)
+       || records_size != (size_t) header->record_count*sizeof(checkpoint_record_t)) {
+        DEBUG_PRINTF("checkpoint %s has an unknown layout", path);
+    } else if(now - header->created > DATAMGR_CHECKPOINT_MAX_AGE) {
+        DEBUG_PRINTF("checkpoint %s is too old", path);
+    } else if(checkpoint_checksum(header, records, records_size) != header->checksum) {
+        DEBUG_PRINTF("checkpoint %s has a bad checksum", path);
     } else {
-        //buffer already full, get rid of oldest node and add the newest
-        temp_buffer_node_t *new_node = malloc(sizeof(temp_buffer_node_t));
-        if(new_node == NULL) return DATAMGR_MEM_ERROR;
-        new_node->value = value;
-        new_node->next = NULL;
-        temp_buffer_node_t *old = sensor_data->buffer->head;
-        sensor_data->buffer->head = old->next;
-        free(old);
-        temp_buffer_node_t *dummy = sensor_data->buffer->head;
-        while(dummy->next != NULL) {//crawl through buffer until the last node
-                dummy= dummy->next;
-            }
-        dummy->next = new_node;
-        return DATAMGR_OK; //fix return values
+        for(uint32_t i = 0; i < header->record_count; i++) {
+            const checkpoint_record_t *record = &(records[i]);
+            datamgr_map_entry_t *entry = map_find(map, record->sensor_id);
+            if(entry == NULL || record->count > RUN_AVG_LENGTH || record->head >= RUN_AVG_LENGTH) continue;
+            int slot = entry->slot;
+            sensor_value_t *window = &(store->window[slot*RUN_AVG_LENGTH]);
+            memcpy(window, record->window, sizeof(record->window));
+            memcpy(&(store->window_ts[slot*RUN_AVG_LENGTH]), record->window_ts, sizeof(record->window_ts));
+            store->count[slot] = record->count;
+            store->head[slot] = record->head;
+            store->last_ts[slot] = record->last_ts;
+            sensor_value_t sum = 0;
+            for(int k = 0; k < record->count; k++) sum += window[k];
+            store->sum[slot] = sum;
+            store->avg[slot] = record->count == RUN_AVG_LENGTH ? sum/RUN_AVG_LENGTH : NAN;
+            anomaly_t *anomaly = &(store->anomaly[slot]);
+            anomaly->seen = record->anomaly_seen;
+            anomaly->mean = record->anomaly_mean;
+            anomaly->var = record->anomaly_var;
+            anomaly->last_value = record->anomaly_last_value;
+            anomaly->last_ts = record->anomaly_last_ts;
+            liveness_touch(slot, now);
+            (*restored)++;
+        }
+        status = DATAMGR_OK;
     }
+    munmap(image, st.st_size);
+    return status;
 }
 
+datamgr_status_t datamgr_get_room_avg(datamgr_map_t *map, int room_index, room_id_t *room_id, sensor_value_t *av) {
+
+    if(map == NULL || room_index < 0 || room_index >= map->room_count) return DATAMGR_FAILURE;
+    *room_id = map->room_ids[room_index];
+    *av = store->room_avg[room_index];
+    return DATAMGR_OK;
+}
+
+
 
 
 
@@ -8,7 +8,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include "config.h"
-#include "lib/dplist.h"
+#include "alert.h"
+#include "anomaly.h"
 
 
 
@@ -26,38 +27,51 @@
 typedef uint16_t room_id_t;
 
 /*
- * set up temp_buffer
+ * lookup table from sensor id to room id and state slot, built from the room sensor map
  */
-
-typedef struct temp_buffer temp_buffer_t;
-typedef struct temp_buffer_node temp_buffer_node_t;
+typedef struct datamgr_map datamgr_map_t;
 
 /*
  * set up status return type
  */
-enum datamgr_status {DATAMGR_OK = 0, DATAMGR_FAILURE, DATAMGR_MEM_ERROR, DATAMGR_WRONG_ID };
+enum datamgr_status {DATAMGR_OK = 0, DATAMGR_FAILURE, DATAMGR_MEM_ERROR, DATAMGR_WRONG_ID, DATAMGR_REJECTED };
 typedef enum datamgr_status datamgr_status_t;
 
  
 /**
- * structure to hold sensor data solely for use in datamgr
+ * result of one datamgr_scan() over all sensors
  */
 typedef struct {
-    sensor_id_t id;         /** < sensor id */
-    temp_buffer_t *buffer;   /** < sensor value buffer - a cyclic buffer retaining only last RUN_AVG_LENGTH sensor values */
-    sensor_ts_t ts;         /** < sensor timestamp */
-} sensor_data_mgr_t;
+    int too_hot;    /** < sensors with a full window above their max_temp */
+    int too_cold;   /** < sensors with a full window below their min_temp */
+    int stale;      /** < sensors marked stale by datamgr_check_liveness() */
+    int rooms;      /** < rooms with an average available through datamgr_get_room_avg() */
+} datamgr_scan_t;
 
 
 
 /**
- *  This method holds the core functionality of your datamgr. It takes in 2 file pointers to the sensor files and parses them. 
- *  When the method finishes all data should be in the internal pointer list and all log messages should be printed to stderr.
+ *  Parses the room sensor map and publishes it as the current lookup table.
+ *  Map lines are "room_id sensor_id" or "room_id sensor_id min_temp max_temp".
+ *  Used for the first load as well as for a reload: sensors that are still in the map keep their running window.
+ *  The datamgr thread is never blocked, the replaced table is freed later by datamgr_map_reclaim().
  *  \param fp_sensor_map file pointer to the map file
- *  \param fp_sensor_data file pointer to the binary data file
  *  \return status
  */
-datamgr_status_t datamgr_parse_sensor_files(FILE *fp_sensor_map, dplist_t **data_list);
+datamgr_status_t datamgr_load_sensor_map(FILE *fp_sensor_map);
+
+/**
+ * Gets the current lookup table, only to be called from the datamgr thread.
+ * The first call after a reload applies the map changes to the sensor state (new sensors start empty, thresholds are updated).
+ * The table stays valid until the next call.
+ * \return the current table, NULL if no map is loaded
+ */
+datamgr_map_t *datamgr_map_acquire();
+
+/**
+ * Frees tables replaced by a reload once the datamgr thread moved on to a newer one, called by the loader side
+ */
+void datamgr_map_reclaim();
 
 /**
  * This method should be called to clean up the datamgr, and to free all used memory. 
@@ -79,7 +93,7 @@ uint16_t datamgr_get_room_id(sensor_id_t sensor_id);
  * \param sensor_id the sensor id to look for
  * \return the running AVG of the given sensor
  */
-datamgr_status_t datamgr_get_avg(dplist_t *data_list, sensor_id_t sensor_id, sensor_value_t *av);
+datamgr_status_t datamgr_get_avg(datamgr_map_t *map, sensor_id_t sensor_id, sensor_value_t *av);
 
 /**
  * Returns the time of the last reading for a certain sensor ID
@@ -96,15 +110,83 @@ time_t datamgr_get_last_modified(sensor_id_t sensor_id);
 int datamgr_get_total_sensors();
 
 /*
- * inserts sensor data in sensor_data from data_list, found by sensor_id
- *
+ * gets the thresholds of a sensor, SET_MIN_TEMP/SET_MAX_TEMP unless the map line overrides them
+ */
+datamgr_status_t datamgr_get_thresholds(datamgr_map_t *map, sensor_id_t sensor_id, sensor_value_t *min_temp, sensor_value_t *max_temp);
+
+/*
+ * inserts new received sensor reading from the sbuffer into map
+ * every reading is classified by the anomaly detection of its sensor first (see anomaly.h)
+ * the window holds the newest RUN_AVG_LENGTH readings by event time, out of order readings are sorted in
+ * \param now arrival time in the clock of datamgr_check_liveness(), liveness does not trust the sensor's ts
+ * \param anomaly gets the classification, may be NULL
+ * \return DATAMGR_REJECTED if the value or timestamp is implausible or the reading is late, the reading is then only counted
+ */
+int datamgr_insert_new_sensor_reading(datamgr_map_t *map, sensor_id_t sensor_id, sensor_value_t value, sensor_ts_t ts,
+                                      sensor_ts_t now, anomaly_result_t *anomaly);
+
+/*
+ * gets the number of readings per anomaly class of one sensor
+ */
+datamgr_status_t datamgr_get_anomaly_counts(datamgr_map_t *map, sensor_id_t sensor_id, uint32_t counts[ANOMALY_CLASSES]);
+
+/*
+ * gets the number of readings per anomaly class over all sensors, only to be called from the datamgr thread
+ */
+void datamgr_get_anomaly_totals(uint64_t totals[ANOMALY_CLASSES]);
+
+/*
+ * sets the sink that receives alert transitions, call before the datamgr thread starts
+ */
+void datamgr_set_alert_sink(alert_sink_t sink, void *arg);
+
+/*
+ * runs the alert state machine of a sensor on its current average, transitions go to the alert sink
+ * \param ts time of the reading that was just inserted
+ */
+datamgr_status_t datamgr_update_alert(datamgr_map_t *map, sensor_id_t sensor_id, sensor_ts_t ts);
+
+/*
+ * full scan over the sensor state: thresholds and room averages
+ * room averages are fed to the room alert state machines, using SET_MIN_TEMP/SET_MAX_TEMP
+ * \param now current time
+ */
+datamgr_status_t datamgr_scan(datamgr_map_t *map, sensor_ts_t now, datamgr_scan_t *scan);
+
+/*
+ * expires the liveness timers up to now, meant to be called about once per second
+ * a sensor is stale when no reading came in for DATAMGR_STALE_INTERVALS times its learned reporting interval
+ * (between DATAMGR_STALE_MIN and DATAMGR_STALE_AFTER seconds), measured from the arrival of its last reading
+ * stale and recovered sensors are handed to the alert sink with kind ALERT_STALE
+ * only sensors that expire cost anything, there is no pass over all sensors
+ * \param expired gets the number of timers that fired, including ones that were only pushed out
+ */
+datamgr_status_t datamgr_check_liveness(datamgr_map_t *map, sensor_ts_t now, int *expired);
+
+/*
+ * gets the room average computed by the last datamgr_scan(), NAN if no sensor in the room has a full window
+ * \param room_index 0 up to scan->rooms
+ */
+datamgr_status_t datamgr_get_room_avg(datamgr_map_t *map, int room_index, room_id_t *room_id, sensor_value_t *av);
+
+/*
+ * copies the window, last timestamp and anomaly statistics of every sensor in map into a checkpoint image
+ * only to be called from the datamgr thread, this is a memcpy per sensor and does no I/O
+ * \param image gets a malloc'ed buffer the caller has to free
+ */
+datamgr_status_t datamgr_checkpoint_create(datamgr_map_t *map, sensor_ts_t now, void **image, size_t *size);
+
+/*
+ * writes a checkpoint image to path with a single write, fsync and an atomic rename, can run on any thread
  */
-datamgr_status_t datamgr_get_sensor_data_from_sensorid(dplist_t *data_list, sensor_id_t sensor_id, sensor_data_mgr_t **sensor_data);
+datamgr_status_t datamgr_checkpoint_write(const char *path, void *image, size_t size);
 
 /*
- * inserts new received sensor reading from the sbuffer into data_list
+ * restores the sensors of map from the checkpoint at path (mmap'ed), sensors not in map are skipped
+ * the file is refused if version, layout or checksum do not match or it is older than DATAMGR_CHECKPOINT_MAX_AGE
+ * \param restored gets the number of sensors restored
  */
-int datamgr_insert_new_sensor_reading(dplist_t *data_list, sensor_id_t sensor_id, sensor_value_t value, sensor_ts_t ts);
+datamgr_status_t datamgr_checkpoint_restore(datamgr_map_t *map, const char *path, sensor_ts_t now, int *restored);
 
 
 
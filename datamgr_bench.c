@@ -0,0 +1,153 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+/*
+ * microbenchmark for the datamgr scans, sweeps BENCH_SENSORS sensors with every kernel level the cpu supports
+ * not part of the gateway, build with:
+ * gcc -O2 -DSET_MAX_TEMP=20 -DSET_MIN_TEMP=10 -DDATAMGR_MAX_SENSORS=65536 datamgr_bench.c datamgr.c simd_scan.c alert.c anomaly.c timer_wheel.c -lpthread -lm -o datamgr_bench
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "config.h"
+#include "datamgr.h"
+#include "simd_scan.h"
+
+#ifndef BENCH_SENSORS
+#define BENCH_SENSORS 65536
+#endif
+
+#ifndef BENCH_ROUNDS
+#define BENCH_ROUNDS 200
+#endif
+
+#define SENSORS_PER_ROOM 16
+
+#if DATAMGR_MAX_SENSORS < BENCH_SENSORS
+#error build with -DDATAMGR_MAX_SENSORS=65536 (or more than BENCH_SENSORS)
+#endif
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+static double random_temp() {
+    return SET_MIN_TEMP - 5 + (SET_MAX_TEMP - SET_MIN_TEMP + 10)*(rand()/(double) RAND_MAX);
+}
+
+/*
+ * one bench row: ns per sensor for each kernel and a checksum that has to match between levels
+ */
+static void bench_kernels(int level, sensor_value_t *avg, sensor_value_t *min_temp, sensor_value_t *max_temp,
+                          int32_t *slots, int32_t *room_start, int rooms) {
+    int8_t *flags = malloc(BENCH_SENSORS);
+    sensor_value_t *room_avg = malloc(rooms*sizeof(sensor_value_t));
+    int hot = 0, cold = 0;
+    simd_scan_set_level(level);
+
+    double start = now_ns();
+    for(int r = 0; r < BENCH_ROUNDS; r++) simd_scan_thresholds(avg, min_temp, max_temp, flags, BENCH_SENSORS, &hot, &cold);
+    double thresholds = (now_ns() - start)/BENCH_ROUNDS/BENCH_SENSORS;
+
+    start = now_ns();
+    for(int r = 0; r < BENCH_ROUNDS; r++) simd_scan_room_avg(avg, slots, room_start, rooms, room_avg);
+    double rooms_ns = (now_ns() - start)/BENCH_ROUNDS/BENCH_SENSORS;
+
+    double checksum = 0;
+    for(int i = 0; i < rooms; i++) if(!isnan(room_avg[i])) checksum += room_avg[i];
+    for(int i = 0; i < BENCH_SENSORS; i++) checksum += flags[i]*(i % 7);
+    printf("%-8s thresholds %6.3f ns/sensor  rooms %6.3f ns/sensor  (hot %i, cold %i, checksum %.4f)\n",
+           simd_scan_level_name(level), thresholds, rooms_ns, hot, cold, checksum);
+    free(flags);
+    free(room_avg);
+}
+
+int main() {
+
+    srand(42);
+    //kernels on their own, on arrays laid out the way datamgr stores them
+    int rooms = BENCH_SENSORS/SENSORS_PER_ROOM;
+    sensor_value_t *avg = malloc(BENCH_SENSORS*sizeof(sensor_value_t));
+    sensor_value_t *min_temp = malloc(BENCH_SENSORS*sizeof(sensor_value_t));
+    sensor_value_t *max_temp = malloc(BENCH_SENSORS*sizeof(sensor_value_t));
+    int32_t *slots = malloc(BENCH_SENSORS*sizeof(int32_t));
+    int32_t *room_start = malloc((rooms + 1)*sizeof(int32_t));
+    if(avg == NULL || min_temp == NULL || max_temp == NULL || slots == NULL || room_start == NULL) {
+        printf("out of memory\n");
+        return EXIT_FAILURE;
+    }
+    time_t now = time(NULL);
+    for(int i = 0; i < BENCH_SENSORS; i++) {
+        avg[i] = (i % 10 == 0) ? NAN : random_temp();      //every tenth window not full yet
+        min_temp[i] = SET_MIN_TEMP;
+        max_temp[i] = SET_MAX_TEMP;
+        slots[i] = (int32_t) ((i*7919L) % BENCH_SENSORS); //rooms gather from scattered slots
+    }
+    for(int r = 0; r <= rooms; r++) room_start[r] = r*SENSORS_PER_ROOM;
+
+    printf("kernels over %i sensors in %i rooms, %i rounds\n", BENCH_SENSORS, rooms, BENCH_ROUNDS);
+    int best = simd_scan_init();
+    for(int level = SIMD_SCAN_SCALAR; level <= best; level++) {
+        if(simd_scan_set_level(level) != level) continue;
+        bench_kernels(level, avg, min_temp, max_temp, slots, room_start, rooms);
+    }
+
+    //full datamgr path: load a map, insert readings, scan
+    char *map_text = NULL;
+    size_t map_size = 0;
+    FILE *fp_map = open_memstream(&map_text, &map_size);
+    for(int i = 0; i < BENCH_SENSORS; i++) fprintf(fp_map, "%i %i\n", i/SENSORS_PER_ROOM, i);
+    fclose(fp_map);
+    fp_map = fmemopen(map_text, map_size, "r");
+    double start = now_ns();
+    if(datamgr_load_sensor_map(fp_map) != DATAMGR_OK) {
+        printf("failed to load sensor map\n");
+        return EXIT_FAILURE;
+    }
+    printf("map load: %.2f ms\n", (now_ns() - start)/1e6);
+    fclose(fp_map);
+    free(map_text);
+
+    datamgr_map_t *map = datamgr_map_acquire();
+    long readings = (long) BENCH_SENSORS*RUN_AVG_LENGTH*4;
+    start = now_ns();
+    for(long r = 0; r < readings; r++) {
+        datamgr_insert_new_sensor_reading(map, (sensor_id_t) (r % BENCH_SENSORS), 15.0 + (r % 11), now, now, NULL);
+    }
+    printf("insert: %.2f ns/reading\n", (now_ns() - start)/readings);
+
+    //liveness: one second at a time while every sensor keeps its deadline, then all of them going silent at once
+    int expired, total = 0;
+    start = now_ns();
+    for(int r = 1; r < DATAMGR_STALE_AFTER; r++) {
+        datamgr_check_liveness(map, now + r, &expired);
+        total += expired;
+    }
+    printf("liveness, nothing due: %.1f ns per check (%i expired)\n", (now_ns() - start)/(DATAMGR_STALE_AFTER - 1), total);
+    start = now_ns();
+    datamgr_check_liveness(map, now + DATAMGR_STALE_AFTER + 1, &expired);
+    printf("liveness, all due: %.2f ns/sensor (%i expired)\n", (now_ns() - start)/BENCH_SENSORS, expired);
+
+    for(int level = SIMD_SCAN_SCALAR; level <= best; level++) {
+        if(simd_scan_set_level(level) != level) continue;
+        datamgr_scan_t scan;
+        start = now_ns();
+        for(int r = 0; r < BENCH_ROUNDS; r++) datamgr_scan(map, now, &scan);
+        printf("%-8s datamgr_scan %.3f ms per sweep (hot %i, cold %i, stale %i, rooms %i)\n", simd_scan_level_name(level),
+               (now_ns() - start)/BENCH_ROUNDS/1e6, scan.too_hot, scan.too_cold, scan.stale, scan.rooms);
+    }
+
+    datamgr_free();
+    free(avg);
+    free(min_temp);
+    free(max_temp);
+    free(slots);
+    free(room_start);
+    return 0;
+}
@@ -0,0 +1,41 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#include <string.h>
+#include "histogram.h"
+
+void histogram_reset(histogram_t *histogram) {
+    memset(histogram, 0, sizeof(histogram_t));
+}
+
+int histogram_bucket(uint64_t value) {
+    int bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+    return bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1;
+}
+
+void histogram_add(histogram_t *histogram, uint64_t value) {
+    histogram->buckets[histogram_bucket(value)]++;
+    histogram->count++;
+    histogram->sum += value;
+    if(value > histogram->max) histogram->max = value;
+}
+
+uint64_t histogram_bucket_bound(int bucket) {
+    return bucket == 0 ? 0 : (1ULL << bucket) - 1;
+}
+
+uint64_t histogram_percentile(const histogram_t *histogram, double percentile) {
+    if(histogram->count == 0) return 0;
+    uint64_t rank = (uint64_t) (percentile/100*histogram->count);
+    if(rank >= histogram->count) rank = histogram->count - 1;
+    uint64_t seen = 0;
+    for(int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        seen += histogram->buckets[b];
+        if(seen > rank) {
+            uint64_t bound = histogram_bucket_bound(b);
+            return bound < histogram->max ? bound : histogram->max;
+        }
+    }
+    return histogram->max;
+}
@@ -0,0 +1,46 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+#include <stdint.h>
+
+/*
+ * fixed size histogram with power of two buckets, bucket i counts values in [2^(i-1), 2^i), bucket 0 counts 0
+ * adding is O(1) and never allocates, percentiles are accurate to a factor of two
+ * not thread safe, owners copy it out under their own lock
+ */
+
+#define HISTOGRAM_BUCKETS 48
+
+typedef struct {
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+} histogram_t;
+
+void histogram_reset(histogram_t *histogram);
+
+void histogram_add(histogram_t *histogram, uint64_t value);
+
+/*
+ * upper bound of the bucket holding the given percentile, capped at the largest value seen
+ * \param percentile 0 up to 100
+ * \return 0 for an empty histogram
+ */
+uint64_t histogram_percentile(const histogram_t *histogram, double percentile);
+
+/*
+ * \return the bucket value is counted in
+ */
+int histogram_bucket(uint64_t value);
+
+/*
+ * upper bound of bucket i, the le label of a cumulative bucket
+ */
+uint64_t histogram_bucket_bound(int bucket);
+
+#endif /* _HISTOGRAM_H_ */
@@ -0,0 +1,55 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#include <string.h>
+#include <strings.h>
+#include "log.h"
+
+_Atomic uint8_t log_levels[LOG_THREADS] = {LOG_LEVEL, LOG_LEVEL, LOG_LEVEL, LOG_LEVEL, LOG_LEVEL};
+
+static const char *level_names[] = {"debug", "info", "warn", "error", "off"};
+
+static const char *thread_names[LOG_THREADS] = {
+    [LOG_MAIN] = "main",
+    [LOG_CONNMGR] = "connmgr",
+    [LOG_DATAMGR] = "datamgr",
+    [LOG_STORAGEMGR] = "storagemgr",
+    [LOG_LOGGER] = "log",
+};
+
+void log_level_set(log_thread_t thread, log_level_t level) {
+    if(thread < LOG_THREADS) atomic_store_explicit(&log_levels[thread], (uint8_t) level, memory_order_relaxed);
+}
+
+static int find_name(const char *names[], int count, const char *name, size_t length) {
+    for(int i = 0; i < count; i++) {
+        if(strlen(names[i]) == length && strncasecmp(names[i], name, length) == 0) return i;
+    }
+    return -1;
+}
+
+int log_levels_parse(const char *spec) {
+
+    if(spec == NULL) return 0;
+    const char *part = spec;
+    while(*part != '\0') {
+        size_t length = strcspn(part, ",");
+        const char *equals = memchr(part, '=', length);
+        int thread = -1;
+        const char *level_name = part;
+        if(equals != NULL) {
+            thread = find_name(thread_names, LOG_THREADS, part, (size_t) (equals - part));
+            if(thread < 0) return -1;
+            level_name = equals + 1;
+        }
+        int level = find_name(level_names, LOG_LEVEL_OFF + 1, level_name, length - (size_t) (level_name - part));
+        if(level < 0) return -1;
+        for(int i = 0; i < LOG_THREADS; i++) {
+            if(thread < 0 || thread == i) log_level_set((log_thread_t) i, (log_level_t) level);
+        }
+        part += length;
+        if(*part == ',') part++;
+    }
+    return 0;
+}
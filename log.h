@@ -0,0 +1,66 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#ifndef _LOG_H_
+#define _LOG_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "config.h"
+#include "log_ring.h"
+#include "log_event.h"
+
+/*
+ * leveled logging of the gateway threads into the log ring
+ *
+ * a level below LOG_MIN_LEVEL is compiled out, above it a record is only written if the level is at least the
+ * runtime level of the thread, that test is the only cost of a disabled level, arguments are not even evaluated
+ * runtime levels start at LOG_LEVEL and are set per thread from the LOG_LEVEL_ENV environment variable, either one
+ * level for all threads or a list like "storagemgr=debug,connmgr=warn", or later with log_level_set()
+ *
+ * LOG_SAMPLED() is for events that can come many times a second, only one in every occurrences of that call site
+ * is written and its line says so
+ *
+ * logging never waits for the log process, while it is behind debug and info records are dropped first, warnings
+ * and errors may still take the reserve of the queue, the log process reports how many were dropped
+ */
+
+enum log_level {LOG_LEVEL_DEBUG = 0, LOG_LEVEL_INFO, LOG_LEVEL_WARN, LOG_LEVEL_ERROR, LOG_LEVEL_OFF};
+typedef enum log_level log_level_t;
+
+extern _Atomic uint8_t log_levels[LOG_THREADS];
+
+#define LOG_ENABLED(level, thread) \
+        ((level) >= LOG_MIN_LEVEL && (level) >= atomic_load_explicit(&log_levels[thread], memory_order_relaxed))
+
+#define LOG_RESERVED(level) ((level) >= LOG_LEVEL_WARN)
+
+/*
+ * \param ... number of arguments and the LOG_I()/LOG_F() arguments of event
+ */
+#define LOG_EVENT(ring, level, thread, event, ...)                                                  \
+        do {                                                                                        \
+            if(LOG_ENABLED(level, thread)) {                                                        \
+                log_ring_write(ring, LOG_RESERVED(level), thread, event, __VA_ARGS__);              \
+            }                                                                                       \
+        } while(0)
+
+#define LOG_SAMPLED(ring, level, thread, every, event, ...)                                         \
+        do {                                                                                        \
+            static _Atomic uint32_t log_sample_calls;                                               \
+            if(LOG_ENABLED(level, thread)                                                           \
+               && atomic_fetch_add_explicit(&log_sample_calls, 1, memory_order_relaxed) % (every) == 0) { \
+                log_ring_write_sampled(ring, LOG_RESERVED(level), thread, event, every, __VA_ARGS__); \
+            }                                                                                       \
+        } while(0)
+
+void log_level_set(log_thread_t thread, log_level_t level);
+
+/*
+ * sets the runtime levels from spec as described above, NULL leaves them as they are
+ * \return 0 for success, -1 if a part of spec is not understood, the parts before it are applied
+ */
+int log_levels_parse(const char *spec);
+
+#endif /* _LOG_H_ */
@@ -0,0 +1,150 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+/*
+ * benchmark of the log path, threads log through the shared ring into a forked log process that writes the lines
+ * one fprintf() and fflush() per line like the old log process, or in writev() batches of the log writer, also while
+ * the file is rotated every BENCH_ROTATE_BYTES and compressed in the background
+ * logging does not wait for the log process but drops what it is too slow for, here those lines are written again
+ * not part of the gateway, run it in a scratch directory, build with:
+ * gcc -O2 -DSET_MAX_TEMP=20 -DSET_MIN_TEMP=10 log_bench.c log_ring.c log_event.c log_writer.c log_rotate.c alert.c anomaly.c -lpthread -lz -lm -o log_bench
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/wait.h>
+#include "config.h"
+#include "log_ring.h"
+#include "log_event.h"
+#include "log_writer.h"
+
+#ifndef BENCH_THREADS
+#define BENCH_THREADS 4
+#endif
+
+#ifndef BENCH_LINES
+#define BENCH_LINES 250000 //per thread
+#endif
+
+#ifndef BENCH_ROTATE_BYTES
+#define BENCH_ROTATE_BYTES (1024*1024)
+#endif
+
+#define BENCH_FILE "log_bench.log"
+#define BENCH_ROTATE_KEEP 2
+
+static log_ring_t *ring;
+static _Atomic uint64_t dropped;                //lines written again after the ring dropped them
+
+static int64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+static void *bench_thread(void *arg) {
+    uint64_t retries = 0;
+    for(int i = 0; i < BENCH_LINES; i++) {
+        //the bench measures what the log process keeps up with, so a dropped line is written again
+        while(log_ring_write(ring, 0, LOG_STORAGEMGR, LOG_INSERTED, 1, LOG_I(i)) != 0) {
+            retries++;
+            sched_yield();
+        }
+    }
+    atomic_fetch_add(&dropped, retries);
+    return NULL;
+}
+
+/*
+ * the log process as it was, one line at a time
+ */
+static void consume_lines() {
+    FILE *fp = fopen(BENCH_FILE, "w");
+    if(fp == NULL) exit(EXIT_FAILURE);
+    log_record_t record;
+    char line[LOG_LINE_MAX];
+    int result;
+    while((result = log_ring_read(ring, &record, 1000)) >= 0) {
+        if(result == 0) continue;
+        log_event_format(&record, line, sizeof(line));
+        fprintf(fp, "%llu %lld %s\n", (unsigned long long) record.seq, (long long) (record.ts/1000000000), line);
+        fflush(fp);
+    }
+    fclose(fp);
+    exit(0);
+}
+
+static void consume_batches(log_rotate_t *rotate) {
+    log_writer_t *writer = log_writer_open(BENCH_FILE, LOG_FLUSH_BYTES, LOG_FLUSH_MS);
+    if(writer == NULL) exit(EXIT_FAILURE);
+    log_writer_rotate(writer, rotate);
+    log_record_t records[LOG_READ_BATCH];
+    int count;
+    while((count = log_ring_read_batch(ring, records, LOG_READ_BATCH, log_writer_wait_ms(writer, 1000))) >= 0) {
+        for(int i = 0; i < count; i++) log_writer_add(writer, &records[i]);
+        log_writer_poll(writer);
+    }
+    log_writer_close(writer);
+    log_rotate_stop(rotate);
+    exit(0);
+}
+
+static void consume_unrotated() {
+    consume_batches(NULL);
+}
+
+static void consume_rotated() {
+    log_rotate_t *rotate = log_rotate_start(BENCH_FILE, BENCH_ROTATE_BYTES, 0, BENCH_ROTATE_KEEP);
+    if(rotate == NULL) exit(EXIT_FAILURE);
+    consume_batches(rotate);
+}
+
+/*
+ * deletes the bench file and whatever rotation left of it
+ */
+static void remove_files() {
+    char name[64];
+    unlink(BENCH_FILE);
+    for(int i = 1; i <= 256; i++) {
+        snprintf(name, sizeof(name), BENCH_FILE ".%i", i);
+        unlink(name);
+        snprintf(name, sizeof(name), BENCH_FILE ".%i.gz", i);
+        unlink(name);
+    }
+}
+
+static void bench(const char *label, void (*consume)()) {
+
+    ring = log_ring_create(LOG_RING_WRITERS, LOG_RING_SLOTS, LOG_RING_RESERVE);
+    if(ring == NULL) exit(EXIT_FAILURE);
+    fflush(stdout); //or the consumer prints it again on exit
+    int64_t begin = now_us();
+    pid_t consumer = fork();
+    if(consumer == 0) consume();
+    pthread_t threads[BENCH_THREADS];
+    for(int i = 0; i < BENCH_THREADS; i++) pthread_create(&threads[i], NULL, bench_thread, NULL);
+    for(int i = 0; i < BENCH_THREADS; i++) pthread_join(threads[i], NULL);
+    double produced = (now_us() - begin)/1e6;
+    log_ring_stop(ring);
+    waitpid(consumer, NULL, 0);
+    double seconds = (now_us() - begin)/1e6;
+    double lines = (double) BENCH_THREADS*BENCH_LINES;
+    printf("  %-24s %10.0f lines/s %9llu retries  logging threads done after %.2f s\n", label, lines/seconds,
+           (unsigned long long) atomic_exchange(&dropped, 0), produced);
+    log_ring_destroy(ring);
+    remove_files();
+}
+
+int main() {
+
+    printf("%i threads logging %i lines each\n", BENCH_THREADS, BENCH_LINES);
+    bench("fprintf+fflush a line", consume_lines);
+    bench("writev batches", consume_unrotated);
+    bench("writev batches, rotated", consume_rotated);
+    return 0;
+}
@@ -0,0 +1,194 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "log_event.h"
+#include "alert.h"
+#include "anomaly.h"
+
+/*
+ * an event is either a format of its arguments or a function for the events that need lookups
+ */
+typedef struct {
+    const char *format;
+    int (*format_f)(const log_record_t *record, char *buf, size_t size);
+} log_event_info_t;
+
+static int format_temp_alert(const log_record_t *record, char *buf, size_t size);
+static int format_anomaly(const log_record_t *record, char *buf, size_t size);
+
+static const char *thread_names[LOG_THREADS] = {
+    [LOG_MAIN] = "MAIN",
+    [LOG_CONNMGR] = "CONNMGR_THREAD",
+    [LOG_DATAMGR] = "DATAMGR_THREAD",
+    [LOG_STORAGEMGR] = "STORAGE_THREAD",
+    [LOG_LOGGER] = "LOG_PROCESS",
+};
+
+static const log_event_info_t events[LOG_EVENTS] = {
+    [LOG_RING_READY] = {"log ring is initialized"},
+    [LOG_MEM_FAIL] = {"memory failure, stopping gateway"},
+    [LOG_BUFFER_FAIL] = {"buffer not possible to open"},
+    [LOG_MAP_OPEN_FAIL] = {"sensor map not possible to open"},
+
+    [LOG_NO_CONNECTIONS] = {"exiting connmgr due to no connections..."},
+    [LOG_NODE_CONNECTED] = {"sensor node connected with id %i"},
+    [LOG_NODE_DISCONNECTED] = {"sensor node disconnected with id %i"},
+    [LOG_NODE_REFUSED] = {"sensor node refused, MAX_CONN = %i nodes connected"},
+
+    [LOG_SENSOR_STALE] = {"sensor stale (sensor id = %i, last reading ts = %ld)"},
+    [LOG_SENSOR_RECOVERED] = {"sensor recovered (sensor id = %i, last reading ts = %ld)"},
+    [LOG_TEMP_ALERT] = {NULL, format_temp_alert},
+    [LOG_ANOMALY] = {NULL, format_anomaly},
+    [LOG_CHECKPOINT_FAIL] = {"failed to write checkpoint"},
+    [LOG_WARM_RESTART] = {"warm restart, restored %i sensors from checkpoint"},
+    [LOG_NO_CHECKPOINT] = {"no usable checkpoint, starting with empty windows"},
+    [LOG_MAP_PARSE_FAIL] = {"failed to parse sensor map file"},
+    [LOG_DATAMGR_MEM_FAIL] = {"failure to allocate memory"},
+    [LOG_ANOMALY_TOTALS] = {"anomalies: %lu out of range, %lu bad timestamp, %lu deviation, %lu spike, %lu flatline, "
+                            "%lu late"},
+    [LOG_DATAMGR_EXIT] = {"exiting datamgr.."},
+    [LOG_UNKNOWN_SENSOR] = {"received data with missing sensor_id: %i, please check room sensor map file. "
+                            "Data stored in the database"},
+    [LOG_READING_FAIL] = {"failure to insert datamgr reading"},
+    [LOG_RELOAD_OPEN_FAIL] = {"reload requested but sensor map not possible to open, keeping old map"},
+    [LOG_MAP_RELOADED] = {"sensor map reloaded, %i sensors"},
+    [LOG_RELOAD_FAIL] = {"failed to reload sensor map, keeping old map"},
+
+    [LOG_COMMIT_STATS] = {"%lu commits, rows/commit p50 %lu max %lu, latency p50 %lu p99 %lu us"},
+    [LOG_ROLLUP_STATS] = {"rollups: %lu runs, %lu rows"},
+    [LOG_CHECKPOINT_STATS] = {"WAL checkpoints: %lu runs, %lu pages, %lu busy, longest %lu us"},
+    [LOG_SPOOL_STATS] = {"spool: %lu readings waiting, %lu spooled, %lu replayed, %lu already stored"},
+    [LOG_TRACE_STATS] = {"latency since receive: processed p50 %lu p99 %lu, alerted p50 %lu p99 %lu, committed p50 %lu "
+                         "p99 %lu us"},
+    [LOG_ROLLUP_FAIL] = {"cannot update rollups"},
+    [LOG_EXPIRE_FAIL] = {"cannot drop expired partitions"},
+    [LOG_EXPIRED] = {"%lu expired partitions dropped"},
+    [LOG_INSERTED] = {"%i new readings inserted successfully"},
+    [LOG_SPOOLED] = {"%i new readings spooled until the DB takes them"},
+    [LOG_NOT_STORED] = {"storagemgr lost connection to DB, %i readings not stored"},
+    [LOG_DB_CONNECTED] = {"Connection to DB estabilished successfuly"},
+    [LOG_TABLE_CREATED] = {"new table " TABLE_NAME " created"},
+    [LOG_SHARDS_CREATED] = {"new table " TABLE_NAME " created in %i shards"},
+    [LOG_COLUMNS_CREATED] = {"new column storage in " STORAGE_COLUMN_DIR " created"},
+    [LOG_DB_FAIL] = {"Connection to DB failed"},
+    [LOG_CHECKPOINTER_FAIL] = {"cannot start WAL checkpoint thread, the writer checkpoints itself"},
+    [LOG_SPOOL_OPEN_FAIL] = {"cannot open spool " STORAGE_SPOOL_FILE ", readings are lost while the DB is down"},
+    [LOG_SPOOL_FOUND] = {"spooled readings of an earlier run found, replaying them"},
+    [LOG_DB_GIVE_UP] = {"Connection to DB failed 3 times, stopping gateway.."},
+    [LOG_DB_SPOOLING] = {"Connection to DB failed 3 times, spooling readings to " STORAGE_SPOOL_FILE},
+    [LOG_STORAGEMGR_EXIT] = {"exiting storagemgr"},
+
+    [LOG_RECORDS_DROPPED] = {"log process behind, %lu log records dropped (%lu warnings or errors), %lu in total"},
+};
+
+static int64_t arg_i(const log_record_t *record, int i) {
+    return i < record->nargs ? record->args[i].i : 0;
+}
+
+static double arg_f(const log_record_t *record, int i) {
+    return i < record->nargs ? record->args[i].f : 0;
+}
+
+/*
+ * length actually written by snprintf() into size bytes
+ */
+static size_t written(int result, size_t size) {
+    if(result < 0 || size == 0) return 0;
+    return (size_t) result < size ? (size_t) result : size - 1;
+}
+
+static int format_temp_alert(const log_record_t *record, char *buf, size_t size) {
+    const char *subject = arg_i(record, 2) == ALERT_ROOM ? "room id" : "sensor id";
+    size_t len = written(snprintf(buf, size, "%s temp %s (%s = %i, average temp = %.2f",
+                                  alert_kind_name((alert_kind_t) arg_i(record, 0)),
+                                  alert_state_name((alert_state_t) arg_i(record, 1)), subject, (int) arg_i(record, 3),
+                                  arg_f(record, 4)), size);
+    if(arg_i(record, 5) > 0) {
+        len += written(snprintf(buf + len, size - len, ", %u earlier transitions suppressed",
+                                (unsigned) arg_i(record, 5)), size - len);
+    }
+    len += written(snprintf(buf + len, size - len, ")"), size - len);
+    return (int) len;
+}
+
+static int format_anomaly(const log_record_t *record, char *buf, size_t size) {
+    char classes[96];
+    uint8_t flags = (uint8_t) arg_i(record, 0);
+    anomaly_describe(flags, classes, sizeof(classes));
+    return (int) written(snprintf(buf, size, "anomaly: %s (sensor id = %i, value = %.2f, ts = %ld, z = %.1f)%s",
+                                  classes, (int) arg_i(record, 1), arg_f(record, 2), (long) arg_i(record, 3),
+                                  arg_f(record, 4), (flags & ANOMALY_REJECT) ? ", not used for the average" : ""),
+                         size);
+}
+
+/*
+ * printf of format with the arguments of record, one conversion at a time
+ */
+static int format_args(const char *format, const log_record_t *record, char *buf, size_t size) {
+
+    size_t len = 0;
+    int arg = 0;
+    const char *p = format;
+    while(*p != '\0' && len + 1 < size) {
+        if(*p != '%') {
+            buf[len++] = *p++;
+            continue;
+        }
+        if(p[1] == '%') {
+            buf[len++] = '%';
+            p += 2;
+            continue;
+        }
+        char spec[24];
+        int n = 0;
+        spec[n++] = *p++;
+        while(*p != '\0' && strchr("-+ #0123456789.", *p) != NULL && n < 16) spec[n++] = *p++;
+        while(*p != '\0' && strchr("hlLjzt", *p) != NULL) p++;
+        char conversion = *p;
+        if(conversion != '\0') p++;
+        int result = 0;
+        if(conversion == '\0') {
+            break;
+        } else if(strchr("di", conversion) != NULL) {
+            spec[n++] = 'l';
+            spec[n++] = 'l';
+            spec[n++] = conversion;
+            spec[n] = '\0';
+            result = snprintf(buf + len, size - len, spec, (long long) arg_i(record, arg++));
+        } else if(strchr("uxX", conversion) != NULL) {
+            spec[n++] = 'l';
+            spec[n++] = 'l';
+            spec[n++] = conversion;
+            spec[n] = '\0';
+            result = snprintf(buf + len, size - len, spec, (unsigned long long) arg_i(record, arg++));
+        } else if(strchr("feEgG", conversion) != NULL) {
+            spec[n++] = conversion;
+            spec[n] = '\0';
+            result = snprintf(buf + len, size - len, spec, arg_f(record, arg++));
+        }
+        len += written(result, size - len);
+    }
+    buf[len] = '\0';
+    return (int) len;
+}
+
+int log_event_format(const log_record_t *record, char *buf, size_t size) {
+
+    if(size == 0) return 0;
+    const char *thread = record->thread < LOG_THREADS ? thread_names[record->thread] : "UNKNOWN";
+    size_t len = written(snprintf(buf, size, "%s: ", thread), size);
+    if(record->event >= LOG_EVENTS || (events[record->event].format == NULL && events[record->event].format_f == NULL)) {
+        len += written(snprintf(buf + len, size - len, "unknown event %u", (unsigned) record->event), size - len);
+    } else if(events[record->event].format_f != NULL) {
+        len += events[record->event].format_f(record, buf + len, size - len);
+    } else {
+        len += format_args(events[record->event].format, record, buf + len, size - len);
+    }
+    if(record->sample > 1 && len < size) {
+        len += written(snprintf(buf + len, size - len, " (1 in %u logged)", (unsigned) record->sample), size - len);
+    }
+    return (int) len;
+}
@@ -0,0 +1,83 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#ifndef _LOG_EVENT_H_
+#define _LOG_EVENT_H_
+
+#include <stddef.h>
+#include "log_ring.h"
+
+/*
+ * the events of the gateway log, a record only carries the event id and its arguments, the log process turns it
+ * into text with the format of the event, %d %i %u %x take an integer argument, %f %e %g a floating point one
+ * (length modifiers are ignored), in the order of the format
+ */
+
+enum log_thread {LOG_MAIN = 0, LOG_CONNMGR, LOG_DATAMGR, LOG_STORAGEMGR, LOG_LOGGER, LOG_THREADS};
+typedef enum log_thread log_thread_t;
+
+enum log_event {
+    //main
+    LOG_RING_READY = 0,
+    LOG_MEM_FAIL,
+    LOG_BUFFER_FAIL,
+    LOG_MAP_OPEN_FAIL,
+    //connmgr
+    LOG_NO_CONNECTIONS,
+    LOG_NODE_CONNECTED,             /** < sensor id */
+    LOG_NODE_DISCONNECTED,          /** < sensor id */
+    LOG_NODE_REFUSED,               /** < MAX_CONN */
+    //datamgr
+    LOG_SENSOR_STALE,               /** < sensor id, last reading ts */
+    LOG_SENSOR_RECOVERED,           /** < sensor id, last reading ts */
+    LOG_TEMP_ALERT,                 /** < kind, state, subject, id, average, suppressed */
+    LOG_ANOMALY,                    /** < anomaly flags, sensor id, value, ts, z-score */
+    LOG_CHECKPOINT_FAIL,
+    LOG_WARM_RESTART,               /** < sensors restored */
+    LOG_NO_CHECKPOINT,
+    LOG_MAP_PARSE_FAIL,
+    LOG_DATAMGR_MEM_FAIL,
+    LOG_ANOMALY_TOTALS,             /** < count per anomaly class */
+    LOG_DATAMGR_EXIT,
+    LOG_UNKNOWN_SENSOR,             /** < sensor id */
+    LOG_READING_FAIL,
+    LOG_RELOAD_OPEN_FAIL,
+    LOG_MAP_RELOADED,               /** < sensors */
+    LOG_RELOAD_FAIL,
+    //storagemgr
+    LOG_COMMIT_STATS,               /** < commits, rows/commit p50 and max, latency p50 and p99 */
+    LOG_ROLLUP_STATS,               /** < runs, rows */
+    LOG_CHECKPOINT_STATS,           /** < runs, pages, busy, longest */
+    LOG_SPOOL_STATS,                /** < pending, spooled, replayed, skipped */
+    LOG_TRACE_STATS,                /** < p50 and p99 in us of processed, alerted and committed */
+    LOG_ROLLUP_FAIL,
+    LOG_EXPIRE_FAIL,
+    LOG_EXPIRED,                    /** < partitions dropped */
+    LOG_INSERTED,                   /** < readings */
+    LOG_SPOOLED,                    /** < readings */
+    LOG_NOT_STORED,                 /** < readings */
+    LOG_DB_CONNECTED,
+    LOG_TABLE_CREATED,
+    LOG_SHARDS_CREATED,             /** < shards */
+    LOG_COLUMNS_CREATED,
+    LOG_DB_FAIL,
+    LOG_CHECKPOINTER_FAIL,
+    LOG_SPOOL_OPEN_FAIL,
+    LOG_SPOOL_FOUND,
+    LOG_DB_GIVE_UP,
+    LOG_DB_SPOOLING,
+    LOG_STORAGEMGR_EXIT,
+    //log process
+    LOG_RECORDS_DROPPED,            /** < dropped since the last report, of which reserved, dropped in total */
+    LOG_EVENTS
+};
+typedef enum log_event log_event_t;
+
+/*
+ * the log line of record, thread prefix and message, without sequence number and time
+ * \return the length of the line, truncated to size - 1
+ */
+int log_event_format(const log_record_t *record, char *buf, size_t size);
+
+#endif /* _LOG_EVENT_H_ */
@@ -0,0 +1,267 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include "log_ring.h"
+
+#define LOG_RING_GAP_SPINS 64               //yields the log process waits for a sequence number taken but not published
+#define LOG_RING_IDLE_SPINS 16              //yields before the log process sleeps, a burst rarely needs a wake up
+
+/*
+ * one writer, one reader queue, head only written by the thread owning the queue, tail only by the log process
+ */
+typedef struct {
+    _Atomic uint64_t head;                  //records published
+    uint64_t seen_tail;                     //tail as the writer saw it last, it only loads tail when that looks full
+    _Atomic uint64_t dropped;               //records that did not fit, kept over owners of the queue
+    _Atomic uint64_t dropped_reserved;
+    _Atomic int owner;                      //non-zero while a thread writes to this queue
+    char pad1[28];
+    _Atomic uint64_t tail;                  //records read
+    uint64_t seen_head;                     //head as the log process saw it last
+    char pad2[48];
+} log_queue_t;
+
+struct log_ring {
+    _Atomic uint64_t seq;                   //last sequence number handed out
+    char pad[56];
+    _Atomic int sleeping;                   //the log process waits on wake
+    _Atomic int stopped;
+    sem_t wake;
+    uint64_t next;                          //next sequence number to read, only used by the log process
+    uint64_t mask;
+    uint64_t limit;                         //records in a queue that is full for records not reserved
+    int queues;
+    size_t map_size;
+    log_queue_t *queue;                     //queues in this mapping, queue 0 is shared by threads without one
+    log_record_t *slots;                    //mask + 1 per queue
+};
+
+/*
+ * the queue of the calling thread, given back by the key destructor when the thread exits
+ */
+static __thread log_ring_t *thread_ring = NULL;
+static __thread log_queue_t *thread_queue = NULL;
+static pthread_key_t queue_key;
+static pthread_once_t queue_key_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t shared_lock = PTHREAD_MUTEX_INITIALIZER;   //writers of queue 0
+
+static void queue_release(void *queue) {
+    if(queue != NULL) atomic_store(&(((log_queue_t *) queue)->owner), 0);
+}
+
+static void queue_key_create() {
+    pthread_key_create(&queue_key, queue_release);
+}
+
+log_ring_t *log_ring_create(int writers, int slots, int reserve) {
+
+    uint64_t count = 1;
+    while(count < (uint64_t) slots) count <<= 1;
+    int queues = (writers > 0 ? writers : 1) + 1;
+    size_t size = sizeof(log_ring_t) + queues*sizeof(log_queue_t) + queues*count*sizeof(log_record_t);
+    log_ring_t *ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(ring == MAP_FAILED) {
+        DEBUG_PRINTF("cannot map a log ring of %lu bytes", (unsigned long) size);
+        return NULL;
+    }
+    //a fresh anonymous mapping is zeroed, the pointers stay valid in the log process as it is forked after this
+    ring->next = 1;
+    ring->mask = count - 1;
+    ring->limit = count - (reserve > 0 ? ((uint64_t) reserve < count/2 ? (uint64_t) reserve : count/2) : 0);
+    ring->queues = queues;
+    ring->map_size = size;
+    ring->queue = (log_queue_t *) (ring + 1);
+    ring->slots = (log_record_t *) (ring->queue + queues);
+    if(sem_init(&(ring->wake), 1, 0) != 0) {
+        munmap(ring, size);
+        return NULL;
+    }
+    pthread_once(&queue_key_once, queue_key_create);
+    return ring;
+}
+
+void log_ring_destroy(log_ring_t *ring) {
+    if(ring == NULL) return;
+    if(thread_ring == ring) {
+        queue_release(thread_queue);
+        pthread_setspecific(queue_key, NULL);
+        thread_ring = NULL;
+        thread_queue = NULL;
+    }
+    sem_destroy(&(ring->wake));
+    munmap(ring, ring->map_size);
+}
+
+/*
+ * takes a free queue for the calling thread, NULL if every queue is taken
+ */
+static log_queue_t *queue_take(log_ring_t *ring) {
+    if(thread_ring == ring) return thread_queue;
+    queue_release(thread_queue);
+    thread_ring = ring;
+    thread_queue = NULL;
+    for(int i = 1; i < ring->queues && thread_queue == NULL; i++) {
+        int free = 0;
+        if(atomic_compare_exchange_strong(&(ring->queue[i].owner), &free, 1)) thread_queue = &(ring->queue[i]);
+    }
+    pthread_setspecific(queue_key, thread_queue);
+    return thread_queue;
+}
+
+static int ring_put(log_ring_t *ring, int reserved, int thread, int event, int sample, int nargs, va_list args) {
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    log_queue_t *queue = queue_take(ring);
+    if(queue == NULL) {
+        queue = &(ring->queue[0]);
+        pthread_mutex_lock(&shared_lock);
+    }
+    uint64_t head = atomic_load_explicit(&(queue->head), memory_order_relaxed);
+    uint64_t limit = reserved ? ring->mask + 1 : ring->limit;
+    if(head - queue->seen_tail >= limit) {
+        queue->seen_tail = atomic_load_explicit(&(queue->tail), memory_order_acquire);
+        if(head - queue->seen_tail >= limit) {
+            //the log process is behind, waiting for it would hold up the readings
+            atomic_fetch_add_explicit(&(queue->dropped), 1, memory_order_relaxed);
+            if(reserved) atomic_fetch_add_explicit(&(queue->dropped_reserved), 1, memory_order_relaxed);
+            if(queue == &(ring->queue[0])) pthread_mutex_unlock(&shared_lock);
+            if(atomic_load(&(ring->sleeping))) sem_post(&(ring->wake));
+            return -1;
+        }
+    }
+    log_record_t *record = &(ring->slots[(uint64_t) (queue - ring->queue)*(ring->mask + 1) + (head & ring->mask)]);
+    record->ts = (int64_t) now.tv_sec*1000000000 + now.tv_nsec;
+    record->event = (uint16_t) event;
+    record->thread = (uint8_t) thread;
+    record->nargs = nargs < LOG_RECORD_ARGS ? (uint8_t) nargs : LOG_RECORD_ARGS;
+    record->sample = sample < UINT16_MAX ? (uint16_t) sample : UINT16_MAX;
+    for(int i = 0; i < nargs; i++) {
+        log_arg_t arg = va_arg(args, log_arg_t);
+        if(i < LOG_RECORD_ARGS) record->args[i] = arg;
+    }
+    //taken right before publishing, so the log process hardly ever waits for a sequence number still being written
+    record->seq = atomic_fetch_add(&(ring->seq), 1) + 1;
+    atomic_store(&(queue->head), head + 1);
+    if(queue == &(ring->queue[0])) pthread_mutex_unlock(&shared_lock);
+    if(atomic_load(&(ring->sleeping))) sem_post(&(ring->wake));
+    return 0;
+}
+
+int log_ring_write(log_ring_t *ring, int reserved, int thread, int event, int nargs, ...) {
+    va_list args;
+    va_start(args, nargs);
+    int result = ring_put(ring, reserved, thread, event, 0, nargs, args);
+    va_end(args);
+    return result;
+}
+
+int log_ring_write_sampled(log_ring_t *ring, int reserved, int thread, int event, int sample, int nargs, ...) {
+    va_list args;
+    va_start(args, nargs);
+    int result = ring_put(ring, reserved, thread, event, sample, nargs, args);
+    va_end(args);
+    return result;
+}
+
+void log_ring_dropped(log_ring_t *ring, uint64_t *dropped, uint64_t *reserved) {
+    *dropped = 0;
+    *reserved = 0;
+    for(int i = 0; i < ring->queues; i++) {
+        *dropped += atomic_load_explicit(&(ring->queue[i].dropped), memory_order_relaxed);
+        *reserved += atomic_load_explicit(&(ring->queue[i].dropped_reserved), memory_order_relaxed);
+    }
+}
+
+/*
+ * the queue whose oldest record has the lowest sequence number, NULL if all queues are empty
+ */
+static log_queue_t *oldest(log_ring_t *ring, log_record_t **record) {
+    log_queue_t *best = NULL;
+    *record = NULL;
+    for(int i = 0; i < ring->queues; i++) {
+        log_queue_t *queue = &(ring->queue[i]);
+        uint64_t tail = atomic_load_explicit(&(queue->tail), memory_order_relaxed);
+        if(queue->seen_head == tail && (queue->seen_head = atomic_load(&(queue->head))) == tail) continue;
+        log_record_t *first = &(ring->slots[(uint64_t) i*(ring->mask + 1) + (tail & ring->mask)]);
+        if(best == NULL || first->seq < (*record)->seq) {
+            best = queue;
+            *record = first;
+        }
+    }
+    return best;
+}
+
+/*
+ * takes the oldest record without waiting for one
+ * \return 1 if record was filled in, 0 if every queue is empty
+ */
+static int take(log_ring_t *ring, log_record_t *record) {
+    log_record_t *first;
+    log_queue_t *queue = oldest(ring, &first);
+    if(queue == NULL) return 0;
+    //an older sequence number is taken but its writer did not publish yet, give it a moment to keep the order
+    for(int spin = 0; first->seq > ring->next && spin < LOG_RING_GAP_SPINS; spin++) {
+        sched_yield();
+        queue = oldest(ring, &first);
+    }
+    *record = *first;
+    uint64_t tail = atomic_load_explicit(&(queue->tail), memory_order_relaxed);
+    atomic_store_explicit(&(queue->tail), tail + 1, memory_order_release);
+    if(record->seq >= ring->next) ring->next = record->seq + 1;
+    return 1;
+}
+
+int log_ring_read(log_ring_t *ring, log_record_t *record, int timeout_ms) {
+
+    //writers are done before the ring is stopped, so once stopped empty queues stay empty
+    int stopped = atomic_load(&(ring->stopped));
+    if(take(ring, record)) return 1;
+    for(int spin = 0; !stopped && spin < LOG_RING_IDLE_SPINS; spin++) {
+        sched_yield();
+        if(take(ring, record)) return 1;
+    }
+    if(stopped) return -1;
+    //sleeping is set before the queues are checked again, a writer publishing in between sees it and posts
+    atomic_store(&(ring->sleeping), 1);
+    int found = take(ring, record);
+    if(!found && !atomic_load(&(ring->stopped))) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms/1000;
+        deadline.tv_nsec += (long) (timeout_ms % 1000)*1000000;
+        if(deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        sem_timedwait(&(ring->wake), &deadline);
+        found = take(ring, record);
+    }
+    atomic_store(&(ring->sleeping), 0);
+    return found;
+}
+
+int log_ring_read_batch(log_ring_t *ring, log_record_t *records, int max, int timeout_ms) {
+
+    if(max <= 0) return 0;
+    int count = log_ring_read(ring, records, timeout_ms);
+    if(count <= 0) return count;
+    while(count < max && take(ring, records + count)) count++;
+    return count;
+}
+
+void log_ring_stop(log_ring_t *ring) {
+    atomic_store(&(ring->stopped), 1);
+    sem_post(&(ring->wake));
+}
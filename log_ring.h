@@ -0,0 +1,98 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#ifndef _LOG_RING_H_
+#define _LOG_RING_H_
+
+#include <stdint.h>
+#include "config.h"
+
+/*
+ * log records from the gateway threads to the log process
+ *
+ * a ring of fixed size binary records in shared memory (MAP_SHARED), created before fork() so both processes see it
+ * a record is an event id, the thread that logged it, a timestamp and a few numeric arguments, the text is only
+ * made by the log process (see log_event.h), so logging is a copy into a slot and never allocates
+ *
+ * every writing thread gets a queue of its own on its first record and gives it back when it exits, so writers
+ * never wait for each other, threads beyond the number of queues share one queue under a lock
+ * a record gets its sequence number from one atomic add, the log process merges the queues by sequence number
+ * writing never waits for the log process, a record that does not fit in its queue is dropped and counted, the last
+ * reserve slots of a queue only take records written as reserved, so those are still kept while the log process is
+ * behind and a flood of other records fills the queues
+ */
+
+#define LOG_RECORD_ARGS 6
+
+typedef union {
+    int64_t i;
+    double f;
+} log_arg_t;
+
+#define LOG_I(x) ((log_arg_t) {.i = (int64_t) (x)})
+#define LOG_F(x) ((log_arg_t) {.f = (double) (x)})
+
+typedef struct {
+    uint64_t seq;                       /** < the sequence number in the log, from 1 */
+    int64_t ts;                         /** < CLOCK_REALTIME in ns */
+    uint16_t event;
+    uint8_t thread;
+    uint8_t nargs;
+    uint16_t sample;                    /** < logged once every sample times, 0 or 1 if not sampled */
+    uint16_t reserved;
+    log_arg_t args[LOG_RECORD_ARGS];
+} log_record_t;
+
+typedef struct log_ring log_ring_t;
+
+/*
+ * maps a ring with a queue of slots records for each of writers threads, slots is rounded up to a power of two
+ * \param reserve slots of each queue for reserved records, at most half of them
+ * \return the ring, NULL if it cannot be mapped
+ */
+log_ring_t *log_ring_create(int writers, int slots, int reserve);
+
+/*
+ * unmaps the ring in the calling process
+ */
+void log_ring_destroy(log_ring_t *ring);
+
+/*
+ * writes a record or drops it if the queue of the calling thread is full
+ * \param reserved non-zero if the record may take the reserve slots
+ * \param nargs number of log_arg_t arguments that follow, at most LOG_RECORD_ARGS are kept
+ * \return 0 if the record was written, -1 if it was dropped
+ */
+int log_ring_write(log_ring_t *ring, int reserved, int thread, int event, int nargs, ...);
+
+/*
+ * log_ring_write() of a record that stands for sample occurrences of the event
+ */
+int log_ring_write_sampled(log_ring_t *ring, int reserved, int thread, int event, int sample, int nargs, ...);
+
+/*
+ * \param dropped set to the records dropped since the ring was created
+ * \param reserved set to how many of them were reserved records
+ */
+void log_ring_dropped(log_ring_t *ring, uint64_t *dropped, uint64_t *reserved);
+
+/*
+ * takes the next record, for the log process only
+ * \param timeout_ms longest wait for a record
+ * \return 1 if record was filled in, 0 on timeout, -1 once the ring is stopped and every record was read
+ */
+int log_ring_read(log_ring_t *ring, log_record_t *record, int timeout_ms);
+
+/*
+ * takes up to max records, waits like log_ring_read() for the first one only
+ * \return the number of records filled in, 0 on timeout, -1 once the ring is stopped and every record was read
+ */
+int log_ring_read_batch(log_ring_t *ring, log_record_t *records, int max, int timeout_ms);
+
+/*
+ * no more records follow, log_ring_read() returns -1 once it read the rest
+ */
+void log_ring_stop(log_ring_t *ring);
+
+#endif /* _LOG_RING_H_ */
@@ -0,0 +1,237 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "config.h"
+#include "log_rotate.h"
+
+#define LOG_ROTATE_CHUNK 65536              //bytes read and compressed at a time
+
+struct log_rotate {
+    char path[PATH_MAX];
+    char dir[PATH_MAX];
+    const char *base;                       //file name part of path
+    size_t max_bytes;
+    int max_seconds;
+    int keep;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    //rotated files are numbered oldest to next - 1, all below compressed are compressed or deleted
+    uint64_t oldest;
+    uint64_t compressed;
+    uint64_t next;
+    _Atomic int stop;
+};
+
+static void rotated_name(log_rotate_t *rotate, uint64_t n, const char *suffix, char *name, size_t size) {
+    snprintf(name, size, "%s.%llu%s", rotate->path, (unsigned long long) n, suffix);
+}
+
+/*
+ * \return the number of a rotated file name of base, path.N or path.N.gz, 0 for any other name
+ */
+static uint64_t rotated_number(const char *base, const char *name) {
+
+    size_t length = strlen(base);
+    if(strncmp(name, base, length) != 0 || name[length] != '.') return 0;
+    const char *digits = name + length + 1;
+    char *end;
+    if(*digits < '0' || *digits > '9') return 0;
+    unsigned long long n = strtoull(digits, &end, 10);
+    if(*end != '\0' && strcmp(end, ".gz") != 0) return 0;
+    return (uint64_t) n;
+}
+
+/*
+ * finds the rotated files of an earlier run, numbering carries on after the newest
+ */
+static void scan_rotated(log_rotate_t *rotate) {
+
+    uint64_t lowest = 0, highest = 0;
+    DIR *dir = opendir(rotate->dir);
+    if(dir != NULL) {
+        struct dirent *entry;
+        while((entry = readdir(dir)) != NULL) {
+            uint64_t n = rotated_number(rotate->base, entry->d_name);
+            if(n == 0) continue;
+            if(lowest == 0 || n < lowest) lowest = n;
+            if(n > highest) highest = n;
+        }
+        closedir(dir);
+    }
+    rotate->oldest = lowest > 0 ? lowest : 1;
+    rotate->compressed = rotate->oldest;
+    rotate->next = highest + 1;
+}
+
+/*
+ * compresses path.n into path.n.gz, through a temporary file so a half written .gz is never left under its name
+ */
+static void compress_rotated(log_rotate_t *rotate, uint64_t n) {
+
+    char plain[PATH_MAX + 32], gz[PATH_MAX + 32], tmp[PATH_MAX + 32];
+    rotated_name(rotate, n, "", plain, sizeof(plain));
+    rotated_name(rotate, n, ".gz", gz, sizeof(gz));
+    rotated_name(rotate, n, ".gz.tmp", tmp, sizeof(tmp));
+    int fd = open(plain, O_RDONLY);
+    if(fd < 0) return; //already compressed or deleted
+    char mode[8];
+    snprintf(mode, sizeof(mode), "wb%i", LOG_COMPRESS_LEVEL);
+    gzFile out = gzopen(tmp, mode);
+    if(out == NULL) {
+        DEBUG_PRINTF("cannot open %s", tmp);
+        close(fd);
+        return;
+    }
+    char chunk[LOG_ROTATE_CHUNK];
+    ssize_t length;
+    int failed = 0;
+    while(!atomic_load(&rotate->stop) && (length = read(fd, chunk, sizeof(chunk))) != 0) {
+        if(length < 0) {
+            if(errno == EINTR) continue;
+            failed = 1;
+            break;
+        }
+        if(gzwrite(out, chunk, (unsigned) length) != (int) length) {
+            failed = 1;
+            break;
+        }
+    }
+    close(fd);
+    if(gzclose(out) != Z_OK || failed || atomic_load(&rotate->stop) || rename(tmp, gz) != 0) {
+        DEBUG_PRINTF("%s not compressed", plain);
+        unlink(tmp);
+        return;
+    }
+    unlink(plain);
+}
+
+static void *compress_thread(void *arg) {
+
+    log_rotate_t *rotate = (log_rotate_t *) arg;
+    //compression only gets the CPU the gateway leaves over
+    struct sched_param param = {.sched_priority = 0};
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+    pthread_mutex_lock(&rotate->lock);
+    while(!atomic_load(&rotate->stop)) {
+        uint64_t expired = rotate->oldest;
+        while(rotate->next - rotate->oldest > (uint64_t) rotate->keep) rotate->oldest++;
+        if(rotate->compressed < rotate->oldest) rotate->compressed = rotate->oldest;
+        uint64_t oldest = rotate->oldest;
+        if(expired == oldest && rotate->compressed == rotate->next) {
+            pthread_cond_wait(&rotate->cond, &rotate->lock);
+            continue;
+        }
+        uint64_t n = rotate->compressed;
+        uint64_t next = rotate->next;
+        pthread_mutex_unlock(&rotate->lock);
+        char name[PATH_MAX + 32];
+        for(; expired < oldest; expired++) {
+            rotated_name(rotate, expired, ".gz", name, sizeof(name));
+            unlink(name);
+            rotated_name(rotate, expired, "", name, sizeof(name));
+            unlink(name);
+        }
+        if(n < next) compress_rotated(rotate, n);
+        pthread_mutex_lock(&rotate->lock);
+        if(n < next && rotate->compressed == n) rotate->compressed = n + 1;
+    }
+    pthread_mutex_unlock(&rotate->lock);
+    return NULL;
+}
+
+log_rotate_t *log_rotate_start(const char *path, size_t max_bytes, int max_seconds, int keep) {
+
+    log_rotate_t *rotate = calloc(1, sizeof(log_rotate_t));
+    if(rotate == NULL || strlen(path) >= sizeof(rotate->path)) {
+        free(rotate);
+        return NULL;
+    }
+    strcpy(rotate->path, path);
+    const char *slash = strrchr(rotate->path, '/');
+    if(slash == NULL) {
+        strcpy(rotate->dir, ".");
+        rotate->base = rotate->path;
+    } else {
+        size_t length = slash == rotate->path ? 1 : (size_t) (slash - rotate->path);
+        memcpy(rotate->dir, rotate->path, length);
+        rotate->dir[length] = '\0';
+        rotate->base = slash + 1;
+    }
+    rotate->max_bytes = max_bytes > 0 ? max_bytes : 1;
+    rotate->max_seconds = max_seconds > 0 ? max_seconds : 0;
+    rotate->keep = keep > 0 ? keep : 0;
+    scan_rotated(rotate);
+    //the log of the last run is kept instead of truncated
+    struct stat st;
+    char name[PATH_MAX + 32];
+    if(stat(rotate->path, &st) == 0 && st.st_size > 0) {
+        rotated_name(rotate, rotate->next, "", name, sizeof(name));
+        if(rename(rotate->path, name) == 0) rotate->next++;
+    }
+    pthread_mutex_init(&rotate->lock, NULL);
+    pthread_cond_init(&rotate->cond, NULL);
+    if(pthread_create(&rotate->thread, NULL, compress_thread, rotate) != 0) {
+        DEBUG_PRINTF("cannot start log compression thread");
+        pthread_mutex_destroy(&rotate->lock);
+        pthread_cond_destroy(&rotate->cond);
+        free(rotate);
+        return NULL;
+    }
+    return rotate;
+}
+
+void log_rotate_stop(log_rotate_t *rotate) {
+
+    if(rotate == NULL) return;
+    pthread_mutex_lock(&rotate->lock);
+    atomic_store(&rotate->stop, 1);
+    pthread_cond_signal(&rotate->cond);
+    pthread_mutex_unlock(&rotate->lock);
+    pthread_join(rotate->thread, NULL);
+    pthread_mutex_destroy(&rotate->lock);
+    pthread_cond_destroy(&rotate->cond);
+    free(rotate);
+}
+
+int log_rotate_due(log_rotate_t *rotate, size_t file_bytes, int64_t age_ms) {
+    if(file_bytes == 0) return 0;
+    return file_bytes >= rotate->max_bytes || (rotate->max_seconds > 0 && age_ms >= (int64_t) rotate->max_seconds*1000);
+}
+
+int log_rotate_next(log_rotate_t *rotate, int fd) {
+
+    //only this thread changes next, it is read without the lock
+    char name[PATH_MAX + 32];
+    rotated_name(rotate, rotate->next, "", name, sizeof(name));
+    if(rename(rotate->path, name) != 0) {
+        DEBUG_PRINTF("cannot rotate %s", rotate->path);
+        return fd;
+    }
+    int new_fd = open(rotate->path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(new_fd < 0) {
+        DEBUG_PRINTF("cannot open %s after rotation", rotate->path);
+        rename(name, rotate->path);
+        return fd;
+    }
+    close(fd);
+    pthread_mutex_lock(&rotate->lock);
+    rotate->next++;
+    pthread_cond_signal(&rotate->cond);
+    pthread_mutex_unlock(&rotate->lock);
+    return new_fd;
+}
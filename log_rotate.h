@@ -0,0 +1,52 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#ifndef _LOG_ROTATE_H_
+#define _LOG_ROTATE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * rotation of the log file of the log process
+ *
+ * once the file holds max_bytes or was opened max_seconds ago it is renamed to path.N, N counting up over runs, and
+ * a new file is opened at path, that is a rename() and an open() on the path of the log writer, nothing more
+ * a background thread compresses path.N into path.N.gz with zlib and deletes rotated files so only the newest keep
+ * stay, the log lines on disk are bounded by max_bytes plus keep compressed files
+ * a file left uncompressed by an earlier run is compressed after start, one being compressed when the log process
+ * stops is finished by the next run
+ *
+ * used by the log process only
+ */
+
+typedef struct log_rotate log_rotate_t;
+
+/*
+ * rotates a non-empty file left at path by an earlier run, so its lines are kept, and starts the compression thread
+ * \param max_seconds 0 rotates by size only
+ * \return the rotation, NULL if the thread cannot be started, then the log file grows without bound
+ */
+log_rotate_t *log_rotate_start(const char *path, size_t max_bytes, int max_seconds, int keep);
+
+/*
+ * stops the compression thread, a file it is compressing is left for the next run
+ */
+void log_rotate_stop(log_rotate_t *rotate);
+
+/*
+ * \param file_bytes bytes written to the current file
+ * \param age_ms since the current file was opened
+ * \return non-zero if the current file is due for rotation
+ */
+int log_rotate_due(log_rotate_t *rotate, size_t file_bytes, int64_t age_ms);
+
+/*
+ * closes fd, the file at path, renames it for compression and opens a new file at path
+ * \return the fd of the new file, fd itself if the file cannot be renamed or the new one not opened, then the lines
+ * carry on into the old file
+ */
+int log_rotate_next(log_rotate_t *rotate, int fd);
+
+#endif /* _LOG_ROTATE_H_ */
@@ -0,0 +1,154 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include "log_writer.h"
+#include "log_event.h"
+
+#define LOG_WRITER_SEGMENT 8192             //bytes per iovec of a batch
+#define LOG_WRITER_LINE_ROOM (LOG_LINE_MAX + 48)   //a line with sequence number and time always fits in this
+
+struct log_writer {
+    int fd;
+    char *buffer;                           //segments*LOG_WRITER_SEGMENT bytes
+    struct iovec *iov;                      //one per segment, iov_len is what the segment holds
+    int segments;
+    int used;                               //segments holding lines, the last one is being filled
+    size_t buffered;
+    uint64_t buffered_lines;
+    size_t flush_bytes;
+    int flush_ms;
+    int64_t oldest_ms;                      //when the oldest buffered line was added
+    log_rotate_t *rotate;                   //NULL if the file is not rotated
+    size_t file_bytes;                      //written to the current file
+    int64_t opened_ms;
+};
+
+static int64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+log_writer_t *log_writer_open(const char *path, int flush_bytes, int flush_ms) {
+
+    log_writer_t *writer = calloc(1, sizeof(log_writer_t));
+    if(writer == NULL) return NULL;
+    writer->flush_bytes = flush_bytes > 0 ? (size_t) flush_bytes : 1;
+    writer->flush_ms = flush_ms > 0 ? flush_ms : 0;
+    //a full batch never has to wait for a segment, and writev() takes them all at once
+    writer->segments = (int) (writer->flush_bytes/(LOG_WRITER_SEGMENT - LOG_WRITER_LINE_ROOM)) + 2;
+    if(writer->segments > IOV_MAX) writer->segments = IOV_MAX;
+    writer->buffer = malloc((size_t) writer->segments*LOG_WRITER_SEGMENT);
+    writer->iov = malloc(writer->segments*sizeof(struct iovec));
+    writer->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(writer->buffer == NULL || writer->iov == NULL || writer->fd < 0) {
+        DEBUG_PRINTF("cannot open log file %s", path);
+        if(writer->fd >= 0) close(writer->fd);
+        free(writer->buffer);
+        free(writer->iov);
+        free(writer);
+        return NULL;
+    }
+    struct stat st;
+    if(fstat(writer->fd, &st) == 0) writer->file_bytes = (size_t) st.st_size;
+    writer->opened_ms = now_ms();
+    return writer;
+}
+
+void log_writer_rotate(log_writer_t *writer, log_rotate_t *rotate) {
+    if(writer != NULL) writer->rotate = rotate;
+}
+
+void log_writer_close(log_writer_t *writer) {
+    if(writer == NULL) return;
+    log_writer_flush(writer);
+    close(writer->fd);
+    free(writer->buffer);
+    free(writer->iov);
+    free(writer);
+}
+
+int log_writer_flush(log_writer_t *writer) {
+
+    if(writer->used == 0) return 0;
+    int result = 0;
+    int i = 0;
+    while(i < writer->used) {
+        ssize_t written = writev(writer->fd, writer->iov + i, writer->used - i);
+        if(written < 0) {
+            if(errno == EINTR) continue;
+            DEBUG_PRINTF("cannot write %lu log lines", (unsigned long) writer->buffered_lines);
+            result = -1;
+            break;
+        }
+        writer->file_bytes += (size_t) written;
+        //a short write continues where it stopped
+        while(i < writer->used && (size_t) written >= writer->iov[i].iov_len) {
+            written -= (ssize_t) writer->iov[i].iov_len;
+            i++;
+        }
+        if(i < writer->used) {
+            writer->iov[i].iov_base = (char *) writer->iov[i].iov_base + written;
+            writer->iov[i].iov_len -= (size_t) written;
+        }
+    }
+    writer->used = 0;
+    writer->buffered = 0;
+    writer->buffered_lines = 0;
+    //a rotation only happens between batches, so no line is ever split over two files
+    if(writer->rotate != NULL && log_rotate_due(writer->rotate, writer->file_bytes, now_ms() - writer->opened_ms)) {
+        int fd = log_rotate_next(writer->rotate, writer->fd);
+        if(fd != writer->fd) {
+            writer->fd = fd;
+            writer->file_bytes = 0;
+            writer->opened_ms = now_ms();
+        }
+    }
+    return result;
+}
+
+void log_writer_add(log_writer_t *writer, const log_record_t *record) {
+
+    struct iovec *last = writer->used > 0 ? &(writer->iov[writer->used - 1]) : NULL;
+    if(last == NULL || LOG_WRITER_SEGMENT - last->iov_len < LOG_WRITER_LINE_ROOM) {
+        if(writer->used == writer->segments) log_writer_flush(writer);
+        last = &(writer->iov[writer->used]);
+        last->iov_base = writer->buffer + (size_t) writer->used*LOG_WRITER_SEGMENT;
+        last->iov_len = 0;
+        writer->used++;
+    }
+    char *line = (char *) last->iov_base + last->iov_len;
+    size_t room = LOG_WRITER_SEGMENT - last->iov_len;
+    int length = snprintf(line, room, "%llu %lld ", (unsigned long long) record->seq,
+                          (long long) (record->ts/1000000000));
+    if(length < 0) return;
+    length += log_event_format(record, line + length, LOG_LINE_MAX);
+    line[length++] = '\n';
+    last->iov_len += (size_t) length;
+    if(writer->buffered == 0) writer->oldest_ms = now_ms();
+    writer->buffered += (size_t) length;
+    writer->buffered_lines++;
+    if(writer->buffered >= writer->flush_bytes) log_writer_flush(writer);
+}
+
+void log_writer_poll(log_writer_t *writer) {
+    if(writer->buffered > 0 && now_ms() - writer->oldest_ms >= writer->flush_ms) log_writer_flush(writer);
+}
+
+int log_writer_wait_ms(log_writer_t *writer, int idle_ms) {
+    if(writer->buffered == 0) return idle_ms;
+    int64_t due = writer->oldest_ms + writer->flush_ms - now_ms();
+    if(due < 0) return 0;
+    return due < idle_ms ? (int) due : idle_ms;
+}
@@ -0,0 +1,59 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#ifndef _LOG_WRITER_H_
+#define _LOG_WRITER_H_
+
+#include "log_ring.h"
+#include "log_rotate.h"
+
+/*
+ * the file side of the log process, records are formatted into segments of a buffer and written with one writev()
+ * once flush_bytes are buffered or the oldest buffered line is flush_ms old, whichever comes first
+ * a crash of the log process loses at most what is buffered, main dying does not, the log process still flushes
+ * with a rotation the file is checked after every flush and rotated once it is due
+ *
+ * used by the log process only
+ */
+
+typedef struct log_writer log_writer_t;
+
+/*
+ * opens the log file at path, lines are appended to what it holds
+ * \return the writer, NULL if the file cannot be opened or the buffer not allocated
+ */
+log_writer_t *log_writer_open(const char *path, int flush_bytes, int flush_ms);
+
+/*
+ * rotates the file with rotate from now on, the writer does not own it
+ */
+void log_writer_rotate(log_writer_t *writer, log_rotate_t *rotate);
+
+/*
+ * flushes and closes the file
+ */
+void log_writer_close(log_writer_t *writer);
+
+/*
+ * formats record into the buffer, flushes first if the buffer is full
+ */
+void log_writer_add(log_writer_t *writer, const log_record_t *record);
+
+/*
+ * flushes if the size or the time policy says so
+ */
+void log_writer_poll(log_writer_t *writer);
+
+/*
+ * writes everything buffered with one writev()
+ * \return 0 for success, -1 if the write failed, the buffered lines are dropped either way
+ */
+int log_writer_flush(log_writer_t *writer);
+
+/*
+ * \return the ms until the buffered lines are due, the longest the log process may wait for records
+ */
+int log_writer_wait_ms(log_writer_t *writer, int idle_ms);
+
+#endif /* _LOG_WRITER_H_ */
@@ -13,29 +13,30 @@
 #include "datamgr.h"
 #include <unistd.h>
 #include "sensor_db.h"
+#include "storage_writer.h"
+#include "storage_profile.h"
+#include "storage_partition.h"
+#include "storage_backend.h"
+#include "storage_spool.h"
 #include <string.h>
-#include "fifo_pipe.h"
+#include "log_ring.h"
+#include "log.h"
+#include "log_writer.h"
+#include "log_rotate.h"
+#include "metrics.h"
+#include "trace.h"
 #include <limits.h>
 #include <assert.h>
 #include <signal.h>
 #include <sys/poll.h>
 #include <sys/wait.h>
-#ifdef DEBUG
-#define DEBUG_PRINTF(...) 									                                        \
-        do {											                                            \
-            fprintf(stderr,"\nIn %s - function %s at line %d: ", __FILE__, __func__, __LINE__);	    \
-            fprintf(stderr,__VA_ARGS__);								                            \
-            fflush(stderr);                                                                         \
-                } while(0)
-#else
-#define DEBUG_PRINTF(...) (void)0
-#endif
-
+#include <stdatomic.h>
 //
 
-fifo_pipe_t *log_pipe;
+log_ring_t *log_ring;
 sbuffer_t *shared_buffer;
-dplist_t *datamgr_list; //TODO maybe put in datamgr_thread func
+storage_writer_t *storage_writer = NULL;     //owned by storagemgr, stats can be read from other threads
+storage_partition_stats_t partition_stats;   //only used by the storagemgr thread
 
 pthread_mutex_t *stop_threads;
 int *stop_threads_flag;
@@ -56,40 +57,165 @@ void kill_gateway() {
 void mem_fail() {
 
     printf("FATAL ERROR: memory failure, stopping gateway");
-    fifo_pipe_write(log_pipe, "memory failure, stopping gateway");
+    LOG_EVENT(log_ring, LOG_LEVEL_ERROR, LOG_MAIN, LOG_MEM_FAIL, 0);
     kill_gateway();
 }
 
-void datamgr_log(char *msg) {
+#define datamgr_log(level, ...) LOG_EVENT(log_ring, level, LOG_DATAMGR, __VA_ARGS__)
+#define datamgr_log_sampled(level, ...) LOG_SAMPLED(log_ring, level, LOG_DATAMGR, LOG_SAMPLE_RATE, __VA_ARGS__)
+
+int64_t datamgr_traced = 0;                  //trace stamp of the reading datamgr is processing
+int64_t datamgr_last_traced = 0;             //and of the last traced one it processed
+
+/*
+ * alert sink of datamgr, only state transitions end up here
+ */
+void datamgr_alert(const alert_event_t *event, void *arg) {
+
+    //a room alert of the scan is set off by readings processed before it, the newest traced one stands for them,
+    //a stale sensor is found by the time that passed, not by a reading
+    if(event->kind != ALERT_STALE) trace_record(TRACE_ALERTED, datamgr_traced != 0 ? datamgr_traced : datamgr_last_traced);
 
-    char *mod_msg;
-    asprintf(&mod_msg, "DATAMGR_THREAD: %s", msg);
-    fifo_pipe_write(log_pipe, mod_msg);
-    free(mod_msg);
+    const char *subject = event->subject == ALERT_ROOM ? "room id" : "sensor id";
+    if(event->kind == ALERT_STALE) {
+        if(event->state == ALERT_RAISED) {
+            datamgr_log(LOG_LEVEL_WARN, LOG_SENSOR_STALE, 2, LOG_I(event->id), LOG_I(event->ts));
+        } else {
+            datamgr_log(LOG_LEVEL_INFO, LOG_SENSOR_RECOVERED, 2, LOG_I(event->id), LOG_I(event->ts));
+        }
+        if(event->state == ALERT_RAISED) printf("Sensor stopped reporting: sensor id = %i\n", event->id);
+        return;
+    }
+    datamgr_log(LOG_LEVEL_WARN, LOG_TEMP_ALERT, 6, LOG_I(event->kind), LOG_I(event->state), LOG_I(event->subject),
+                LOG_I(event->id), LOG_F(event->value), LOG_I(event->suppressed));
+    if(event->state == ALERT_RAISED) {
+        printf("Temperature is %s: %s = %i, average temperature = %.2f\n", event->kind == ALERT_HOT ? "too high" : "too low",
+               subject, event->id, event->value);
+    } else if(event->state == ALERT_CLEARED) {
+        printf("Temperature back to normal: %s = %i, average temperature = %.2f\n", subject, event->id, event->value);
+    }
 }
 
-void datamgr_log_temp(char *msg, sensor_id_t id, sensor_value_t average) {
+/*
+ * logs the first reading of an anomaly episode, the following readings of the same kind are only counted
+ */
+void datamgr_log_anomaly(sensor_data_t *data, anomaly_result_t *anomaly) {
+
+    datamgr_log(LOG_LEVEL_INFO, LOG_ANOMALY, 5, LOG_I(anomaly->flags), LOG_I(data->id), LOG_F(data->value),
+                LOG_I(data->ts), LOG_F(anomaly->zscore));
+}
+
+/*
+ * full scan over all sensors, room alerts are raised from here
+ */
+void datamgr_periodic_scan(time_t now) {
+
+    datamgr_map_t *map = datamgr_map_acquire();
+    datamgr_scan_t scan;
+    if(datamgr_scan(map, now, &scan) != DATAMGR_OK) return;
+    DEBUG_PRINTF("scan: %i sensors too hot, %i too cold, %i stale", scan.too_hot, scan.too_cold, scan.stale);
+}
 
-    char *mod_msg;
-    asprintf(&mod_msg, "DATAMGR_THREAD: %s (sensor id = %i, average temp = %.2f)", msg, id, average);
-    fifo_pipe_write(log_pipe, mod_msg);
-    free(mod_msg);
+/*
+ * timers of datamgr, liveness once per second and the full scan every DATAMGR_SCAN_INTERVAL seconds
+ */
+void datamgr_tick(time_t *last_tick, time_t *last_scan) {
+
+    time_t now = time(NULL);
+    if(now == *last_tick) return;
+    *last_tick = now;
+    int expired;
+    datamgr_check_liveness(datamgr_map_acquire(), now, &expired);
+    if(now - *last_scan >= DATAMGR_SCAN_INTERVAL) {
+        *last_scan = now;
+        datamgr_periodic_scan(now);
+    }
+}
+
+struct checkpoint_job {
+    void *image;
+    size_t size;
+};
+typedef struct checkpoint_job checkpoint_job_t;
+
+atomic_int checkpoint_busy = 0;
+
+void *checkpoint_writer(void *args) {
+
+    checkpoint_job_t *job = (checkpoint_job_t *) args;
+    if(datamgr_checkpoint_write(DATAMGR_CHECKPOINT_FILE, job->image, job->size) != DATAMGR_OK) {
+        datamgr_log(LOG_LEVEL_WARN, LOG_CHECKPOINT_FAIL, 0);
+    }
+    free(job->image);
+    free(job);
+    atomic_store(&checkpoint_busy, 0);
+    return NULL;
+}
+
+/*
+ * snapshots the datamgr state, the snapshot is taken on the datamgr thread but written by a detached thread
+ * so a slow disk never holds up alerting, on exit (sync) the write happens right here
+ */
+void datamgr_checkpoint(int sync) {
+
+    if(!sync && atomic_exchange(&checkpoint_busy, 1)) return; //previous checkpoint still being written
+    if(sync) {
+        while(atomic_load(&checkpoint_busy)) usleep(1000);
+    }
+    checkpoint_job_t *job = malloc(sizeof(checkpoint_job_t));
+    if(job == NULL || datamgr_checkpoint_create(datamgr_map_acquire(), time(NULL), &(job->image), &(job->size)) != DATAMGR_OK) {
+        free(job);
+        atomic_store(&checkpoint_busy, 0);
+        return;
+    }
+    pthread_t writer;
+    if(sync || pthread_create(&writer, NULL, checkpoint_writer, job) != 0) {
+        checkpoint_writer(job);
+        return;
+    }
+    pthread_detach(writer);
+}
+
+/*
+ * takes a checkpoint every DATAMGR_CHECKPOINT_INTERVAL seconds, called between readings so it also runs under load
+ */
+void datamgr_checkpoint_tick(time_t *last_checkpoint) {
+
+    time_t now = time(NULL);
+    if(now - *last_checkpoint < DATAMGR_CHECKPOINT_INTERVAL) return;
+    *last_checkpoint = now;
+    datamgr_checkpoint(0);
+}
+
+/*
+ * restores running windows from the last checkpoint so averages are available right after a restart
+ */
+void datamgr_warm_restart() {
+
+    int restored;
+    if(datamgr_checkpoint_restore(datamgr_map_acquire(), DATAMGR_CHECKPOINT_FILE, time(NULL), &restored) == DATAMGR_OK) {
+        datamgr_log(LOG_LEVEL_INFO, LOG_WARM_RESTART, 1, LOG_I(restored));
+    } else {
+        datamgr_log(LOG_LEVEL_INFO, LOG_NO_CHECKPOINT, 0);
+    }
 }
 
 void *datamgr_thread(void *args) {
 
     arg_struct_datamgr_t *arg_datamgr = (arg_struct_datamgr_t *) args;
     datamgr_status_t dmgr_status;
-    dmgr_status = datamgr_parse_sensor_files(arg_datamgr->fp_sensor_map, &datamgr_list);//arg_connmgr->fp_sensor_map
+    dmgr_status = datamgr_load_sensor_map(arg_datamgr->fp_sensor_map);
+    fclose(arg_datamgr->fp_sensor_map);
 
     if(dmgr_status == DATAMGR_FAILURE) {
-        datamgr_log("failed to parse sensor map file");
+        datamgr_log(LOG_LEVEL_ERROR, LOG_MAP_PARSE_FAIL, 0);
         kill_gateway();
     }
     if(dmgr_status == DATAMGR_MEM_ERROR) {
-        datamgr_log("failure to allocate memory");
+        datamgr_log(LOG_LEVEL_ERROR, LOG_DATAMGR_MEM_FAIL, 0);
         kill_gateway();
     }
+    if(dmgr_status == DATAMGR_OK) datamgr_warm_restart();
 
     int reader_id = DATAMGR_ID;
     sensor_data_t *read_data = malloc(sizeof(sensor_data_t));
@@ -98,7 +224,9 @@ void *datamgr_thread(void *args) {
     read_data->id = 0;
     read_data->value = 0.00;
     read_data->ts = 0;
-    sensor_value_t average = 0;
+    time_t last_scan = time(NULL);
+    time_t last_tick = 0;
+    time_t last_checkpoint = time(NULL);
 
     int st_flag, sbuffer_status;
     //Big loop, exits only on threadstop
@@ -108,9 +236,14 @@ void *datamgr_thread(void *args) {
         st_flag = *stop_threads_flag;
         pthread_mutex_unlock(stop_threads);
         if(st_flag) {
-            //clean up storagemgr, exit
-            dpl_free(&datamgr_list, true);
-            datamgr_log("exiting datamgr..");
+            //clean up datamgr, exit (the map and sensor state are freed by main once the reload thread is gone)
+            uint64_t totals[ANOMALY_CLASSES];
+            datamgr_get_anomaly_totals(totals);
+            datamgr_log(LOG_LEVEL_INFO, LOG_ANOMALY_TOTALS, 6, LOG_I(totals[ANOMALY_RANGE]),
+                        LOG_I(totals[ANOMALY_TIMESTAMP]), LOG_I(totals[ANOMALY_ZSCORE]), LOG_I(totals[ANOMALY_SPIKE]),
+                        LOG_I(totals[ANOMALY_FLATLINE]), LOG_I(totals[ANOMALY_LATE]));
+            datamgr_checkpoint(1);
+            datamgr_log(LOG_LEVEL_INFO, LOG_DATAMGR_EXIT, 0);
             free(read_data);
             pthread_exit(NULL);
         }
@@ -119,37 +252,32 @@ void *datamgr_thread(void *args) {
         while(sbuffer_status == SBUFFER_MORE_AVAILABLE || sbuffer_status == SBUFFER_SUCCESS) {
 
             DEBUG_PRINTF("datamgr thread received sensdata with id: %i, value: %.2f, ts: %ld", read_data->id, read_data->value, read_data->ts);
-            dmgr_status = datamgr_insert_new_sensor_reading(datamgr_list, read_data->id, read_data->value, read_data->ts);
+            datamgr_traced = sbuffer_last_received(shared_buffer, reader_id);
+            datamgr_map_t *map = datamgr_map_acquire();
+            anomaly_result_t anomaly;
+            dmgr_status = datamgr_insert_new_sensor_reading(map, read_data->id, read_data->value, read_data->ts, time(NULL),
+                                                            &anomaly);
+            if(dmgr_status == DATAMGR_OK) datamgr_update_alert(map, read_data->id, read_data->ts);
+            if((dmgr_status == DATAMGR_OK || dmgr_status == DATAMGR_REJECTED) && anomaly.new_episode && anomaly.flags) {
+                datamgr_log_anomaly(read_data, &anomaly);
+            }
+            trace_record(TRACE_PROCESSED, datamgr_traced);
+            if(datamgr_traced != 0) datamgr_last_traced = datamgr_traced;
+            datamgr_traced = 0;
             //check if sensor inserted correctly
             if(dmgr_status == DATAMGR_MEM_ERROR) mem_fail();
             if(dmgr_status == DATAMGR_WRONG_ID) {
-                char *msg;
-                asprintf(&msg, "received data with missing sensor_id: %i, please check room sensor map file. Data stored in the database", read_data->id);
-                datamgr_log(msg);
-                free(msg);
+                datamgr_log_sampled(LOG_LEVEL_WARN, LOG_UNKNOWN_SENSOR, 1, LOG_I(read_data->id));
                 break;
             }
             if(dmgr_status == DATAMGR_FAILURE){
                 DEBUG_PRINTF("failure to insert datamgr reading");
-                datamgr_log("failure to insert datamgr reading");
+                datamgr_log(LOG_LEVEL_ERROR, LOG_READING_FAIL, 0);
                 break;
             }
 
-            dmgr_status = datamgr_get_avg(datamgr_list, read_data->id, &average);
-            if(dmgr_status == DATAMGR_MEM_ERROR) mem_fail();
-            if(dmgr_status == DATAMGR_FAILURE){
-                DEBUG_PRINTF("failure to calculate average");
-                datamgr_log("failure to calculate average");
-                break;
-            }
-            DEBUG_PRINTF("average for sensorid: %i is %.2f", read_data->id, average);
-            if(average > SET_MAX_TEMP) {
-                datamgr_log_temp("too hot temp", read_data->id, average);
-                printf("Temperature is too high: sensor_id = %i, average temperature = %.2f\n", read_data->id, average);
-            } else if (average < SET_MIN_TEMP) {
-                datamgr_log_temp("too cold temp", read_data->id, average);
-                printf("Temperature is too low: sensor_id = %i, average temperature = %.2f\n", read_data->id, average);
-            }
+            datamgr_tick(&last_tick, &last_scan);
+            datamgr_checkpoint_tick(&last_checkpoint);
             sbuffer_status = sbuffer_read(shared_buffer, read_data, reader_id, 1);
         }
 
@@ -158,111 +286,239 @@ void *datamgr_thread(void *args) {
         } else if(sbuffer_status == SBUFFER_NO_DATA) {
             DEBUG_PRINTF("sbuffer no data");
         }
+        datamgr_tick(&last_tick, &last_scan);
+        datamgr_checkpoint_tick(&last_checkpoint);
     }
     return NULL;
 }
 
-void storagemgr_log(char *msg) {
+/*
+ * waits for SIGHUP and reloads the room sensor map, the parsing happens here and not in datamgr
+ * SIGHUP is blocked in every thread so sigtimedwait is the only one receiving it
+ */
+void *reload_thread(void *args) {
 
-    char *mod_msg;
-    asprintf(&mod_msg, "STORAGE_THREAD: %s", msg);
-    fifo_pipe_write(log_pipe, mod_msg);
-    free(mod_msg);
+    sigset_t hup;
+    sigemptyset(&hup);
+    sigaddset(&hup, SIGHUP);
+    struct timespec poll_time = {1, 0};
+    int st_flag;
+    while(1) {
+        pthread_mutex_lock(stop_threads);
+        st_flag = *stop_threads_flag;
+        pthread_mutex_unlock(stop_threads);
+        if(st_flag) pthread_exit(NULL);
+
+        datamgr_map_reclaim();
+        if(sigtimedwait(&hup, NULL, &poll_time) != SIGHUP) continue;
+        FILE *fp_sensor_map = fopen(SENSOR_MAP_FILE, "r");
+        if(fp_sensor_map == NULL) {
+            datamgr_log(LOG_LEVEL_WARN, LOG_RELOAD_OPEN_FAIL, 0);
+            continue;
+        }
+        datamgr_status_t status = datamgr_load_sensor_map(fp_sensor_map);
+        fclose(fp_sensor_map);
+        if(status == DATAMGR_OK) {
+            datamgr_log(LOG_LEVEL_INFO, LOG_MAP_RELOADED, 1, LOG_I(datamgr_get_total_sensors()));
+        } else {
+            datamgr_log(LOG_LEVEL_WARN, LOG_RELOAD_FAIL, 0);
+        }
+    }
+    return NULL;
 }
-void *storagemgr_thread(void *args) {
 
-    DBCONN *db;
-    status_code_storagemgr_t *status = malloc(sizeof(status_code_storagemgr_t));
-    if(status==NULL) mem_fail();
-    char *table_name = malloc(16*sizeof(char));
-    if(table_name == NULL) mem_fail();
-    int fail_count = 0;
-    do{
-        db = init_connection(CLEAR_DB, status, table_name); //by default db is cleared every time
-        if(*status == STATUS_NEW_TABLE) {
-            storagemgr_log("Connection to DB estabilished successfuly");
-            char *buf;
-            asprintf(&buf, "new table %s created", table_name);
-            storagemgr_log(buf);//TODO full logging capabilities
-            free(buf);
-        } else if(*status == STATUS_OK) {
-            storagemgr_log("Connection to DB estabilished successfuly");
+#define storagemgr_log(level, ...) LOG_EVENT(log_ring, level, LOG_STORAGEMGR, __VA_ARGS__)
+#define storagemgr_log_sampled(level, ...) LOG_SAMPLED(log_ring, level, LOG_STORAGEMGR, LOG_SAMPLE_RATE, __VA_ARGS__)
+
+/*
+ * reports what the group commit did so far
+ */
+void storagemgr_log_stats(storage_writer_t *writer) {
+
+    storage_writer_stats_t stats;
+    storage_writer_get_stats(writer, &stats);
+    storagemgr_log(LOG_LEVEL_INFO, LOG_COMMIT_STATS, 5, LOG_I(stats.commits),
+                   LOG_I(histogram_percentile(&(stats.commit_size), 50)), LOG_I(stats.commit_size.max),
+                   LOG_I(histogram_percentile(&(stats.commit_latency), 50)),
+                   LOG_I(histogram_percentile(&(stats.commit_latency), 99)));
+    storagemgr_log(LOG_LEVEL_INFO, LOG_ROLLUP_STATS, 2, LOG_I(partition_stats.rollup_runs),
+                   LOG_I(partition_stats.rolled_up));
+    histogram_t traced[TRACE_INTERVALS];
+    for(int i = 0; i < TRACE_INTERVALS; i++) trace_get((trace_interval_t) i, &traced[i]);
+    if(traced[TRACE_PROCESSED].count > 0 || traced[TRACE_COMMITTED].count > 0) {
+        storagemgr_log(LOG_LEVEL_INFO, LOG_TRACE_STATS, 6, LOG_I(histogram_percentile(&traced[TRACE_PROCESSED], 50)),
+                       LOG_I(histogram_percentile(&traced[TRACE_PROCESSED], 99)),
+                       LOG_I(histogram_percentile(&traced[TRACE_ALERTED], 50)),
+                       LOG_I(histogram_percentile(&traced[TRACE_ALERTED], 99)),
+                       LOG_I(histogram_percentile(&traced[TRACE_COMMITTED], 50)),
+                       LOG_I(histogram_percentile(&traced[TRACE_COMMITTED], 99)));
+    }
+    storage_checkpoint_stats_t checkpoints;
+    storage_checkpointer_get_stats(&checkpoints);
+    if(checkpoints.runs == 0) return;
+    storagemgr_log(LOG_LEVEL_INFO, LOG_CHECKPOINT_STATS, 4, LOG_I(checkpoints.runs), LOG_I(checkpoints.pages),
+                   LOG_I(checkpoints.busy), LOG_I(checkpoints.max_us));
+}
+
+/*
+ * reports the readings waiting in the spool and what was replayed from it
+ */
+void storagemgr_log_spool(storage_spool_t *spool) {
+
+    storage_spool_stats_t stats;
+    storage_spool_get_stats(spool, &stats);
+    storagemgr_log(LOG_LEVEL_INFO, LOG_SPOOL_STATS, 4, LOG_I(stats.pending), LOG_I(stats.rows),
+                   LOG_I(stats.replayed), LOG_I(stats.skipped));
+}
+
+/*
+ * brings the rollups up to date and drops expired partitions, in this order so rollups see all rows of a partition
+ */
+void storagemgr_maintain(DBCONN *db) {
+
+    uint64_t dropped = partition_stats.dropped;
+    if(storage_partition_rollup(db, &partition_stats) != STATUS_OK) storagemgr_log(LOG_LEVEL_WARN, LOG_ROLLUP_FAIL, 0);
+    if(storage_partition_expire(db, time(NULL), &partition_stats) != STATUS_OK) {
+        storagemgr_log(LOG_LEVEL_WARN, LOG_EXPIRE_FAIL, 0);
+    } else if(partition_stats.dropped > dropped) {
+        storagemgr_log(LOG_LEVEL_INFO, LOG_EXPIRED, 1, LOG_I(partition_stats.dropped - dropped));
+    }
+}
+
+int64_t storagemgr_traced[STORAGEMGR_BATCH_MAX];   //trace stamps of the readings in the open batch
+int storagemgr_traced_count = 0;
+
+/*
+ * hands a reading read from the shared buffer to the storage writer
+ */
+void storagemgr_add(sensor_data_t *data) {
+    int64_t received = sbuffer_last_received(shared_buffer, STORAGEMGR_ID);
+    if(received != 0 && storagemgr_traced_count < STORAGEMGR_BATCH_MAX) {
+        storagemgr_traced[storagemgr_traced_count++] = received;
+    }
+    storage_writer_add(storage_writer, data);
+}
+
+/*
+ * commit sink of the storage writer
+ */
+void storagemgr_committed(status_code_storagemgr_t status, int rows, void *arg) {
+
+    //spooled readings are committed by a replay later, they are not traced that far
+    for(int i = 0; status == STATUS_OK && i < storagemgr_traced_count; i++) {
+        trace_record(TRACE_COMMITTED, storagemgr_traced[i]);
+    }
+    storagemgr_traced_count = 0;
+
+    if(status == STATUS_OK) {
+        storagemgr_log_sampled(LOG_LEVEL_INFO, LOG_INSERTED, 1, LOG_I(rows));
+    } else if(status == STATUS_SPOOLED) {
+        storagemgr_log_sampled(LOG_LEVEL_WARN, LOG_SPOOLED, 1, LOG_I(rows));
+    } else {
+        storagemgr_log(LOG_LEVEL_ERROR, LOG_NOT_STORED, 1, LOG_I(rows));
+    }
+}
+
+/*
+ * opens the storage backend and logs the outcome
+ * \return the backend, NULL if it cannot be opened
+ */
+storage_backend_t *storagemgr_connect() {
+
+    status_code_storagemgr_t status;
+    storage_backend_t *backend = storage_backend_open(STORAGE_BACKEND, CLEAR_DB, &status); //by default stored readings are kept
+    if(status == STATUS_NEW_TABLE) {
+        storagemgr_log(LOG_LEVEL_INFO, LOG_DB_CONNECTED, 0);
+        if(storage_backend_sqlite(backend) != NULL) {
+            storagemgr_log(LOG_LEVEL_INFO, LOG_TABLE_CREATED, 0);
+        } else if(storage_backend_shards(backend) != NULL) {
+            storagemgr_log(LOG_LEVEL_INFO, LOG_SHARDS_CREATED, 1, LOG_I(STORAGE_SHARDS));
         } else {
-            storagemgr_log("Connection to DB failed");
-            fail_count++;
-            sleep(2);
+            storagemgr_log(LOG_LEVEL_INFO, LOG_COLUMNS_CREATED, 0);
         }
+    } else if(status == STATUS_OK) {
+        storagemgr_log(LOG_LEVEL_INFO, LOG_DB_CONNECTED, 0);
+    } else {
+        storagemgr_log(LOG_LEVEL_ERROR, LOG_DB_FAIL, 0);
     }
-    while(*status == STATUS_FAILURE && fail_count<3);
-    free(table_name);
+    return backend;
+}
 
-    if(fail_count == 3 && *status == STATUS_FAILURE) {
-        storagemgr_log("Connection to DB failed 3 times, stopping gateway..");
-        kill_gateway();
+/*
+ * the checkpointer, rollups and retention only exist for the sqlite backend
+ */
+DBCONN *storagemgr_start_backend(storage_backend_t *backend) {
+
+    DBCONN *db = storage_backend_sqlite(backend);
+    if(db != NULL && storage_checkpointer_start(db, storage_profile_find(STORAGE_PROFILE)) != STATUS_OK) {
+        storagemgr_log(LOG_LEVEL_WARN, LOG_CHECKPOINTER_FAIL, 0);
     }
+    return db;
+}
 
-    int reader_id = STORAGEMGR_ID;
+void *storagemgr_thread(void *args) {
 
-    sensor_data_t *read_data = malloc(sizeof(sensor_data_t));
-    if(read_data == NULL) mem_fail();
-    read_data->id = 0;
-    read_data->value = 0.0;
-    read_data->ts = 0;
+    storage_spool_t *spool = storage_spool_open(STORAGE_SPOOL_FILE);
+    if(spool == NULL) {
+        storagemgr_log(LOG_LEVEL_WARN, LOG_SPOOL_OPEN_FAIL, 0);
+    } else if(storage_spool_pending(spool)) {
+        storagemgr_log(LOG_LEVEL_INFO, LOG_SPOOL_FOUND, 0);
+    }
+    storage_backend_t *backend;
+    int fail_count = 0;
+    while((backend = storagemgr_connect()) == NULL && ++fail_count < 3) sleep(2);
 
-    char blocking = 1; //read mode
-    char cleanup = 1; //one-shot final cleanup
-    int MAX_READS = 8;  //control how many reads to do in one "go"
-    int sleep_length = 7;  //sleep after one "go"
+    if(backend == NULL && spool == NULL) {
+        storagemgr_log(LOG_LEVEL_ERROR, LOG_DB_GIVE_UP, 0);
+        kill_gateway();
+    } else if(backend == NULL) {
+        //readings keep flowing to the spool, alerting does not depend on the DB
+        storagemgr_log(LOG_LEVEL_WARN, LOG_DB_SPOOLING, 0);
+    }
 
-    int sbuffer_status = 0;
-    int counter = 0;    //counts reads currently done
+    DBCONN *db = backend != NULL ? storagemgr_start_backend(backend) : NULL;
+    storage_writer = storage_writer_create(backend, spool, STORAGEMGR_BATCH_MAX, STORAGEMGR_COMMIT_DEADLINE_MS, storagemgr_committed, NULL);
+    if(storage_writer == NULL) mem_fail();
+    sensor_data_t read_data;
+    int sbuffer_status;
     int st_flag = 0;
+    int spooling = spool != NULL && storage_spool_pending(spool);
+    time_t last_stats = time(NULL);
+    time_t last_maintenance = 0;
+    time_t last_connect = time(NULL);
     while(1) {
-        //receive data from the sbuffer
-        do {
-            sbuffer_status = sbuffer_read(shared_buffer, read_data, reader_id, blocking);
-            if(sbuffer_status == SBUFFER_NO_DATA || sbuffer_status == SBUFFER_FAILURE || sbuffer_status == SBUFFER_TIMEOUT) break;
-            DEBUG_PRINTF("storagemgr thread received sensdata with id: %i, value: %.2f, ts: %ld", read_data->id, read_data->value, read_data->ts);
-            *status = insert_sensor(db, read_data->id, read_data->value, read_data->ts);
-            if(*status == STATUS_OK) {
-                storagemgr_log("new reading inserted successfully");
-               // storagemgr_log("race condition check");
-            } else {
-                storagemgr_log("storagemgr lost connection to DB");
+        /*
+         * group commit: wait for readings until the open batch is due, it is committed once it is full or its
+         * oldest reading waited STORAGEMGR_COMMIT_DEADLINE_MS, with no open batch the wait is one second
+         */
+        struct timespec deadline;
+        storage_writer_deadline(storage_writer, 1000, &deadline);
+        sbuffer_status = sbuffer_read_until(shared_buffer, &read_data, STORAGEMGR_ID, &deadline);
+        if(sbuffer_status == SBUFFER_SUCCESS || sbuffer_status == SBUFFER_MORE_AVAILABLE) {
+            DEBUG_PRINTF("storagemgr thread received sensdata with id: %i, value: %.2f, ts: %ld", read_data.id, read_data.value, read_data.ts);
+            storagemgr_add(&read_data);
+        }
+        if(backend == NULL && spool != NULL && time(NULL) - last_connect >= STORAGE_SPOOL_RETRY_MS/1000) {
+            last_connect = time(NULL);
+            if((backend = storagemgr_connect()) != NULL) {
+                db = storagemgr_start_backend(backend);
+                storage_writer_set_backend(storage_writer, backend);
             }
-            if(blocking) break; //break out of blocking mode on first successful read;
-            counter++;
-        } while((sbuffer_status == SBUFFER_MORE_AVAILABLE || sbuffer_status == SBUFFER_SUCCESS) && counter < MAX_READS);
-
-        //autoscale read size/speed up and down
-        if(sbuffer_status == SBUFFER_MORE_AVAILABLE) {
-            DEBUG_PRINTF("speeding up storagemgr..");
-            MAX_READS++;
-            sleep_length--;
-            if(sleep_length < 1) sleep_length = 1; // keep sane limits
-            if(MAX_READS > 50) MAX_READS = 50;
         }
-        if(sbuffer_status == SBUFFER_SUCCESS && (counter+3 < MAX_READS)) { //the +3 is arbritary
-            DEBUG_PRINTF("slowing down storagemgr...");
-            sleep_length++;
-            MAX_READS--;
-            if(sleep_length > 20) sleep_length = 20; //keep sane limits
-            if(MAX_READS < 5) MAX_READS = 5;
+        storage_writer_poll(storage_writer);
+        if(spool != NULL && spooling != storage_spool_pending(spool)) {
+            spooling = !spooling;
+            storagemgr_log_spool(spool);
+        }
+        if(db != NULL && time(NULL) - last_maintenance >= STORAGE_ROLLUP_INTERVAL) {
+            last_maintenance = time(NULL);
+            storagemgr_maintain(db);
         }
 
-        /*
-         * Control blocking mode and non-blocking mode
-         * Blocking - when no node is connected -> storagemgr will wait for signal from writer thread(connmgr)
-         * Non-blocking - nodes connected, data is flowing -> storagemgr does not wait for signal, locks mutex, reads up to MAX_READS nodes, unlocks and sleeps for sleep_length until next lock
-         */
-        if(counter == 0 && (sbuffer_status == SBUFFER_NO_DATA||sbuffer_status == SBUFFER_FAILURE || sbuffer_status == SBUFFER_TIMEOUT) ) {
-            //unsuccessful read, wait for write to continue
-            blocking =1;
-            DEBUG_PRINTF("blocking mode for storagemgr");
-        } else {
-            //all fine, keep working in non block mode
-            blocking = 0;
-            DEBUG_PRINTF("nonblock mode for storagemgr");
+        if(time(NULL) - last_stats >= STORAGEMGR_STATS_INTERVAL) {
+            last_stats = time(NULL);
+            storagemgr_log_stats(storage_writer);
+            if(spool != NULL) storagemgr_log_spool(spool);
         }
         //check if thread should be killed instead
         pthread_mutex_lock(stop_threads);
@@ -270,68 +526,109 @@ void *storagemgr_thread(void *args) {
         pthread_mutex_unlock(stop_threads);
         if(st_flag) {
             //make sure all the nodes in sbuffer have been read
-            if(cleanup) {
-                DEBUG_PRINTF("exiting storagemgr");
-                storagemgr_log("exiting storagemgr");
-                disconnect(db);
-                MAX_READS = INT_MAX; // will miss nodes in extreme use cases
-                sleep_length = 0;
-                cleanup = 0;
-                continue;
+            DEBUG_PRINTF("exiting storagemgr");
+            storagemgr_log(LOG_LEVEL_INFO, LOG_STORAGEMGR_EXIT, 0);
+            sbuffer_status = sbuffer_read(shared_buffer, &read_data, STORAGEMGR_ID, 0);
+            while(sbuffer_status == SBUFFER_SUCCESS || sbuffer_status == SBUFFER_MORE_AVAILABLE) {
+                storagemgr_add(&read_data);
+                sbuffer_status = sbuffer_read(shared_buffer, &read_data, STORAGEMGR_ID, 0);
             }
-
-            disconnect(db);
-            free(read_data);
-            free(status);
+            storage_writer_commit(storage_writer);
+            if(db != NULL) storagemgr_maintain(db);
+            storagemgr_log_stats(storage_writer);
+            if(spool != NULL) storagemgr_log_spool(spool);
+            storage_writer_free(storage_writer);
+            storage_writer = NULL;
+            storage_checkpointer_stop();
+            storage_backend_close(backend);
+            //what is still spooled is replayed by the next run
+            storage_spool_close(spool);
             pthread_exit(NULL);
         }
-        counter = 0;
-        if (!blocking) sleep(sleep_length); //sleeps only in non-blocking mode
     }
 }
 
-//a bit wierd implementation but works
-//better to move magic string termination thing to fifo_pipe.c
-void log_process(char *magic_string) {
-    fifo_pipe_close_input(log_pipe);
-    FILE *fp = fopen("./gateway.log", "w");
-    int result;
-    char buff[MAX];
-    //i set up a quick poll structure for this, a bit overkill
-    struct pollfd fds[1];
-    memset(fds, 0, sizeof(fds));
-    fds[0].fd = fifo_pipe_getreadfd(log_pipe);
-    fds[0].events = POLLIN;
-    int enable_loop = 1;
-    int status;
-    while(enable_loop) {
-    status = poll(fds, 1, 5000);
-    if(status == 0) {
+/*
+ * metrics read from the shared buffer and the log ring when a snapshot is taken, none of them takes a lock
+ */
+int64_t metric_sbuffer_nodes(void *arg) {
+    sbuffer_stats_t stats;
+    sbuffer_get_stats(shared_buffer, &stats);
+    return (int64_t) stats.nodes;
+}
+
+int64_t metric_reader_lag(void *arg) {
+    sbuffer_stats_t stats;
+    sbuffer_get_stats(shared_buffer, &stats);
+    return (int64_t) (stats.inserted - stats.read[*((int *) arg)]);
+}
 
-    } else {
-        if(fds[0].revents != POLLIN) {
-            DEBUG_PRINTF("logproc received %i instead of POLLIN, exiting..", fds[0].revents);
-            exit(0);
+int64_t metric_log_dropped(void *arg) {
+    uint64_t dropped, reserved;
+    log_ring_dropped(log_ring, &dropped, &reserved);
+    return (int64_t) dropped;
+}
 
-        } else {
-            result = fifo_pipe_read(log_pipe, buff, MAX);
-            if(result>0) {
-                if(strcmp(buff, magic_string) == 0) {
-                    DEBUG_PRINTF("log process exiting\n");
-                    close(fds[0].fd);
-                    enable_loop = 0;
-                    fflush(fp);
-                    fclose(fp);
-                    exit(0);
-                }
-                DEBUG_PRINTF("new log msg from main: \"%s\"", buff);
-                fprintf(fp, "%s\n", buff );
-                fflush(fp);
+void metrics_start() {
+
+    static int datamgr_id = DATAMGR_ID, storagemgr_id = STORAGEMGR_ID;
+    metrics_callback("gateway_sbuffer_nodes", "readings in the shared buffer", METRIC_GAUGE, metric_sbuffer_nodes, NULL);
+    metrics_callback("gateway_datamgr_lag_readings", "readings received that datamgr did not take yet", METRIC_GAUGE,
+                     metric_reader_lag, &datamgr_id);
+    metrics_callback("gateway_storagemgr_lag_readings", "readings received that storagemgr did not take yet",
+                     METRIC_GAUGE, metric_reader_lag, &storagemgr_id);
+    metrics_callback("gateway_log_records_dropped_total", "log records dropped while the log process was behind",
+                     METRIC_COUNTER, metric_log_dropped, NULL);
+    if(metrics_serve_start(METRICS_SOCKET, METRICS_PORT) != 0) printf("metrics endpoint not possible to open\n");
+}
 
-            }
+/*
+ * logs the records dropped since the last report, if any, the log process writes to the ring like any thread
+ */
+void log_report_dropped(uint64_t *reported, uint64_t *reported_reserved) {
+
+    uint64_t dropped, reserved;
+    log_ring_dropped(log_ring, &dropped, &reserved);
+    if(dropped == *reported) return;
+    LOG_EVENT(log_ring, LOG_LEVEL_WARN, LOG_LOGGER, LOG_RECORDS_DROPPED, 3, LOG_I(dropped - *reported),
+              LOG_I(reserved - *reported_reserved), LOG_I(dropped));
+    *reported = dropped;
+    *reported_reserved = reserved;
+}
+
+/*
+ * the log process, turns the records of the ring into lines of LOG_FILE until main stops the ring
+ * rotated files are compressed by a thread of the log process
+ */
+void log_process(pid_t main_pid) {
+    log_rotate_t *rotate = log_rotate_start(LOG_FILE, LOG_ROTATE_BYTES, LOG_ROTATE_SECONDS, LOG_ROTATE_KEEP);
+    log_writer_t *writer = log_writer_open(LOG_FILE, LOG_FLUSH_BYTES, LOG_FLUSH_MS);
+    log_writer_rotate(writer, rotate);
+    log_record_t records[LOG_READ_BATCH];
+    int count;
+    uint64_t reported = 0, reported_reserved = 0;
+    time_t report = time(NULL) + LOG_DROP_REPORT_INTERVAL;
+    //records are read even without a log file, otherwise the gateway threads keep dropping them
+    while((count = log_ring_read_batch(log_ring, records, LOG_READ_BATCH,
+                                       writer != NULL ? log_writer_wait_ms(writer, 5000) : 5000)) >= 0) {
+        if(count == 0 && getppid() != main_pid) break; //main died without stopping the ring
+        if(time(NULL) >= report) {
+            log_report_dropped(&reported, &reported_reserved);
+            report = time(NULL) + LOG_DROP_REPORT_INTERVAL;
         }
+        if(writer == NULL) continue;
+        for(int i = 0; i < count; i++) log_writer_add(writer, &records[i]);
+        log_writer_poll(writer);
     }
+    //the last report is read back right away, the ring hands out what is left before it says stopped again
+    log_report_dropped(&reported, &reported_reserved);
+    while(writer != NULL && (count = log_ring_read_batch(log_ring, records, LOG_READ_BATCH, 0)) > 0) {
+        for(int i = 0; i < count; i++) log_writer_add(writer, &records[i]);
     }
+    DEBUG_PRINTF("log process exiting\n");
+    log_writer_close(writer);
+    log_rotate_stop(rotate);
+    exit(0);
 }
 
 
@@ -347,20 +644,27 @@ int main(int argc, char *argv[]) {
     }
 
 
+    //SIGHUP is only handled by the reload thread, block it before any thread or the log process exists
+    sigset_t hup;
+    sigemptyset(&hup);
+    sigaddset(&hup, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &hup, NULL);
+
     pid_t log_pid;
-    //create pipe
-    if(fifo_pipe_init(&log_pipe) == -1) mem_fail();
-    //random string generate
-    int magic = 12345;
-    char *magic_string;
-    asprintf(&magic_string,"%p", &magic);
+    if(log_levels_parse(getenv(LOG_LEVEL_ENV)) != 0) printf("cannot parse " LOG_LEVEL_ENV ", using what came before\n");
+    //the ring is shared with the log process, so it is mapped before the fork
+    log_ring = log_ring_create(LOG_RING_WRITERS, LOG_RING_SLOTS, LOG_RING_RESERVE);
+    if(log_ring == NULL) {
+        printf("FATAL ERROR: cannot map the log ring\n");
+        exit(EXIT_FAILURE);
+    }
+    pid_t main_pid = getpid();
     log_pid = fork();
     if(log_pid == 0) {
-        log_process(magic_string);
+        log_process(main_pid);
     }
-    fifo_pipe_close_output(log_pipe);
-    fifo_pipe_write(log_pipe, "MAIN: pipe is initialized");
-    pthread_t pthread_id_connmgr, pthread_id_datamgr, pthread_id_storagemgr;
+    LOG_EVENT(log_ring, LOG_LEVEL_INFO, LOG_MAIN, LOG_RING_READY, 0);
+    pthread_t pthread_id_connmgr, pthread_id_datamgr, pthread_id_storagemgr, pthread_id_reload;
     stop_threads = malloc(sizeof(pthread_mutex_t));
     if(stop_threads == NULL) mem_fail();
     pthread_mutex_init(stop_threads, NULL);
@@ -372,14 +676,16 @@ int main(int argc, char *argv[]) {
 
     if(sbuffer_init(&shared_buffer) != SBUFFER_SUCCESS) {
         DEBUG_PRINTF("buffer not possible to open");
-        fifo_pipe_write(log_pipe, "buffer not possible to open");
+        LOG_EVENT(log_ring, LOG_LEVEL_ERROR, LOG_MAIN, LOG_BUFFER_FAIL, 0);
+        log_ring_stop(log_ring);
         exit(EXIT_FAILURE);
     }
 
-    FILE *fp_sensor_map = fopen("./room_sensor.map", "r");
+    FILE *fp_sensor_map = fopen(SENSOR_MAP_FILE, "r");
     if (fp_sensor_map == NULL) {
         DEBUG_PRINTF("sensor map not possible to open");
-        fifo_pipe_write(log_pipe, "sensor map not possible to open");
+        LOG_EVENT(log_ring, LOG_LEVEL_ERROR, LOG_MAIN, LOG_MAP_OPEN_FAIL, 0);
+        log_ring_stop(log_ring);
         exit(EXIT_FAILURE);
     }
 
@@ -390,30 +696,38 @@ int main(int argc, char *argv[]) {
     arg_connmgr->sb = shared_buffer;
     arg_connmgr->lock = stop_threads;
     arg_connmgr->stop_threads_flag = stop_threads_flag;
-    arg_connmgr->log_pipe = log_pipe;
+    arg_connmgr->log_ring = log_ring;
 
     arg_struct_datamgr_t *arg_datamgr = malloc(sizeof(arg_struct_datamgr_t));
     if(arg_datamgr == NULL) mem_fail();
 
     arg_datamgr->fp_sensor_map = fp_sensor_map;
+    datamgr_set_alert_sink(datamgr_alert, NULL);
+    trace_init();
+    metrics_start();
 
     pthread_create(&pthread_id_connmgr, NULL, connmgr_listen,(void *) arg_connmgr);
     pthread_create(&pthread_id_datamgr, NULL, datamgr_thread, (void *) arg_datamgr);
     pthread_create(&pthread_id_storagemgr, NULL, storagemgr_thread, NULL);
+    pthread_create(&pthread_id_reload, NULL, reload_thread, NULL);
 
     pthread_join(pthread_id_connmgr, NULL);
     pthread_join(pthread_id_datamgr, NULL);
     pthread_join(pthread_id_storagemgr, NULL);
+    pthread_join(pthread_id_reload, NULL);
+
+    datamgr_free();
 
+    metrics_serve_stop(); //its gauges read the shared buffer
     sbuffer_clear(&shared_buffer);
 
     DEBUG_PRINTF("all threads exited");
     //now kill the log process (unreliable on mem_fail())
-    fifo_pipe_write_magic(log_pipe, magic_string); //writing magic_string to pipe terminates log_process
-    wait(NULL);
+    log_ring_stop(log_ring); //the log process exits once it wrote what is left in the ring
+    waitpid(log_pid, NULL, 0);
+    log_ring_destroy(log_ring);
     free(stop_threads);
     free(stop_threads_flag);
-    free(magic_string);
     free(arg_connmgr);
     free(arg_datamgr);
 }
@@ -0,0 +1,369 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include "config.h"
+#include "metrics.h"
+
+#define METRICS_POLL_MS 500                 //longest the serving thread takes to see it is stopped
+#define METRICS_CLIENT_TIMEOUT 1            //seconds a client gets to send its request and take the snapshot
+
+struct metric {
+    char *name;
+    char *help;
+    char *label;
+    metric_type_t type;
+    _Atomic uint64_t counter;
+    _Atomic int64_t gauge;
+    _Atomic uint64_t *counters;             //of a counter vec
+    int size;
+    _Atomic uint64_t buckets[HISTOGRAM_BUCKETS];
+    _Atomic uint64_t sum;
+    int64_t (*read)(void *arg);
+    void *arg;
+};
+
+//registered metrics are never removed, a snapshot reads the first metrics_count without the lock
+static metric_t metrics[METRICS_MAX];
+static _Atomic int metrics_count = 0;
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_t serve_thread;
+static _Atomic int serve_stop = 0;
+static int unix_fd = -1;
+static int http_fd = -1;
+static struct sockaddr_un unix_address;
+
+/*
+ * registers a metric or finds the one with the same name, the caller fills in the rest under the lock
+ */
+static metric_t *metric_register(const char *name, const char *help, metric_type_t type, int *fresh) {
+
+    int count = atomic_load_explicit(&metrics_count, memory_order_relaxed);
+    for(int i = 0; i < count; i++) {
+        if(strcmp(metrics[i].name, name) == 0) return &metrics[i];
+    }
+    if(count == METRICS_MAX) {
+        DEBUG_PRINTF("no room for metric %s", name);
+        return NULL;
+    }
+    metric_t *metric = &metrics[count];
+    metric->name = strdup(name);
+    metric->help = strdup(help);
+    if(metric->name == NULL || metric->help == NULL) {
+        free(metric->name);
+        free(metric->help);
+        memset(metric, 0, sizeof(metric_t));
+        return NULL;
+    }
+    metric->type = type;
+    *fresh = 1;
+    return metric;
+}
+
+/*
+ * makes a metric filled in by metric_register() visible to snapshots
+ */
+static void metric_publish(metric_t *metric) {
+    atomic_store_explicit(&metrics_count, (int) (metric - metrics) + 1, memory_order_release);
+}
+
+static metric_t *metric_simple(const char *name, const char *help, metric_type_t type) {
+    int fresh = 0;
+    pthread_mutex_lock(&metrics_lock);
+    metric_t *metric = metric_register(name, help, type, &fresh);
+    if(fresh) metric_publish(metric);
+    pthread_mutex_unlock(&metrics_lock);
+    return metric;
+}
+
+metric_t *metrics_counter(const char *name, const char *help) {
+    return metric_simple(name, help, METRIC_COUNTER);
+}
+
+metric_t *metrics_gauge(const char *name, const char *help) {
+    return metric_simple(name, help, METRIC_GAUGE);
+}
+
+metric_t *metrics_histogram(const char *name, const char *help) {
+    return metric_simple(name, help, METRIC_HISTOGRAM);
+}
+
+metric_t *metrics_counter_vec(const char *name, const char *help, const char *label, int size) {
+
+    int fresh = 0;
+    pthread_mutex_lock(&metrics_lock);
+    metric_t *metric = metric_register(name, help, METRIC_COUNTER, &fresh);
+    if(fresh) {
+        metric->label = strdup(label);
+        metric->counters = calloc(size > 0 ? (size_t) size : 1, sizeof(_Atomic uint64_t));
+        if(metric->label == NULL || metric->counters == NULL) {
+            free(metric->name);
+            free(metric->help);
+            free(metric->label);
+            free((void *) metric->counters);
+            memset(metric, 0, sizeof(metric_t));
+            metric = NULL;
+        } else {
+            metric->size = size;
+            metric_publish(metric);
+        }
+    }
+    pthread_mutex_unlock(&metrics_lock);
+    return metric;
+}
+
+metric_t *metrics_callback(const char *name, const char *help, metric_type_t type, int64_t (*read)(void *arg),
+                           void *arg) {
+    int fresh = 0;
+    pthread_mutex_lock(&metrics_lock);
+    metric_t *metric = metric_register(name, help, type == METRIC_COUNTER ? METRIC_COUNTER : METRIC_GAUGE, &fresh);
+    if(fresh) {
+        metric->read = read;
+        metric->arg = arg;
+        metric_publish(metric);
+    }
+    pthread_mutex_unlock(&metrics_lock);
+    return metric;
+}
+
+void metrics_add(metric_t *metric, uint64_t n) {
+    if(metric != NULL) atomic_fetch_add_explicit(&(metric->counter), n, memory_order_relaxed);
+}
+
+void metrics_add_at(metric_t *metric, int index, uint64_t n) {
+    if(metric == NULL || index < 0 || index >= metric->size) return;
+    atomic_fetch_add_explicit(&(metric->counters[index]), n, memory_order_relaxed);
+}
+
+void metrics_set(metric_t *metric, int64_t value) {
+    if(metric != NULL) atomic_store_explicit(&(metric->gauge), value, memory_order_relaxed);
+}
+
+void metrics_observe(metric_t *metric, uint64_t value) {
+    if(metric == NULL) return;
+    atomic_fetch_add_explicit(&(metric->buckets[histogram_bucket(value)]), 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&(metric->sum), value, memory_order_relaxed);
+}
+
+void metrics_histogram_get(metric_t *metric, histogram_t *histogram) {
+    histogram_reset(histogram);
+    if(metric == NULL) return;
+    for(int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        histogram->buckets[b] = atomic_load_explicit(&(metric->buckets[b]), memory_order_relaxed);
+        histogram->count += histogram->buckets[b];
+        if(histogram->buckets[b] > 0) histogram->max = histogram_bucket_bound(b);
+    }
+    histogram->sum = atomic_load_explicit(&(metric->sum), memory_order_relaxed);
+}
+
+static void write_histogram(FILE *fp, metric_t *metric) {
+
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+    int last = 0;
+    for(int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        buckets[b] = atomic_load_explicit(&(metric->buckets[b]), memory_order_relaxed);
+        if(buckets[b] > 0) last = b;
+    }
+    //the count is the sum of the buckets copied, so the snapshot of one histogram is consistent in itself
+    uint64_t count = 0;
+    for(int b = 0; b <= last; b++) {
+        count += buckets[b];
+        fprintf(fp, "%s_bucket{le=\"%llu\"} %llu\n", metric->name, (unsigned long long) histogram_bucket_bound(b),
+                (unsigned long long) count);
+    }
+    fprintf(fp, "%s_bucket{le=\"+Inf\"} %llu\n", metric->name, (unsigned long long) count);
+    fprintf(fp, "%s_sum %llu\n", metric->name,
+            (unsigned long long) atomic_load_explicit(&(metric->sum), memory_order_relaxed));
+    fprintf(fp, "%s_count %llu\n", metric->name, (unsigned long long) count);
+}
+
+void metrics_write(FILE *fp) {
+
+    static const char *type_names[] = {"counter", "gauge", "histogram"};
+    int count = atomic_load_explicit(&metrics_count, memory_order_acquire);
+    for(int i = 0; i < count; i++) {
+        metric_t *metric = &metrics[i];
+        fprintf(fp, "# HELP %s %s\n# TYPE %s %s\n", metric->name, metric->help, metric->name,
+                type_names[metric->type]);
+        if(metric->read != NULL) {
+            fprintf(fp, "%s %lld\n", metric->name, (long long) metric->read(metric->arg));
+        } else if(metric->counters != NULL) {
+            for(int j = 0; j < metric->size; j++) {
+                uint64_t value = atomic_load_explicit(&(metric->counters[j]), memory_order_relaxed);
+                if(value > 0) fprintf(fp, "%s{%s=\"%i\"} %llu\n", metric->name, metric->label, j, (unsigned long long) value);
+            }
+        } else if(metric->type == METRIC_COUNTER) {
+            fprintf(fp, "%s %llu\n", metric->name,
+                    (unsigned long long) atomic_load_explicit(&(metric->counter), memory_order_relaxed));
+        } else if(metric->type == METRIC_GAUGE) {
+            fprintf(fp, "%s %lld\n", metric->name,
+                    (long long) atomic_load_explicit(&(metric->gauge), memory_order_relaxed));
+        } else {
+            write_histogram(fp, metric);
+        }
+    }
+}
+
+/*
+ * \return a snapshot in a buffer to free(), NULL if it cannot be allocated
+ */
+static char *snapshot(size_t *length) {
+    char *text = NULL;
+    FILE *fp = open_memstream(&text, length);
+    if(fp == NULL) return NULL;
+    metrics_write(fp);
+    if(fclose(fp) != 0) {
+        free(text);
+        return NULL;
+    }
+    return text;
+}
+
+static void send_all(int fd, const char *buf, size_t length) {
+    while(length > 0) {
+        ssize_t sent = send(fd, buf, length, MSG_NOSIGNAL);
+        if(sent < 0) {
+            if(errno == EINTR) continue;
+            return;
+        }
+        buf += sent;
+        length -= (size_t) sent;
+    }
+}
+
+/*
+ * reads the request up to the empty line that ends its head, the body of a request is not looked at
+ */
+static void read_request(int fd) {
+    char request[2048];
+    size_t length = 0;
+    while(length < sizeof(request) - 1) {
+        ssize_t received = recv(fd, request + length, sizeof(request) - 1 - length, 0);
+        if(received <= 0) return;
+        length += (size_t) received;
+        request[length] = '\0';
+        if(strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL) return;
+    }
+}
+
+static void serve_client(int listen_fd, int http) {
+
+    int fd = accept(listen_fd, NULL, NULL);
+    if(fd < 0) return;
+    //a client that stalls holds up the next scrape, not the gateway
+    struct timeval timeout = {METRICS_CLIENT_TIMEOUT, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if(http) read_request(fd);
+    size_t length = 0;
+    char *text = snapshot(&length);
+    if(http) {
+        char head[160];
+        int head_length = snprintf(head, sizeof(head), "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                   "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                                   text != NULL ? "200 OK" : "500 Internal Server Error", text != NULL ? length : 0);
+        send_all(fd, head, (size_t) head_length);
+    }
+    if(text != NULL) send_all(fd, text, length);
+    free(text);
+    close(fd);
+}
+
+static void *serve(void *arg) {
+
+    struct pollfd fds[2];
+    int http[2];
+    int nfds = 0;
+    if(unix_fd >= 0) {
+        fds[nfds] = (struct pollfd) {.fd = unix_fd, .events = POLLIN};
+        http[nfds++] = 0;
+    }
+    if(http_fd >= 0) {
+        fds[nfds] = (struct pollfd) {.fd = http_fd, .events = POLLIN};
+        http[nfds++] = 1;
+    }
+    while(!atomic_load(&serve_stop)) {
+        if(poll(fds, (nfds_t) nfds, METRICS_POLL_MS) <= 0) continue;
+        for(int i = 0; i < nfds; i++) {
+            if(fds[i].revents & POLLIN) serve_client(fds[i].fd, http[i]);
+        }
+    }
+    return NULL;
+}
+
+static int open_unix(const char *path) {
+
+    if(strlen(path) >= sizeof(unix_address.sun_path)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) return -1;
+    memset(&unix_address, 0, sizeof(unix_address));
+    unix_address.sun_family = AF_UNIX;
+    strcpy(unix_address.sun_path, path);
+    unlink(path); //left by a gateway that did not stop cleanly
+    if(bind(fd, (struct sockaddr *) &unix_address, sizeof(unix_address)) != 0 || listen(fd, 8) != 0) {
+        DEBUG_PRINTF("cannot listen on %s", path);
+        close(fd);
+        return -1;
+    }
+    chmod(path, 0600);
+    return fd;
+}
+
+static int open_http(int port) {
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0) return -1;
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons((uint16_t) port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK); //metrics are not for the network the sensors are on
+    if(bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(fd, 8) != 0) {
+        DEBUG_PRINTF("cannot listen on 127.0.0.1:%i", port);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int metrics_serve_start(const char *path, int port) {
+
+    unix_fd = path != NULL ? open_unix(path) : -1;
+    http_fd = port > 0 ? open_http(port) : -1;
+    if(unix_fd < 0 && http_fd < 0) return -1;
+    atomic_store(&serve_stop, 0);
+    if(pthread_create(&serve_thread, NULL, serve, NULL) != 0) {
+        atomic_store(&serve_stop, 1); //nothing to join
+        metrics_serve_stop();
+        return -1;
+    }
+    return 0;
+}
+
+void metrics_serve_stop() {
+
+    if(unix_fd < 0 && http_fd < 0) return;
+    if(!atomic_exchange(&serve_stop, 1)) pthread_join(serve_thread, NULL);
+    if(unix_fd >= 0) {
+        close(unix_fd);
+        unlink(unix_address.sun_path);
+    }
+    if(http_fd >= 0) close(http_fd);
+    unix_fd = -1;
+    http_fd = -1;
+}
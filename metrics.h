@@ -0,0 +1,81 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "histogram.h"
+
+/*
+ * counters, gauges and histograms of the gateway, served as a Prometheus text snapshot
+ *
+ * modules register their metrics once and update them with relaxed atomics, a snapshot reads the same atomics, so
+ * neither updating nor reading takes a lock of the pipeline, a snapshot is not taken at one instant, every value in
+ * it is one the metric really had
+ * a callback metric is read when the snapshot is taken, it must not block either
+ * registering a name again returns the metric already registered, registering more than METRICS_MAX returns NULL
+ * and every update function takes NULL, so a module works without its metrics
+ *
+ * histograms have the power of two buckets of histogram.h
+ */
+
+typedef struct metric metric_t;
+
+enum metric_type {METRIC_COUNTER, METRIC_GAUGE, METRIC_HISTOGRAM};
+typedef enum metric_type metric_type_t;
+
+metric_t *metrics_counter(const char *name, const char *help);
+
+/*
+ * counters labelled label="i" for i from 0 to size - 1, only the ones that are not 0 show up in a snapshot
+ */
+metric_t *metrics_counter_vec(const char *name, const char *help, const char *label, int size);
+
+metric_t *metrics_gauge(const char *name, const char *help);
+
+metric_t *metrics_histogram(const char *name, const char *help);
+
+/*
+ * a counter or gauge whose value is read from read(arg) at every snapshot
+ */
+metric_t *metrics_callback(const char *name, const char *help, metric_type_t type, int64_t (*read)(void *arg),
+                           void *arg);
+
+void metrics_add(metric_t *metric, uint64_t n);
+
+/*
+ * adds n to the counter labelled index, indexes out of range are ignored
+ */
+void metrics_add_at(metric_t *metric, int index, uint64_t n);
+
+void metrics_set(metric_t *metric, int64_t value);
+
+void metrics_observe(metric_t *metric, uint64_t value);
+
+/*
+ * copies a histogram metric for histogram_percentile(), max is the bound of the highest bucket in use
+ */
+void metrics_histogram_get(metric_t *metric, histogram_t *histogram);
+
+/*
+ * writes a snapshot of every metric in the Prometheus text format
+ */
+void metrics_write(FILE *fp);
+
+/*
+ * starts a thread serving snapshots, on the Unix socket at path and over HTTP on 127.0.0.1:port
+ * \param path NULL for no Unix socket, a snapshot is written to every client that connects
+ * \param port 0 for no HTTP endpoint, every request is answered with a snapshot
+ * \return 0 for success, -1 if neither can be opened or the thread not started
+ */
+int metrics_serve_start(const char *path, int port);
+
+/*
+ * stops the thread and removes the Unix socket
+ */
+void metrics_serve_stop();
+
+#endif /* _METRICS_H_ */
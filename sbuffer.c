@@ -9,26 +9,17 @@
 #include <sys/time.h>
 #include <pthread.h>
 #include <errno.h>
+#include <stdatomic.h>
 #include "config.h"
 
 
-
-#ifdef DEBUG
-#define DEBUG_PRINTF(...) 									                                        \
-        do {											                                            \
-            fprintf(stderr,"\nIn %s - function %s at line %d: ", __FILE__, __func__, __LINE__);	    \
-            fprintf(stderr,__VA_ARGS__);								                            \
-            fflush(stderr);                                                                         \
-                } while(0)
-#else
-#define DEBUG_PRINTF(...) (void)0
-#endif
 /**
  * basic node for the buffer, these nodes are linked together to create the buffer
  */
 struct sbuffer_node {
     struct sbuffer_node *next;  /**< a pointer to the next node*/
     sensor_data_t data;         /**< a structure containing the data */
+    int64_t received;           /**< trace stamp, 0 if not traced */
     unsigned char read_count[2];
 };
 
@@ -42,6 +33,10 @@ struct sbuffer {
     pthread_mutex_t lock2;
     pthread_cond_t new_unread1;
     pthread_cond_t new_unread2;
+    _Atomic uint64_t inserted;  /**< counters for sbuffer_get_stats(), written under the locks, read without them */
+    _Atomic uint64_t read[2];
+    _Atomic uint64_t nodes;
+    int64_t last_received[2];   /**< trace stamp of the node each reader read last, only used by that reader */
 };
 
 int sbuffer_init(sbuffer_t **buffer) {
@@ -53,6 +48,11 @@ int sbuffer_init(sbuffer_t **buffer) {
     pthread_mutex_init(&((*buffer)->lock2), NULL);
     pthread_cond_init(&((*buffer)->new_unread1), NULL);
     pthread_cond_init(&((*buffer)->new_unread2), NULL);
+    atomic_init(&((*buffer)->inserted), 0);
+    atomic_init(&((*buffer)->read[0]), 0);
+    atomic_init(&((*buffer)->read[1]), 0);
+    atomic_init(&((*buffer)->nodes), 0);
+    (*buffer)->last_received[0] = (*buffer)->last_received[1] = 0;
     return SBUFFER_SUCCESS;
 }
 
@@ -77,6 +77,7 @@ int sbuffer_remove(sbuffer_t *buffer, sbuffer_node_t *node) {
    {
         DEBUG_PRINTF("buffer only has one node");
         free(buffer->head);
+        atomic_fetch_sub_explicit(&(buffer->nodes), 1, memory_order_relaxed);
         buffer->head = buffer->tail = NULL;
         return SBUFFER_SUCCESS;
    }
@@ -86,6 +87,7 @@ int sbuffer_remove(sbuffer_t *buffer, sbuffer_node_t *node) {
        DEBUG_PRINTF("buffer has multiple nodes");
        buffer->head = dummy->next;
        free(dummy);
+       atomic_fetch_sub_explicit(&(buffer->nodes), 1, memory_order_relaxed);
        dummy = buffer->head;
    }
 
@@ -96,11 +98,46 @@ int sbuffer_remove(sbuffer_t *buffer, sbuffer_node_t *node) {
         buffer->head=buffer->tail=NULL;
         free(dummy);
     }
+    atomic_fetch_sub_explicit(&(buffer->nodes), 1, memory_order_relaxed);
     return SBUFFER_SUCCESS;
 }
 
 
 
+/*
+ * takes the first node not read by reader_id yet, caller holds the lock of the reader
+ */
+static int read_unread_locked(sbuffer_t *buffer, sensor_data_t *data, int reader_id) {
+    for(sbuffer_node_t *node = buffer->head; node != NULL; node = node->next) {
+        if(node->read_count[reader_id] == 0) {
+            node->read_count[reader_id] = 1;
+            atomic_fetch_add_explicit(&(buffer->read[reader_id]), 1, memory_order_release);
+            *data = node->data;
+            buffer->last_received[reader_id] = node->received;
+            return node->next != NULL ? SBUFFER_MORE_AVAILABLE : SBUFFER_SUCCESS;
+        }
+    }
+    return buffer->head == NULL ? SBUFFER_FAILURE : SBUFFER_NO_DATA;
+}
+
+int sbuffer_read_until(sbuffer_t *buffer, sensor_data_t *data, int reader_id, const struct timespec *deadline) {
+
+    pthread_mutex_t *my_lock = reader_id == STORAGEMGR_ID ? &(buffer->lock1) : &(buffer->lock2);
+    pthread_cond_t *my_cond = reader_id == STORAGEMGR_ID ? &(buffer->new_unread1) : &(buffer->new_unread2);
+    pthread_mutex_lock(my_lock);
+    int status = read_unread_locked(buffer, data, reader_id);
+    while(status == SBUFFER_NO_DATA || status == SBUFFER_FAILURE) {
+        if(pthread_cond_timedwait(my_cond, my_lock, deadline) == ETIMEDOUT) {
+            status = read_unread_locked(buffer, data, reader_id);
+            if(status == SBUFFER_NO_DATA || status == SBUFFER_FAILURE) status = SBUFFER_TIMEOUT;
+            break;
+        }
+        status = read_unread_locked(buffer, data, reader_id);
+    }
+    pthread_mutex_unlock(my_lock);
+    return status;
+}
+
 int sbuffer_read(sbuffer_t *buffer, sensor_data_t *data, int reader_id, char blocking) {
 
     sbuffer_node_t *dummy;
@@ -154,7 +191,9 @@ int sbuffer_read(sbuffer_t *buffer, sensor_data_t *data, int reader_id, char blo
         //not read yet
         if(dummy->read_count[reader_id] == 0) {
             dummy->read_count[reader_id] = 1;
+            atomic_fetch_add_explicit(&(buffer->read[reader_id]), 1, memory_order_release);
             *data = dummy->data;
+            buffer->last_received[reader_id] = dummy->received;
             status = 0;
             if(dummy->next != NULL) {
                 DEBUG_PRINTF("more avail");
@@ -186,6 +225,14 @@ int sbuffer_read(sbuffer_t *buffer, sensor_data_t *data, int reader_id, char blo
 
 
 int sbuffer_insert(sbuffer_t *buffer, sensor_data_t *data) {
+    return sbuffer_insert_traced(buffer, data, 0);
+}
+
+int64_t sbuffer_last_received(sbuffer_t *buffer, int reader_id) {
+    return buffer->last_received[reader_id];
+}
+
+int sbuffer_insert_traced(sbuffer_t *buffer, sensor_data_t *data, int64_t received) {
     DEBUG_PRINTF("inserting ...");
     pthread_mutex_lock(&(buffer->lock1));
     DEBUG_PRINTF("lock1 taken by write");
@@ -196,8 +243,11 @@ int sbuffer_insert(sbuffer_t *buffer, sensor_data_t *data) {
     dummy = malloc(sizeof(sbuffer_node_t));
     if (dummy == NULL) return SBUFFER_FAILURE;
     dummy->data = *data;
+    dummy->received = received;
     dummy->next = NULL;
     memset(dummy->read_count, 0, sizeof(unsigned char)*2);
+    atomic_fetch_add_explicit(&(buffer->inserted), 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&(buffer->nodes), 1, memory_order_relaxed);
     if (buffer->tail == NULL) // buffer empty (buffer->head should also be NULL
     {
         //DEBUG_PRINTF("buffer empty");
@@ -247,6 +297,14 @@ int sbuffer_remove_read(sbuffer_t *buffer) {
     return SBUFFER_SUCCESS;
 }
 
+void sbuffer_get_stats(sbuffer_t *buffer, sbuffer_stats_t *stats) {
+    //a node is counted as inserted before a reader can take it, read first so inserted is never below read
+    stats->read[0] = atomic_load_explicit(&(buffer->read[0]), memory_order_acquire);
+    stats->read[1] = atomic_load_explicit(&(buffer->read[1]), memory_order_acquire);
+    stats->inserted = atomic_load_explicit(&(buffer->inserted), memory_order_relaxed);
+    stats->nodes = atomic_load_explicit(&(buffer->nodes), memory_order_relaxed);
+}
+
 int sbuffer_clear(sbuffer_t **buffer) {
     sbuffer_t *buf_p = *buffer;
     if(buf_p->head == NULL) {
@@ -6,8 +6,9 @@
 #define _SBUFFER_H_
 
 #include <pthread.h>
+#include <stdint.h>
 #include "config.h"
-#include "fifo_pipe.h"
+#include "log_ring.h"
 
 
 #define SBUFFER_FAILURE -1
@@ -22,6 +23,12 @@
 typedef struct sbuffer sbuffer_t;
 typedef struct sbuffer_node sbuffer_node_t;
 
+typedef struct {
+    uint64_t inserted;
+    uint64_t read[2];           /** < nodes read by DATAMGR_ID and STORAGEMGR_ID */
+    uint64_t nodes;             /** < nodes in the buffer, read or not */
+} sbuffer_stats_t;
+
 
 //should not be here
 struct arg_struct_connmgr {
@@ -30,7 +37,7 @@ struct arg_struct_connmgr {
     FILE *fp_sensor_map;
     pthread_mutex_t *lock;
     int *stop_threads_flag;
-    fifo_pipe_t *log_pipe;
+    log_ring_t *log_ring;
 };
 typedef struct arg_struct_connmgr arg_struct_connmgr_t;
 
@@ -64,6 +71,16 @@ int sbuffer_remove(sbuffer_t *buffer, sbuffer_node_t *node);
  * \return SBUFFER_SUCCESS on success and SBUFFER_FAILURE if an error occured
 */
 int sbuffer_insert(sbuffer_t *buffer, sensor_data_t *data);
+
+/*
+ * sbuffer_insert() of a reading with its trace stamp (trace.h), 0 if it is not traced
+ */
+int sbuffer_insert_traced(sbuffer_t *buffer, sensor_data_t *data, int64_t received);
+
+/*
+ * trace stamp of the node reader_id read last, only to be called by that reader
+ */
+int64_t sbuffer_last_received(sbuffer_t *buffer, int reader_id);
 /*
  * reads node from sbuffer that has not been read already by this reader
  *
@@ -78,6 +95,13 @@ int sbuffer_insert(sbuffer_t *buffer, sensor_data_t *data);
  */
 int sbuffer_read(sbuffer_t *buffer, sensor_data_t *data, int reader_id, char blocking);
 
+/*
+ * reads the next node not read by this reader yet, waits for one until deadline (CLOCK_REALTIME) if there is none
+ * unlike blocking sbuffer_read() it returns right away when unread nodes are already there
+ * \return SBUFFER_SUCCESS or SBUFFER_MORE_AVAILABLE with data filled in, SBUFFER_TIMEOUT once deadline passed
+ */
+int sbuffer_read_until(sbuffer_t *buffer, sensor_data_t *data, int reader_id, const struct timespec *deadline);
+
 /*
  * remove nodes that are read by both readers already
  */
@@ -88,4 +112,10 @@ int sbuffer_remove_read(sbuffer_t *buffer);
  */
 int sbuffer_clear(sbuffer_t **buffer);
 
+/*
+ * copies the counters of the buffer without taking its locks, for monitoring from any thread
+ * inserted is at least read, so inserted - read is never negative
+ */
+void sbuffer_get_stats(sbuffer_t *buffer, sbuffer_stats_t *stats);
+
 #endif  //_SBUFFER_H_
@@ -2,79 +2,204 @@
 #include <stdlib.h>
 #include <sqlite3.h> 
 #include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "config.h"
 #include "sensor_db.h"
+#include "storage_profile.h"
+#include "storage_partition.h"
+
+
+#define INSERT_SQL  "INSERT INTO \"%s\"(sensor_id, sensor_value, timestamp) VALUES (?, ?, ?);"
+
+#define SELECT_SQL  "SELECT id, sensor_id, sensor_value, timestamp FROM " TABLE_NAME
+#define SPOOL_TABLE TABLE_NAME "_spool"     //per spool file the last batch replayed from it, see storage_spool.h
+
+static const char *query_sql[] = {
+    [SENSOR_QUERY_ALL]              = SELECT_SQL ";",
+    [SENSOR_QUERY_BY_VALUE]         = SELECT_SQL " WHERE sensor_value = ?1;",
+    [SENSOR_QUERY_EXCEED_VALUE]     = SELECT_SQL " WHERE sensor_value > ?1;",
+    [SENSOR_QUERY_BY_TIMESTAMP]     = SELECT_SQL " WHERE timestamp = ?2;",
+    [SENSOR_QUERY_AFTER_TIMESTAMP]  = SELECT_SQL " WHERE timestamp > ?2 ORDER BY timestamp;",
+    [SENSOR_QUERY_BY_SENSOR]        = SELECT_SQL " WHERE sensor_id = ?3 AND timestamp BETWEEN ?2 AND ?4 ORDER BY timestamp;",
+    [SENSOR_QUERY_TIME_RANGE]       = SELECT_SQL " WHERE timestamp BETWEEN ?2 AND ?4 ORDER BY timestamp;",
+};
+
+/*
+ * a cursor always stands on its next row (ready = 1) so the statement stays busy and is not handed to another cursor
+ * once the result ended (0) or failed (-1) the statement is reset and no longer touched by this cursor
+ */
+struct sensor_cursor {
+    DBCONN *conn;
+    sqlite3_stmt *stmt;
+    int ready;
+};
+
+/*
+ * the partition the last reading went to, readings that follow mostly go to the same one
+ */
+typedef struct {
+    int64_t day;
+    sqlite3_stmt *stmt;
+    int with_indexes;           //for partitions created on the way
+} insert_target_t;
 
 
-#ifdef DEBUG
-#define DEBUG_PRINTF(...) 									                                        \
-        do {											                                            \
-            fprintf(stderr,"\nIn %s - function %s at line %d: ", __FILE__, __func__, __LINE__);	    \
-            fprintf(stderr,__VA_ARGS__);								                            \
-            fflush(stderr);                                                                         \
-                } while(0)
-#else
-#define DEBUG_PRINTF(...) (void)0
-#endif
+DBCONN *init_connection(char clear_up_flag, status_code_storagemgr_t *status, char *table_name) {
 
+    DBCONN *db = init_connection_at(DB_NAME, clear_up_flag, status);
+    if(db != NULL && clear_up_flag) strcpy(table_name, TABLE_NAME);
+    return db;
+}
 
-DBCONN *init_connection(char clear_up_flag, status_code_storagemgr_t *status, char *table_name) {
+DBCONN *init_connection_at(const char *path, char clear_up_flag, status_code_storagemgr_t *status) {
     
     sqlite3 *db;
-    int rc = sqlite3_open(DB_NAME, &db);
+    int rc = sqlite3_open(path, &db);
     if (rc != SQLITE_OK) {
         DEBUG_PRINTF("cannot open db");
         sqlite3_close(db);
         *status = STATUS_FAILURE;
         return NULL;
     }
+    sqlite3_busy_timeout(db, STORAGE_BUSY_TIMEOUT);
+    if(storage_profile_apply(db, storage_profile_find(STORAGE_PROFILE)) != STATUS_OK) {
+        DEBUG_PRINTF("cannot apply storage profile " STORAGE_PROFILE);
+        sqlite3_close(db);
+        *status = STATUS_FAILURE;
+        return NULL;
+    }
+    //partitions, rollups and the TABLE_NAME view, see storage_partition.h
+    if(storage_partition_init(db, clear_up_flag) != STATUS_OK) {
+        DEBUG_PRINTF("cannot access data, %s", sqlite3_errmsg(db));
+        sqlite3_close(db);
+        *status = STATUS_FAILURE;
+        return NULL;
+    }
+    if(sqlite3_exec(db, "CREATE TABLE IF NOT EXISTS " SPOOL_TABLE " (spool INTEGER PRIMARY KEY, seq INTEGER NOT NULL);",
+                    0, 0, NULL) != SQLITE_OK) {
+        DEBUG_PRINTF("cannot create " SPOOL_TABLE ", %s", sqlite3_errmsg(db));
+        sqlite3_close(db);
+        *status = STATUS_FAILURE;
+        return NULL;
+    }
     if(clear_up_flag) {
-        //clear table
-        char *query = "DROP TABLE IF EXISTS "
-                    TABLE_NAME
-                    ";"
-                    "CREATE TABLE "
-                    TABLE_NAME
-                    " (id INTEGER PRIMARY KEY AUTOINCREMENT,"
-                    "sensor_id INTEGER,"
-                    "sensor_value DECIMAL(4,2), "
-                    "timestamp TIMESTAMP);";
-        char *err_msg;
-        rc = sqlite3_exec(db, query, 0, 0, &err_msg);
-        if(rc != SQLITE_OK) {
-            DEBUG_PRINTF("cannot access data, %s", err_msg);
-            sqlite3_free(err_msg);
-            sqlite3_close(db);
-            *status = STATUS_FAILURE;
-            return NULL;
-        }
         *status = STATUS_NEW_TABLE;
-        strcpy(table_name, TABLE_NAME);
         return db;//TODO STATUS_OK
-    } else {
-        *status = STATUS_OK;
-        return db;
     }
+    *status = STATUS_OK;
+    return db;
+}
+
+DBCONN *init_read_connection() {
+    return init_read_connection_at(DB_NAME);
+}
+
+DBCONN *init_read_connection_at(const char *path) {
+
+    sqlite3 *db;
+    if(sqlite3_open_v2(path, &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+        DEBUG_PRINTF("cannot open db for reading");
+        sqlite3_close(db);
+        return NULL;
+    }
+    sqlite3_busy_timeout(db, STORAGE_BUSY_TIMEOUT);
+    if(storage_profile_apply_reader(db, storage_profile_find(STORAGE_PROFILE)) != STATUS_OK) {
+        DEBUG_PRINTF("cannot apply storage profile " STORAGE_PROFILE);
+        sqlite3_close(db);
+        return NULL;
+    }
+    return db;
 }
 
 void disconnect(DBCONN *db) {
+    //prepared statements belong to the connection and have to go first
+    sqlite3_stmt *stmt;
+    while((stmt = sqlite3_next_stmt(db, NULL)) != NULL) sqlite3_finalize(stmt);
     sqlite3_close(db);
     
 }
+
+/*
+ * the connection keeps track of its statements, so there is no cache of our own to keep in sync
+ * a statement an open cursor is still stepping through is not handed out again
+ */
+static sqlite3_stmt *cached_statement(DBCONN *conn, const char *sql) {
+    sqlite3_stmt *stmt = NULL;
+    while((stmt = sqlite3_next_stmt(conn, stmt)) != NULL) {
+        if(!sqlite3_stmt_busy(stmt) && strcmp(sqlite3_sql(stmt), sql) == 0) return stmt;
+    }
+    return NULL;
+}
+
+void forget_statements(DBCONN *conn, const char *match) {
+    sqlite3_stmt *stmt = sqlite3_next_stmt(conn, NULL);
+    while(stmt != NULL) {
+        sqlite3_stmt *next = sqlite3_next_stmt(conn, stmt);
+        if(!sqlite3_stmt_busy(stmt) && strstr(sqlite3_sql(stmt), match) != NULL) sqlite3_finalize(stmt);
+        stmt = next;
+    }
+}
+
+/*
+ * returns the prepared statement for sql, prepares it on first use
+ */
+static sqlite3_stmt *prepared_statement(DBCONN *conn, const char *sql) {
+    sqlite3_stmt *stmt = cached_statement(conn, sql);
+    if(stmt != NULL) return stmt;
+    if(sqlite3_prepare_v2(conn, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        DEBUG_PRINTF("cannot prepare %s, %s", sql, sqlite3_errmsg(conn));
+        return NULL;
+    }
+    return stmt;
+}
+
+static int insert_row(sqlite3_stmt *stmt, sensor_id_t id, sensor_value_t value, sensor_ts_t ts) {
+    sqlite3_bind_int(stmt, 1, id);
+    sqlite3_bind_double(stmt, 2, round(value*100)/100);   //same 2 decimals the table always stored
+    sqlite3_bind_int64(stmt, 3, (sqlite3_int64) ts);
+    int rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    return rc == SQLITE_DONE ? 0 : -1;
+}
+
+/*
+ * insert statement into the partition of ts, the partition is created the first time this connection needs it
+ */
+static sqlite3_stmt *insert_statement(DBCONN *conn, sensor_ts_t ts, insert_target_t *target) {
+    int64_t day = storage_partition_day(ts);
+    if(target->stmt != NULL && target->day == day) return target->stmt;
+    char name[STORAGE_PARTITION_NAME_MAX], sql[STORAGE_PARTITION_NAME_MAX + 96];
+    storage_partition_name(ts, name);
+    snprintf(sql, sizeof(sql), INSERT_SQL, name);
+    sqlite3_stmt *stmt = cached_statement(conn, sql);
+    if(stmt == NULL) {
+        if(storage_partition_create(conn, name, target->with_indexes) != STATUS_OK) return NULL;
+        stmt = prepared_statement(conn, sql);
+    }
+    target->day = day;
+    target->stmt = stmt;
+    return stmt;
+}
+
+/*
+ * after a rollback partitions created in the transaction are gone again, and so must be the inserts into them
+ */
+static void rollback(DBCONN *conn) {
+    sqlite3_exec(conn, "ROLLBACK;", 0, 0, NULL);
+    forget_statements(conn, "INSERT INTO");
+}
+
 status_code_storagemgr_t insert_sensor(DBCONN *conn, sensor_id_t id, sensor_value_t value, sensor_ts_t ts) {
     
-    char stringified[64];
-    char *err_msg;
-    int rc;
-    sprintf(stringified, "(%d, %.2f, %lld);", (int) id, (double) value, (long long)ts);
-    char query[2048];
-    sprintf(query, "INSERT INTO " TABLE_NAME "(sensor_id, sensor_value, timestamp) VALUES %s ", stringified);
-    DEBUG_PRINTF("executing query: %s", query);
-    rc = sqlite3_exec(conn, query, 0, 0, &err_msg);
-    if(rc != SQLITE_OK) {
-        DEBUG_PRINTF("cannot insert data, %s", err_msg);
-        sqlite3_free(err_msg);
+    insert_target_t target = {0, NULL, 1};
+    sqlite3_stmt *stmt = insert_statement(conn, ts, &target);
+    if(stmt == NULL || insert_row(stmt, id, value, ts) != 0) {
+        DEBUG_PRINTF("cannot insert data, %s", sqlite3_errmsg(conn));
         return STATUS_FAILURE;
     }
     
@@ -82,30 +207,334 @@ status_code_storagemgr_t insert_sensor(DBCONN *conn, sensor_id_t id, sensor_valu
     
 }
 
+status_code_storagemgr_t insert_sensor_begin(DBCONN *conn, const sensor_data_t *data, int count, uint64_t spool,
+                                             uint64_t seq) {
+
+    insert_target_t target = {0, NULL, 1};
+    char *err_msg;
+    if(sqlite3_exec(conn, "BEGIN;", 0, 0, &err_msg) != SQLITE_OK) {
+        DEBUG_PRINTF("cannot begin transaction, %s", err_msg);
+        sqlite3_free(err_msg);
+        return STATUS_FAILURE;
+    }
+    for(int i = 0; i < count; i++) {
+        sqlite3_stmt *stmt = insert_statement(conn, data[i].ts, &target);
+        if(stmt == NULL || insert_row(stmt, data[i].id, data[i].value, data[i].ts) != 0) {
+            DEBUG_PRINTF("cannot insert data, %s", sqlite3_errmsg(conn));
+            rollback(conn);
+            return STATUS_FAILURE;
+        }
+    }
+    if(spool != 0) {
+        sqlite3_stmt *stmt = prepared_statement(conn, "INSERT INTO " SPOOL_TABLE " (spool, seq) VALUES (?1, ?2) "
+                                                "ON CONFLICT (spool) DO UPDATE SET seq = excluded.seq;");
+        int rc = SQLITE_ERROR;
+        if(stmt != NULL) {
+            sqlite3_bind_int64(stmt, 1, (sqlite3_int64) spool);
+            sqlite3_bind_int64(stmt, 2, (sqlite3_int64) seq);
+            rc = sqlite3_step(stmt);
+            sqlite3_reset(stmt);
+        }
+        if(rc != SQLITE_DONE) {
+            DEBUG_PRINTF("cannot record spool position, %s", sqlite3_errmsg(conn));
+            rollback(conn);
+            return STATUS_FAILURE;
+        }
+    }
+    return STATUS_OK;
+}
+
+status_code_storagemgr_t insert_sensor_end(DBCONN *conn, int commit) {
 
+    if(!commit) {
+        rollback(conn);
+        return STATUS_OK;
+    }
+    //one commit (and one sync) for the whole batch
+    char *err_msg;
+    if(sqlite3_exec(conn, "COMMIT;", 0, 0, &err_msg) != SQLITE_OK) {
+        DEBUG_PRINTF("cannot commit, %s", err_msg);
+        sqlite3_free(err_msg);
+        rollback(conn);
+        return STATUS_FAILURE;
+    }
+    return STATUS_OK;
+}
 
+status_code_storagemgr_t insert_sensor_batch(DBCONN *conn, const sensor_data_t *data, int count) {
+    if(count <= 0) return STATUS_OK;
+    if(insert_sensor_begin(conn, data, count, 0, 0) != STATUS_OK) return STATUS_FAILURE;
+    return insert_sensor_end(conn, 1);
+}
 
+status_code_storagemgr_t insert_sensor_spooled(DBCONN *conn, const sensor_data_t *data, int count, uint64_t spool,
+                                               uint64_t seq) {
+    if(insert_sensor_begin(conn, data, count, spool, seq) != STATUS_OK) return STATUS_FAILURE;
+    return insert_sensor_end(conn, 1);
+}
 
+status_code_storagemgr_t find_sensor_spooled(DBCONN *conn, uint64_t spool, uint64_t *seq) {
 
+    sqlite3_stmt *stmt = prepared_statement(conn, "SELECT seq FROM " SPOOL_TABLE " WHERE spool = ?1;");
+    if(stmt == NULL) return STATUS_FAILURE;
+    sqlite3_bind_int64(stmt, 1, (sqlite3_int64) spool);
+    int rc = sqlite3_step(stmt);
+    *seq = rc == SQLITE_ROW ? (uint64_t) sqlite3_column_int64(stmt, 0) : 0;
+    sqlite3_reset(stmt);
+    return rc == SQLITE_ROW || rc == SQLITE_DONE ? STATUS_OK : STATUS_FAILURE;
+}
 
+static void cursor_advance(sensor_cursor_t *cursor) {
+    int rc = sqlite3_step(cursor->stmt);
+    if(rc == SQLITE_ROW) {
+        cursor->ready = 1;
+    } else if(rc == SQLITE_DONE) {
+        cursor->ready = 0;
+    } else {
+        DEBUG_PRINTF("cannot read data, %s", sqlite3_errmsg(cursor->conn));
+        sqlite3_reset(cursor->stmt);
+        cursor->ready = -1;
+    }
+}
 
+sensor_cursor_t *sensor_cursor_open(DBCONN *conn, sensor_query_t query, sensor_id_t id, sensor_value_t value,
+                                    sensor_ts_t from, sensor_ts_t to) {
 
+    if(query < 0 || query >= SENSOR_QUERY_COUNT) return NULL;
+    sensor_cursor_t *cursor = malloc(sizeof(sensor_cursor_t));
+    if(cursor == NULL) return NULL;
+    cursor->conn = conn;
+    cursor->stmt = prepared_statement(conn, query_sql[query]);
+    if(cursor->stmt == NULL) {
+        free(cursor);
+        return NULL;
+    }
+    //a statement that ran to the end keeps its old parameters until it is reset
+    sqlite3_reset(cursor->stmt);
+    //parameters a query does not use are left alone, binding them would fail
+    int params = sqlite3_bind_parameter_count(cursor->stmt);
+    if(params >= 1) sqlite3_bind_double(cursor->stmt, 1, round(value*100)/100);  //values are stored with 2 decimals
+    if(params >= 2) sqlite3_bind_int64(cursor->stmt, 2, (sqlite3_int64) from);
+    if(params >= 3) sqlite3_bind_int(cursor->stmt, 3, id);
+    if(params >= 4) sqlite3_bind_int64(cursor->stmt, 4, (sqlite3_int64) to);
+    cursor_advance(cursor);
+    return cursor;
+}
 
+int sensor_cursor_next(sensor_cursor_t *cursor, sensor_data_t *data) {
 
+    if(cursor->ready != 1) return cursor->ready;
+    data->id = (sensor_id_t) sqlite3_column_int(cursor->stmt, 1);
+    data->value = sqlite3_column_double(cursor->stmt, 2);
+    data->ts = (sensor_ts_t) sqlite3_column_int64(cursor->stmt, 3);
+    cursor_advance(cursor);
+    return 1;
+}
 
+int sensor_cursor_peek(sensor_cursor_t *cursor, sensor_ts_t *ts) {
+    if(cursor->ready == 1) *ts = (sensor_ts_t) sqlite3_column_int64(cursor->stmt, 3);
+    return cursor->ready;
+}
 
+int sensor_cursor_emit(sensor_cursor_t *cursor, callback_t f) {
 
+    if(cursor->ready != 1) return -1;
+    char *columns[4], *row[4];
+    for(int i = 0; i < 4; i++) {
+        columns[i] = (char *) sqlite3_column_name(cursor->stmt, i);
+        row[i] = (char *) sqlite3_column_text(cursor->stmt, i);
+    }
+    int rc = f(NULL, 4, row, columns);
+    cursor_advance(cursor);
+    return rc;
+}
 
+void sensor_cursor_close(sensor_cursor_t *cursor) {
+    if(cursor == NULL) return;
+    //the statement stays prepared on the connection for the next cursor
+    sqlite3_reset(cursor->stmt);
+    free(cursor);
+}
 
+//packed on disk, so a record is not a sensor_data_t
+#define RECORD_SIZE (sizeof(sensor_id_t) + sizeof(sensor_value_t) + sizeof(sensor_ts_t))
+#define BULK_CHUNK  4096    //records decoded at a time
+
+/*
+ * decodes and validates n records, valid ones go to data
+ * \return the number of valid records
+ */
+static int decode_records(const unsigned char *raw, int n, sensor_data_t *data, sensor_bulk_stats_t *stats) {
+    int valid = 0;
+    for(int i = 0; i < n; i++, raw += RECORD_SIZE) {
+        sensor_data_t *d = &(data[valid]);
+        memcpy(&(d->id), raw, sizeof(sensor_id_t));
+        memcpy(&(d->value), raw + sizeof(sensor_id_t), sizeof(sensor_value_t));
+        memcpy(&(d->ts), raw + sizeof(sensor_id_t) + sizeof(sensor_value_t), sizeof(sensor_ts_t));
+        valid += isfinite(d->value) && d->ts > 0;
+    }
+    stats->records += n;
+    stats->rejected += n - valid;
+    return valid;
+}
 
+typedef struct {
+    DBCONN *conn;
+    insert_target_t target;
+    int in_transaction;
+    int rows;                   //rows in the open transaction
+    struct timespec start;
+    sensor_bulk_progress_t progress;
+    void *arg;
+    sensor_bulk_stats_t *stats;
+} bulk_load_t;
+
+static void bulk_elapsed(bulk_load_t *load) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    load->stats->seconds = (now.tv_sec - load->start.tv_sec) + (now.tv_nsec - load->start.tv_nsec)/1e9;
+}
 
+static int bulk_commit(bulk_load_t *load) {
+    if(!load->in_transaction) return 0;
+    load->in_transaction = 0;
+    char *err_msg;
+    if(sqlite3_exec(load->conn, "COMMIT;", 0, 0, &err_msg) != SQLITE_OK) {
+        DEBUG_PRINTF("cannot commit, %s", err_msg);
+        sqlite3_free(err_msg);
+        rollback(load->conn);
+        load->target.stmt = NULL;
+        return -1;
+    }
+    load->stats->inserted += load->rows;
+    load->rows = 0;
+    bulk_elapsed(load);
+    if(load->progress != NULL) load->progress(load->stats, load->arg);
+    return 0;
+}
 
+static int bulk_insert(bulk_load_t *load, const sensor_data_t *data, int count) {
+    for(int i = 0; i < count; i++) {
+        if(!load->in_transaction) {
+            if(sqlite3_exec(load->conn, "BEGIN;", 0, 0, NULL) != SQLITE_OK) return -1;
+            load->in_transaction = 1;
+        }
+        sqlite3_stmt *stmt = insert_statement(load->conn, data[i].ts, &(load->target));
+        if(stmt == NULL || insert_row(stmt, data[i].id, data[i].value, data[i].ts) != 0) {
+            DEBUG_PRINTF("cannot insert data, %s", sqlite3_errmsg(load->conn));
+            rollback(load->conn);
+            load->target.stmt = NULL;
+            load->in_transaction = 0;
+            return -1;
+        }
+        if(++load->rows == STORAGE_BULK_TRANSACTION && bulk_commit(load) != 0) return -1;
+    }
+    return 0;
+}
 
+/*
+ * feeds the records from the current file position on to the load, mapped if the file allows it
+ */
+static int bulk_read(bulk_load_t *load, FILE *file, sensor_data_t *data) {
+
+    struct stat st;
+    off_t offset = ftello(file);
+    if(offset >= 0 && fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode)) {
+        if(st.st_size <= offset) return 0;
+        size_t length = st.st_size;
+        unsigned char *map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+        if(map != MAP_FAILED) {
+            madvise(map, length, MADV_SEQUENTIAL);
+            const unsigned char *raw = map + offset;
+            size_t records = (length - offset)/RECORD_SIZE;
+            int rc = 0;
+            for(size_t done = 0; done < records && rc == 0; done += BULK_CHUNK) {
+                int n = records - done < BULK_CHUNK ? records - done : BULK_CHUNK;
+                int valid = decode_records(raw + done*RECORD_SIZE, n, data, load->stats);
+                rc = bulk_insert(load, data, valid);
+            }
+            load->stats->trailing_bytes = (length - offset) % RECORD_SIZE;
+            munmap(map, length);
+            fseeko(file, 0, SEEK_END);
+            return rc;
+        }
+    }
+    //pipes and the like
+    unsigned char *raw = malloc(BULK_CHUNK*RECORD_SIZE);
+    if(raw == NULL) return -1;
+    size_t got;
+    int rc = 0;
+    while(rc == 0 && (got = fread(raw, 1, BULK_CHUNK*RECORD_SIZE, file)) > 0) {
+        int n = got/RECORD_SIZE;
+        load->stats->trailing_bytes = got % RECORD_SIZE;    //only possible in the last chunk
+        int valid = decode_records(raw, n, data, load->stats);
+        rc = bulk_insert(load, data, valid);
+    }
+    free(raw);
+    return rc == 0 && ferror(file) ? -1 : rc;
+}
 
+int sensor_bulk_load(DBCONN *conn, FILE *sensor_data, int rebuild_indexes, sensor_bulk_progress_t progress, void *arg,
+                     sensor_bulk_stats_t *stats) {
+
+    sensor_bulk_stats_t own_stats;
+    bulk_load_t load = {conn, {0, NULL, !rebuild_indexes}, 0, 0, {0, 0}, progress, arg,
+                        stats != NULL ? stats : &own_stats};
+    memset(load.stats, 0, sizeof(sensor_bulk_stats_t));
+    clock_gettime(CLOCK_MONOTONIC, &(load.start));
+    sensor_data_t *data = malloc(BULK_CHUNK*sizeof(sensor_data_t));
+    if(data == NULL) return -1;
+    if(rebuild_indexes && storage_partition_indexes(conn, 0) != STATUS_OK) {
+        DEBUG_PRINTF("cannot drop indexes, %s", sqlite3_errmsg(conn));
+        free(data);
+        return -1;
+    }
+    int rc = bulk_read(&load, sensor_data, data);
+    if(rc == 0) rc = bulk_commit(&load);
+    free(data);
+    //also after a failure, the committed rows need their indexes
+    if(rebuild_indexes && storage_partition_indexes(conn, 1) != STATUS_OK) {
+        DEBUG_PRINTF("cannot create indexes, %s", sqlite3_errmsg(conn));
+        rc = -1;
+    }
+    bulk_elapsed(&load);
+    return rc;
+}
 
+int insert_sensor_from_file(DBCONN *conn, FILE *sensor_data) {
+    return sensor_bulk_load(conn, sensor_data, STORAGE_BULK_REBUILD_INDEXES, NULL, NULL, NULL);
+}
 
+/*
+ * streams the rows of a query into f the way sqlite3_exec() would, one row in memory at a time
+ * f returning non-zero stops the query
+ */
+static int find_sensor(DBCONN *conn, sensor_query_t query, sensor_value_t value, sensor_ts_t ts, callback_t f) {
+
+    sensor_cursor_t *cursor = sensor_cursor_open(conn, query, 0, value, ts, ts);
+    if(cursor == NULL) return -1;
+    while(cursor->ready == 1 && sensor_cursor_emit(cursor, f) == 0);
+    int status = cursor->ready < 0 ? -1 : 0;
+    sensor_cursor_close(cursor);
+    return status;
+}
 
+int find_sensor_all(DBCONN *conn, callback_t f) {
+    return find_sensor(conn, SENSOR_QUERY_ALL, 0, 0, f);
+}
 
+int find_sensor_by_value(DBCONN *conn, sensor_value_t value, callback_t f) {
+    return find_sensor(conn, SENSOR_QUERY_BY_VALUE, value, 0, f);
+}
 
+int find_sensor_exceed_value(DBCONN *conn, sensor_value_t value, callback_t f) {
+    return find_sensor(conn, SENSOR_QUERY_EXCEED_VALUE, value, 0, f);
+}
 
+int find_sensor_by_timestamp(DBCONN *conn, sensor_ts_t ts, callback_t f) {
+    return find_sensor(conn, SENSOR_QUERY_BY_TIMESTAMP, 0, ts, f);
+}
 
+int find_sensor_after_timestamp(DBCONN *conn, sensor_ts_t ts, callback_t f) {
+    return find_sensor(conn, SENSOR_QUERY_AFTER_TIMESTAMP, 0, ts, f);
+}
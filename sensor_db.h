@@ -18,25 +18,82 @@
 
 #define DBCONN sqlite3
 
-enum status_code_storagemgr {STATUS_OK = 0, STATUS_NEW_TABLE, STATUS_FAILURE };
+enum status_code_storagemgr {STATUS_OK = 0, STATUS_NEW_TABLE, STATUS_FAILURE, STATUS_SPOOLED };
 typedef enum status_code_storagemgr status_code_storagemgr_t;
 
 typedef int (*callback_t)(void *, int, char **, char **);
 
+/*
+ * the queries a cursor can stream, the timestamp ones are answered from an index on (timestamp) and the per sensor
+ * one from an index on (sensor_id, timestamp), both covering so the table itself is never read
+ */
+enum sensor_query {
+    SENSOR_QUERY_ALL = 0,
+    SENSOR_QUERY_BY_VALUE,          /** < sensor_value = value */
+    SENSOR_QUERY_EXCEED_VALUE,      /** < sensor_value > value */
+    SENSOR_QUERY_BY_TIMESTAMP,      /** < timestamp = from */
+    SENSOR_QUERY_AFTER_TIMESTAMP,   /** < timestamp > from, oldest first */
+    SENSOR_QUERY_BY_SENSOR,         /** < sensor_id = id and from <= timestamp <= to, oldest first */
+    SENSOR_QUERY_TIME_RANGE,        /** < from <= timestamp <= to, oldest first */
+    SENSOR_QUERY_COUNT
+};
+typedef enum sensor_query sensor_query_t;
+
+typedef struct sensor_cursor sensor_cursor_t;
+
+typedef struct {
+    uint64_t records;           /** < complete records read from the file */
+    uint64_t inserted;
+    uint64_t rejected;          /** < records with a value that is not a number or a timestamp <= 0 */
+    uint64_t trailing_bytes;    /** < bytes after the last complete record */
+    double seconds;
+} sensor_bulk_stats_t;
+
+/*
+ * called after every committed transaction of a bulk load
+ */
+typedef void (*sensor_bulk_progress_t)(const sensor_bulk_stats_t *stats, void *arg);
+
 /**
  * Make a connection to the database server
  * Create (open) a database with name DB_NAME having 1 table named TABLE_NAME  
+ * TABLE_NAME is a view over one table per day, inserts go to the partition of their timestamp (see storage_partition.h)
+ * The connection gets the settings of the storage profile STORAGE_PROFILE (see storage_profile.h)
  * \param clear_up_flag if the table existed, clear up the existing data when clear_up_flag is set to 1
  * \return the connection for success, NULL if an error occurs
  */
 DBCONN *init_connection(char clear_up_flag, status_code_storagemgr_t *status, char *table_name);
 
+/**
+ * Same as init_connection() for the database file at path instead of DB_NAME
+ */
+DBCONN *init_connection_at(const char *path, char clear_up_flag, status_code_storagemgr_t *status);
+
+/**
+ * Open a read only connection to DB_NAME for queries
+ * With a WAL storage profile queries on it never block the writer connection and see the last committed data
+ * A connection, and the cursors on it, must only be used by one thread at a time
+ * \return the connection for success, NULL if an error occurs
+ */
+DBCONN *init_read_connection();
+
+/**
+ * Same as init_read_connection() for the database file at path instead of DB_NAME
+ */
+DBCONN *init_read_connection_at(const char *path);
+
 /**
  * Disconnect from the database server
  * \param conn pointer to the current connection
  */
 void disconnect(DBCONN *conn);
 
+/**
+ * Finalize the statements prepared on a connection whose SQL contains 'match', e.g. ones on a table that is dropped
+ * \param conn pointer to the current connection
+ */
+void forget_statements(DBCONN *conn, const char *match);
+
 /**
  * Write an INSERT query to insert a single sensor measurement
  * \param conn pointer to the current connection
@@ -47,14 +104,70 @@ void disconnect(DBCONN *conn);
  */
 status_code_storagemgr_t insert_sensor(DBCONN *conn, sensor_id_t id, sensor_value_t value, sensor_ts_t ts);
 
+/**
+ * Insert count sensor measurements in one transaction, rows are bound to a prepared statement that is reused
+ * for every row and kept by the connection until disconnect()
+ * Either all rows are stored or none of them
+ * \param conn pointer to the current connection
+ * \param data the measurements
+ * \param count number of measurements in data
+ * \return zero for success, and non-zero if an error occurs
+ */
+status_code_storagemgr_t insert_sensor_batch(DBCONN *conn, const sensor_data_t *data, int count);
+
+/**
+ * The two halves of insert_sensor_batch(), so several databases can commit a batch only once all of them took it
+ * insert_sensor_begin() opens a transaction and inserts the rows, on failure it is rolled back already,
+ * after a successful begin insert_sensor_end() commits (commit = 1) or rolls back (commit = 0)
+ * \param spool non-zero also records seq as stored for that spool, like insert_sensor_spooled()
+ * \return zero for success, and non-zero if an error occurs
+ */
+status_code_storagemgr_t insert_sensor_begin(DBCONN *conn, const sensor_data_t *data, int count, uint64_t spool,
+                                             uint64_t seq);
+
+status_code_storagemgr_t insert_sensor_end(DBCONN *conn, int commit);
+
+/**
+ * Insert readings replayed from a spool file (see storage_spool.h) like insert_sensor_batch(), and in the same
+ * transaction record seq as the last batch of that spool that is stored, so a replay cut short is never stored twice
+ * \param spool the id of the spool file
+ * \param seq the sequence number of the last spooled batch in data
+ * \return zero for success, and non-zero if an error occurs
+ */
+status_code_storagemgr_t insert_sensor_spooled(DBCONN *conn, const sensor_data_t *data, int count, uint64_t spool,
+                                               uint64_t seq);
+
+/**
+ * Read the sequence number of the last batch of a spool file that is stored
+ * \param seq set to the sequence number, 0 if nothing of that spool was stored
+ * \return zero for success, and non-zero if an error occurs
+ */
+status_code_storagemgr_t find_sensor_spooled(DBCONN *conn, uint64_t spool, uint64_t *seq);
+
 /**
  * Write an INSERT query to insert all sensor measurements available in the file 'sensor_data'
+ * Same as sensor_bulk_load() without progress, with STORAGE_BULK_REBUILD_INDEXES
  * \param conn pointer to the current connection
  * \param sensor_data a file pointer to binary file containing sensor data
  * \return zero for success, and non-zero if an error occurs
  */
 int insert_sensor_from_file(DBCONN *conn, FILE *sensor_data);
 
+/**
+ * Insert all records from the current position of 'sensor_data' to its end
+ * Records are the packed sensor id, value and timestamp fields, the way a sensor node sends them
+ * The file is mapped when possible and read in chunks otherwise, invalid records are skipped
+ * Rows are inserted in transactions of STORAGE_BULK_TRANSACTION rows, a failing transaction is rolled back
+ * but the ones before it stay committed
+ * \param rebuild_indexes drop the indexes before loading and create them again after, faster for large files
+ * but queries are slow in the meantime
+ * \param progress called after every transaction, may be NULL
+ * \param stats filled with the totals, may be NULL
+ * \return zero for success, and non-zero if an error occurs
+ */
+int sensor_bulk_load(DBCONN *conn, FILE *sensor_data, int rebuild_indexes, sensor_bulk_progress_t progress, void *arg,
+                     sensor_bulk_stats_t *stats);
+
 /**
   * Write a SELECT query to select all sensor measurements in the table 
   * The callback function is applied to every row in the result
@@ -104,4 +217,37 @@ int find_sensor_by_timestamp(DBCONN *conn, sensor_ts_t ts, callback_t f);
  */
 int find_sensor_after_timestamp(DBCONN *conn, sensor_ts_t ts, callback_t f);
 
+/**
+ * Start streaming the result of a query, rows are read one at a time with sensor_cursor_next()
+ * so memory use does not depend on the size of the result
+ * \param conn pointer to the connection, preferably one from init_read_connection()
+ * \param query which query to run, only the parameters it mentions are used
+ * \return the cursor, NULL if an error occurs
+ */
+sensor_cursor_t *sensor_cursor_open(DBCONN *conn, sensor_query_t query, sensor_id_t id, sensor_value_t value,
+                                    sensor_ts_t from, sensor_ts_t to);
+
+/**
+ * Read the next row of a cursor
+ * \return 1 if data holds the next row, 0 at the end of the result, -1 if an error occurs
+ */
+int sensor_cursor_next(sensor_cursor_t *cursor, sensor_data_t *data);
+
+/**
+ * Look at the timestamp of the row a cursor stands on without moving it, for merging cursors
+ * \return 1 if ts is set, 0 at the end of the result, -1 if an error occurs
+ */
+int sensor_cursor_peek(sensor_cursor_t *cursor, sensor_ts_t *ts);
+
+/**
+ * Pass the row a cursor stands on to a find_sensor_* callback and move to the next row
+ * \return what f returned, -1 if there was no row
+ */
+int sensor_cursor_emit(sensor_cursor_t *cursor, callback_t f);
+
+/**
+ * Close a cursor, also before its end was reached
+ */
+void sensor_cursor_close(sensor_cursor_t *cursor);
+
 #endif /* _SENSOR_DB_H_ */
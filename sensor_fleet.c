@@ -0,0 +1,671 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+/*
+ * synthetic sensor fleet, the load generator and end to end benchmark of the gateway
+ * every node is a connection of its own sending readings in the wire format of the sensor nodes (id, value and ts,
+ * 18 bytes), the fleet sends at a steady rate, every node in turn, with bursts of extra readings on every node at
+ * once, reconnect storms that close a part of the nodes and connect them again at once, and bad clients that send
+ * half a record and the rest later, garbage records, nothing at all, or one reading per connection
+ * one thread and epoll, a node the gateway is too slow for buffers SENSOR_FLEET_QUEUE readings, more are dropped and
+ * counted, as are readings due on a node that is not connected
+ * with -g the fleet is a harness, it starts the gateway in the current directory, writes a room_sensor.map for its
+ * ids if there is none, waits until the gateway stored what it received, reads its metrics before and after for the
+ * end to end throughput, the readings it lost and the latency percentiles of the trace histograms, and waits for
+ * the gateway to stop once the nodes left
+ * without -g the metrics are still read if METRICS_SOCKET of a running gateway can be opened
+ * the gateway takes at most MAX_CONN nodes and keeps state for DATAMGR_MAX_SENSORS, for thousands of nodes build it
+ * with e.g. -DMAX_CONN=4096 -DDATAMGR_MAX_SENSORS=4096 and raise ulimit -n of both
+ * not part of the gateway, build with the flags of the gateway:
+ * gcc -O2 -DSET_MAX_TEMP=20 -DSET_MIN_TEMP=10 sensor_fleet.c -lm -o sensor_fleet
+ * usage: sensor_fleet [-g gateway] [-a ip] [-p port] [-c nodes] [-r readings/s per node] [-d seconds] [-i first id]
+ *                     [-B burst every seconds] [-b burst readings] [-S storm every seconds] [-s storm fraction]
+ *                     [-x bad client fraction] [-t hot fraction] [-w drain seconds]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <math.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "config.h"
+
+#define SENSOR_FLEET_RECORD 18              //bytes of a reading on the wire
+#define SENSOR_FLEET_QUEUE 64               //readings a node buffers while the gateway does not take them
+#define SENSOR_FLEET_RETRY_MS 100           //a node that failed or was closed connects again after this
+#define SENSOR_FLEET_REPORT_MS 1000
+#define SENSOR_FLEET_SETTLE_MS 2000         //the gateway drained once nothing was received or stored for this long
+#define SENSOR_FLEET_EVENTS 256
+#define SENSOR_FLEET_METRICS_MAX (1 << 20)  //bytes of a metrics snapshot read at most
+#define SENSOR_FLEET_BUCKETS 64
+
+enum node_state {NODE_IDLE, NODE_CONNECTING, NODE_CONNECTED};
+
+/*
+ * a slow node sends half of a record and the rest with its next reading, garbage sends random bytes for an id
+ * outside the fleet, silent never sends, flapping closes after every reading and connects again
+ */
+enum node_kind {NODE_GOOD, NODE_SLOW, NODE_GARBAGE, NODE_SILENT, NODE_FLAPPING, NODE_KINDS};
+
+static const char *kind_names[NODE_KINDS] = {"good", "slow", "garbage", "silent", "flapping"};
+
+typedef struct {
+    int fd;
+    uint16_t id;
+    uint8_t state;
+    uint8_t kind;
+    uint8_t hot;                            //reports above SET_MAX_TEMP
+    uint8_t close_after;                    //flapping node closes once its queue is sent
+    int held;                               //bytes of the queue a slow node holds back until its next reading
+    int64_t retry_ms;
+    uint64_t sent_bytes;                    //written to the socket of this connection
+    int length, offset;                     //bytes queued, bytes of them sent
+    uint8_t queue[SENSOR_FLEET_QUEUE*SENSOR_FLEET_RECORD];
+} node_t;
+
+/*
+ * a good reading counts as sent once the gateway acknowledged all of its record, written but not acknowledged when
+ * its node was closed counts as unacknowledged, the kernel may still deliver it
+ */
+typedef struct {
+    uint64_t due, queued, sent, unacknowledged, queued_full, not_connected, bad_records;
+    uint64_t connects, connect_failures, closed_by_gateway, storm_closes;
+} fleet_stats_t;
+
+typedef struct {
+    uint64_t bounds[SENSOR_FLEET_BUCKETS];
+    uint64_t counts[SENSOR_FLEET_BUCKETS];  //cumulative like the le buckets
+    int size;
+} metrics_histogram_t;
+
+/*
+ * what the fleet reads from a metrics snapshot of the gateway
+ */
+typedef struct {
+    int ok;
+    uint64_t received;                      //readings of the ids of the fleet
+    uint64_t committed, spooled;
+    int64_t datamgr_lag, storagemgr_lag;
+    metrics_histogram_t trace[3];
+} gateway_metrics_t;
+
+static const char *trace_names[3] = {"gateway_trace_processed_us", "gateway_trace_alerted_us",
+                                     "gateway_trace_committed_us"};
+
+static struct {
+    const char *gateway;
+    const char *ip;
+    int port;
+    int nodes;
+    double rate;
+    double seconds;
+    int first_id;
+    double burst_every;
+    int burst;
+    double storm_every;
+    double storm_fraction;
+    double bad_fraction;
+    double hot_fraction;
+    double drain_seconds;
+} opt = {NULL, "127.0.0.1", 5678, 1000, 1, 10, 1, 0, 10, 0, 0.5, 0, 0.01, 30};
+
+static node_t *nodes;
+static int epoll_fd;
+static struct sockaddr_in gateway_addr;
+static fleet_stats_t stats;
+
+static int64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+static int is_fleet_id(uint16_t id) {
+    return (uint16_t) (id - opt.first_id) < (unsigned) opt.nodes;
+}
+
+/*
+ * bytes the gateway acknowledged of the ones written to the socket of node
+ */
+static uint64_t acknowledged(node_t *node) {
+    int unacknowledged = 0;
+    if(node->sent_bytes == 0 || ioctl(node->fd, SIOCOUTQ, &unacknowledged) != 0 || unacknowledged < 0) return 0;
+    return (uint64_t) unacknowledged < node->sent_bytes ? node->sent_bytes - (uint64_t) unacknowledged : 0;
+}
+
+static void node_close(node_t *node, int64_t now) {
+    if(node->kind != NODE_GARBAGE) {
+        uint64_t sent = acknowledged(node)/SENSOR_FLEET_RECORD;
+        stats.sent += sent;
+        stats.unacknowledged += node->sent_bytes/SENSOR_FLEET_RECORD - sent;
+    }
+    if(node->fd >= 0) close(node->fd);
+    node->sent_bytes = 0;
+    node->fd = -1;
+    node->state = NODE_IDLE;
+    node->length = node->offset = node->held = 0;
+    node->close_after = 0;
+    node->retry_ms = now + SENSOR_FLEET_RETRY_MS;
+}
+
+static void node_watch(node_t *node, int op, uint32_t events) {
+    struct epoll_event event = {.events = events, .data.ptr = node};
+    epoll_ctl(epoll_fd, op, node->fd, &event);
+}
+
+static void node_connect(node_t *node, int64_t now) {
+    node->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(node->fd < 0) {
+        stats.connect_failures++;
+        node_close(node, now);
+        return;
+    }
+    if(connect(node->fd, (struct sockaddr *) &gateway_addr, sizeof(gateway_addr)) != 0 && errno != EINPROGRESS) {
+        stats.connect_failures++;
+        node_close(node, now);
+        return;
+    }
+    node->state = NODE_CONNECTING;
+    node_watch(node, EPOLL_CTL_ADD, EPOLLOUT);
+}
+
+/*
+ * sends what is queued and not held back, waits for EPOLLOUT if the socket is full
+ */
+static void node_flush(node_t *node, int64_t now) {
+    int end = node->length - node->held;
+    while(node->offset < end) {
+        ssize_t n = send(node->fd, node->queue + node->offset, end - node->offset, MSG_NOSIGNAL);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                node_watch(node, EPOLL_CTL_MOD, EPOLLIN | EPOLLRDHUP | EPOLLOUT);
+                return;
+            }
+            stats.closed_by_gateway++;
+            node_close(node, now);
+            return;
+        }
+        node->offset += (int) n;
+        node->sent_bytes += (uint64_t) n;
+    }
+    //the sent bytes are moved out so the queue takes new readings at its end
+    memmove(node->queue, node->queue + node->offset, node->length - node->offset);
+    node->length -= node->offset;
+    node->offset = 0;
+    node_watch(node, EPOLL_CTL_MOD, EPOLLIN | EPOLLRDHUP);
+    if(node->close_after && node->length == 0) node_close(node, now);
+}
+
+static void put_record(uint8_t *at, uint16_t id, double value, int64_t ts) {
+    memcpy(at, &id, sizeof(id));
+    memcpy(at + 2, &value, sizeof(value));
+    memcpy(at + 10, &ts, sizeof(ts));
+}
+
+/*
+ * queues one reading on node and sends it, or counts why it could not
+ */
+static void node_reading(node_t *node, int64_t now) {
+    stats.due++;
+    if(node->kind == NODE_SILENT) return;
+    if(node->state != NODE_CONNECTED) {
+        stats.not_connected++;
+        return;
+    }
+    if(node->length + SENSOR_FLEET_RECORD > (int) sizeof(node->queue)) {
+        stats.queued_full++;
+        return;
+    }
+    uint8_t *at = node->queue + node->length;
+    if(node->kind == NODE_GARBAGE) {
+        for(int i = 0; i < SENSOR_FLEET_RECORD; i++) at[i] = (uint8_t) rand();
+        uint16_t id = (uint16_t) (opt.first_id + opt.nodes + rand()%(65536 - opt.nodes));
+        memcpy(at, &id, sizeof(id));
+        stats.bad_records++;
+    } else {
+        double low = node->hot ? SET_MAX_TEMP + 1 : SET_MIN_TEMP;
+        double high = node->hot ? SET_MAX_TEMP + 5 : SET_MAX_TEMP;
+        put_record(at, node->id, low + (high - low)*rand()/RAND_MAX, (int64_t) time(NULL));
+        stats.queued++;
+    }
+    node->length += SENSOR_FLEET_RECORD;
+    //a slow node sends what it held back and holds back half of this record until its next reading
+    node->held = node->kind == NODE_SLOW ? SENSOR_FLEET_RECORD/2 : 0;
+    if(node->kind == NODE_FLAPPING) node->close_after = 1;
+    if(node->offset == 0 && node->length - node->held > 0) node_flush(node, now);
+}
+
+static void node_event(node_t *node, uint32_t events, int64_t now) {
+    if(node->state == NODE_IDLE) return; //closed by an earlier event of the same epoll_wait()
+    if(node->state == NODE_CONNECTING) {
+        int error = 0;
+        socklen_t size = sizeof(error);
+        getsockopt(node->fd, SOL_SOCKET, SO_ERROR, &error, &size);
+        if(error != 0) {
+            stats.connect_failures++;
+            node_close(node, now);
+            return;
+        }
+        stats.connects++;
+        node->state = NODE_CONNECTED;
+        node_watch(node, EPOLL_CTL_MOD, EPOLLIN | EPOLLRDHUP);
+        return;
+    }
+    if(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        //the gateway never sends, readable is the gateway closing the connection
+        char byte;
+        ssize_t n = recv(node->fd, &byte, 1, MSG_DONTWAIT);
+        if(n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            stats.closed_by_gateway++;
+            node_close(node, now);
+            return;
+        }
+    }
+    if(events & EPOLLOUT) node_flush(node, now);
+}
+
+/*
+ * closes a fraction of the connected nodes at once, they all connect again after SENSOR_FLEET_RETRY_MS
+ */
+static void storm(int64_t now) {
+    for(int i = 0; i < opt.nodes; i++) {
+        if(nodes[i].state == NODE_CONNECTED && (double) rand()/RAND_MAX < opt.storm_fraction) {
+            stats.storm_closes++;
+            node_close(&nodes[i], now);
+        }
+    }
+}
+
+static int connected_nodes() {
+    int connected = 0;
+    for(int i = 0; i < opt.nodes; i++) connected += nodes[i].state == NODE_CONNECTED;
+    return connected;
+}
+
+static uint64_t written_readings() {
+    uint64_t written = stats.sent + stats.unacknowledged;
+    for(int i = 0; i < opt.nodes; i++) {
+        if(nodes[i].kind != NODE_GARBAGE) written += nodes[i].sent_bytes/SENSOR_FLEET_RECORD;
+    }
+    return written;
+}
+
+static uint64_t sent_readings() {
+    uint64_t sent = stats.sent;
+    for(int i = 0; i < opt.nodes; i++) {
+        if(nodes[i].kind != NODE_GARBAGE) sent += acknowledged(&nodes[i])/SENSOR_FLEET_RECORD;
+    }
+    return sent;
+}
+
+/*
+ * reads a snapshot from the metrics socket of the gateway, ok stays 0 if there is none
+ */
+static void read_metrics(gateway_metrics_t *metrics) {
+
+    memset(metrics, 0, sizeof(*metrics));
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) return;
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path, METRICS_SOCKET, sizeof(addr.sun_path) - 1);
+    if(connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        return;
+    }
+    char *text = malloc(SENSOR_FLEET_METRICS_MAX + 1);
+    if(text == NULL) {
+        close(fd);
+        return;
+    }
+    size_t length = 0;
+    ssize_t n;
+    while(length < SENSOR_FLEET_METRICS_MAX && (n = read(fd, text + length, SENSOR_FLEET_METRICS_MAX - length)) != 0) {
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            break;
+        }
+        length += (size_t) n;
+    }
+    close(fd);
+    text[length] = '\0';
+    char *save, name[128], bucket[64];
+    for(char *line = strtok_r(text, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save)) {
+        unsigned long long label, value;
+        long long gauge;
+        if(line[0] == '#') continue;
+        if(sscanf(line, "gateway_readings_received_total{sensor=\"%llu\"} %llu", &label, &value) == 2) {
+            if(is_fleet_id((uint16_t) label)) metrics->received += value;
+        } else if(sscanf(line, "gateway_db_rows_committed_total %llu", &value) == 1) {
+            metrics->committed = value;
+        } else if(sscanf(line, "gateway_db_rows_spooled_total %llu", &value) == 1) {
+            metrics->spooled = value;
+        } else if(sscanf(line, "gateway_datamgr_lag_readings %lld", &gauge) == 1) {
+            metrics->datamgr_lag = gauge;
+        } else if(sscanf(line, "gateway_storagemgr_lag_readings %lld", &gauge) == 1) {
+            metrics->storagemgr_lag = gauge;
+        } else if(sscanf(line, "%127[a-z_]{le=\"%llu\"} %llu", name, &label, &value) == 3) {
+            for(int t = 0; t < 3; t++) {
+                metrics_histogram_t *histogram = &metrics->trace[t];
+                snprintf(bucket, sizeof(bucket), "%s_bucket", trace_names[t]);
+                if(strcmp(name, bucket) != 0 || histogram->size == SENSOR_FLEET_BUCKETS) continue;
+                histogram->bounds[histogram->size] = label;
+                histogram->counts[histogram->size++] = value;
+            }
+        }
+    }
+    free(text);
+    metrics->ok = 1;
+}
+
+/*
+ * count of before at or below bound, a bucket above the last one of before holds all of before
+ */
+static uint64_t count_at(const metrics_histogram_t *before, uint64_t bound) {
+    uint64_t count = 0;
+    for(int i = 0; i < before->size && before->bounds[i] <= bound; i++) count = before->counts[i];
+    return count;
+}
+
+/*
+ * bucket bound of the percentile p of what after counted since before, 0 if nothing was
+ */
+static uint64_t percentile(const metrics_histogram_t *before, const metrics_histogram_t *after, double p,
+                           uint64_t *count) {
+    *count = after->size > 0 ? after->counts[after->size - 1] - count_at(before, UINT64_MAX) : 0;
+    if(*count == 0) return 0;
+    uint64_t rank = (uint64_t) ceil(p*(*count));
+    for(int i = 0; i < after->size; i++) {
+        if(after->counts[i] - count_at(before, after->bounds[i]) >= rank) return after->bounds[i];
+    }
+    return after->bounds[after->size - 1];
+}
+
+static void report_metrics(const gateway_metrics_t *before, const gateway_metrics_t *after, uint64_t sent,
+                           double load_seconds, double total_seconds) {
+
+    uint64_t received = after->received - before->received;
+    uint64_t stored = (after->committed - before->committed) + (after->spooled - before->spooled);
+    printf("gateway: %llu readings of the fleet received (%.0f/s), %llu sent but not received, %llu written by the "
+           "fleet but not acknowledged, %llu stored (%.0f/s end to "
+           "end over %.1f s), %lld not taken by datamgr, %lld by storagemgr\n",
+           (unsigned long long) received, received/load_seconds,
+           (unsigned long long) (sent > received ? sent - received : 0),
+           (unsigned long long) (written_readings() - sent), (unsigned long long) stored,
+           stored/total_seconds, total_seconds, (long long) after->datamgr_lag, (long long) after->storagemgr_lag);
+    for(int t = 0; t < 3; t++) {
+        uint64_t count, p50 = percentile(&before->trace[t], &after->trace[t], 0.5, &count);
+        uint64_t p90 = percentile(&before->trace[t], &after->trace[t], 0.9, &count);
+        uint64_t p99 = percentile(&before->trace[t], &after->trace[t], 0.99, &count);
+        printf("  %-30s %8llu traced  p50 <= %llu us  p90 <= %llu us  p99 <= %llu us\n", trace_names[t],
+               (unsigned long long) count, (unsigned long long) p50, (unsigned long long) p90,
+               (unsigned long long) p99);
+    }
+}
+
+/*
+ * the gateway exits without a map, one is written for as many nodes as datamgr has slots, the rest are unknown
+ * sensors to the gateway, 8 sensors per room
+ */
+static void write_map() {
+    if(access(SENSOR_MAP_FILE, F_OK) == 0) return;
+    FILE *fp = fopen(SENSOR_MAP_FILE, "w");
+    if(fp == NULL) return;
+    int mapped = opt.nodes < DATAMGR_MAX_SENSORS ? opt.nodes : DATAMGR_MAX_SENSORS;
+    for(int i = 0; i < mapped; i++) fprintf(fp, "%i %i\n", 1 + i/8, opt.first_id + i);
+    fclose(fp);
+    printf("%s written for %i sensors\n", SENSOR_MAP_FILE, mapped);
+}
+
+/*
+ * starts the gateway with its output in gateway.out and waits until it accepts nodes
+ * \return its pid, -1 if it did not start
+ */
+static pid_t start_gateway() {
+
+    write_map();
+    fflush(stdout);
+    pid_t pid = fork();
+    if(pid == 0) {
+        int fd = open("gateway.out", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd >= 0) {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+        }
+        char port[16];
+        snprintf(port, sizeof(port), "%i", opt.port);
+        execl(opt.gateway, opt.gateway, port, (char *) NULL);
+        _exit(127);
+    }
+    if(pid < 0) return -1;
+    for(int i = 0; i < 100; i++) {
+        if(waitpid(pid, NULL, WNOHANG) == pid) return -1;
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        int up = connect(fd, (struct sockaddr *) &gateway_addr, sizeof(gateway_addr)) == 0;
+        close(fd);
+        if(up) return pid;
+        usleep(100000);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+/*
+ * the gateway stops on its own some TIMEOUTs after the last node left
+ */
+static void stop_gateway(pid_t pid) {
+    int status;
+    for(int i = 0; i < (TIMEOUT*2 + 30)*10; i++) {
+        if(waitpid(pid, &status, WNOHANG) == pid) {
+            printf("gateway stopped, exit status %i\n", WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+            return;
+        }
+        usleep(100000);
+    }
+    printf("gateway did not stop after the nodes left, killed\n");
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-g gateway] [-a ip] [-p port] [-c nodes] [-r readings/s per node] [-d seconds] "
+            "[-i first id] [-B burst every seconds] [-b burst readings] [-S storm every seconds] [-s storm fraction] "
+            "[-x bad client fraction] [-t hot fraction] [-w drain seconds]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+static void parse_options(int argc, char *argv[]) {
+    int c;
+    while((c = getopt(argc, argv, "g:a:p:c:r:d:i:B:b:S:s:x:t:w:")) != -1) {
+        switch(c) {
+            case 'g': opt.gateway = optarg; break;
+            case 'a': opt.ip = optarg; break;
+            case 'p': opt.port = atoi(optarg); break;
+            case 'c': opt.nodes = atoi(optarg); break;
+            case 'r': opt.rate = atof(optarg); break;
+            case 'd': opt.seconds = atof(optarg); break;
+            case 'i': opt.first_id = atoi(optarg); break;
+            case 'B': opt.burst_every = atof(optarg); break;
+            case 'b': opt.burst = atoi(optarg); break;
+            case 'S': opt.storm_every = atof(optarg); break;
+            case 's': opt.storm_fraction = atof(optarg); break;
+            case 'x': opt.bad_fraction = atof(optarg); break;
+            case 't': opt.hot_fraction = atof(optarg); break;
+            case 'w': opt.drain_seconds = atof(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if(opt.nodes <= 0 || opt.nodes > 65536 - opt.first_id || opt.first_id < 0 || opt.rate <= 0 || opt.seconds <= 0) {
+        usage(argv[0]);
+    }
+}
+
+int main(int argc, char *argv[]) {
+
+    parse_options(argc, argv);
+    signal(SIGPIPE, SIG_IGN);
+    //a node is a descriptor, the soft limit is raised as far as allowed, the gateway started here inherits it
+    struct rlimit limit;
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        if(limit.rlim_cur < (rlim_t) opt.nodes + 64) {
+            printf("ulimit -n is %llu, not every node can connect\n", (unsigned long long) limit.rlim_cur);
+        }
+    }
+    gateway_addr.sin_family = AF_INET;
+    gateway_addr.sin_port = htons(opt.port);
+    if(inet_pton(AF_INET, opt.ip, &gateway_addr.sin_addr) != 1) usage(argv[0]);
+    srand(1);
+    pid_t gateway = -1;
+    if(opt.gateway != NULL) {
+        gateway = start_gateway();
+        if(gateway < 0) {
+            fprintf(stderr, "%s did not start, see gateway.out\n", opt.gateway);
+            return EXIT_FAILURE;
+        }
+    }
+    nodes = calloc(opt.nodes, sizeof(node_t));
+    epoll_fd = epoll_create1(0);
+    if(nodes == NULL || epoll_fd < 0) return EXIT_FAILURE;
+    int bad = 0;
+    for(int i = 0; i < opt.nodes; i++) {
+        nodes[i].fd = -1;
+        nodes[i].id = (uint16_t) (opt.first_id + i);
+        //bad clients are spread over the fleet and take the kinds in turn
+        if((double) rand()/RAND_MAX < opt.bad_fraction) nodes[i].kind = (uint8_t) (NODE_SLOW + bad++ % (NODE_KINDS - 1));
+        nodes[i].hot = nodes[i].kind == NODE_GOOD && (double) rand()/RAND_MAX < opt.hot_fraction;
+    }
+    printf("%i nodes, %i of them bad clients, %.1f readings/s each, %.0f readings/s, %.0f s", opt.nodes, bad,
+           opt.rate, opt.nodes*opt.rate, opt.seconds);
+    if(opt.burst_every > 0) printf(", bursts of %i readings per node every %.1f s", opt.burst, opt.burst_every);
+    if(opt.storm_every > 0) printf(", %.0f%% of the nodes reconnect every %.1f s", opt.storm_fraction*100,
+                                   opt.storm_every);
+    printf("\n");
+    gateway_metrics_t before, after;
+    read_metrics(&before);
+
+    int64_t begin = now_ms(), end = begin + (int64_t) (opt.seconds*1000);
+    int64_t next_burst = opt.burst_every > 0 ? begin + (int64_t) (opt.burst_every*1000) : INT64_MAX;
+    int64_t next_storm = opt.storm_every > 0 ? begin + (int64_t) (opt.storm_every*1000) : INT64_MAX;
+    int64_t next_report = begin + SENSOR_FLEET_REPORT_MS, next_retry = begin;
+    uint64_t scheduled = 0, last_sent = 0, sent;
+    int next_node = 0;
+    double per_ms = opt.nodes*opt.rate/1000;
+    struct epoll_event events[SENSOR_FLEET_EVENTS];
+    int64_t now;
+    while((now = now_ms()) < end) {
+        if(now >= next_retry) {
+            for(int i = 0; i < opt.nodes; i++) {
+                if(nodes[i].state == NODE_IDLE && nodes[i].retry_ms <= now) node_connect(&nodes[i], now);
+            }
+            next_retry = now + 10;
+        }
+        //readings are due on the nodes in turn, so the fleet sends at a steady rate and no node sends twice as often
+        uint64_t due = (uint64_t) ((now - begin)*per_ms);
+        for(; scheduled < due; scheduled++) {
+            node_reading(&nodes[next_node], now);
+            next_node = (next_node + 1) % opt.nodes;
+        }
+        if(now >= next_burst) {
+            for(int b = 0; b < opt.burst; b++) {
+                for(int i = 0; i < opt.nodes; i++) node_reading(&nodes[i], now);
+            }
+            next_burst += (int64_t) (opt.burst_every*1000);
+        }
+        if(now >= next_storm) {
+            storm(now);
+            next_storm += (int64_t) (opt.storm_every*1000);
+        }
+        if(now >= next_report) {
+            sent = sent_readings();
+            printf("  %5.1f s  %6i connected  %8.0f readings/s  %llu not connected  %llu queue full  %llu closed by "
+                   "gateway\n", (now - begin)/1000.0, connected_nodes(),
+                   (sent - last_sent)*1000.0/SENSOR_FLEET_REPORT_MS, (unsigned long long) stats.not_connected,
+                   (unsigned long long) stats.queued_full, (unsigned long long) stats.closed_by_gateway);
+            fflush(stdout);
+            last_sent = sent;
+            next_report += SENSOR_FLEET_REPORT_MS;
+        }
+        int count = epoll_wait(epoll_fd, events, SENSOR_FLEET_EVENTS, 1);
+        for(int i = 0; i < count; i++) node_event((node_t *) events[i].data.ptr, events[i].events, now_ms());
+    }
+    double load_seconds = (now_ms() - begin)/1000.0;
+
+    //readings still queued on nodes are sent while the gateway drains, slow nodes send the half record they held
+    for(int i = 0; i < opt.nodes; i++) {
+        if(nodes[i].state == NODE_CONNECTED && nodes[i].held > 0) {
+            nodes[i].held = 0;
+            if(nodes[i].offset == 0) node_flush(&nodes[i], now_ms());
+        }
+    }
+    sent = sent_readings();
+    printf("fleet: %llu readings due, %llu queued, %llu sent (%.0f/s), %llu not connected, %llu queue full, "
+           "%llu garbage records\n", (unsigned long long) stats.due, (unsigned long long) stats.queued,
+           (unsigned long long) sent, sent/load_seconds, (unsigned long long) stats.not_connected,
+           (unsigned long long) stats.queued_full, (unsigned long long) stats.bad_records);
+    printf("fleet: %llu connects, %llu failed, %llu closed by the gateway, %llu closed by storms\n",
+           (unsigned long long) stats.connects, (unsigned long long) stats.connect_failures,
+           (unsigned long long) stats.closed_by_gateway, (unsigned long long) stats.storm_closes);
+    for(int k = NODE_SLOW; k < NODE_KINDS; k++) {
+        int count = 0;
+        for(int i = 0; i < opt.nodes; i++) count += nodes[i].kind == k;
+        if(count > 0) printf("  %i %s nodes\n", count, kind_names[k]);
+    }
+
+    //the nodes stay connected while the gateway catches up, until what it received is stored
+    if(before.ok) {
+        int64_t drain_end = now_ms() + (int64_t) (opt.drain_seconds*1000), changed = now_ms();
+        uint64_t stored = UINT64_MAX, received = UINT64_MAX;
+        while(now_ms() < drain_end) {
+            read_metrics(&after);
+            if(!after.ok) break;
+            uint64_t now_stored = after.committed + after.spooled;
+            if(now_stored != stored || after.received != received) {
+                stored = now_stored;
+                received = after.received;
+                changed = now_ms();
+            }
+            //connmgr can stand still for a while on one node, only a longer pause counts as drained
+            //datamgr only reads on a new reading, readings it left are reported instead of waited for
+            if(after.storagemgr_lag == 0 && now_ms() - changed >= SENSOR_FLEET_SETTLE_MS) break;
+            //queued readings still go out, no new ones are due
+            int64_t wait_end = now_ms() + 200;
+            while((now = now_ms()) < wait_end) {
+                int count = epoll_wait(epoll_fd, events, SENSOR_FLEET_EVENTS, (int) (wait_end - now));
+                for(int i = 0; i < count; i++) node_event((node_t *) events[i].data.ptr, events[i].events, now_ms());
+            }
+        }
+        double total_seconds = (changed - begin)/1000.0;
+        read_metrics(&after);
+        if(after.ok) report_metrics(&before, &after, sent_readings(), load_seconds, total_seconds);
+        else printf("gateway metrics at %s gone before the end\n", METRICS_SOCKET);
+    } else {
+        printf("no gateway metrics at %s\n", METRICS_SOCKET);
+    }
+    fflush(stdout);
+    for(int i = 0; i < opt.nodes; i++) {
+        if(nodes[i].fd >= 0) close(nodes[i].fd);
+    }
+    close(epoll_fd);
+    free(nodes);
+    if(gateway > 0) stop_gateway(gateway);
+    return EXIT_SUCCESS;
+}
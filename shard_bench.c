@@ -0,0 +1,117 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+/*
+ * benchmark of the sharded storage: insert throughput with 1, 2, 4 and 8 shards, and a merged query over them
+ * not part of the gateway, run it in a scratch directory, build with:
+ * gcc -O2 -DSET_MAX_TEMP=20 -DSET_MIN_TEMP=10 -DDB_NAME='"shard_bench.db"' shard_bench.c storage_shard.c sensor_db.c storage_profile.c storage_partition.c histogram.c -lsqlite3 -lpthread -lm -o shard_bench
+ * the shards use STORAGE_PROFILE, e.g. add -DSTORAGE_PROFILE='"durable"' to sync every commit
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include "config.h"
+#include "storage_shard.h"
+#include "histogram.h"
+
+#ifndef BENCH_ROWS
+#define BENCH_ROWS 200000
+#endif
+
+#ifndef BENCH_SENSORS
+#define BENCH_SENSORS 64
+#endif
+
+#ifndef BENCH_BATCH
+#define BENCH_BATCH STORAGEMGR_BATCH_MAX
+#endif
+
+static int64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+static void remove_shards(int count) {
+    char path[256], other[300];
+    for(int i = 0; i < count; i++) {
+        storage_shard_path(i, path, sizeof(path));
+        unlink(path);
+        snprintf(other, sizeof(other), "%s-wal", path);
+        unlink(other);
+        snprintf(other, sizeof(other), "%s-shm", path);
+        unlink(other);
+    }
+}
+
+static int count_row(void *arg, int columns, char **row, char **names) {
+    return 0;
+}
+
+static int count_reading(const sensor_data_t *data, void *arg) {
+    sensor_ts_t *last = arg;
+    if(data->ts < *last) {
+        printf("merge out of order\n");
+        exit(EXIT_FAILURE);
+    }
+    *last = data->ts;
+    return 0;
+}
+
+int main() {
+
+    sensor_data_t *data = malloc(BENCH_ROWS*sizeof(sensor_data_t));
+    if(data == NULL) return EXIT_FAILURE;
+    time_t start = time(NULL) - BENCH_ROWS/BENCH_SENSORS;
+    for(int i = 0; i < BENCH_ROWS; i++) {
+        data[i].id = 1 + i % BENCH_SENSORS;
+        data[i].value = 15 + (i % 100)/10.0;
+        data[i].ts = start + i/BENCH_SENSORS;
+    }
+
+    printf("%i rows of %i sensors in batches of %i, profile %s\n", BENCH_ROWS, BENCH_SENSORS, BENCH_BATCH,
+           STORAGE_PROFILE);
+    double base = 0;
+    for(int count = 1; count <= 8; count *= 2) {
+        remove_shards(count);
+        status_code_storagemgr_t status;
+        storage_shards_t *shards = storage_shards_open(count, 1, &status);
+        if(shards == NULL) {
+            printf("cannot open %i shards\n", count);
+            return EXIT_FAILURE;
+        }
+        histogram_t latency;
+        histogram_reset(&latency);
+        int64_t begin = now_us();
+        for(int done = 0; done < BENCH_ROWS; done += BENCH_BATCH) {
+            int rows = BENCH_ROWS - done < BENCH_BATCH ? BENCH_ROWS - done : BENCH_BATCH;
+            int64_t batch_start = now_us();
+            if(storage_shards_append(shards, data + done, rows, 0, 0) != STATUS_OK) {
+                printf("insert failed\n");
+                return EXIT_FAILURE;
+            }
+            histogram_add(&latency, now_us() - batch_start);
+        }
+        double rate = BENCH_ROWS/((now_us() - begin)/1e6);
+        if(count == 1) base = rate;
+        begin = now_us();
+        if(storage_shards_find(shards, SENSOR_QUERY_ALL, 0, 0, 0, 0, count_row) != 0) {
+            printf("query failed\n");
+            return EXIT_FAILURE;
+        }
+        double query_ms = (now_us() - begin)/1e3;
+        sensor_ts_t last = 0;
+        begin = now_us();
+        int64_t scanned = storage_shards_scan(shards, NULL, start, start + BENCH_ROWS/BENCH_SENSORS, count_reading, &last);
+        double scan_ms = (now_us() - begin)/1e3;
+        printf("  %i shard%s %9.0f rows/s (x%.2f)  batch p50 %6lu us  p99 %6lu us  find_all %6.0f ms  merged scan %lld rows %6.0f ms\n",
+               count, count > 1 ? "s" : " ", rate, rate/base, (unsigned long) histogram_percentile(&latency, 50),
+               (unsigned long) histogram_percentile(&latency, 99), query_ms, (long long) scanned, scan_ms);
+        storage_shards_close(shards);
+        remove_shards(count);
+    }
+    free(data);
+    return 0;
+}
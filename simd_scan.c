@@ -0,0 +1,208 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#include <math.h>
+#include <string.h>
+#include "simd_scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+typedef void (*thresholds_fn)(const sensor_value_t *, const sensor_value_t *, const sensor_value_t *, int8_t *, int, int *, int *);
+typedef void (*room_avg_fn)(const sensor_value_t *, const int32_t *, const int32_t *, int, sensor_value_t *);
+
+/*
+ * scalar kernels, also used for the tail of the vector loops
+ */
+static void thresholds_scalar(const sensor_value_t *avg, const sensor_value_t *min_temp, const sensor_value_t *max_temp,
+                              int8_t *flags, int n, int *too_hot, int *too_cold) {
+    int hot = 0, cold = 0;
+    for(int i = 0; i < n; i++) {
+        int h = avg[i] > max_temp[i];
+        int c = avg[i] < min_temp[i];
+        flags[i] = (int8_t) (h - c);
+        hot += h;
+        cold += c;
+    }
+    *too_hot += hot;
+    *too_cold += cold;
+}
+
+static void room_avg_scalar(const sensor_value_t *avg, const int32_t *slots, const int32_t *room_start, int rooms,
+                            sensor_value_t *room_avg) {
+    for(int r = 0; r < rooms; r++) {
+        sensor_value_t sum = 0;
+        int count = 0;
+        for(int k = room_start[r]; k < room_start[r+1]; k++) {
+            sensor_value_t v = avg[slots[k]];
+            if(isnan(v)) continue;
+            sum += v;
+            count++;
+        }
+        room_avg[r] = count ? sum/count : NAN;
+    }
+}
+
+#ifdef SIMD_SCAN_X86
+
+/*
+ * movemask -> one flag byte per lane, lane k lives in byte k
+ * hot and cold never both hold for a lane because the map parser rejects min_temp >= max_temp
+ */
+static const uint32_t lane_bytes[16] = {
+    0x00000000, 0x00000001, 0x00000100, 0x00000101, 0x00010000, 0x00010001, 0x00010100, 0x00010101,
+    0x01000000, 0x01000001, 0x01000100, 0x01000101, 0x01010000, 0x01010001, 0x01010100, 0x01010101
+};
+
+__attribute__((target("sse4.2,popcnt")))
+static void thresholds_sse42(const sensor_value_t *avg, const sensor_value_t *min_temp, const sensor_value_t *max_temp,
+                             int8_t *flags, int n, int *too_hot, int *too_cold) {
+    int i = 0, hot = 0, cold = 0;
+    for(; i + 2 <= n; i += 2) {
+        __m128d a = _mm_loadu_pd(avg + i);
+        int h = _mm_movemask_pd(_mm_cmpgt_pd(a, _mm_loadu_pd(max_temp + i)));   //ordered compare, NAN gives 0
+        int c = _mm_movemask_pd(_mm_cmplt_pd(a, _mm_loadu_pd(min_temp + i)));
+        uint16_t packed = (uint16_t) (lane_bytes[h] | lane_bytes[c]*0xff);      //0x01 hot, 0xff cold per byte
+        memcpy(flags + i, &packed, sizeof(packed));
+        hot += _mm_popcnt_u32(h);
+        cold += _mm_popcnt_u32(c);
+    }
+    *too_hot += hot;
+    *too_cold += cold;
+    thresholds_scalar(avg + i, min_temp + i, max_temp + i, flags + i, n - i, too_hot, too_cold);
+}
+
+__attribute__((target("avx2,popcnt")))
+static void thresholds_avx2(const sensor_value_t *avg, const sensor_value_t *min_temp, const sensor_value_t *max_temp,
+                            int8_t *flags, int n, int *too_hot, int *too_cold) {
+    int i = 0, hot = 0, cold = 0;
+    for(; i + 4 <= n; i += 4) {
+        __m256d a = _mm256_loadu_pd(avg + i);
+        int h = _mm256_movemask_pd(_mm256_cmp_pd(a, _mm256_loadu_pd(max_temp + i), _CMP_GT_OQ));
+        int c = _mm256_movemask_pd(_mm256_cmp_pd(a, _mm256_loadu_pd(min_temp + i), _CMP_LT_OQ));
+        uint32_t packed = lane_bytes[h] | lane_bytes[c]*0xff;
+        memcpy(flags + i, &packed, sizeof(packed));
+        hot += _mm_popcnt_u32(h);
+        cold += _mm_popcnt_u32(c);
+    }
+    *too_hot += hot;
+    *too_cold += cold;
+    thresholds_scalar(avg + i, min_temp + i, max_temp + i, flags + i, n - i, too_hot, too_cold);
+}
+
+__attribute__((target("sse4.2")))
+static void room_avg_sse42(const sensor_value_t *avg, const int32_t *slots, const int32_t *room_start, int rooms,
+                           sensor_value_t *room_avg) {
+    __m128d one = _mm_set1_pd(1.0);
+    for(int r = 0; r < rooms; r++) {
+        __m128d sum = _mm_setzero_pd(), count = _mm_setzero_pd();
+        int k = room_start[r];
+        for(; k + 2 <= room_start[r+1]; k += 2) {
+            __m128d v = _mm_set_pd(avg[slots[k+1]], avg[slots[k]]);
+            __m128d ok = _mm_cmpord_pd(v, v);
+            sum = _mm_add_pd(sum, _mm_and_pd(v, ok));
+            count = _mm_add_pd(count, _mm_and_pd(one, ok));
+        }
+        double s[2], c[2];
+        _mm_storeu_pd(s, sum);
+        _mm_storeu_pd(c, count);
+        sensor_value_t total = s[0] + s[1];
+        double counted = c[0] + c[1];
+        for(; k < room_start[r+1]; k++) {
+            if(isnan(avg[slots[k]])) continue;
+            total += avg[slots[k]];
+            counted++;
+        }
+        room_avg[r] = counted > 0 ? total/counted : NAN;
+    }
+}
+
+__attribute__((target("avx2")))
+static void room_avg_avx2(const sensor_value_t *avg, const int32_t *slots, const int32_t *room_start, int rooms,
+                          sensor_value_t *room_avg) {
+    __m256d one = _mm256_set1_pd(1.0);
+    for(int r = 0; r < rooms; r++) {
+        __m256d sum = _mm256_setzero_pd(), count = _mm256_setzero_pd();
+        int k = room_start[r];
+        for(; k + 4 <= room_start[r+1]; k += 4) {
+            __m128i idx = _mm_loadu_si128((const __m128i *) (slots + k));
+            __m256d v = _mm256_i32gather_pd(avg, idx, sizeof(sensor_value_t));
+            __m256d ok = _mm256_cmp_pd(v, v, _CMP_ORD_Q);
+            sum = _mm256_add_pd(sum, _mm256_and_pd(v, ok));
+            count = _mm256_add_pd(count, _mm256_and_pd(one, ok));
+        }
+        double s[4], c[4];
+        _mm256_storeu_pd(s, sum);
+        _mm256_storeu_pd(c, count);
+        sensor_value_t total = (s[0] + s[1]) + (s[2] + s[3]);
+        double counted = (c[0] + c[1]) + (c[2] + c[3]);
+        for(; k < room_start[r+1]; k++) {
+            if(isnan(avg[slots[k]])) continue;
+            total += avg[slots[k]];
+            counted++;
+        }
+        room_avg[r] = counted > 0 ? total/counted : NAN;
+    }
+}
+
+#endif /* SIMD_SCAN_X86 */
+
+static thresholds_fn thresholds_impl = thresholds_scalar;
+static room_avg_fn room_avg_impl = room_avg_scalar;
+static int current_level = SIMD_SCAN_SCALAR;
+
+static int level_supported(int level) {
+    if(level == SIMD_SCAN_SCALAR) return 1;
+#ifdef SIMD_SCAN_X86
+    __builtin_cpu_init();
+    if(level == SIMD_SCAN_SSE42) return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt");
+    if(level == SIMD_SCAN_AVX2) return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+#endif
+    return 0;
+}
+
+int simd_scan_set_level(int level) {
+    if(!level_supported(level)) level = SIMD_SCAN_SCALAR;
+    thresholds_impl = thresholds_scalar;
+    room_avg_impl = room_avg_scalar;
+#ifdef SIMD_SCAN_X86
+    if(level == SIMD_SCAN_SSE42) {
+        thresholds_impl = thresholds_sse42;
+        room_avg_impl = room_avg_sse42;
+    } else if(level == SIMD_SCAN_AVX2) {
+        thresholds_impl = thresholds_avx2;
+        room_avg_impl = room_avg_avx2;
+    }
+#endif
+    current_level = level;
+    return level;
+}
+
+int simd_scan_init() {
+    if(level_supported(SIMD_SCAN_AVX2)) return simd_scan_set_level(SIMD_SCAN_AVX2);
+    if(level_supported(SIMD_SCAN_SSE42)) return simd_scan_set_level(SIMD_SCAN_SSE42);
+    return simd_scan_set_level(SIMD_SCAN_SCALAR);
+}
+
+const char *simd_scan_level_name(int level) {
+    switch(level) {
+        case SIMD_SCAN_AVX2: return "avx2";
+        case SIMD_SCAN_SSE42: return "sse4.2";
+        default: return "scalar";
+    }
+}
+
+void simd_scan_thresholds(const sensor_value_t *avg, const sensor_value_t *min_temp, const sensor_value_t *max_temp,
+                          int8_t *flags, int n, int *too_hot, int *too_cold) {
+    *too_hot = 0;
+    *too_cold = 0;
+    thresholds_impl(avg, min_temp, max_temp, flags, n, too_hot, too_cold);
+}
+
+void simd_scan_room_avg(const sensor_value_t *avg, const int32_t *slots, const int32_t *room_start, int rooms,
+                        sensor_value_t *room_avg) {
+    room_avg_impl(avg, slots, room_start, rooms, room_avg);
+}
@@ -0,0 +1,52 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#ifndef _SIMD_SCAN_H_
+#define _SIMD_SCAN_H_
+
+#include <stdint.h>
+#include "config.h"
+
+/*
+ * scan kernels over the struct-of-arrays sensor state of datamgr
+ * every kernel has a scalar version, x86 cpus get an SSE4.2 or AVX2 version picked at runtime
+ */
+
+#define SIMD_SCAN_SCALAR 0
+#define SIMD_SCAN_SSE42 1
+#define SIMD_SCAN_AVX2 2
+
+#define SIMD_SCAN_OK 0
+#define SIMD_SCAN_HOT 1
+#define SIMD_SCAN_COLD -1
+
+/*
+ * picks the best kernels this cpu supports, safe to call more than once
+ * \return the selected level
+ */
+int simd_scan_init();
+
+/*
+ * forces a level (used by the benchmark), falls back to scalar if the cpu does not support it
+ * \return the selected level
+ */
+int simd_scan_set_level(int level);
+
+const char *simd_scan_level_name(int level);
+
+/*
+ * flags every sensor whose average is above max_temp (SIMD_SCAN_HOT) or below min_temp (SIMD_SCAN_COLD)
+ * a NAN average (window not full yet) is never flagged
+ */
+void simd_scan_thresholds(const sensor_value_t *avg, const sensor_value_t *min_temp, const sensor_value_t *max_temp,
+                          int8_t *flags, int n, int *too_hot, int *too_cold);
+
+/*
+ * averages avg over the slots of every room, room r owns slots[room_start[r]] up to slots[room_start[r+1]]
+ * NAN averages are skipped, a room without any full window gets NAN
+ */
+void simd_scan_room_avg(const sensor_value_t *avg, const int32_t *slots, const int32_t *room_start, int rooms,
+                        sensor_value_t *room_avg);
+
+#endif /* _SIMD_SCAN_H_ */
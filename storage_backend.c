@@ -0,0 +1,276 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include "storage_backend.h"
+#include "column_store.h"
+#include "storage_shard.h"
+
+typedef struct {
+    const char *name;
+    void *(*open)(int clear, status_code_storagemgr_t *status);
+    void (*close)(void *handle);
+    status_code_storagemgr_t (*append)(void *handle, const sensor_data_t *data, int count);
+    status_code_storagemgr_t (*append_spooled)(void *handle, const sensor_data_t *data, int count, uint64_t spool,
+                                               uint64_t seq);
+    status_code_storagemgr_t (*spooled)(void *handle, uint64_t spool, uint64_t *seq);
+    int64_t (*scan)(void *handle, const sensor_id_t *id, sensor_ts_t from, sensor_ts_t to, storage_scan_t f, void *arg);
+    uint64_t (*bytes)(void *handle);
+} backend_ops_t;
+
+struct storage_backend {
+    const backend_ops_t *ops;
+    void *handle;
+};
+
+/*
+ * sqlite: writes on the connection of init_connection(), scans on a read connection opened on the first scan
+ */
+typedef struct {
+    DBCONN *db;
+    DBCONN *reader;
+    pthread_mutex_t read_lock;          //one scan at a time on the read connection
+} sqlite_backend_t;
+
+static void *sqlite_open(int clear, status_code_storagemgr_t *status) {
+    sqlite_backend_t *b = calloc(1, sizeof(sqlite_backend_t));
+    if(b == NULL) {
+        *status = STATUS_FAILURE;
+        return NULL;
+    }
+    char table_name[64];
+    b->db = init_connection(clear, status, table_name);
+    if(b->db == NULL) {
+        free(b);
+        return NULL;
+    }
+    pthread_mutex_init(&(b->read_lock), NULL);
+    return b;
+}
+
+static void sqlite_close(void *handle) {
+    sqlite_backend_t *b = handle;
+    if(b->reader != NULL) disconnect(b->reader);
+    disconnect(b->db);
+    pthread_mutex_destroy(&(b->read_lock));
+    free(b);
+}
+
+static status_code_storagemgr_t sqlite_append(void *handle, const sensor_data_t *data, int count) {
+    return insert_sensor_batch(((sqlite_backend_t *) handle)->db, data, count);
+}
+
+static status_code_storagemgr_t sqlite_append_spooled(void *handle, const sensor_data_t *data, int count,
+                                                      uint64_t spool, uint64_t seq) {
+    return insert_sensor_spooled(((sqlite_backend_t *) handle)->db, data, count, spool, seq);
+}
+
+static status_code_storagemgr_t sqlite_spooled(void *handle, uint64_t spool, uint64_t *seq) {
+    return find_sensor_spooled(((sqlite_backend_t *) handle)->db, spool, seq);
+}
+
+static int64_t sqlite_scan(void *handle, const sensor_id_t *id, sensor_ts_t from, sensor_ts_t to, storage_scan_t f,
+                           void *arg) {
+    sqlite_backend_t *b = handle;
+    int64_t found = -1;
+    pthread_mutex_lock(&(b->read_lock));
+    if(b->reader == NULL) b->reader = init_read_connection();
+    sensor_cursor_t *cursor = b->reader == NULL ? NULL : sensor_cursor_open(b->reader, id != NULL ? SENSOR_QUERY_BY_SENSOR
+                                                   : SENSOR_QUERY_TIME_RANGE, id != NULL ? *id : 0, 0, from, to);
+    if(cursor != NULL) {
+        sensor_data_t data;
+        int rc;
+        found = 0;
+        while((rc = sensor_cursor_next(cursor, &data)) == 1) {
+            found++;
+            if(f(&data, arg) != 0) break;
+        }
+        if(rc < 0) found = -1;
+        sensor_cursor_close(cursor);
+    }
+    pthread_mutex_unlock(&(b->read_lock));
+    return found;
+}
+
+static uint64_t sqlite_bytes(void *handle) {
+    sqlite3_stmt *stmt;
+    uint64_t bytes = 0;
+    if(sqlite3_prepare_v2(((sqlite_backend_t *) handle)->db, "SELECT page_count*page_size FROM pragma_page_count(), "
+                          "pragma_page_size();", -1, &stmt, NULL) != SQLITE_OK) return 0;
+    if(sqlite3_step(stmt) == SQLITE_ROW) bytes = sqlite3_column_int64(stmt, 0);
+    sqlite3_finalize(stmt);
+    return bytes;
+}
+
+/*
+ * sharded: STORAGE_SHARDS sqlite files written in parallel, see storage_shard.h
+ */
+static void *sharded_open(int clear, status_code_storagemgr_t *status) {
+    return storage_shards_open(STORAGE_SHARDS, clear, status);
+}
+
+static void sharded_close(void *handle) {
+    storage_shards_close(handle);
+}
+
+static status_code_storagemgr_t sharded_append(void *handle, const sensor_data_t *data, int count) {
+    return storage_shards_append(handle, data, count, 0, 0);
+}
+
+static status_code_storagemgr_t sharded_append_spooled(void *handle, const sensor_data_t *data, int count,
+                                                       uint64_t spool, uint64_t seq) {
+    return storage_shards_append(handle, data, count, spool, seq);
+}
+
+static status_code_storagemgr_t sharded_spooled(void *handle, uint64_t spool, uint64_t *seq) {
+    return storage_shards_spooled(handle, spool, seq);
+}
+
+static int64_t sharded_scan(void *handle, const sensor_id_t *id, sensor_ts_t from, sensor_ts_t to, storage_scan_t f,
+                            void *arg) {
+    return storage_shards_scan(handle, id, from, to, f, arg);
+}
+
+static uint64_t sharded_bytes(void *handle) {
+    return storage_shards_bytes(handle);
+}
+
+/*
+ * column: the files of column_store.c, the spool position is kept in their manifest
+ */
+static void *column_open(int clear, status_code_storagemgr_t *status) {
+    column_store_t *store = column_store_open(STORAGE_COLUMN_DIR, clear);
+    if(store == NULL) {
+        *status = STATUS_FAILURE;
+        return NULL;
+    }
+    column_store_stats_t stats;
+    column_store_get_stats(store, &stats);
+    *status = stats.readings == 0 ? STATUS_NEW_TABLE : STATUS_OK;
+    return store;
+}
+
+static void column_close(void *handle) {
+    column_store_close(handle);
+}
+
+/*
+ * appends and commits the batch, a batch that fails partway is rolled back, so it is stored whole or not at all
+ */
+static status_code_storagemgr_t column_commit(column_store_t *store, const sensor_data_t *data, int count,
+                                              uint64_t spool, uint64_t seq, int sync) {
+    if(column_store_append(store, data, count) == 0 && column_store_commit(store, spool, seq, sync) == 0) return STATUS_OK;
+    column_store_rollback(store);
+    return STATUS_FAILURE;
+}
+
+static status_code_storagemgr_t column_append(void *handle, const sensor_data_t *data, int count) {
+    uint64_t spool, seq;
+    column_store_position(handle, &spool, &seq);
+    //without sync the page cache writes the mapped blocks back, like synchronous=OFF
+    return column_commit(handle, data, count, spool, seq, STORAGE_COLUMN_SYNC);
+}
+
+/*
+ * always synced, the spool drops its copy of the batch once it is replayed
+ */
+static status_code_storagemgr_t column_append_spooled(void *handle, const sensor_data_t *data, int count,
+                                                      uint64_t spool, uint64_t seq) {
+    return column_commit(handle, data, count, spool, seq, 1);
+}
+
+static status_code_storagemgr_t column_spooled(void *handle, uint64_t spool, uint64_t *seq) {
+    uint64_t stored_spool;
+    column_store_position(handle, &stored_spool, seq);
+    if(stored_spool != spool) *seq = 0;
+    return STATUS_OK;
+}
+
+static int64_t column_scan(void *handle, const sensor_id_t *id, sensor_ts_t from, sensor_ts_t to, storage_scan_t f,
+                           void *arg) {
+    return column_store_scan(handle, id, from, to, f, arg);
+}
+
+static uint64_t column_bytes(void *handle) {
+    column_store_stats_t stats;
+    column_store_get_stats(handle, &stats);
+    return stats.used_bytes;
+}
+
+static const backend_ops_t backends[] = {
+    {"sqlite", sqlite_open, sqlite_close, sqlite_append, sqlite_append_spooled, sqlite_spooled, sqlite_scan, sqlite_bytes},
+    {"sharded", sharded_open, sharded_close, sharded_append, sharded_append_spooled, sharded_spooled, sharded_scan,
+     sharded_bytes},
+    {"column", column_open, column_close, column_append, column_append_spooled, column_spooled, column_scan, column_bytes},
+};
+#define BACKEND_COUNT ((int) (sizeof(backends)/sizeof(backends[0])))
+
+storage_backend_t *storage_backend_open(const char *name, int clear, status_code_storagemgr_t *status) {
+
+    *status = STATUS_FAILURE;
+    for(int i = 0; i < BACKEND_COUNT; i++) {
+        if(strcasecmp(backends[i].name, name) != 0) continue;
+        storage_backend_t *backend = malloc(sizeof(storage_backend_t));
+        if(backend == NULL) return NULL;
+        backend->ops = &(backends[i]);
+        backend->handle = backends[i].open(clear, status);
+        if(backend->handle == NULL) {
+            DEBUG_PRINTF("cannot open storage backend %s", name);
+            free(backend);
+            return NULL;
+        }
+        return backend;
+    }
+    DEBUG_PRINTF("no storage backend %s", name);
+    return NULL;
+}
+
+void storage_backend_close(storage_backend_t *backend) {
+    if(backend == NULL) return;
+    backend->ops->close(backend->handle);
+    free(backend);
+}
+
+const char *storage_backend_name(storage_backend_t *backend) {
+    return backend->ops->name;
+}
+
+status_code_storagemgr_t storage_backend_append(storage_backend_t *backend, const sensor_data_t *data, int count) {
+    if(count <= 0) return STATUS_OK;
+    return backend->ops->append(backend->handle, data, count);
+}
+
+int storage_backend_partial(storage_backend_t *backend) {
+    return backend->ops->open == sharded_open;
+}
+
+status_code_storagemgr_t storage_backend_append_spooled(storage_backend_t *backend, const sensor_data_t *data, int count,
+                                                        uint64_t spool, uint64_t seq) {
+    return backend->ops->append_spooled(backend->handle, data, count, spool, seq);
+}
+
+status_code_storagemgr_t storage_backend_spooled(storage_backend_t *backend, uint64_t spool, uint64_t *seq) {
+    return backend->ops->spooled(backend->handle, spool, seq);
+}
+
+int64_t storage_backend_scan(storage_backend_t *backend, const sensor_id_t *id, sensor_ts_t from, sensor_ts_t to,
+                             storage_scan_t f, void *arg) {
+    return backend->ops->scan(backend->handle, id, from, to, f, arg);
+}
+
+uint64_t storage_backend_bytes(storage_backend_t *backend) {
+    return backend->ops->bytes(backend->handle);
+}
+
+storage_shards_t *storage_backend_shards(storage_backend_t *backend) {
+    return backend->ops->open == sharded_open ? backend->handle : NULL;
+}
+
+DBCONN *storage_backend_sqlite(storage_backend_t *backend) {
+    return backend->ops->open == sqlite_open ? ((sqlite_backend_t *) backend->handle)->db : NULL;
+}
@@ -0,0 +1,90 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#ifndef _STORAGE_BACKEND_H_
+#define _STORAGE_BACKEND_H_
+
+#include <stdint.h>
+#include "config.h"
+#include "sensor_db.h"
+#include "storage_shard.h"
+
+/*
+ * where the storagemgr keeps readings, picked by name with STORAGE_BACKEND
+ *
+ * sqlite    the SQL database of sensor_db.c, with partitions, rollups and the find_sensor_* queries
+ * sharded   STORAGE_SHARDS sqlite files by sensor id, each written by its own thread (storage_shard.c),
+ *           storage_shards_find() runs the find_sensor_* queries over all of them
+ * column    the append only per sensor column files of column_store.c in STORAGE_COLUMN_DIR, a few bytes per reading
+ *
+ * a backend is written by one thread, scans may come from other threads
+ */
+
+typedef struct storage_backend storage_backend_t;
+
+/*
+ * called for every reading of a scan, non-zero stops the scan
+ */
+typedef int (*storage_scan_t)(const sensor_data_t *data, void *arg);
+
+/*
+ * opens a backend by name, clear removes the stored readings
+ * \param status set like init_connection() does, STATUS_NEW_TABLE when the backend starts out empty
+ * \return the backend, NULL if there is no backend with that name or it cannot be opened
+ */
+storage_backend_t *storage_backend_open(const char *name, int clear, status_code_storagemgr_t *status);
+
+void storage_backend_close(storage_backend_t *backend);
+
+const char *storage_backend_name(storage_backend_t *backend);
+
+/*
+ * stores count readings, all of them or none for the sqlite and column backends
+ */
+status_code_storagemgr_t storage_backend_append(storage_backend_t *backend, const sensor_data_t *data, int count);
+
+/*
+ * \return non-zero when a failed append can have stored part of the batch, the sharded backend when a COMMIT
+ * fails after other shards committed
+ */
+int storage_backend_partial(storage_backend_t *backend);
+
+/*
+ * stores count readings replayed from spool file spool, or a live batch numbered with storage_spool_claim(), and
+ * records seq, the last batch in data, as stored
+ * sqlite does both in one transaction, every shard of the sharded backend does both for its part and skips a batch it
+ * already stored, the column backend syncs the readings and then writes the position into the
+ * manifest that also counts them, a crash before the manifest is renamed drops the readings with the position
+ */
+status_code_storagemgr_t storage_backend_append_spooled(storage_backend_t *backend, const sensor_data_t *data, int count,
+                                                        uint64_t spool, uint64_t seq);
+
+/*
+ * \param seq set to the last batch of spool file spool that is stored, 0 if none
+ */
+status_code_storagemgr_t storage_backend_spooled(storage_backend_t *backend, uint64_t spool, uint64_t *seq);
+
+/*
+ * calls f for the readings of sensor id (all sensors if id is NULL) with from <= ts <= to
+ * \return the number of readings passed to f, -1 if an error occurs
+ */
+int64_t storage_backend_scan(storage_backend_t *backend, const sensor_id_t *id, sensor_ts_t from, sensor_ts_t to,
+                             storage_scan_t f, void *arg);
+
+/*
+ * bytes the stored readings take on disk
+ */
+uint64_t storage_backend_bytes(storage_backend_t *backend);
+
+/*
+ * the shards of the sharded backend, NULL for the others
+ */
+storage_shards_t *storage_backend_shards(storage_backend_t *backend);
+
+/*
+ * the writer connection of the sqlite backend, NULL for the others
+ */
+DBCONN *storage_backend_sqlite(storage_backend_t *backend);
+
+#endif /* _STORAGE_BACKEND_H_ */
@@ -0,0 +1,98 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+/*
+ * benchmark of the storage profiles, commits readings one at a time and in batches with every profile
+ * not part of the gateway, run it in a scratch directory, build with:
+ * gcc -O2 -DSET_MAX_TEMP=20 -DSET_MIN_TEMP=10 -DDB_NAME='"storage_bench.db"' storage_bench.c sensor_db.c storage_profile.c storage_partition.c histogram.c -lsqlite3 -lpthread -lm -o storage_bench
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include "config.h"
+#include "sensor_db.h"
+#include "storage_profile.h"
+#include "histogram.h"
+
+#ifndef BENCH_ROWS
+#define BENCH_ROWS 100000
+#endif
+
+#ifndef BENCH_SINGLE_COMMITS
+#define BENCH_SINGLE_COMMITS 1000
+#endif
+
+#define BENCH_BATCH STORAGEMGR_BATCH_MAX
+
+static int64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+/*
+ * commits rows readings in batches of batch, one bench row
+ */
+static void bench_commits(DBCONN *db, const char *label, sensor_data_t *data, int rows, int batch) {
+    histogram_t latency;
+    histogram_reset(&latency);
+    int64_t start = now_us();
+    for(int done = 0; done < rows; done += batch) {
+        int64_t commit_start = now_us();
+        if(insert_sensor_batch(db, data + done, batch) != STATUS_OK) {
+            printf("insert failed\n");
+            exit(EXIT_FAILURE);
+        }
+        histogram_add(&latency, now_us() - commit_start);
+    }
+    double seconds = (now_us() - start)/1e6;
+    printf("  %-10s %9.0f rows/s  commit p50 %7lu us  p99 %7lu us  max %7lu us\n", label, rows/seconds,
+           (unsigned long) histogram_percentile(&latency, 50), (unsigned long) histogram_percentile(&latency, 99),
+           (unsigned long) latency.max);
+}
+
+int main() {
+
+    sensor_data_t *data = malloc(BENCH_ROWS*sizeof(sensor_data_t));
+    if(data == NULL) return EXIT_FAILURE;
+    time_t now = time(NULL);
+    for(int i = 0; i < BENCH_ROWS; i++) {
+        data[i].id = i % 64;
+        data[i].value = 15 + (i % 100)/10.0;
+        data[i].ts = now + i/64;
+    }
+
+    printf("%i single row commits, %i rows in batches of %i\n", BENCH_SINGLE_COMMITS, BENCH_ROWS, BENCH_BATCH);
+    const storage_profile_t *profile;
+    for(int p = 0; (profile = storage_profile_at(p)) != NULL; p++) {
+        unlink(DB_NAME);
+        unlink(DB_NAME "-wal");
+        unlink(DB_NAME "-shm");
+        status_code_storagemgr_t status;
+        char table_name[16];
+        DBCONN *db = init_connection(1, &status, table_name);
+        if(db == NULL || storage_profile_apply(db, profile) != STATUS_OK
+           || storage_checkpointer_start(db, profile) != STATUS_OK) {
+            printf("cannot open %s with profile %s\n", DB_NAME, profile->name);
+            return EXIT_FAILURE;
+        }
+        printf("%s (journal %s, synchronous %i)\n", profile->name, profile->journal_mode, profile->synchronous);
+        bench_commits(db, "single", data, BENCH_SINGLE_COMMITS, 1);
+        bench_commits(db, "batched", data, BENCH_ROWS - BENCH_ROWS % BENCH_BATCH, BENCH_BATCH);
+        storage_checkpointer_stop();
+        storage_checkpoint_stats_t checkpoints;
+        storage_checkpointer_get_stats(&checkpoints);
+        if(checkpoints.runs > 0) {
+            printf("  checkpoints %lu, pages %lu, longest %lu us\n", (unsigned long) checkpoints.runs,
+                   (unsigned long) checkpoints.pages, (unsigned long) checkpoints.max_us);
+        }
+        disconnect(db);
+    }
+    unlink(DB_NAME);
+    unlink(DB_NAME "-wal");
+    unlink(DB_NAME "-shm");
+    free(data);
+    return 0;
+}
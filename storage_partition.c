@@ -0,0 +1,334 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+#include "storage_partition.h"
+
+#define SECONDS_PER_DAY 86400
+
+#define LEGACY_TABLE    TABLE_NAME "_legacy"
+#define HOUR_TABLE      TABLE_NAME "_hour_rollup"
+#define STATE_TABLE     TABLE_NAME "_rollup"     //per raw table the last row id in the rollups
+#define PARTITION_GLOB  TABLE_NAME "_[0-9][0-9][0-9][0-9][0-9][0-9][0-9][0-9]"
+
+//no AUTOINCREMENT, it costs a sqlite_sequence lookup per insert statement and that table has a row per partition
+//rows are never deleted one by one so ids still only grow within a partition, which is all the rollups need
+#define RAW_COLUMNS     "(id INTEGER PRIMARY KEY, sensor_id INTEGER, sensor_value DECIMAL(4,2), timestamp TIMESTAMP)"
+#define ROLLUP_COLUMNS  "(sensor_id INTEGER, %s INTEGER, samples INTEGER, min_value REAL, max_value REAL, sum_value REAL, " \
+                        "PRIMARY KEY(sensor_id, %s)) WITHOUT ROWID"
+
+//rows with an id in (?1, ?2] of a raw table, added to a rollup table per sensor and bucket of ?3 seconds
+#define ROLLUP_SQL      "INSERT INTO \"%w\" SELECT sensor_id, timestamp - timestamp %% ?3, count(*), min(sensor_value), "   \
+                        "max(sensor_value), sum(sensor_value) FROM \"%w\" WHERE id > ?1 AND id <= ?2 GROUP BY 1, 2 "        \
+                        "ON CONFLICT(sensor_id, %s) DO UPDATE SET samples = samples + excluded.samples, "                                 \
+                        "min_value = min(min_value, excluded.min_value), max_value = max(max_value, excluded.max_value), " \
+                        "sum_value = sum_value + excluded.sum_value;"
+
+static int run(DBCONN *conn, const char *sql) {
+    char *err_msg;
+    if(sqlite3_exec(conn, sql, 0, 0, &err_msg) != SQLITE_OK) {
+        DEBUG_PRINTF("%s failed, %s", sql, err_msg);
+        sqlite3_free(err_msg);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * like run() for sql built with sqlite3_mprintf(), frees it
+ */
+static int run_printed(DBCONN *conn, char *sql) {
+    if(sql == NULL) return -1;
+    int rc = run(conn, sql);
+    sqlite3_free(sql);
+    return rc;
+}
+
+static void free_names(char **names) {
+    if(names == NULL) return;
+    for(int i = 0; names[i] != NULL; i++) sqlite3_free(names[i]);
+    free(names);
+}
+
+/*
+ * names of the raw tables, the legacy table first and then the partitions from old to new
+ * \return a NULL terminated array for free_names(), NULL if an error occurs
+ */
+static char **raw_tables(DBCONN *conn) {
+    sqlite3_stmt *stmt;
+    if(sqlite3_prepare_v2(conn, "SELECT name FROM sqlite_master WHERE type = 'table' AND (name = ?1 OR name GLOB ?2) "
+                          "ORDER BY name = ?1 DESC, name;", -1, &stmt, NULL) != SQLITE_OK) return NULL;
+    sqlite3_bind_text(stmt, 1, LEGACY_TABLE, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, PARTITION_GLOB, -1, SQLITE_STATIC);
+    int count = 0, capacity = 16;
+    char **names = malloc(capacity*sizeof(char *));
+    while(names != NULL && sqlite3_step(stmt) == SQLITE_ROW) {
+        if(count + 1 == capacity) {
+            char **grown = realloc(names, 2*capacity*sizeof(char *));
+            if(grown == NULL) {
+                names[count] = NULL;
+                free_names(names);
+                names = NULL;
+                break;
+            }
+            names = grown;
+            capacity *= 2;
+        }
+        names[count++] = sqlite3_mprintf("%s", sqlite3_column_text(stmt, 0));
+    }
+    if(names != NULL) names[count] = NULL;
+    sqlite3_finalize(stmt);
+    return names;
+}
+
+/*
+ * TABLE_NAME and TABLE_NAME_minute are unions of all raw and minute rollup tables, remade when partitions come or go
+ */
+static int rebuild_views(DBCONN *conn) {
+    char **names = raw_tables(conn);
+    if(names == NULL) return -1;
+    sqlite3_str *raw = sqlite3_str_new(conn), *minute = sqlite3_str_new(conn);
+    sqlite3_str_appendall(raw, "DROP VIEW IF EXISTS \"" TABLE_NAME "\"; CREATE VIEW \"" TABLE_NAME "\" AS ");
+    sqlite3_str_appendall(minute, "DROP VIEW IF EXISTS \"" TABLE_NAME "_minute\"; CREATE VIEW \"" TABLE_NAME "_minute\" AS ");
+    for(int i = 0; names[i] != NULL; i++) {
+        const char *glue = i > 0 ? " UNION ALL " : "";
+        sqlite3_str_appendf(raw, "%sSELECT id, sensor_id, sensor_value, timestamp FROM \"%w\"", glue, names[i]);
+        sqlite3_str_appendf(minute, "%sSELECT sensor_id, minute, samples, min_value, max_value, "
+                            "sum_value/samples AS avg_value FROM \"%w_m\"", glue, names[i]);
+    }
+    free_names(names);
+    sqlite3_str_appendall(raw, ";");
+    sqlite3_str_appendall(minute, ";");
+    int rc = run_printed(conn, sqlite3_str_finish(raw));
+    return run_printed(conn, sqlite3_str_finish(minute)) | rc;
+}
+
+static int create_indexes(DBCONN *conn, const char *name) {
+    return run_printed(conn, sqlite3_mprintf(
+            "CREATE INDEX IF NOT EXISTS \"%w_sensor_ts\" ON \"%w\"(sensor_id, timestamp, sensor_value);"
+            "CREATE INDEX IF NOT EXISTS \"%w_ts\" ON \"%w\"(timestamp, sensor_id, sensor_value);", name, name, name, name));
+}
+
+static int drop_indexes(DBCONN *conn, const char *name) {
+    return run_printed(conn, sqlite3_mprintf("DROP INDEX IF EXISTS \"%w_sensor_ts\"; DROP INDEX IF EXISTS \"%w_ts\";",
+                                             name, name));
+}
+
+/*
+ * the raw table and its minute rollup table
+ */
+static int create_tables(DBCONN *conn, const char *name) {
+    return run_printed(conn, sqlite3_mprintf("CREATE TABLE IF NOT EXISTS \"%w\" " RAW_COLUMNS ";"
+                                             "CREATE TABLE IF NOT EXISTS \"%w_m\" " ROLLUP_COLUMNS ";",
+                                             name, name, "minute", "minute"));
+}
+
+static int table_exists(DBCONN *conn, const char *name, const char *type) {
+    sqlite3_stmt *stmt;
+    if(sqlite3_prepare_v2(conn, "SELECT 1 FROM sqlite_master WHERE type = ?1 AND name = ?2;", -1, &stmt, NULL) != SQLITE_OK) {
+        return 0;
+    }
+    sqlite3_bind_text(stmt, 1, type, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, name, -1, SQLITE_STATIC);
+    int exists = sqlite3_step(stmt) == SQLITE_ROW;
+    sqlite3_finalize(stmt);
+    return exists;
+}
+
+/*
+ * drops every table and view of the partitioned layout
+ */
+static int drop_all(DBCONN *conn) {
+    sqlite3_stmt *stmt;
+    if(sqlite3_prepare_v2(conn, "SELECT type, name FROM sqlite_master WHERE type IN ('table', 'view') "
+                          "AND (name = ?1 OR name GLOB ?1 || '_*');", -1, &stmt, NULL) != SQLITE_OK) return -1;
+    sqlite3_bind_text(stmt, 1, TABLE_NAME, -1, SQLITE_STATIC);
+    sqlite3_str *sql = sqlite3_str_new(conn);
+    while(sqlite3_step(stmt) == SQLITE_ROW) {
+        sqlite3_str_appendf(sql, "DROP %s IF EXISTS \"%w\";", strcmp((const char *) sqlite3_column_text(stmt, 0), "view") == 0
+                            ? "VIEW" : "TABLE", sqlite3_column_text(stmt, 1));
+    }
+    sqlite3_finalize(stmt);
+    forget_statements(conn, TABLE_NAME);
+    if(sqlite3_str_length(sql) == 0) {
+        sqlite3_free(sqlite3_str_finish(sql));
+        return 0;
+    }
+    return run_printed(conn, sqlite3_str_finish(sql));
+}
+
+status_code_storagemgr_t storage_partition_init(DBCONN *conn, int clear) {
+
+    if(run(conn, "BEGIN IMMEDIATE;") != 0) return STATUS_FAILURE;
+    int rc = 0;
+    if(clear) rc |= drop_all(conn);
+    if(rc == 0 && table_exists(conn, TABLE_NAME, "table")) {
+        //the single table from before partitioning, its rows stay available through the view
+        rc |= drop_indexes(conn, TABLE_NAME);
+        rc |= run(conn, "ALTER TABLE \"" TABLE_NAME "\" RENAME TO \"" LEGACY_TABLE "\";");
+    }
+    if(rc == 0) {
+        rc |= create_tables(conn, LEGACY_TABLE);
+        rc |= create_indexes(conn, LEGACY_TABLE);
+        rc |= run_printed(conn, sqlite3_mprintf("CREATE TABLE IF NOT EXISTS \"" HOUR_TABLE "\" " ROLLUP_COLUMNS ";"
+                                                "CREATE TABLE IF NOT EXISTS \"" STATE_TABLE "\" "
+                                                "(partition TEXT PRIMARY KEY, last_id INTEGER NOT NULL);"
+                                                "CREATE VIEW IF NOT EXISTS \"" TABLE_NAME "_hour\" AS SELECT sensor_id, hour, "
+                                                "samples, min_value, max_value, sum_value/samples AS avg_value "
+                                                "FROM \"" HOUR_TABLE "\";", "hour", "hour"));
+        rc |= rebuild_views(conn);
+    }
+    if(rc != 0 || run(conn, "COMMIT;") != 0) {
+        run(conn, "ROLLBACK;");
+        return STATUS_FAILURE;
+    }
+    return STATUS_OK;
+}
+
+int64_t storage_partition_day(sensor_ts_t ts) {
+    int64_t t = (int64_t) ts;
+    return t >= 0 ? t/SECONDS_PER_DAY : -((-t + SECONDS_PER_DAY - 1)/SECONDS_PER_DAY);
+}
+
+void storage_partition_name(sensor_ts_t ts, char *name) {
+    time_t day_start = (time_t) (storage_partition_day(ts)*SECONDS_PER_DAY);
+    struct tm tm;
+    gmtime_r(&day_start, &tm);
+    snprintf(name, STORAGE_PARTITION_NAME_MAX, TABLE_NAME "_%04d%02d%02d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+}
+
+status_code_storagemgr_t storage_partition_create(DBCONN *conn, const char *name, int with_indexes) {
+
+    if(table_exists(conn, name, "table")) return STATUS_OK;
+    //a savepoint works inside the transaction of a batch as well as on its own
+    if(run(conn, "SAVEPOINT partition;") != 0) return STATUS_FAILURE;
+    int rc = create_tables(conn, name);
+    if(with_indexes) rc |= create_indexes(conn, name);
+    rc |= rebuild_views(conn);
+    if(rc != 0) {
+        run(conn, "ROLLBACK TO partition; RELEASE partition;");
+        return STATUS_FAILURE;
+    }
+    run(conn, "RELEASE partition;");
+    return STATUS_OK;
+}
+
+status_code_storagemgr_t storage_partition_indexes(DBCONN *conn, int create) {
+    char **names = raw_tables(conn);
+    if(names == NULL) return STATUS_FAILURE;
+    int rc = 0;
+    for(int i = 0; names[i] != NULL; i++) rc |= create ? create_indexes(conn, names[i]) : drop_indexes(conn, names[i]);
+    free_names(names);
+    return rc == 0 ? STATUS_OK : STATUS_FAILURE;
+}
+
+static sqlite3_int64 query_int(DBCONN *conn, char *sql, const char *text) {
+    sqlite3_stmt *stmt;
+    sqlite3_int64 value = -1;
+    if(sql != NULL && sqlite3_prepare_v2(conn, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        if(text != NULL) sqlite3_bind_text(stmt, 1, text, -1, SQLITE_STATIC);
+        value = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int64(stmt, 0) : 0;
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_free(sql);
+    return value;
+}
+
+/*
+ * adds the rows (from, to] of a raw table to a rollup table with buckets of width seconds
+ */
+static int rollup_range(DBCONN *conn, const char *rollup, const char *bucket, const char *name, sqlite3_int64 from,
+                        sqlite3_int64 to, int width) {
+    char *sql = sqlite3_mprintf(ROLLUP_SQL, rollup, name, bucket);
+    sqlite3_stmt *stmt;
+    int rc = sql != NULL && sqlite3_prepare_v2(conn, sql, -1, &stmt, NULL) == SQLITE_OK ? 0 : -1;
+    sqlite3_free(sql);
+    if(rc != 0) {
+        DEBUG_PRINTF("cannot prepare rollup of %s, %s", name, sqlite3_errmsg(conn));
+        return -1;
+    }
+    sqlite3_bind_int64(stmt, 1, from);
+    sqlite3_bind_int64(stmt, 2, to);
+    sqlite3_bind_int(stmt, 3, width);
+    rc = sqlite3_step(stmt) == SQLITE_DONE ? 0 : -1;
+    sqlite3_finalize(stmt);
+    return rc;
+}
+
+status_code_storagemgr_t storage_partition_rollup(DBCONN *conn, storage_partition_stats_t *stats) {
+
+    char **names = raw_tables(conn);
+    if(names == NULL) return STATUS_FAILURE;
+    if(run(conn, "BEGIN IMMEDIATE;") != 0) {
+        free_names(names);
+        return STATUS_FAILURE;
+    }
+    int rc = 0;
+    uint64_t rows = 0;
+    for(int i = 0; names[i] != NULL && rc == 0; i++) {
+        sqlite3_int64 last = query_int(conn, sqlite3_mprintf("SELECT last_id FROM \"" STATE_TABLE "\" WHERE partition = ?1;"),
+                                       names[i]);
+        sqlite3_int64 top = query_int(conn, sqlite3_mprintf("SELECT max(id) FROM \"%w\";", names[i]), NULL);
+        if(last < 0 || top < 0) rc = -1;
+        if(rc != 0 || top <= last) continue;
+        char minute[STORAGE_PARTITION_NAME_MAX + 2];
+        snprintf(minute, sizeof(minute), "%s_m", names[i]);
+        rc |= rollup_range(conn, minute, "minute", names[i], last, top, 60);
+        rc |= rollup_range(conn, HOUR_TABLE, "hour", names[i], last, top, 3600);
+        rc |= run_printed(conn, sqlite3_mprintf("INSERT INTO \"" STATE_TABLE "\" VALUES (%Q, %lld) "
+                                                "ON CONFLICT(partition) DO UPDATE SET last_id = excluded.last_id;", names[i], top));
+        rows += query_int(conn, sqlite3_mprintf("SELECT count(*) FROM \"%w\" WHERE id > %lld AND id <= %lld;",
+                                                names[i], last, top), NULL);
+    }
+    free_names(names);
+    if(rc != 0 || run(conn, "COMMIT;") != 0) {
+        run(conn, "ROLLBACK;");
+        return STATUS_FAILURE;
+    }
+    if(stats != NULL) {
+        stats->rollup_runs++;
+        stats->rolled_up += rows;
+    }
+    return STATUS_OK;
+}
+
+status_code_storagemgr_t storage_partition_expire(DBCONN *conn, time_t now, storage_partition_stats_t *stats) {
+
+    if(STORAGE_RETENTION_DAYS <= 0) return STATUS_OK;
+    //today and the STORAGE_RETENTION_DAYS - 1 days before it are kept, names sort like their days
+    char oldest_kept[STORAGE_PARTITION_NAME_MAX];
+    storage_partition_name(now - (time_t) (STORAGE_RETENTION_DAYS - 1)*SECONDS_PER_DAY, oldest_kept);
+    char **names = raw_tables(conn);
+    if(names == NULL) return STATUS_FAILURE;
+    int expired = 0;
+    for(int i = 0; names[i] != NULL; i++) expired += strcmp(names[i], LEGACY_TABLE) != 0 && strcmp(names[i], oldest_kept) < 0;
+    if(expired == 0) {
+        free_names(names);
+        return STATUS_OK;
+    }
+    if(run(conn, "BEGIN IMMEDIATE;") != 0) {
+        free_names(names);
+        return STATUS_FAILURE;
+    }
+    int rc = 0;
+    for(int i = 0; names[i] != NULL && rc == 0; i++) {
+        if(strcmp(names[i], LEGACY_TABLE) == 0 || strcmp(names[i], oldest_kept) >= 0) continue;
+        //cached inserts into the partition would keep it from being dropped
+        forget_statements(conn, names[i]);
+        rc |= run_printed(conn, sqlite3_mprintf("DROP TABLE \"%w\"; DROP TABLE IF EXISTS \"%w_m\";"
+                                                "DELETE FROM \"" STATE_TABLE "\" WHERE partition = %Q;",
+                                                names[i], names[i], names[i]));
+    }
+    free_names(names);
+    if(rc == 0) rc = rebuild_views(conn);
+    if(rc != 0 || run(conn, "COMMIT;") != 0) {
+        run(conn, "ROLLBACK;");
+        return STATUS_FAILURE;
+    }
+    if(stats != NULL) stats->dropped += expired;
+    return STATUS_OK;
+}
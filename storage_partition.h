@@ -0,0 +1,73 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#ifndef _STORAGE_PARTITION_H_
+#define _STORAGE_PARTITION_H_
+
+#include <stdint.h>
+#include <time.h>
+#include "config.h"
+#include "sensor_db.h"
+
+/*
+ * time partitioned storage
+ *
+ * readings go to one table per UTC day of their timestamp, TABLE_NAME_YYYYMMDD, with the columns and indexes the single
+ * table had, TABLE_NAME itself is a view over all of them so queries stay the same
+ * a table from before partitioning is kept as TABLE_NAME_legacy, a partition that never expires
+ * partitions older than STORAGE_RETENTION_DAYS are dropped as a whole instead of deleting their rows
+ *
+ * rollups per sensor keep the count, min, max and sum of the values per minute and per hour
+ * minute rollups live next to their partition (TABLE_NAME_YYYYMMDD_m) and are dropped with it, hour rollups are kept
+ * in TABLE_NAME_hour_rollup, the views TABLE_NAME_minute and TABLE_NAME_hour add the average
+ * they are brought up to date with the rows inserted since the last run, found by row id
+ * row ids are unique within a partition, not over all of them
+ */
+
+#define STORAGE_PARTITION_NAME_MAX 64
+
+typedef struct {
+    uint64_t rollup_runs;
+    uint64_t rolled_up;         /** < raw rows added to the rollups */
+    uint64_t dropped;           /** < expired partitions dropped */
+} storage_partition_stats_t;
+
+/*
+ * creates the views, rollup tables and TABLE_NAME_legacy if they are missing, turns an unpartitioned TABLE_NAME into
+ * TABLE_NAME_legacy, with clear set all partitions and rollups are dropped first
+ */
+status_code_storagemgr_t storage_partition_init(DBCONN *conn, int clear);
+
+/*
+ * day number of a timestamp, readings with the same day number share a partition
+ */
+int64_t storage_partition_day(sensor_ts_t ts);
+
+/*
+ * writes the name of the partition of ts into name (STORAGE_PARTITION_NAME_MAX bytes)
+ */
+void storage_partition_name(sensor_ts_t ts, char *name);
+
+/*
+ * creates partition name and its minute rollup table if it does not exist yet
+ * \param with_indexes 0 leaves out the indexes, for bulk loads that build them at the end
+ */
+status_code_storagemgr_t storage_partition_create(DBCONN *conn, const char *name, int with_indexes);
+
+/*
+ * drops (create = 0) or creates the indexes of all partitions
+ */
+status_code_storagemgr_t storage_partition_indexes(DBCONN *conn, int create);
+
+/*
+ * adds the rows inserted since the last run to the minute and hour rollups, in one transaction
+ */
+status_code_storagemgr_t storage_partition_rollup(DBCONN *conn, storage_partition_stats_t *stats);
+
+/*
+ * drops the partitions with readings older than STORAGE_RETENTION_DAYS days before now
+ */
+status_code_storagemgr_t storage_partition_expire(DBCONN *conn, time_t now, storage_partition_stats_t *stats);
+
+#endif /* _STORAGE_PARTITION_H_ */
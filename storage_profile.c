@@ -0,0 +1,188 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <time.h>
+#include <sqlite3.h>
+#include "storage_profile.h"
+
+static const storage_profile_t profiles[] = {
+    {"legacy",   "DELETE", 2, 0,         -2000,  0},
+    {"durable",  "WAL",    2, 64 << 20,  -16000, 1000},
+    {"balanced", "WAL",    1, 256 << 20, -32000, 1000},
+    {"fast",     "WAL",    0, 256 << 20, -64000, 4000},
+};
+#define PROFILE_COUNT ((int) (sizeof(profiles)/sizeof(profiles[0])))
+
+/*
+ * one background checkpointer, woken by the WAL hook of the writer connection
+ */
+static pthread_t checkpointer;
+static int checkpointer_running = 0;
+static pthread_mutex_t checkpoint_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t checkpoint_cond = PTHREAD_COND_INITIALIZER;
+static int wal_pages = 0;           //WAL size reported by the last commit
+static int wal_copied = 0;          //pages of the current WAL the last checkpoint copied back
+static int wal_threshold = 0;
+static int checkpoint_stop = 0;
+static DBCONN *writer_conn = NULL;
+static sqlite3 *checkpoint_conn = NULL;
+static storage_checkpoint_stats_t checkpoint_stats;
+static int last_log_pages = 0, last_done_pages = 0;     //only used by the checkpoint thread
+
+const storage_profile_t *storage_profile_find(const char *name) {
+    for(int i = 0; i < PROFILE_COUNT; i++) {
+        if(strcasecmp(profiles[i].name, name) == 0) return &(profiles[i]);
+    }
+    return NULL;
+}
+
+const storage_profile_t *storage_profile_at(int i) {
+    return i >= 0 && i < PROFILE_COUNT ? &(profiles[i]) : NULL;
+}
+
+status_code_storagemgr_t storage_profile_apply(DBCONN *conn, const storage_profile_t *profile) {
+
+    if(profile == NULL) return STATUS_FAILURE;
+    char query[256];
+    snprintf(query, sizeof(query), "PRAGMA journal_mode=%s; PRAGMA synchronous=%i; PRAGMA mmap_size=%lld; PRAGMA cache_size=%i;",
+             profile->journal_mode, profile->synchronous, (long long) profile->mmap_size, profile->cache_size);
+    char *err_msg;
+    if(sqlite3_exec(conn, query, 0, 0, &err_msg) != SQLITE_OK) {
+        DEBUG_PRINTF("cannot apply storage profile %s, %s", profile->name, err_msg);
+        sqlite3_free(err_msg);
+        return STATUS_FAILURE;
+    }
+    return STATUS_OK;
+}
+
+status_code_storagemgr_t storage_profile_apply_reader(DBCONN *conn, const storage_profile_t *profile) {
+
+    if(profile == NULL) return STATUS_FAILURE;
+    char query[128];
+    snprintf(query, sizeof(query), "PRAGMA query_only=1; PRAGMA mmap_size=%lld; PRAGMA cache_size=%i;",
+             (long long) profile->mmap_size, profile->cache_size);
+    char *err_msg;
+    if(sqlite3_exec(conn, query, 0, 0, &err_msg) != SQLITE_OK) {
+        DEBUG_PRINTF("cannot apply storage profile %s, %s", profile->name, err_msg);
+        sqlite3_free(err_msg);
+        return STATUS_FAILURE;
+    }
+    return STATUS_OK;
+}
+
+/*
+ * runs on the writer thread after every commit, only hands the WAL size over
+ * installing it also turns off the automatic checkpoint of the writer connection
+ */
+static int wal_hook(void *arg, sqlite3 *db, const char *name, int pages) {
+    pthread_mutex_lock(&checkpoint_lock);
+    if(pages < wal_copied) wal_copied = 0;     //the writer started the WAL over
+    wal_pages = pages;
+    if(pages - wal_copied >= wal_threshold) pthread_cond_signal(&checkpoint_cond);
+    pthread_mutex_unlock(&checkpoint_lock);
+    return SQLITE_OK;
+}
+
+static void checkpoint_run(int pending) {
+    struct timespec start, end;
+    int log_pages = 0, done_pages = 0;
+    /*
+     * passive never waits for the writer or readers, but the writer only starts the WAL over when a commit begins
+     * with every frame copied back, under constant load that never happens and the WAL keeps growing
+     * so once it is STORAGE_CHECKPOINT_RESTART_FACTOR times over its threshold the next commit is held up once
+     */
+    int mode = pending >= STORAGE_CHECKPOINT_RESTART_FACTOR*wal_threshold ? SQLITE_CHECKPOINT_RESTART : SQLITE_CHECKPOINT_PASSIVE;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int rc = sqlite3_wal_checkpoint_v2(checkpoint_conn, NULL, mode, &log_pages, &done_pages);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t took = (end.tv_sec - start.tv_sec)*1000000 + (end.tv_nsec - start.tv_nsec)/1000;
+    //done_pages counts every copied frame of the current WAL, also the ones of earlier runs
+    int copied = log_pages < last_log_pages ? done_pages : done_pages - last_done_pages;
+    last_log_pages = log_pages;
+    last_done_pages = done_pages;
+    pthread_mutex_lock(&checkpoint_lock);
+    checkpoint_stats.runs++;
+    if(copied > 0) checkpoint_stats.pages += copied;
+    if(done_pages > wal_copied) wal_copied = done_pages;
+    if(rc == SQLITE_BUSY || done_pages < log_pages) checkpoint_stats.busy++;
+    if(took > checkpoint_stats.max_us) checkpoint_stats.max_us = took;
+    pthread_mutex_unlock(&checkpoint_lock);
+}
+
+static void *checkpoint_thread(void *arg) {
+    int stop = 0;
+    while(!stop) {
+        pthread_mutex_lock(&checkpoint_lock);
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += STORAGE_CHECKPOINT_INTERVAL;
+        while(!checkpoint_stop && wal_pages - wal_copied < wal_threshold) {
+            if(pthread_cond_timedwait(&checkpoint_cond, &checkpoint_lock, &deadline) != 0) break;
+        }
+        stop = checkpoint_stop;
+        int pending = wal_pages;
+        int fresh = wal_pages - wal_copied;
+        pthread_mutex_unlock(&checkpoint_lock);
+        if(fresh > 0 || stop) checkpoint_run(pending);
+    }
+    return NULL;
+}
+
+status_code_storagemgr_t storage_checkpointer_start(DBCONN *conn, const storage_profile_t *profile) {
+
+    if(profile == NULL || strcasecmp(profile->journal_mode, "WAL") != 0 || checkpointer_running) return STATUS_OK;
+    const char *path = sqlite3_db_filename(conn, "main");
+    //a connection only attaches to the WAL once it read something
+    if(path == NULL || sqlite3_open_v2(path, &checkpoint_conn, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK
+       || sqlite3_exec(checkpoint_conn, "PRAGMA schema_version;", 0, 0, NULL) != SQLITE_OK) {
+        DEBUG_PRINTF("cannot open checkpoint connection");
+        sqlite3_close(checkpoint_conn);
+        checkpoint_conn = NULL;
+        return STATUS_FAILURE;
+    }
+    sqlite3_busy_timeout(checkpoint_conn, STORAGE_BUSY_TIMEOUT);
+    last_log_pages = 0;
+    last_done_pages = 0;
+    pthread_mutex_lock(&checkpoint_lock);
+    wal_pages = 0;
+    wal_copied = 0;
+    wal_threshold = profile->wal_autocheckpoint > 0 ? profile->wal_autocheckpoint : 1000;
+    checkpoint_stop = 0;
+    memset(&checkpoint_stats, 0, sizeof(checkpoint_stats));
+    pthread_mutex_unlock(&checkpoint_lock);
+    writer_conn = conn;
+    sqlite3_wal_hook(conn, wal_hook, NULL);
+    if(pthread_create(&checkpointer, NULL, checkpoint_thread, NULL) != 0) {
+        sqlite3_wal_autocheckpoint(conn, wal_threshold);   //back to checkpoints on the writer
+        sqlite3_close(checkpoint_conn);
+        checkpoint_conn = NULL;
+        return STATUS_FAILURE;
+    }
+    checkpointer_running = 1;
+    return STATUS_OK;
+}
+
+void storage_checkpointer_stop() {
+    if(!checkpointer_running) return;
+    pthread_mutex_lock(&checkpoint_lock);
+    checkpoint_stop = 1;
+    pthread_cond_signal(&checkpoint_cond);
+    pthread_mutex_unlock(&checkpoint_lock);
+    pthread_join(checkpointer, NULL);
+    sqlite3_wal_hook(writer_conn, NULL, NULL);
+    sqlite3_close(checkpoint_conn);
+    checkpoint_conn = NULL;
+    writer_conn = NULL;
+    checkpointer_running = 0;
+}
+
+void storage_checkpointer_get_stats(storage_checkpoint_stats_t *stats) {
+    pthread_mutex_lock(&checkpoint_lock);
+    *stats = checkpoint_stats;
+    pthread_mutex_unlock(&checkpoint_lock);
+}
@@ -0,0 +1,75 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#ifndef _STORAGE_PROFILE_H_
+#define _STORAGE_PROFILE_H_
+
+#include <stdint.h>
+#include "config.h"
+#include "sensor_db.h"
+
+/*
+ * named sets of sqlite settings, picked with STORAGE_PROFILE
+ *
+ * legacy    rollback journal, synchronous=FULL, what init_connection always did
+ * durable   WAL, synchronous=FULL, every commit survives a power loss
+ * balanced  WAL, synchronous=NORMAL, commits survive a crash of the gateway, the last ones may be lost on power loss
+ * fast      WAL, synchronous=OFF, the OS decides when data reaches the disk
+ *
+ * with WAL the writer connection never checkpoints itself, a background thread with its own connection does
+ * once wal_autocheckpoint pages piled up (or every STORAGE_CHECKPOINT_INTERVAL seconds)
+ * these checkpoints never wait, only a WAL STORAGE_CHECKPOINT_RESTART_FACTOR times over its threshold makes the
+ * checkpoint wait for the writer to start the WAL over
+ */
+
+typedef struct {
+    const char *name;
+    const char *journal_mode;   /** < "WAL" or "DELETE" */
+    int synchronous;            /** < 0 OFF, 1 NORMAL, 2 FULL */
+    int64_t mmap_size;          /** < bytes of the database file read through mmap, 0 disables */
+    int cache_size;             /** < pages if positive, KiB if negative, like the pragma */
+    int wal_autocheckpoint;     /** < WAL pages before the background checkpoint runs */
+} storage_profile_t;
+
+typedef struct {
+    uint64_t runs;              /** < checkpoints done */
+    uint64_t pages;             /** < WAL pages written back to the database */
+    uint64_t busy;              /** < checkpoints that could not finish because of readers */
+    uint64_t max_us;            /** < longest checkpoint */
+} storage_checkpoint_stats_t;
+
+/*
+ * \return the profile with the given name, NULL if there is none
+ */
+const storage_profile_t *storage_profile_find(const char *name);
+
+/*
+ * \return profile number i, NULL past the last one
+ */
+const storage_profile_t *storage_profile_at(int i);
+
+/*
+ * applies the pragmas of a profile to a connection, has to happen outside of a transaction
+ */
+status_code_storagemgr_t storage_profile_apply(DBCONN *conn, const storage_profile_t *profile);
+
+/*
+ * applies the read side of a profile (mmap, cache) to a read only connection, its journal mode is the one of the file
+ */
+status_code_storagemgr_t storage_profile_apply_reader(DBCONN *conn, const storage_profile_t *profile);
+
+/*
+ * starts the background checkpoint thread for the writer connection conn, does nothing for a profile without WAL
+ * only one checkpointer runs at a time
+ */
+status_code_storagemgr_t storage_checkpointer_start(DBCONN *conn, const storage_profile_t *profile);
+
+/*
+ * runs a last checkpoint and joins the thread, call before the writer connection is closed
+ */
+void storage_checkpointer_stop();
+
+void storage_checkpointer_get_stats(storage_checkpoint_stats_t *stats);
+
+#endif /* _STORAGE_PROFILE_H_ */
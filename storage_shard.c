@@ -0,0 +1,343 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "storage_shard.h"
+#include "storage_partition.h"
+
+#define SHARD_PATH_MAX 256
+
+/*
+ * a shard thread goes IDLE -> BEGIN -> BEGUN -> END -> IDLE for every batch, the appending thread moves it to BEGIN
+ * and END and waits until every shard got through
+ */
+typedef enum {SHARD_IDLE = 0, SHARD_BEGIN, SHARD_BEGUN, SHARD_END, SHARD_STOP} shard_state_t;
+
+typedef struct {
+    int number;
+    pthread_t thread;
+    DBCONN *db;
+    DBCONN *reader;                         //opened by the first query
+    char path[SHARD_PATH_MAX];
+    sensor_data_t *rows;                    //this shard's part of the batch
+    int count;
+    int capacity;
+    int active;                             //takes part in the current batch
+    int skip;                               //stored the replayed batch already, begins and ends nothing
+    shard_state_t state;
+    status_code_storagemgr_t status;        //of the last step
+    struct storage_shards *shards;
+} shard_t;
+
+struct storage_shards {
+    int count;
+    shard_t *shard;
+    pthread_mutex_t lock;                   //guards the states, the rows of a shard belong to whoever moved it last
+    pthread_cond_t work;
+    pthread_cond_t done;
+    int busy;                               //shards still working on the current step
+    int commit;
+    uint64_t spool;
+    uint64_t seq;
+    pthread_mutex_t read_lock;              //one query at a time on the read connections
+};
+
+void storage_shard_path(int shard, char *path, size_t size) {
+    const char *dot = strrchr(DB_NAME, '.');
+    if(dot == NULL || strchr(dot, '/') != NULL) {
+        snprintf(path, size, "%s_%i", DB_NAME, shard);
+    } else {
+        snprintf(path, size, "%.*s_%i%s", (int) (dot - DB_NAME), DB_NAME, shard, dot);
+    }
+}
+
+int storage_shards_count(storage_shards_t *shards) {
+    return shards->count;
+}
+
+int storage_shards_of(storage_shards_t *shards, sensor_id_t id) {
+    //sensor ids are mostly small and consecutive, spread them with a multiplicative hash
+    return (int) (((uint32_t) id*2654435761u >> 16) % (uint32_t) shards->count);
+}
+
+static void shard_maintain(shard_t *shard) {
+    storage_partition_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    if(storage_partition_rollup(shard->db, &stats) != STATUS_OK) DEBUG_PRINTF("shard %i: cannot update rollups", shard->number);
+    if(storage_partition_expire(shard->db, time(NULL), &stats) != STATUS_OK) {
+        DEBUG_PRINTF("shard %i: cannot drop expired partitions", shard->number);
+    }
+}
+
+static void *shard_thread(void *arg) {
+
+    shard_t *shard = arg;
+    storage_shards_t *shards = shard->shards;
+    time_t last_maintenance = time(NULL);
+    pthread_mutex_lock(&(shards->lock));
+    while(1) {
+        if(shard->state == SHARD_IDLE && time(NULL) - last_maintenance >= STORAGE_ROLLUP_INTERVAL) {
+            last_maintenance = time(NULL);
+            pthread_mutex_unlock(&(shards->lock));
+            shard_maintain(shard);
+            pthread_mutex_lock(&(shards->lock));
+        }
+        if(shard->state == SHARD_STOP) break;
+        if(shard->state != SHARD_BEGIN && shard->state != SHARD_END) {
+            struct timespec wake;
+            clock_gettime(CLOCK_REALTIME, &wake);
+            wake.tv_sec += 1;
+            pthread_cond_timedwait(&(shards->work), &(shards->lock), &wake);
+            continue;
+        }
+        shard_state_t step = shard->state;
+        pthread_mutex_unlock(&(shards->lock));
+        status_code_storagemgr_t status;
+        if(step == SHARD_BEGIN) {
+            //a replayed batch can be on this shard already, its COMMIT went through when another shard's failed
+            uint64_t stored = 0;
+            status = STATUS_OK;
+            if(shards->spool != 0) status = find_sensor_spooled(shard->db, shards->spool, &stored);
+            shard->skip = status != STATUS_OK || (shards->spool != 0 && stored >= shards->seq);
+            if(!shard->skip) {
+                status = insert_sensor_begin(shard->db, shard->rows, shard->count, shards->spool, shards->seq);
+            }
+        } else {
+            status = shard->skip ? STATUS_OK : insert_sensor_end(shard->db, shards->commit);
+        }
+        pthread_mutex_lock(&(shards->lock));
+        shard->status = status;
+        shard->state = step == SHARD_BEGIN ? SHARD_BEGUN : SHARD_IDLE;
+        if(--shards->busy == 0) pthread_cond_signal(&(shards->done));
+    }
+    pthread_mutex_unlock(&(shards->lock));
+    return NULL;
+}
+
+storage_shards_t *storage_shards_open(int count, int clear, status_code_storagemgr_t *status) {
+
+    *status = STATUS_FAILURE;
+    if(count < 1) return NULL;
+    storage_shards_t *shards = calloc(1, sizeof(storage_shards_t));
+    if(shards == NULL) return NULL;
+    shards->shard = calloc(count, sizeof(shard_t));
+    if(shards->shard == NULL) {
+        free(shards);
+        return NULL;
+    }
+    pthread_mutex_init(&(shards->lock), NULL);
+    pthread_cond_init(&(shards->work), NULL);
+    pthread_cond_init(&(shards->done), NULL);
+    pthread_mutex_init(&(shards->read_lock), NULL);
+    *status = STATUS_OK;
+    for(int i = 0; i < count; i++) {
+        shard_t *shard = &(shards->shard[i]);
+        shard->number = i;
+        shard->shards = shards;
+        storage_shard_path(i, shard->path, sizeof(shard->path));
+        status_code_storagemgr_t shard_status;
+        shard->db = init_connection_at(shard->path, clear, &shard_status);
+        if(shard->db == NULL || pthread_create(&(shard->thread), NULL, shard_thread, shard) != 0) {
+            DEBUG_PRINTF("cannot open shard %s", shard->path);
+            if(shard->db != NULL) disconnect(shard->db);
+            shards->count = i;
+            storage_shards_close(shards);
+            *status = STATUS_FAILURE;
+            return NULL;
+        }
+        if(shard_status == STATUS_NEW_TABLE) *status = STATUS_NEW_TABLE;
+        shards->count = i + 1;
+    }
+    return shards;
+}
+
+void storage_shards_close(storage_shards_t *shards) {
+    if(shards == NULL) return;
+    pthread_mutex_lock(&(shards->lock));
+    for(int i = 0; i < shards->count; i++) shards->shard[i].state = SHARD_STOP;
+    pthread_cond_broadcast(&(shards->work));
+    pthread_mutex_unlock(&(shards->lock));
+    for(int i = 0; i < shards->count; i++) {
+        shard_t *shard = &(shards->shard[i]);
+        pthread_join(shard->thread, NULL);
+        if(shard->reader != NULL) disconnect(shard->reader);
+        disconnect(shard->db);
+        free(shard->rows);
+    }
+    pthread_mutex_destroy(&(shards->lock));
+    pthread_cond_destroy(&(shards->work));
+    pthread_cond_destroy(&(shards->done));
+    pthread_mutex_destroy(&(shards->read_lock));
+    free(shards->shard);
+    free(shards);
+}
+
+/*
+ * moves every shard taking part in the batch from one state to the next and waits until they all got through
+ * \return non-zero if every shard succeeded
+ */
+static int run_step(storage_shards_t *shards, shard_state_t step) {
+    int ok = 1;
+    pthread_mutex_lock(&(shards->lock));
+    for(int i = 0; i < shards->count; i++) {
+        if(!shards->shard[i].active) continue;
+        shards->shard[i].state = step;
+        shards->busy++;
+    }
+    pthread_cond_broadcast(&(shards->work));
+    while(shards->busy > 0) pthread_cond_wait(&(shards->done), &(shards->lock));
+    for(int i = 0; i < shards->count; i++) {
+        if(shards->shard[i].active && shards->shard[i].status != STATUS_OK) ok = 0;
+    }
+    pthread_mutex_unlock(&(shards->lock));
+    return ok;
+}
+
+status_code_storagemgr_t storage_shards_append(storage_shards_t *shards, const sensor_data_t *data, int count,
+                                               uint64_t spool, uint64_t seq) {
+
+    if(count <= 0) return STATUS_OK;
+    //the shard threads are idle, their rows can be filled without the lock
+    for(int i = 0; i < shards->count; i++) shards->shard[i].count = 0;
+    for(int i = 0; i < count; i++) {
+        shard_t *shard = &(shards->shard[storage_shards_of(shards, data[i].id)]);
+        if(shard->count == shard->capacity) {
+            int capacity = shard->capacity > 0 ? shard->capacity*2 : 256;
+            sensor_data_t *rows = realloc(shard->rows, capacity*sizeof(sensor_data_t));
+            if(rows == NULL) return STATUS_FAILURE;
+            shard->rows = rows;
+            shard->capacity = capacity;
+        }
+        shard->rows[shard->count++] = data[i];
+    }
+    //with a spool every shard records the position, also one that got no rows of this batch
+    for(int i = 0; i < shards->count; i++) shards->shard[i].active = shards->shard[i].count > 0 || spool != 0;
+    shards->spool = spool;
+    shards->seq = seq;
+    shards->commit = run_step(shards, SHARD_BEGIN);
+    int committed = run_step(shards, SHARD_END);
+    return shards->commit && committed ? STATUS_OK : STATUS_FAILURE;
+}
+
+status_code_storagemgr_t storage_shards_spooled(storage_shards_t *shards, uint64_t spool, uint64_t *seq) {
+    *seq = UINT64_MAX;
+    for(int i = 0; i < shards->count; i++) {
+        uint64_t stored;
+        if(find_sensor_spooled(shards->shard[i].db, spool, &stored) != STATUS_OK) return STATUS_FAILURE;
+        if(stored < *seq) *seq = stored;
+    }
+    if(*seq == UINT64_MAX) *seq = 0;
+    return STATUS_OK;
+}
+
+/*
+ * cursors over the shards that can hold rows of the query, NULL for the others
+ * \return the number of cursors opened, -1 if an error occurs
+ */
+static int open_cursors(storage_shards_t *shards, sensor_cursor_t **cursors, sensor_query_t query, sensor_id_t id,
+                        sensor_value_t value, sensor_ts_t from, sensor_ts_t to) {
+    int only = query == SENSOR_QUERY_BY_SENSOR ? storage_shards_of(shards, id) : -1;
+    int opened = 0;
+    //all entries are set before any can fail, close_cursors() goes over every one of them
+    for(int i = 0; i < shards->count; i++) cursors[i] = NULL;
+    for(int i = 0; i < shards->count; i++) {
+        shard_t *shard = &(shards->shard[i]);
+        if(only >= 0 && i != only) continue;
+        if(shard->reader == NULL) shard->reader = init_read_connection_at(shard->path);
+        if(shard->reader == NULL || (cursors[i] = sensor_cursor_open(shard->reader, query, id, value, from, to)) == NULL) {
+            return -1;
+        }
+        opened++;
+    }
+    return opened;
+}
+
+/*
+ * the cursor standing on the oldest row
+ * \return its index, -1 once all cursors are at their end, -2 if one of them failed
+ */
+static int oldest_cursor(storage_shards_t *shards, sensor_cursor_t **cursors) {
+    int oldest = -1;
+    sensor_ts_t oldest_ts = 0;
+    for(int i = 0; i < shards->count; i++) {
+        sensor_ts_t ts;
+        if(cursors[i] == NULL) continue;
+        int rc = sensor_cursor_peek(cursors[i], &ts);
+        if(rc < 0) return -2;
+        if(rc == 1 && (oldest < 0 || ts < oldest_ts)) {
+            oldest = i;
+            oldest_ts = ts;
+        }
+    }
+    return oldest;
+}
+
+static void close_cursors(storage_shards_t *shards, sensor_cursor_t **cursors) {
+    for(int i = 0; i < shards->count; i++) sensor_cursor_close(cursors[i]);
+}
+
+int storage_shards_find(storage_shards_t *shards, sensor_query_t query, sensor_id_t id, sensor_value_t value,
+                        sensor_ts_t from, sensor_ts_t to, callback_t f) {
+
+    sensor_cursor_t *cursors[shards->count];
+    int rc = 0;
+    pthread_mutex_lock(&(shards->read_lock));
+    if(open_cursors(shards, cursors, query, id, value, from, to) < 0) {
+        rc = -1;
+    } else {
+        int i;
+        while((i = oldest_cursor(shards, cursors)) >= 0 && sensor_cursor_emit(cursors[i], f) == 0);
+        if(i == -2) rc = -1;
+    }
+    close_cursors(shards, cursors);
+    pthread_mutex_unlock(&(shards->read_lock));
+    return rc;
+}
+
+int64_t storage_shards_scan(storage_shards_t *shards, const sensor_id_t *id, sensor_ts_t from, sensor_ts_t to,
+                            storage_shard_scan_t f, void *arg) {
+
+    sensor_cursor_t *cursors[shards->count];
+    int64_t found = 0;
+    pthread_mutex_lock(&(shards->read_lock));
+    if(open_cursors(shards, cursors, id != NULL ? SENSOR_QUERY_BY_SENSOR : SENSOR_QUERY_TIME_RANGE,
+                    id != NULL ? *id : 0, 0, from, to) < 0) {
+        found = -1;
+    } else {
+        int i;
+        sensor_data_t data;
+        while((i = oldest_cursor(shards, cursors)) >= 0) {
+            if(sensor_cursor_next(cursors[i], &data) != 1) {
+                i = -2;
+                break;
+            }
+            found++;
+            if(f(&data, arg) != 0) break;
+        }
+        if(i == -2) found = -1;
+    }
+    close_cursors(shards, cursors);
+    pthread_mutex_unlock(&(shards->read_lock));
+    return found;
+}
+
+uint64_t storage_shards_bytes(storage_shards_t *shards) {
+    uint64_t bytes = 0;
+    pthread_mutex_lock(&(shards->read_lock));
+    for(int i = 0; i < shards->count; i++) {
+        shard_t *shard = &(shards->shard[i]);
+        sqlite3_stmt *stmt;
+        if(shard->reader == NULL) shard->reader = init_read_connection_at(shard->path);
+        if(shard->reader == NULL || sqlite3_prepare_v2(shard->reader, "SELECT page_count*page_size FROM "
+                                                       "pragma_page_count(), pragma_page_size();", -1, &stmt, NULL) != SQLITE_OK) continue;
+        if(sqlite3_step(stmt) == SQLITE_ROW) bytes += sqlite3_column_int64(stmt, 0);
+        sqlite3_finalize(stmt);
+    }
+    pthread_mutex_unlock(&(shards->read_lock));
+    return bytes;
+}
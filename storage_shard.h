@@ -0,0 +1,94 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#ifndef _STORAGE_SHARD_H_
+#define _STORAGE_SHARD_H_
+
+#include <stdint.h>
+#include "config.h"
+#include "sensor_db.h"
+
+/*
+ * sensor readings spread over several database files by a hash of the sensor id, every file (shard) is written by
+ * its own thread on its own connection, so shards insert and sync in parallel
+ * a batch is split over the shards and each shard inserts its part in an open transaction, only when every shard
+ * managed that all of them commit, otherwise all roll back, so a batch is stored whole or not at all (short of a
+ * COMMIT failing after the others succeeded, the storage writer numbers every batch with the spool for that, and the
+ * shards that stored it skip it when it is replayed)
+ * shard threads bring the rollups of their file up to date and drop expired partitions every
+ * STORAGE_ROLLUP_INTERVAL seconds, in between batches
+ *
+ * queries open a cursor per shard (on read only connections) and merge the rows by timestamp, exactly for the
+ * queries ordered by timestamp, the others come out in timestamp order as far as the shards give them in that order
+ *
+ * one thread appends, queries may come from other threads, one at a time
+ */
+
+typedef struct storage_shards storage_shards_t;
+
+/*
+ * called for every reading of a scan, non-zero stops the scan
+ */
+typedef int (*storage_shard_scan_t)(const sensor_data_t *data, void *arg);
+
+/*
+ * path of database file shard, DB_NAME with the shard number before its extension
+ */
+void storage_shard_path(int shard, char *path, size_t size);
+
+/*
+ * opens count shards and starts their threads, clear removes stored readings
+ * \param status set like init_connection() does
+ * \return the shards, NULL if one of them cannot be opened
+ */
+storage_shards_t *storage_shards_open(int count, int clear, status_code_storagemgr_t *status);
+
+/*
+ * stops the shard threads and closes the files
+ */
+void storage_shards_close(storage_shards_t *shards);
+
+int storage_shards_count(storage_shards_t *shards);
+
+/*
+ * the shard sensor id is stored in
+ */
+int storage_shards_of(storage_shards_t *shards, sensor_id_t id);
+
+/*
+ * stores count readings on all shards in parallel
+ * \param spool non-zero records seq as stored for that spool on every shard, see insert_sensor_spooled(), a shard
+ * that stored seq of that spool already skips its part, so a batch replayed after a failed COMMIT is not stored twice
+ * \return STATUS_OK if every shard committed its part
+ */
+status_code_storagemgr_t storage_shards_append(storage_shards_t *shards, const sensor_data_t *data, int count,
+                                               uint64_t spool, uint64_t seq);
+
+/*
+ * \param seq set to the last batch of the spool all shards stored
+ */
+status_code_storagemgr_t storage_shards_spooled(storage_shards_t *shards, uint64_t spool, uint64_t *seq);
+
+/*
+ * find_sensor_* over all shards, a query with a sensor id only asks the shard of that sensor
+ * \param query, id, value, from, to as for sensor_cursor_open()
+ * \param f called like by the find_sensor_* functions, non-zero stops the query
+ * \return zero for success, and non-zero if an error occurs
+ */
+int storage_shards_find(storage_shards_t *shards, sensor_query_t query, sensor_id_t id, sensor_value_t value,
+                        sensor_ts_t from, sensor_ts_t to, callback_t f);
+
+/*
+ * calls f for the readings of sensor id (all sensors if id is NULL) with from <= ts <= to, oldest first
+ * \return the number of readings passed to f, -1 if an error occurs
+ */
+int64_t storage_shards_scan(storage_shards_t *shards, const sensor_id_t *id, sensor_ts_t from, sensor_ts_t to,
+                            storage_shard_scan_t f, void *arg);
+
+/*
+ * bytes of all shard files
+ */
+uint64_t storage_shards_bytes(storage_shards_t *shards);
+
+#endif /* _STORAGE_SHARD_H_ */
@@ -0,0 +1,291 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "storage_spool.h"
+
+#define SPOOL_MAGIC     "SENSPOOL"
+#define BATCH_MAGIC     0x31544142u         //"BAT1"
+#define BATCH_ROWS_MAX  (1 << 20)           //anything larger is not a batch this code wrote
+#define SEQ_RESERVE     4096                //sequence numbers handed out per header write
+
+typedef struct {
+    char magic[8];
+    uint64_t spool;                         //id of this file, the backend keeps its position per id
+    uint64_t next_seq;                      //numbers below it may have been handed out, an empty file starts here
+    uint32_t record_size;                   //sizeof(sensor_data_t) of the build that wrote it
+    uint32_t reserved;
+} spool_header_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+    uint64_t seq;
+    uint32_t checksum;                      //of the readings and seq
+    uint32_t reserved;
+} batch_header_t;
+
+struct storage_spool {
+    int fd;
+    uint64_t id;
+    uint64_t next_seq;
+    uint64_t seq_limit;                     //next_seq of the header
+    off_t end;                              //where the next batch goes
+    off_t replay;                           //first batch not replayed yet
+    sensor_data_t *buffer;                  //readings of a replay
+    int buffer_rows;
+    pthread_mutex_t stats_lock;             //only guards stats
+    storage_spool_stats_t stats;
+};
+
+/*
+ * FNV-1a, enough to tell a batch torn by a crash from a complete one
+ */
+static uint32_t checksum(const void *data, size_t bytes, uint64_t seq) {
+    uint32_t hash = 2166136261u;
+    const uint8_t *p = data;
+    for(size_t i = 0; i < bytes; i++) hash = (hash ^ p[i])*16777619u;
+    for(int i = 0; i < 8; i++) hash = (hash ^ (uint8_t) (seq >> (8*i)))*16777619u;
+    return hash;
+}
+
+static int write_header(storage_spool_t *spool) {
+    spool_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SPOOL_MAGIC, sizeof(header.magic));
+    header.spool = spool->id;
+    header.next_seq = spool->seq_limit;
+    header.record_size = sizeof(sensor_data_t);
+    if(pwrite(spool->fd, &header, sizeof(header), 0) != sizeof(header)) return -1;
+    return fdatasync(spool->fd);
+}
+
+/*
+ * reads the header of the batch at offset and its readings into data, if data is not NULL
+ * \return the offset of the next batch, -1 if there is no complete batch at offset
+ */
+static off_t read_batch(storage_spool_t *spool, off_t offset, off_t end, batch_header_t *batch, sensor_data_t *data) {
+    if(offset + (off_t) sizeof(batch_header_t) > end
+       || pread(spool->fd, batch, sizeof(batch_header_t), offset) != sizeof(batch_header_t)) return -1;
+    if(batch->magic != BATCH_MAGIC || batch->count == 0 || batch->count > BATCH_ROWS_MAX) return -1;
+    size_t bytes = (size_t) batch->count*sizeof(sensor_data_t);
+    off_t next = offset + sizeof(batch_header_t) + bytes;
+    if(next > end) return -1;
+    if(data != NULL && pread(spool->fd, data, bytes, offset + sizeof(batch_header_t)) != (ssize_t) bytes) return -1;
+    return next;
+}
+
+static int reserve_buffer(storage_spool_t *spool, int rows) {
+    if(rows <= spool->buffer_rows) return 0;
+    sensor_data_t *buffer = realloc(spool->buffer, rows*sizeof(sensor_data_t));
+    if(buffer == NULL) return -1;
+    spool->buffer = buffer;
+    spool->buffer_rows = rows;
+    return 0;
+}
+
+/*
+ * walks the batches of an existing file, the file is cut off after the last complete one
+ */
+static int recover(storage_spool_t *spool, off_t size) {
+    off_t offset = sizeof(spool_header_t);
+    batch_header_t batch;
+    while(1) {
+        if(read_batch(spool, offset, size, &batch, NULL) < 0) break;
+        if(reserve_buffer(spool, batch.count) != 0) return -1;
+        off_t next = read_batch(spool, offset, size, &batch, spool->buffer);
+        if(next < 0 || checksum(spool->buffer, batch.count*sizeof(sensor_data_t), batch.seq) != batch.checksum) break;
+        spool->stats.pending += batch.count;
+        if(batch.seq >= spool->next_seq) spool->next_seq = batch.seq + 1;
+        offset = next;
+    }
+    if(offset < size) {
+        DEBUG_PRINTF("cutting off %ld bytes of a torn batch", (long) (size - offset));
+        if(ftruncate(spool->fd, offset) != 0 || fdatasync(spool->fd) != 0) return -1;
+    }
+    spool->end = offset;
+    return 0;
+}
+
+storage_spool_t *storage_spool_open(const char *path) {
+
+    storage_spool_t *spool = calloc(1, sizeof(storage_spool_t));
+    if(spool == NULL) return NULL;
+    pthread_mutex_init(&(spool->stats_lock), NULL);
+    spool->fd = open(path, O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if(spool->fd < 0 || fstat(spool->fd, &st) != 0) {
+        DEBUG_PRINTF("cannot open spool %s", path);
+        storage_spool_close(spool);
+        return NULL;
+    }
+    spool_header_t header;
+    if(st.st_size < (off_t) sizeof(spool_header_t)) {
+        //a new file, its id only has to differ from the ids of spool files the backend saw before, and from 0
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        spool->id = (((uint64_t) now.tv_sec << 30 ^ (uint64_t) now.tv_nsec ^ (uint64_t) getpid() << 48) | 1) & INT64_MAX;
+        spool->next_seq = spool->seq_limit = 1;
+        if(ftruncate(spool->fd, 0) != 0 || write_header(spool) != 0) {
+            storage_spool_close(spool);
+            return NULL;
+        }
+        spool->end = sizeof(spool_header_t);
+    } else {
+        if(pread(spool->fd, &header, sizeof(header), 0) != sizeof(header)
+           || memcmp(header.magic, SPOOL_MAGIC, sizeof(header.magic)) != 0
+           || header.record_size != sizeof(sensor_data_t)) {
+            DEBUG_PRINTF("%s is not a spool file of this build", path);
+            storage_spool_close(spool);
+            return NULL;
+        }
+        spool->id = header.spool;
+        spool->next_seq = spool->seq_limit = header.next_seq;
+        if(recover(spool, st.st_size) != 0) {
+            storage_spool_close(spool);
+            return NULL;
+        }
+    }
+    spool->replay = sizeof(spool_header_t);
+    spool->stats.file_bytes = spool->end;
+    return spool;
+}
+
+void storage_spool_close(storage_spool_t *spool) {
+    if(spool == NULL) return;
+    if(spool->fd >= 0) close(spool->fd);
+    pthread_mutex_destroy(&(spool->stats_lock));
+    free(spool->buffer);
+    free(spool);
+}
+
+uint64_t storage_spool_claim(storage_spool_t *spool, uint64_t *id) {
+    //the header stays ahead of the numbers handed out, so after a restart none is handed out again
+    if(spool->next_seq >= spool->seq_limit) {
+        uint64_t limit = spool->seq_limit;
+        spool->seq_limit = spool->next_seq + SEQ_RESERVE;
+        if(write_header(spool) != 0) {
+            DEBUG_PRINTF("cannot reserve sequence numbers");
+            spool->seq_limit = limit;
+            return 0;
+        }
+    }
+    *id = spool->id;
+    return spool->next_seq++;
+}
+
+int storage_spool_append(storage_spool_t *spool, const sensor_data_t *data, int count, uint64_t seq) {
+
+    if(count <= 0) return 0;
+    if(count > BATCH_ROWS_MAX) return -1;
+    if(seq == 0) seq = spool->next_seq++;
+    size_t bytes = sizeof(batch_header_t) + (size_t) count*sizeof(sensor_data_t);
+    uint8_t *frame = malloc(bytes);
+    if(frame == NULL) return -1;
+    batch_header_t batch = {BATCH_MAGIC, (uint32_t) count, seq, 0, 0};
+    batch.checksum = checksum(data, (size_t) count*sizeof(sensor_data_t), batch.seq);
+    memcpy(frame, &batch, sizeof(batch));
+    memcpy(frame + sizeof(batch), data, (size_t) count*sizeof(sensor_data_t));
+    int ok = pwrite(spool->fd, frame, bytes, spool->end) == (ssize_t) bytes && fdatasync(spool->fd) == 0;
+    free(frame);
+    if(!ok) {
+        DEBUG_PRINTF("cannot spool %i readings", count);
+        if(ftruncate(spool->fd, spool->end) != 0) DEBUG_PRINTF("cannot cut off the failed batch");
+        return -1;
+    }
+    spool->end += bytes;
+    pthread_mutex_lock(&(spool->stats_lock));
+    spool->stats.batches++;
+    spool->stats.rows += count;
+    spool->stats.pending += count;
+    spool->stats.file_bytes = spool->end;
+    pthread_mutex_unlock(&(spool->stats_lock));
+    return 0;
+}
+
+int storage_spool_pending(storage_spool_t *spool) {
+    return spool->replay < spool->end;
+}
+
+/*
+ * everything is replayed, the file goes back to just its header
+ */
+static int spool_reset(storage_spool_t *spool) {
+    if(spool->seq_limit < spool->next_seq) spool->seq_limit = spool->next_seq;
+    if(write_header(spool) != 0 || ftruncate(spool->fd, sizeof(spool_header_t)) != 0) return -1;
+    spool->end = spool->replay = sizeof(spool_header_t);
+    pthread_mutex_lock(&(spool->stats_lock));
+    spool->stats.file_bytes = spool->end;
+    pthread_mutex_unlock(&(spool->stats_lock));
+    return 0;
+}
+
+/*
+ * replays batches of about max_rows readings, at least one, in one backend transaction
+ */
+static int64_t replay_chunk(storage_spool_t *spool, storage_backend_t *backend, int max_rows) {
+
+    uint64_t stored;
+    if(storage_backend_spooled(backend, spool->id, &stored) != STATUS_OK) return -1;
+
+    //batches the backend stored before a crash cut the last replay short
+    batch_header_t batch;
+    uint64_t skipped = 0;
+    off_t next;
+    while((next = read_batch(spool, spool->replay, spool->end, &batch, NULL)) > 0 && batch.seq <= stored) {
+        skipped += batch.count;
+        spool->replay = next;
+    }
+
+    int rows = 0;
+    uint64_t last_seq = 0;
+    off_t offset = spool->replay;
+    while(offset < spool->end) {
+        if(read_batch(spool, offset, spool->end, &batch, NULL) < 0) return -1;
+        if(rows > 0 && rows + (int) batch.count > max_rows) break;
+        if(reserve_buffer(spool, rows + batch.count) != 0) return -1;
+        offset = read_batch(spool, offset, spool->end, &batch, spool->buffer + rows);
+        if(offset < 0) return -1;
+        rows += batch.count;
+        last_seq = batch.seq;
+    }
+    if(rows > 0 && storage_backend_append_spooled(backend, spool->buffer, rows, spool->id, last_seq) != STATUS_OK) {
+        DEBUG_PRINTF("replay of %i readings failed", rows);
+        rows = -1;
+    }
+    if(rows >= 0) spool->replay = offset;
+    pthread_mutex_lock(&(spool->stats_lock));
+    spool->stats.skipped += skipped;
+    spool->stats.replayed += rows > 0 ? rows : 0;
+    spool->stats.pending -= skipped + (rows > 0 ? rows : 0);
+    pthread_mutex_unlock(&(spool->stats_lock));
+    if(!storage_spool_pending(spool) && spool_reset(spool) != 0) DEBUG_PRINTF("cannot empty the spool file");
+    return rows;
+}
+
+int64_t storage_spool_replay(storage_spool_t *spool, storage_backend_t *backend, int max_rows) {
+
+    //a backend that can store part of a batch gets one batch per transaction, its position is then exact per batch
+    int chunk_rows = storage_backend_partial(backend) ? 1 : max_rows;
+    int64_t replayed = 0;
+    while(storage_spool_pending(spool) && replayed < max_rows) {
+        int64_t rows = replay_chunk(spool, backend, chunk_rows);
+        if(rows < 0) return -1;
+        replayed += rows;
+    }
+    return replayed;
+}
+
+void storage_spool_get_stats(storage_spool_t *spool, storage_spool_stats_t *stats) {
+    pthread_mutex_lock(&(spool->stats_lock));
+    *stats = spool->stats;
+    pthread_mutex_unlock(&(spool->stats_lock));
+}
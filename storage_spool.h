@@ -0,0 +1,79 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#ifndef _STORAGE_SPOOL_H_
+#define _STORAGE_SPOOL_H_
+
+#include <stdint.h>
+#include "config.h"
+#include "storage_backend.h"
+
+/*
+ * write ahead spool for readings the storage backend cannot take right now
+ *
+ * an append only file of batches, a batch is written with one write() and is spooled once it is fsync'ed,
+ * every batch has a sequence number and a checksum, a batch torn by a crash is cut off when the file is opened
+ * replay hands whole batches in order to storage_backend_append_spooled(), which records the last sequence number
+ * it stored for the id of this spool file, batches the backend already has are skipped, so a replay cut short by a
+ * crash does not store anything twice
+ * a backend that can store part of a batch (storage_backend_partial()) is handed one batch per transaction and gets
+ * its live batches with a number claimed from the spool, a batch it then spools after storing part of it replays
+ * only into the part that did not store it
+ * once everything is replayed the file is cut back to its header, the id and the sequence numbers carry on
+ *
+ * used by one thread, the stats can be read from any thread
+ */
+
+typedef struct storage_spool storage_spool_t;
+
+typedef struct {
+    uint64_t batches;           /** < batches spooled */
+    uint64_t rows;              /** < readings spooled */
+    uint64_t replayed;          /** < readings replayed into the backend */
+    uint64_t skipped;           /** < readings the backend already had */
+    uint64_t pending;           /** < readings waiting to be replayed */
+    uint64_t file_bytes;
+} storage_spool_stats_t;
+
+/*
+ * opens the spool file at path, creating it if needed, readings spooled before stay pending
+ * \return the spool, NULL if the file cannot be used
+ */
+storage_spool_t *storage_spool_open(const char *path);
+
+/*
+ * closes the file, pending readings stay in it for the next storage_spool_open()
+ */
+void storage_spool_close(storage_spool_t *spool);
+
+/*
+ * hands out the sequence number of the next batch before the backend is tried, the backend stores it with the batch
+ * and the batch is spooled with it if the backend fails, numbers are not handed out again after a restart
+ * \param id set to the id of this spool file
+ * \return the sequence number, 0 if an error occurs
+ */
+uint64_t storage_spool_claim(storage_spool_t *spool, uint64_t *id);
+
+/*
+ * appends count readings as one batch and waits until it is on disk
+ * \param seq the number from storage_spool_claim() for this batch, 0 takes the next one
+ * \return 0 for success, -1 if an error occurs, then nothing of the batch is kept
+ */
+int storage_spool_append(storage_spool_t *spool, const sensor_data_t *data, int count, uint64_t seq);
+
+/*
+ * \return non-zero while spooled readings wait to be replayed
+ */
+int storage_spool_pending(storage_spool_t *spool);
+
+/*
+ * replays the oldest pending batches, about max_rows readings but at least one batch, in one backend transaction,
+ * or one transaction per batch for a backend that can store part of one
+ * \return the number of readings replayed, -1 if the backend failed, the batches then stay pending
+ */
+int64_t storage_spool_replay(storage_spool_t *spool, storage_backend_t *backend, int max_rows);
+
+void storage_spool_get_stats(storage_spool_t *spool, storage_spool_stats_t *stats);
+
+#endif /* _STORAGE_SPOOL_H_ */
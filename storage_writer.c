@@ -0,0 +1,165 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "storage_writer.h"
+#include "metrics.h"
+
+struct storage_writer {
+    storage_backend_t *backend;
+    storage_spool_t *spool;
+    int64_t retry_us;                   //monotonic time the backend is tried again after it failed
+    int max_batch;
+    int64_t deadline_us;
+    sensor_data_t *batch;
+    int count;
+    int64_t opened_us;                  //monotonic time the first reading of the open batch came in
+    storage_commit_sink_t sink;
+    void *sink_arg;
+    pthread_mutex_t stats_lock;         //only guards stats, the batch is owned by the storagemgr thread
+    storage_writer_stats_t stats;
+    metric_t *committed;                //the same numbers for the metrics endpoint, which never takes stats_lock
+    metric_t *spooled;
+    metric_t *latency;
+};
+
+static int64_t monotonic_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+storage_writer_t *storage_writer_create(storage_backend_t *backend, storage_spool_t *spool, int max_batch, int deadline_ms,
+                                        storage_commit_sink_t sink, void *arg) {
+    storage_writer_t *writer = calloc(1, sizeof(storage_writer_t));
+    if(writer == NULL) return NULL;
+    writer->batch = malloc(max_batch*sizeof(sensor_data_t));
+    if(writer->batch == NULL) {
+        free(writer);
+        return NULL;
+    }
+    writer->backend = backend;
+    writer->spool = spool;
+    writer->max_batch = max_batch;
+    writer->deadline_us = (int64_t) deadline_ms*1000;
+    writer->sink = sink;
+    writer->sink_arg = arg;
+    pthread_mutex_init(&(writer->stats_lock), NULL);
+    writer->committed = metrics_counter("gateway_db_rows_committed_total", "readings committed to the storage backend");
+    writer->spooled = metrics_counter("gateway_db_rows_spooled_total", "readings written to the spool");
+    writer->latency = metrics_histogram("gateway_db_commit_latency_us",
+                                        "microseconds from the first reading of a batch until its commit returned");
+    return writer;
+}
+
+void storage_writer_set_backend(storage_writer_t *writer, storage_backend_t *backend) {
+    writer->backend = backend;
+    writer->retry_us = 0;
+}
+
+void storage_writer_free(storage_writer_t *writer) {
+    if(writer == NULL) return;
+    storage_writer_commit(writer);
+    pthread_mutex_destroy(&(writer->stats_lock));
+    free(writer->batch);
+    free(writer);
+}
+
+status_code_storagemgr_t storage_writer_commit(storage_writer_t *writer) {
+
+    if(writer->count == 0) return STATUS_OK;
+    int64_t start = monotonic_us();
+    status_code_storagemgr_t status = STATUS_FAILURE;
+    uint64_t spool = 0, seq = 0;
+    //while older readings wait in the spool new ones queue up behind them
+    if(writer->backend != NULL && (writer->spool == NULL || !storage_spool_pending(writer->spool))) {
+        //a backend that can store part of a batch records its spool number with it, the spooled copy skips that part
+        if(writer->spool != NULL && storage_backend_partial(writer->backend)) {
+            seq = storage_spool_claim(writer->spool, &spool);
+        }
+        if(seq != 0) {
+            status = storage_backend_append_spooled(writer->backend, writer->batch, writer->count, spool, seq);
+        } else {
+            status = storage_backend_append(writer->backend, writer->batch, writer->count);
+        }
+        if(status != STATUS_OK) writer->retry_us = monotonic_us() + (int64_t) STORAGE_SPOOL_RETRY_MS*1000;
+    }
+    if(status != STATUS_OK && writer->spool != NULL
+       && storage_spool_append(writer->spool, writer->batch, writer->count, seq) == 0) status = STATUS_SPOOLED;
+    int64_t end = monotonic_us();
+    pthread_mutex_lock(&(writer->stats_lock));
+    if(status == STATUS_SPOOLED) {
+        writer->stats.spooled_rows += writer->count;
+    } else if(status == STATUS_OK) {
+        writer->stats.commits++;
+        writer->stats.rows += writer->count;
+        histogram_add(&(writer->stats.commit_size), writer->count);
+        histogram_add(&(writer->stats.commit_latency), end - writer->opened_us);
+        histogram_add(&(writer->stats.commit_time), end - start);
+    } else {
+        DEBUG_PRINTF("commit of %i readings failed", writer->count);
+        writer->stats.failed_rows += writer->count;
+    }
+    pthread_mutex_unlock(&(writer->stats_lock));
+    if(status == STATUS_SPOOLED) {
+        metrics_add(writer->spooled, writer->count);
+    } else if(status == STATUS_OK) {
+        metrics_add(writer->committed, writer->count);
+        metrics_observe(writer->latency, end - writer->opened_us);
+    }
+    int rows = writer->count;
+    writer->count = 0;
+    if(writer->sink != NULL) writer->sink(status, rows, writer->sink_arg);
+    return status;
+}
+
+status_code_storagemgr_t storage_writer_add(storage_writer_t *writer, const sensor_data_t *data) {
+
+    if(writer->count == 0) writer->opened_us = monotonic_us();
+    writer->batch[writer->count++] = *data;
+    if(writer->count == writer->max_batch) return storage_writer_commit(writer);
+    return STATUS_OK;
+}
+
+/*
+ * replays one chunk of the spool when the backend is there and not waiting for a retry
+ */
+static int replay_due(storage_writer_t *writer) {
+    return writer->spool != NULL && writer->backend != NULL && storage_spool_pending(writer->spool)
+           && monotonic_us() >= writer->retry_us;
+}
+
+status_code_storagemgr_t storage_writer_poll(storage_writer_t *writer) {
+
+    if(replay_due(writer) && storage_spool_replay(writer->spool, writer->backend, STORAGE_SPOOL_REPLAY_ROWS) < 0) {
+        writer->retry_us = monotonic_us() + (int64_t) STORAGE_SPOOL_RETRY_MS*1000;
+    }
+    if(writer->count == 0 || monotonic_us() - writer->opened_us < writer->deadline_us) return STATUS_OK;
+    return storage_writer_commit(writer);
+}
+
+void storage_writer_deadline(storage_writer_t *writer, int idle_ms, struct timespec *deadline) {
+
+    int64_t wait_us = (int64_t) idle_ms*1000;
+    int64_t now = monotonic_us();
+    if(writer->count > 0) wait_us = writer->opened_us + writer->deadline_us - now;
+    if(writer->spool != NULL && writer->backend != NULL && storage_spool_pending(writer->spool)
+       && writer->retry_us - now < wait_us) wait_us = writer->retry_us - now;
+    if(wait_us < 0) wait_us = 0;
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += wait_us/1000000;
+    deadline->tv_nsec += (wait_us % 1000000)*1000;
+    if(deadline->tv_nsec >= 1000000000) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
+}
+
+void storage_writer_get_stats(storage_writer_t *writer, storage_writer_stats_t *stats) {
+    pthread_mutex_lock(&(writer->stats_lock));
+    *stats = writer->stats;
+    pthread_mutex_unlock(&(writer->stats_lock));
+}
@@ -0,0 +1,85 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#ifndef _STORAGE_WRITER_H_
+#define _STORAGE_WRITER_H_
+
+#include <time.h>
+#include "config.h"
+#include "storage_backend.h"
+#include "storage_spool.h"
+#include "histogram.h"
+
+/*
+ * group commit in front of the storage backend
+ * readings are collected into one open batch that is committed in a single transaction as soon as it holds
+ * max_batch readings or its oldest reading waited deadline_ms milliseconds, whichever comes first
+ * a batch the backend cannot take goes to the spool, and so does every batch after it until the spool is replayed,
+ * which polling does in chunks of STORAGE_SPOOL_REPLAY_ROWS once the backend is back, retrying every
+ * STORAGE_SPOOL_RETRY_MS, so readings reach the backend in order
+ * only the storagemgr thread adds and commits, the stats can be read from any thread
+ */
+
+typedef struct storage_writer storage_writer_t;
+
+typedef struct {
+    uint64_t commits;
+    uint64_t rows;
+    uint64_t failed_rows;       /** < rows of batches that could neither be committed nor spooled */
+    uint64_t spooled_rows;      /** < rows of batches that went to the spool */
+    histogram_t commit_size;    /** < rows per commit */
+    histogram_t commit_latency; /** < microseconds from the first reading of a batch until its commit returned */
+    histogram_t commit_time;    /** < microseconds spent in storage_backend_append() */
+} storage_writer_stats_t;
+
+/*
+ * called after every commit attempt with the number of readings in the batch, status is STATUS_SPOOLED if they
+ * went to the spool
+ */
+typedef void (*storage_commit_sink_t)(status_code_storagemgr_t status, int rows, void *arg);
+
+/*
+ * \param backend NULL while there is none, everything is spooled until storage_writer_set_backend()
+ * \param spool NULL drops batches the backend cannot take
+ * \param sink may be NULL
+ */
+storage_writer_t *storage_writer_create(storage_backend_t *backend, storage_spool_t *spool, int max_batch, int deadline_ms,
+                                        storage_commit_sink_t sink, void *arg);
+
+/*
+ * hands the writer a backend that could be opened later, spooled readings are replayed into it from the next poll
+ */
+void storage_writer_set_backend(storage_writer_t *writer, storage_backend_t *backend);
+
+/*
+ * commits what is left and frees the writer, the backend stays open
+ */
+void storage_writer_free(storage_writer_t *writer);
+
+/*
+ * adds a reading to the open batch, commits the batch when it is full
+ * \return STATUS_FAILURE if a commit was needed and failed
+ */
+status_code_storagemgr_t storage_writer_add(storage_writer_t *writer, const sensor_data_t *data);
+
+/*
+ * replays a chunk of the spool if the backend is due for another try, then commits the open batch if its deadline
+ * passed
+ */
+status_code_storagemgr_t storage_writer_poll(storage_writer_t *writer);
+
+/*
+ * commits the open batch right away
+ */
+status_code_storagemgr_t storage_writer_commit(storage_writer_t *writer);
+
+/*
+ * time the open batch has to be committed by or the next replay is due (CLOCK_REALTIME, for timed waits),
+ * or now + idle_ms if there is neither
+ */
+void storage_writer_deadline(storage_writer_t *writer, int idle_ms, struct timespec *deadline);
+
+void storage_writer_get_stats(storage_writer_t *writer, storage_writer_stats_t *stats);
+
+#endif /* _STORAGE_WRITER_H_ */
@@ -0,0 +1,97 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#include <stdlib.h>
+#include "timer_wheel.h"
+
+int timer_wheel_init(timer_wheel_t *wheel, int capacity, int span) {
+    int size = 64;
+    while(size <= span) size *= 2;
+    wheel->size = size;
+    wheel->capacity = capacity;
+    wheel->current = 0;
+    wheel->bucket = malloc(size*sizeof(int32_t));
+    wheel->next = malloc(capacity*sizeof(int32_t));
+    wheel->prev = malloc(capacity*sizeof(int32_t));
+    wheel->home = malloc(capacity*sizeof(int32_t));
+    wheel->due = calloc(capacity, sizeof(sensor_ts_t));
+    if(wheel->bucket == NULL || wheel->next == NULL || wheel->prev == NULL || wheel->home == NULL || wheel->due == NULL) {
+        timer_wheel_free(wheel);
+        return -1;
+    }
+    for(int b = 0; b < size; b++) wheel->bucket[b] = -1;
+    return 0;
+}
+
+void timer_wheel_free(timer_wheel_t *wheel) {
+    free(wheel->bucket);
+    free(wheel->next);
+    free(wheel->prev);
+    free(wheel->home);
+    free(wheel->due);
+    wheel->bucket = NULL;
+    wheel->next = NULL;
+    wheel->prev = NULL;
+    wheel->home = NULL;
+    wheel->due = NULL;
+}
+
+static int bucket_of(timer_wheel_t *wheel, sensor_ts_t due) {
+    //a timer that is already due goes into the next bucket that will be walked
+    if(wheel->current != 0 && due <= wheel->current) due = wheel->current + 1;
+    return (int) (due & (wheel->size - 1));
+}
+
+static void unlink_timer(timer_wheel_t *wheel, int32_t timer) {
+    int32_t next = wheel->next[timer], prev = wheel->prev[timer];
+    if(prev == -1) wheel->bucket[wheel->home[timer]] = next;
+    else wheel->next[prev] = next;
+    if(next != -1) wheel->prev[next] = prev;
+    wheel->due[timer] = 0;
+}
+
+void timer_wheel_cancel(timer_wheel_t *wheel, int32_t timer) {
+    if(wheel->due[timer] != 0) unlink_timer(wheel, timer);
+}
+
+void timer_wheel_schedule(timer_wheel_t *wheel, int32_t timer, sensor_ts_t due) {
+    if(due <= 0) due = 1;   //0 marks an unscheduled timer
+    timer_wheel_cancel(wheel, timer);
+    int b = bucket_of(wheel, due);
+    wheel->due[timer] = due;
+    wheel->home[timer] = b;
+    wheel->prev[timer] = -1;
+    wheel->next[timer] = wheel->bucket[b];
+    if(wheel->bucket[b] != -1) wheel->prev[wheel->bucket[b]] = timer;
+    wheel->bucket[b] = timer;
+}
+
+int timer_wheel_scheduled(timer_wheel_t *wheel, int32_t timer) {
+    return wheel->due[timer] != 0;
+}
+
+int timer_wheel_advance(timer_wheel_t *wheel, sensor_ts_t now, timer_wheel_expired_t expired, void *arg) {
+
+    if(now <= wheel->current) return 0;
+    int fired = 0;
+    //after a gap of a full lap or more every bucket is walked once
+    sensor_ts_t from = wheel->current + 1;
+    if(wheel->current == 0 || now - wheel->current > wheel->size) from = now - wheel->size + 1;
+    for(sensor_ts_t t = from; t <= now; t++) {
+        int32_t timer = wheel->bucket[t & (wheel->size - 1)];
+        while(timer != -1) {
+            int32_t next = wheel->next[timer];
+            //timers of a later lap stay where they are
+            if(wheel->due[timer] <= now) {
+                unlink_timer(wheel, timer);
+                fired++;
+                sensor_ts_t again = expired(timer, now, arg);
+                if(again > now) timer_wheel_schedule(wheel, timer, again);
+            }
+            timer = next;
+        }
+    }
+    wheel->current = now;
+    return fired;
+}
@@ -0,0 +1,59 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#ifndef _TIMER_WHEEL_H_
+#define _TIMER_WHEEL_H_
+
+#include <stdint.h>
+#include "config.h"
+
+/*
+ * hashed timer wheel with one second ticks over a fixed set of timers 0..capacity-1
+ * a timer sits in bucket due % size, advancing only walks the buckets of the seconds that passed,
+ * so a wheel with more buckets than the longest timeout costs nothing while no timer expires
+ * timers are intrusive linked lists over index arrays, scheduling and cancelling never allocate
+ */
+
+typedef struct {
+    int size;               /** < buckets, power of two */
+    int capacity;           /** < timers */
+    int32_t *bucket;        /** < first timer per bucket, -1 if empty */
+    int32_t *next;
+    int32_t *prev;          /** < -1 for the first timer of a bucket */
+    int32_t *home;          /** < bucket the timer is linked into */
+    sensor_ts_t *due;       /** < 0 if the timer is not scheduled */
+    sensor_ts_t current;    /** < last second advanced to, 0 before the first advance */
+} timer_wheel_t;
+
+/*
+ * called for every expired timer, the timer is no longer scheduled when this runs
+ * it may schedule the same timer again, but must not cancel or schedule other timers
+ * \return a due time after now to schedule the timer again, 0 to leave it unscheduled
+ */
+typedef sensor_ts_t (*timer_wheel_expired_t)(int32_t timer, sensor_ts_t now, void *arg);
+
+/*
+ * \param span longest timeout that is expected, the wheel gets more buckets than that
+ * \return 0 on success, -1 if out of memory
+ */
+int timer_wheel_init(timer_wheel_t *wheel, int capacity, int span);
+
+void timer_wheel_free(timer_wheel_t *wheel);
+
+/*
+ * schedules or moves a timer, a due time that already passed fires on the next advance
+ */
+void timer_wheel_schedule(timer_wheel_t *wheel, int32_t timer, sensor_ts_t due);
+
+void timer_wheel_cancel(timer_wheel_t *wheel, int32_t timer);
+
+int timer_wheel_scheduled(timer_wheel_t *wheel, int32_t timer);
+
+/*
+ * fires every timer due at or before now
+ * \return number of expired timers
+ */
+int timer_wheel_advance(timer_wheel_t *wheel, sensor_ts_t now, timer_wheel_expired_t expired, void *arg);
+
+#endif /* _TIMER_WHEEL_H_ */
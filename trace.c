@@ -0,0 +1,40 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#include <time.h>
+#include "trace.h"
+#include "metrics.h"
+
+static metric_t *intervals[TRACE_INTERVALS];
+static uint32_t received_count = 0;         //only connmgr receives
+
+static int64_t monotonic_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+void trace_init() {
+    intervals[TRACE_PROCESSED] = metrics_histogram("gateway_trace_processed_us",
+                                                   "microseconds from receiving a traced reading until datamgr processed it");
+    intervals[TRACE_ALERTED] = metrics_histogram("gateway_trace_alerted_us",
+                                                 "microseconds from receiving a traced reading until the alert it set off");
+    intervals[TRACE_COMMITTED] = metrics_histogram("gateway_trace_committed_us",
+                                                   "microseconds from receiving a traced reading until its commit returned");
+}
+
+int64_t trace_receive() {
+    if(TRACE_SAMPLE_RATE <= 0 || received_count++ % TRACE_SAMPLE_RATE != 0) return 0;
+    return monotonic_us();
+}
+
+void trace_record(trace_interval_t interval, int64_t received) {
+    if(received == 0) return;
+    int64_t elapsed = monotonic_us() - received;
+    metrics_observe(intervals[interval], elapsed > 0 ? (uint64_t) elapsed : 0);
+}
+
+void trace_get(trace_interval_t interval, histogram_t *histogram) {
+    metrics_histogram_get(intervals[interval], histogram);
+}
@@ -0,0 +1,45 @@
+/**
+ * \author Dāvis Edvards Nelsons
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+#include "config.h"
+#include "histogram.h"
+
+/*
+ * end to end latency of readings, from connmgr receiving them to datamgr processing them, to an alert they set off
+ * and to their commit in the storage backend
+ *
+ * connmgr stamps one reading in TRACE_SAMPLE_RATE with the monotonic time it was received, the stamp travels with
+ * the node in the shared buffer, a stamp of 0 is a reading that is not traced
+ * the intervals go to histograms of the metrics endpoint (gateway_trace_*_us) in microseconds
+ */
+
+enum trace_interval {TRACE_PROCESSED = 0, TRACE_ALERTED, TRACE_COMMITTED, TRACE_INTERVALS};
+typedef enum trace_interval trace_interval_t;
+
+/*
+ * registers the histograms, before the first reading comes in
+ */
+void trace_init();
+
+/*
+ * \return the stamp of the next reading received, the monotonic time in us for every TRACE_SAMPLE_RATE-th call and 0
+ * for the others, for connmgr only
+ */
+int64_t trace_receive();
+
+/*
+ * adds the time from received until now to the histogram of interval, nothing if received is 0
+ */
+void trace_record(trace_interval_t interval, int64_t received);
+
+/*
+ * copies the histogram of interval
+ */
+void trace_get(trace_interval_t interval, histogram_t *histogram);
+
+#endif /* _TRACE_H_ */